@@ -0,0 +1,61 @@
+// 非同期実行: 大きな計算の間に呼び出し側で別の処理（次のバッチの準備など）を進める
+// 準備はsleepで模擬するので、コアが1つでも重なり方がわかる
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include "dezero.h"
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+VarPtr step(const VarPtr& x) {
+  auto y = x;
+  for (int i = 0; i < 20; i++) y = F::tanh(y * 1.01 + 0.1);
+  return F::sum(y);
+}
+
+int main(int argc, char** argv) {
+  const int n = argc > 1 ? std::atoi(argv[1]) : 20;
+  const int prep_ms = argc > 2 ? std::atoi(argv[2]) : 20;
+  auto x = as_variable(as_array(nc::NdArray<double>(512, 1024).fill(0.5)));
+  auto prepare = [prep_ms]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(prep_ms));
+  };
+  auto no_grad_cfg = no_grad();
+
+  // 計算だけの時間
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) step(x);
+  std::cout << "compute only: " << elapsed_ms(start) / n << " ms/iter"
+            << std::endl;
+
+  start = std::chrono::steady_clock::now();
+  double sum = 0.0;
+  for (int i = 0; i < n; i++) {
+    auto y = step(x);
+    prepare();
+    sum += (*y->data)[0];
+  }
+  const double sync_ms = elapsed_ms(start) / n;
+  std::cout << "sync  + prepare: " << sync_ms << " ms/iter" << std::endl;
+
+  start = std::chrono::steady_clock::now();
+  double sum_async = 0.0;
+  for (int i = 0; i < n; i++) {
+    VarPtr y;
+    {
+      stream::Async async_mode;
+      y = step(x);
+    }
+    prepare();
+    sum_async += (*y->data)[0];
+  }
+  const double async_ms = elapsed_ms(start) / n;
+  std::cout << "async + prepare: " << async_ms << " ms/iter" << std::endl;
+  std::cout << "speedup: " << sync_ms / async_ms << "x"
+            << (sum == sum_async ? "" : " (results differ!)") << std::endl;
+}
@@ -0,0 +1,84 @@
+// truncated BPTT: 長い系列をRNNで学習するときのメモリ使用量
+// 窓ごとにloss->unchain_backward()で計算グラフを切ると常駐メモリは一定のまま
+// 切らない場合は系列の長さに比例して増える（短い系列だけ測る）
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "dezero.h"
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// 常駐メモリ（MB）
+double rss_mb() {
+  std::ifstream ifs("/proc/self/statm");
+  long pages = 0, resident = 0;
+  ifs >> pages >> resident;
+  return resident * 4096.0 / (1024 * 1024);
+}
+
+struct Rnn {
+  VarPtr Wx, Wh, b, Wy;
+  explicit Rnn(nc::uint32 hidden)
+      : Wx(as_variable(as_array(rng::normal(nc::Shape(1, hidden), 0.0, 0.5)))),
+        Wh(as_variable(as_array(rng::normal(nc::Shape(hidden, hidden), 0.0,
+                                            0.5 / std::sqrt(hidden))))),
+        b(as_variable(as_array(nc::zeros<double>(1, hidden)))),
+        Wy(as_variable(as_array(rng::normal(nc::Shape(hidden, 1), 0.0,
+                                            1.0 / std::sqrt(hidden))))) {}
+  std::vector<VarPtr> params() { return {Wx, Wh, b, Wy}; }
+};
+
+// 系列sin(0.1 t)の次の値を予測する。unchainがfalseなら計算グラフを切らない
+void train(Rnn& rnn, nc::uint32 hidden, long steps, int window, bool unchain,
+           long report) {
+  auto h = as_variable(as_array(nc::zeros<double>(1, hidden)));
+  auto loss = as_variable(as_array({0.0}));
+  const double lr = 1e-3;
+  auto start = std::chrono::steady_clock::now();
+  for (long t = 0; t < steps; t++) {
+    auto x = as_variable(as_array({std::sin(0.1 * t)}));
+    const double target = std::sin(0.1 * (t + 1));
+    h = F::tanh(F::matmul(x, rnn.Wx) + F::matmul(h, rnn.Wh) + rnn.b);
+    auto y = F::matmul(h, rnn.Wy);
+    loss = loss + pow(y - target, 2);
+    if ((t + 1) % window == 0) {
+      for (auto& p : rnn.params()) p->cleargrad();
+      loss->backward();
+      for (auto& p : rnn.params()) {
+        *p->data = *p->data - *p->grad->data * lr;
+      }
+      if (unchain) {
+        loss->unchain_backward();
+      }
+      // 新しい窓の損失は0から足す（切らない場合はこの加算でグラフが続く）
+      loss = unchain ? as_variable(as_array({0.0})) : loss * 0.0;
+    }
+    if ((t + 1) % report == 0) {
+      std::cout << "  step " << t + 1 << ": rss " << rss_mb() << " MB, "
+                << elapsed_ms(start) / (t + 1) * 1000 << " us/step"
+                << std::endl;
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  const long steps = argc > 1 ? std::atol(argv[1]) : 100000;
+  const int window = argc > 2 ? std::atoi(argv[2]) : 32;
+  const nc::uint32 hidden = argc > 3 ? std::atoi(argv[3]) : 16;
+  rng::manual_seed(0);
+  Rnn rnn(hidden);
+  std::cout << "truncated BPTT, window " << window << ", hidden " << hidden
+            << ", rss at start " << rss_mb() << " MB" << std::endl;
+  std::cout << "unchain_backward every window:" << std::endl;
+  train(rnn, hidden, steps, window, true, steps / 5);
+  const long short_steps = std::min(steps, 20000L);
+  std::cout << "without unchain (graph keeps growing):" << std::endl;
+  train(rnn, hidden, short_steps, window, false, short_steps / 4);
+}
@@ -0,0 +1,96 @@
+// 事前コンパイル: DeZeroの推論（no_grad）とcodegen::export_cppで書き出した
+// ソースの推論時間
+// 書き出したソースはc++ -O3 -march=nativeでコンパイルし、その中で時間を測る
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+#include "dezero.h"
+
+template <typename Fn>
+double bench(int n, Fn fn) {
+  // ウォームアップ
+  fn();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) fn();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count() / n;
+}
+
+// 2層のMLP（d -> h -> 10）
+VarPtr mlp(const VarPtr& x, const VarPtr& W1, const VarPtr& b1,
+           const VarPtr& W2, const VarPtr& b2) {
+  return F::softmax(F::matmul(F::tanh(F::matmul(x, W1) + b1), W2) + b2);
+}
+
+// 生成したソースに時間を測るmainを付けてコンパイルし、1回あたりのmsを返す
+double bench_generated(const std::string& src, size_t in_size,
+                       size_t out_size, int n) {
+  std::ofstream ofs("/tmp/bench_codegen_net.cpp");
+  ofs << src << R"(
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+int main() {
+  std::vector<double> x()"
+      << in_size << R"(, 0.5), y()" << out_size << R"();
+  net(x.data(), y.data());
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < )"
+      << n << R"(; i++) {
+    x[0] = i * 1e-9;  // 毎回計算させる
+    net(x.data(), y.data());
+  }
+  auto end = std::chrono::steady_clock::now();
+  std::printf("%.9g %.17g\n",
+              std::chrono::duration<double, std::milli>(end - start).count() /
+                  )"
+      << n << R"(, y[0]);
+}
+)";
+  ofs.close();
+  if (std::system("c++ -std=c++17 -O3 -march=native -o /tmp/bench_codegen_net "
+                  "/tmp/bench_codegen_net.cpp") != 0) {
+    return -1.0;
+  }
+  FILE* fp = popen("/tmp/bench_codegen_net", "r");
+  double ms = -1.0, y0 = 0.0;
+  if (std::fscanf(fp, "%lf %lf", &ms, &y0) != 2) ms = -1.0;
+  pclose(fp);
+  return ms;
+}
+
+int main(int argc, char** argv) {
+  const int n = argc > 1 ? std::atoi(argv[1]) : 1000;
+  const nc::uint32 d = argc > 2 ? std::atoi(argv[2]) : 64;
+  const nc::uint32 hidden = argc > 3 ? std::atoi(argv[3]) : 128;
+  rng::manual_seed(0);
+  auto W1 = as_variable(as_array(
+      rng::normal(nc::Shape(d, hidden), 0.0, 1.0 / std::sqrt(d))));
+  auto b1 = as_variable(as_array(nc::zeros<double>(1, hidden)));
+  auto W2 = as_variable(as_array(
+      rng::normal(nc::Shape(hidden, 10), 0.0, 1.0 / std::sqrt(hidden))));
+  auto b2 = as_variable(as_array(nc::zeros<double>(1, 10)));
+  for (nc::uint32 batch : {1u, 32u}) {
+    auto x = as_variable(as_array(nc::NdArray<double>(batch, d) = 0.5));
+    // 形を決めるために一度計算グラフを作る
+    auto y = mlp(x, W1, b1, W2, b2);
+    const auto p = codegen::plan(y, {x});
+    const auto src = codegen::export_cpp(y, {x}, "net");
+
+    double t_dezero = bench(n, [&]() {
+      auto mode = no_grad();
+      mlp(x, W1, b1, W2, b2);
+    });
+    double t_gen = bench_generated(src, x->data->size(), y->data->size(), n);
+    std::cout << "batch " << batch << ", (" << d << " -> " << hidden
+              << " -> 10): dezero " << t_dezero << " ms, generated " << t_gen
+              << " ms, speedup " << t_dezero / t_gen << "x, workspace "
+              << p.workspace_size << " doubles (naive " << p.naive_size
+              << "), source " << src.size() / 1024 << " KB" << std::endl;
+  }
+}
@@ -0,0 +1,75 @@
+// 畳み込みとプーリング: CIFAR程度の画像で順伝播・逆伝播1回の時間と、
+// im2colのタイル（一度に展開するサンプル数）によるim2col行列の大きさ
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include "dezero.h"
+
+template <typename Fn>
+double bench(int n, Fn fn) {
+  // ウォームアップ
+  fn();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) fn();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count() / n;
+}
+
+nc::NdArray<double> bench_input(size_t rows, size_t cols) {
+  nc::NdArray<double> x(rows, cols);
+  for (size_t i = 0; i < x.size(); i++) {
+    x[i] = std::sin(0.37 * i);
+  }
+  return x;
+}
+
+int main(int argc, char** argv) {
+  const int n = argc > 1 ? std::atoi(argv[1]) : 3;
+  const size_t batch = argc > 2 ? std::atoi(argv[2]) : 32;
+
+  // (入力チャンネル, 出力チャンネル, 画像の一辺)
+  struct Layer {
+    size_t in, out, size;
+  };
+  for (auto layer : {Layer{3, 32, 32}, Layer{32, 64, 16}}) {
+    F::Conv2dParam p{layer.in, layer.size, layer.size, 3, 3};
+    p.pad = 1;
+    auto x = as_variable(
+        as_array(bench_input(batch, layer.in * layer.size * layer.size)));
+    auto W = as_variable(as_array(bench_input(layer.out, layer.in * 9) * 0.1));
+    auto b = as_variable(as_array(nc::zeros<double>(1, layer.out)));
+    for (size_t tile : {size_t(0), size_t(8), size_t(1)}) {
+      p.tile = tile;
+      double t = bench(n, [&]() {
+        x->cleargrad();
+        W->cleargrad();
+        b->cleargrad();
+        F::sum(F::conv2d(x, W, b, p))->backward();
+      });
+      const size_t samples = tile == 0 ? batch : tile;
+      const double col_mb = layer.in * 9.0 * samples * p.out_h() * p.out_w() *
+                            sizeof(double) / (1 << 20);
+      std::cout << "conv (" << batch << ", " << layer.in << ", " << layer.size
+                << ", " << layer.size << ") -> " << layer.out
+                << " channels, tile " << tile << ": " << t
+                << " ms, im2col " << col_mb << " MB" << std::endl;
+    }
+
+    F::Conv2dParam pool{layer.out, layer.size, layer.size, 2, 2};
+    pool.stride = 2;
+    auto h = as_variable(
+        as_array(bench_input(batch, layer.out * layer.size * layer.size)));
+    double t_max = bench(n, [&]() {
+      h->cleargrad();
+      F::sum(F::max_pooling(h, pool))->backward();
+    });
+    double t_avg = bench(n, [&]() {
+      h->cleargrad();
+      F::sum(F::average_pooling(h, pool))->backward();
+    });
+    std::cout << "pooling 2x2 (" << batch << ", " << layer.out << ", "
+              << layer.size << ", " << layer.size << "): max " << t_max
+              << " ms, average " << t_avg << " ms" << std::endl;
+  }
+}
@@ -0,0 +1,70 @@
+// データ並列: 1スレッドでバッチ全体を計算した場合とDataParallelで
+// レプリカに分けた場合の1ステップの時間（コア数以上は速くならない）
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include "dezero.h"
+
+template <typename Fn>
+double bench(const std::string& name, int n, Fn fn) {
+  // ウォームアップ
+  fn();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) fn();
+  auto end = std::chrono::steady_clock::now();
+  double ms =
+      std::chrono::duration<double, std::milli>(end - start).count() / n;
+  std::cout << name << ": " << ms << " ms/step" << std::endl;
+  return ms;
+}
+
+nc::NdArray<double> filled(size_t rows, size_t cols, double scale) {
+  nc::NdArray<double> a(rows, cols);
+  for (size_t i = 0; i < a.size(); i++) {
+    a[i] = scale * (static_cast<double>(i % 13) - 6.0);
+  }
+  return a;
+}
+
+VarPtr mlp_loss(const std::vector<VarPtr>& p, const VarPtr& x,
+                const VarPtr& t) {
+  auto h = x;
+  for (size_t k = 0; k + 2 < p.size(); k += 2) {
+    h = F::tanh(F::matmul(h, p[k]) + p[k + 1]);
+  }
+  auto d = F::matmul(h, p[p.size() - 2]) + p[p.size() - 1] - t;
+  return F::sum(d * d) / static_cast<double>(x->shape().rows);
+}
+
+int main(int argc, char** argv) {
+  const int n = argc > 1 ? std::atoi(argv[1]) : 10;
+  const size_t batch = argc > 2 ? std::atoi(argv[2]) : 512;
+  const size_t hidden = 256;
+  std::vector<VarPtr> params = {
+      as_variable(as_array(filled(64, hidden, 0.01))),
+      as_variable(as_array(filled(1, hidden, 0.0))),
+      as_variable(as_array(filled(hidden, hidden, 0.01))),
+      as_variable(as_array(filled(1, hidden, 0.0))),
+      as_variable(as_array(filled(hidden, 10, 0.01))),
+      as_variable(as_array(filled(1, 10, 0.0)))};
+  const auto x = filled(batch, 64, 0.1);
+  const auto t = filled(batch, 10, 0.05);
+  std::cout << "threads: " << parallel::get_num_threads()
+            << ", hardware: " << std::thread::hardware_concurrency()
+            << std::endl;
+
+  double base = bench("single", n, [&]() {
+    for (auto& p : params) p->cleargrad();
+    mlp_loss(params, as_variable(as_array(x)), as_variable(as_array(t)))
+        ->backward(false);
+  });
+  data_parallel::DataParallel dp(params, 0, 1 << 14);
+  std::cout << "replicas: " << dp.num_replicas()
+            << ", buckets: " << dp.num_buckets() << std::endl;
+  double fast = bench("data parallel", n, [&]() {
+    for (auto& p : params) p->cleargrad();
+    dp.step(mlp_loss, x, t);
+  });
+  std::cout << "speedup: " << base / fast << "x" << std::endl;
+}
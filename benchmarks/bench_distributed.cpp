@@ -0,0 +1,38 @@
+// 分散学習: ランク数とバックエンドごとのall-reduceの時間と実効帯域
+// （ランクはプロセスなのでコア数以上にすると遅くなる）
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include "dezero.h"
+
+int main(int argc, char** argv) {
+  const int n = argc > 1 ? std::atoi(argv[1]) : 20;
+  const size_t size = argc > 2 ? std::atoi(argv[2]) : 1 << 20;
+  const int world = argc > 3 ? std::atoi(argv[3]) : 2;
+  const std::pair<const char*, distributed::Backend> backends[] = {
+      {"shared memory", distributed::Backend::SharedMemory},
+      {"unix socket", distributed::Backend::UnixSocket}};
+  for (const auto& [name, backend] : backends) {
+    distributed::launch(world, backend, [&](distributed::Transport& t) {
+      std::vector<double> data(size, 1.0);
+      // ウォームアップ
+      distributed::allreduce(t, data.data(), size);
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < n; i++) {
+        distributed::allreduce(t, data.data(), size);
+      }
+      auto end = std::chrono::steady_clock::now();
+      double ms =
+          std::chrono::duration<double, std::milli>(end - start).count() / n;
+      if (t.rank() == 0) {
+        // リングall-reduceで各ランクが送る量は2 (p - 1) / p * size
+        const double bytes = 2.0 * (world - 1) / world * size * sizeof(double);
+        std::cout << name << " (" << world << " ranks, " << size
+                  << " doubles): " << ms << " ms, " << bytes / ms / 1e6
+                  << " GB/s" << std::endl;
+      }
+      return 0;
+    });
+  }
+}
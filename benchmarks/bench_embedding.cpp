@@ -0,0 +1,54 @@
+// 埋め込み: 語彙数を変えたときの順伝播・逆伝播1回の時間
+// 行疎な勾配なら語彙数によらずバッチの大きさに比例する
+#include <chrono>
+#include <iostream>
+#include <random>
+
+#include "dezero.h"
+
+template <typename Fn>
+double bench(int n, Fn fn) {
+  // ウォームアップ
+  fn();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) fn();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count() / n;
+}
+
+int main(int argc, char** argv) {
+  const int n = argc > 1 ? std::atoi(argv[1]) : 10;
+  const size_t batch = argc > 2 ? std::atoi(argv[2]) : 4096;
+  const size_t dim = 16;
+  for (size_t vocab : {size_t(10000), size_t(100000), size_t(1000000)}) {
+    auto W = as_variable(as_array(nc::NdArray<double>(vocab, dim).fill(0.1)));
+    // 頻度の偏った（同じ行が何度も出る）ID
+    std::mt19937_64 rng(0);
+    std::geometric_distribution<size_t> dist(100.0 / vocab);
+    std::vector<size_t> ids(batch);
+    for (auto& id : ids) id = std::min(dist(rng), vocab - 1);
+    // one-hot行列（疎行列）との積
+    sparse::COO coo(batch, vocab);
+    for (size_t i = 0; i < batch; i++) coo.add(i, ids[i], 1.0);
+    auto onehot = sparse::as_csr(sparse::CSR(coo));
+
+    double sparse_ms = bench(n, [&]() {
+      W->cleargrad();
+      F::sum(F::embedding(W, ids))->backward();
+    });
+    double dense_ms = bench(n, [&]() {
+      W->cleargrad();
+      F::sum(F::embedding(W, ids, false))->backward();
+    });
+    double onehot_ms = bench(n, [&]() {
+      W->cleargrad();
+      F::sum(F::sparse_matmul(onehot, W))->backward();
+    });
+    W->cleargrad();
+    F::sum(F::embedding(W, ids))->backward();
+    std::cout << "vocab " << vocab << " (" << W->sparse_grad->rows().size()
+              << " distinct ids / " << batch << "): row-sparse " << sparse_ms
+              << " ms, dense grad " << dense_ms << " ms, one-hot matmul "
+              << onehot_ms << " ms" << std::endl;
+  }
+}
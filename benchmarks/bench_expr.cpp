@@ -0,0 +1,49 @@
+// 推論時（no_grad）の要素ごとの演算: VarPtrの演算子と式テンプレートの比較
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "dezero.h"
+
+template <typename Fn>
+double bench(const std::string& name, int n, Fn fn) {
+  fn();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) fn();
+  auto end = std::chrono::steady_clock::now();
+  double us =
+      std::chrono::duration<double, std::micro>(end - start).count() / n;
+  std::cout << name << ": " << us << " us/iter" << std::endl;
+  return us;
+}
+
+int main(int argc, char** argv) {
+  const int n = argc > 1 ? std::atoi(argv[1]) : 50;
+  using expr::lazy;
+  auto no_grad_guard = no_grad();
+  for (const auto shape : {nc::Shape(100, 100), nc::Shape(1000, 1000)}) {
+    std::cout << "== (" << shape.rows << ", " << shape.cols << ") =="
+              << std::endl;
+    auto x = as_variable(as_array(nc::NdArray<double>(shape).fill(0.3)));
+    auto a = as_variable(as_array(nc::NdArray<double>(shape).fill(1.5)));
+    auto b = as_variable(as_array(nc::NdArray<double>(1, shape.cols).fill(2)));
+
+    double base = bench("a * x + b (operators)", n, [&]() { a * x + b; });
+    double fast = bench("a * x + b (expr)", n,
+                        [&]() { VarPtr y = lazy(a) * lazy(x) + lazy(b); });
+    std::cout << "speedup: " << base / fast << "x" << std::endl;
+
+    base = bench("1 - y * y (operators)", n, [&]() { 1.0 - x * x; });
+    fast = bench("1 - y * y (expr)", n,
+                 [&]() { VarPtr y = 1.0 - lazy(x) * lazy(x); });
+    std::cout << "speedup: " << base / fast << "x" << std::endl;
+
+    base = bench("(x - b) * (x - b) / a + 0.5 * x (operators)", n,
+                 [&]() { (x - b) * (x - b) / a + 0.5 * x; });
+    fast = bench("(x - b) * (x - b) / a + 0.5 * x (expr)", n, [&]() {
+      auto d = lazy(x) - lazy(b);
+      VarPtr y = d * d / lazy(a) + 0.5 * lazy(x);
+    });
+    std::cout << "speedup: " << base / fast << "x" << std::endl;
+  }
+}
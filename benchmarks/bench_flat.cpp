@@ -0,0 +1,92 @@
+// 多数の小さなパラメータの勾配の消去・勾配ノルムによるクリッピング・SGDの更新
+// パラメータごとの配列で行う場合と、flat::FlatParametersの連続したバッファを
+// 1回なめる場合の1ステップあたりの時間
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include "dezero.h"
+
+template <typename Fn>
+double bench(int n, Fn fn) {
+  // ウォームアップ
+  fn();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) fn();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count() / n;
+}
+
+// 層ごとに(width, width)の重みと(1, width)のバイアスを持つモデル
+std::vector<VarPtr> make_params(int layers, nc::uint32 width) {
+  std::vector<VarPtr> params;
+  for (int l = 0; l < layers; l++) {
+    params.push_back(
+        as_variable(as_array(rng::normal(nc::Shape(width, width)))));
+    params.push_back(as_variable(as_array(rng::normal(nc::Shape(1, width)))));
+  }
+  return params;
+}
+
+// 逆伝播の後の状態（パラメータごとの勾配）を作る
+void set_grads(const std::vector<VarPtr>& params) {
+  for (auto& p : params) {
+    p->grad = as_variable(as_array(rng::normal(p->shape(), 0.0, 0.1)));
+  }
+}
+
+int main(int argc, char** argv) {
+  const int n = argc > 1 ? std::atoi(argv[1]) : 200;
+  const int layers = argc > 2 ? std::atoi(argv[2]) : 200;
+  const nc::uint32 width = argc > 3 ? std::atoi(argv[3]) : 16;
+  const double lr = 0.01, max_norm = 1.0;
+  rng::manual_seed(0);
+
+  // パラメータごと: 配列ごとに0で埋め、ノルムを足し合わせて配列ごとに縮める
+  auto params = make_params(layers, width);
+  set_grads(params);
+  double t_zero = bench(n, [&]() {
+    for (auto& p : params) *p->grad->data = 0.0;
+  });
+  set_grads(params);
+  double t_clip = bench(n, [&]() {
+    double sq = 0.0;
+    for (auto& p : params) {
+      const auto& g = *p->grad->data;
+      for (size_t i = 0; i < g.size(); i++) sq += g[i] * g[i];
+    }
+    const double norm = std::sqrt(sq);
+    if (norm > max_norm) {
+      const double scale = max_norm / (norm + 1e-6);
+      for (auto& p : params) {
+        auto& g = *p->grad->data;
+        for (size_t i = 0; i < g.size(); i++) g[i] *= scale;
+      }
+    }
+  });
+  double t_step = bench(n, [&]() {
+    for (auto& p : params) {
+      *p->data = *p->data - *p->grad->data * lr;
+    }
+  });
+
+  // 連続したバッファ（set_gradsで差し替えた勾配をsyncでバッファに写し、
+  // 逆伝播でビューに直接足されたのと同じ状態にする）
+  auto flat_params = make_params(layers, width);
+  flat::FlatParameters flat(flat_params);
+  set_grads(flat_params);
+  flat.sync();
+  double f_zero = bench(n, [&]() { flat.cleargrads(); });
+  double f_clip = bench(n, [&]() { flat.clip_grad_norm(max_norm); });
+  double f_step = bench(n, [&]() { flat.sgd(lr); });
+
+  std::cout << params.size() << " parameters (" << flat.size()
+            << " elements)" << std::endl;
+  std::cout << "zero grads: per-tensor " << t_zero << " ms, flat " << f_zero
+            << " ms, speedup " << t_zero / f_zero << "x" << std::endl;
+  std::cout << "clip by global norm: per-tensor " << t_clip << " ms, flat "
+            << f_clip << " ms, speedup " << t_clip / f_clip << "x"
+            << std::endl;
+  std::cout << "sgd step: per-tensor " << t_step << " ms, flat " << f_step
+            << " ms, speedup " << t_step / f_step << "x" << std::endl;
+}
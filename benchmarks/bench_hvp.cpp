@@ -0,0 +1,85 @@
+// 二階微分: Variable::backward(create_graph=true)による従来の方法と
+// grad/hvpによる方法の比較
+#include <chrono>
+#include <iostream>
+
+#include "dezero.h"
+
+template <typename Fn>
+double bench(const std::string& name, int n, Fn fn) {
+  // ウォームアップ
+  fn();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) fn();
+  auto end = std::chrono::steady_clock::now();
+  double us =
+      std::chrono::duration<double, std::micro>(end - start).count() / n;
+  std::cout << name << ": " << us << " us/iter" << std::endl;
+  return us;
+}
+
+VarPtr rosenbrock(const VarPtr& x0, const VarPtr& x1) {
+  return 100.0 * pow(x1 - pow(x0, 2), 2) + pow(1.0 - x0, 2);
+}
+
+VarPtr newton_f(const VarPtr& x) { return pow(x, 4) - 2.0 * pow(x, 2); }
+
+int main(int argc, char** argv) {
+  const int n = argc > 1 ? std::atoi(argv[1]) : 10000;
+
+  std::cout << "== rosenbrock Hessian-vector product ==" << std::endl;
+  auto x0 = as_variable(as_array({0.0}));
+  auto x1 = as_variable(as_array({2.0}));
+  auto v0 = as_variable(as_array({1.0}));
+  auto v1 = as_variable(as_array({-1.0}));
+  double base = bench("backward(create_graph)", n, [&]() {
+    x0->cleargrad();
+    x1->cleargrad();
+    auto y = rosenbrock(x0, x1);
+    y->backward(false, true);
+    auto gv = x0->grad * v0 + x1->grad * v1;
+    x0->cleargrad();
+    x1->cleargrad();
+    gv->backward();
+  });
+  double fast = bench("grad", n, [&]() {
+    auto y = rosenbrock(x0, x1);
+    auto gxs = grad({y}, {x0, x1}, true);
+    auto gv = gxs[0] * v0 + gxs[1] * v1;
+    grad({gv}, {x0, x1});
+  });
+  std::cout << "speedup: " << base / fast << "x" << std::endl;
+
+  std::cout << "== newton's method (x^4 - 2x^2) ==" << std::endl;
+  auto x = as_variable(as_array({2.0}));
+  base = bench("backward(create_graph)", n, [&]() {
+    x->data = as_array({2.0});
+    for (int i = 0; i < 10; i++) {
+      x->cleargrad();
+      auto y = newton_f(x);
+      y->backward(false, true);
+      auto gx = x->grad;
+      x->cleargrad();
+      gx->backward();
+      x->data = as_array(*x->data - *gx->data / *x->grad->data);
+    }
+  });
+  fast = bench("grad", n, [&]() {
+    x->data = as_array({2.0});
+    for (int i = 0; i < 10; i++) {
+      auto y = newton_f(x);
+      auto gx = grad(y, x, true);
+      auto gx2 = grad(gx, x);
+      x->data = as_array(*x->data - *gx->data / *gx2->data);
+    }
+  });
+  std::cout << "speedup: " << base / fast << "x" << std::endl;
+  std::cout << "x = " << x << std::endl;
+
+  std::cout << "== hvp (sum(x^4), 1x1000) ==" << std::endl;
+  auto xv = as_variable(as_array(nc::NdArray<double>(1, 1000).fill(0.5)));
+  auto vv = as_variable(as_array(nc::NdArray<double>(1, 1000).fill(1.0)));
+  bench("hvp", n / 10, [&]() {
+    hvp([](const VarPtr& x) { return F::sum(pow(x, 4)); }, xv, vv);
+  });
+}
@@ -0,0 +1,86 @@
+// 遅延実行: 要素ごとの演算の鎖を1つのループに融合したときと、1演算ずつ
+// 配列を作るときの比較（鎖が長いほどメモリの読み書きが減る）
+#include <chrono>
+#include <iostream>
+
+#include "dezero.h"
+
+template <typename Fn>
+double bench(const std::string& name, int n, Fn fn) {
+  // ウォームアップ
+  fn();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) fn();
+  auto end = std::chrono::steady_clock::now();
+  double ms =
+      std::chrono::duration<double, std::milli>(end - start).count() / n;
+  std::cout << name << ": " << ms << " ms/iter" << std::endl;
+  return ms;
+}
+
+VarPtr chain(const VarPtr& x, int length) {
+  auto y = x;
+  for (int i = 0; i < length; i++) y = y * 0.5 + x;
+  return y;
+}
+
+int main(int argc, char** argv) {
+  const int n = argc > 1 ? std::atoi(argv[1]) : 10;
+  auto x = as_variable(as_array(nc::NdArray<double>(2048, 2048).fill(0.5)));
+  auto no_grad_cfg = no_grad();
+
+  std::cout << "== sin(x) * cos(x) + x (2048x2048) ==" << std::endl;
+  double base = bench("eager", n, [&]() { F::sin(x) * F::cos(x) + x; });
+  double fused = bench("lazy", n, [&]() {
+    VarPtr y;
+    {
+      lazy::Tracing tracing;
+      y = F::sin(x) * F::cos(x) + x;
+    }
+    y->data.get();
+  });
+  std::cout << "speedup: " << base / fused << "x" << std::endl;
+
+  for (int length : {2, 8, 32}) {
+    std::cout << "== (y * 0.5 + x) x " << length << " ==" << std::endl;
+    base = bench("eager", n, [&]() { chain(x, length); });
+    fused = bench("lazy", n, [&]() {
+      VarPtr y;
+      {
+        lazy::Tracing tracing;
+        y = chain(x, length);
+      }
+      y->data.get();
+    });
+    std::cout << "speedup: " << base / fused << "x" << std::endl;
+  }
+
+  // 順伝播＋逆伝播: 途中の値は根のカーネルが書き出すので、鎖の長さに比例する
+  UsingConfig with_backprop("enable_backprop", true);
+  auto xs = as_variable(as_array(nc::NdArray<double>(256, 256).fill(0.5)));
+  auto tanh_chain = [&xs](int length) {
+    auto y = xs;
+    for (int i = 0; i < length; i++) y = F::tanh(y * 0.9 + xs);
+    return F::sum(y);
+  };
+  for (int length : {25, 50, 100, 200}) {
+    std::cout << "== tanh(y * 0.9 + x) x " << length
+              << " (256x256), forward + backward ==" << std::endl;
+    base = bench("eager", n, [&]() {
+      tanh_chain(length)->backward();
+      xs->cleargrad();
+    });
+    const size_t runs = lazy::num_kernel_runs();
+    fused = bench("lazy", n, [&]() {
+      VarPtr y;
+      {
+        lazy::Tracing tracing;
+        y = tanh_chain(length);
+      }
+      y->backward();
+      xs->cleargrad();
+    });
+    std::cout << "speedup: " << base / fused << "x, kernels/iter: "
+              << (lazy::num_kernel_runs() - runs) / (n + 1) << std::endl;
+  }
+}
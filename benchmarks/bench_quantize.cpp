@@ -0,0 +1,57 @@
+// int8量子化: 倍精度の行列積とF::quantized_linearの推論時間と誤差
+// 重みは(in, out) = (d, d)、入力はバッチ(batch, d)
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include "dezero.h"
+
+template <typename Fn>
+double bench(int n, Fn fn) {
+  // ウォームアップ
+  fn();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) fn();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count() / n;
+}
+
+int main(int argc, char** argv) {
+  const int n = argc > 1 ? std::atoi(argv[1]) : 5;
+  const nc::uint32 batch = argc > 2 ? std::atoi(argv[2]) : 64;
+  std::cout << "isa: " << quant::isa() << std::endl;
+  rng::manual_seed(0);
+  for (nc::uint32 d : {256u, 1024u}) {
+    auto W = as_variable(
+        as_array(rng::normal(nc::Shape(d, d), 0.0, 1.0 / std::sqrt(d))));
+    auto b = as_variable(as_array(rng::normal(nc::Shape(1, d), 0.0, 0.1)));
+    auto x = as_variable(as_array(rng::normal(nc::Shape(batch, d))));
+    auto qW = std::make_shared<const quant::QuantizedWeight>(*W->data);
+    // 校正は別のサンプルで行う
+    quant::Calibrator calib;
+    calib.observe(rng::normal(nc::Shape(batch, d)));
+
+    auto mode = no_grad();
+    VarPtr y, yq;
+    double t_double = bench(n, [&]() { y = F::matmul(x, W) + b; });
+    double t_int8 = bench(n, [&]() {
+      yq = F::quantized_linear(x, qW, b, calib.scale());
+    });
+    double err = 0.0;
+    double norm = 0.0;
+    double max_err = 0.0;
+    for (size_t i = 0; i < y->data->size(); i++) {
+      const double e = (*yq->data)[i] - (*y->data)[i];
+      err += e * e;
+      norm += (*y->data)[i] * (*y->data)[i];
+      max_err = std::max(max_err, std::abs(e));
+    }
+    std::cout << "(" << batch << ", " << d << ") x (" << d << ", " << d
+              << "): double " << t_double << " ms, int8 " << t_int8
+              << " ms, speedup " << t_double / t_int8 << "x, weights "
+              << d * d * sizeof(double) / 1024 << " KB -> "
+              << qW->values().size() / 1024 << " KB, relative error "
+              << std::sqrt(err / norm) << ", max error " << max_err
+              << std::endl;
+  }
+}
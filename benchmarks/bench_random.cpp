@@ -0,0 +1,55 @@
+// 乱数: std::mt19937_64で1要素ずつ埋める場合とPhiloxで並列に埋める場合の時間と、
+// マスクを保存するドロップアウトとマスクを作り直すF::dropoutの比較
+#include <chrono>
+#include <iostream>
+#include <random>
+
+#include "dezero.h"
+
+template <typename Fn>
+double bench(int n, Fn fn) {
+  // ウォームアップ
+  fn();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) fn();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count() / n;
+}
+
+int main(int argc, char** argv) {
+  const int n = argc > 1 ? std::atoi(argv[1]) : 5;
+  const nc::uint32 rows = argc > 2 ? std::atoi(argv[2]) : 4096;
+  const nc::uint32 cols = 4096;
+  nc::NdArray<double> buf(rows, cols);
+
+  std::mt19937_64 engine(0);
+  std::normal_distribution<double> dist;
+  double t_mt = bench(n, [&]() {
+    for (size_t i = 0; i < buf.size(); i++) buf[i] = dist(engine);
+  });
+  double t_philox = bench(n, [&]() {
+    rng::normal(buf.data(), buf.size(), 0, 0);
+  });
+  std::cout << "normal (" << rows << ", " << cols << "): mt19937_64 " << t_mt
+            << " ms, philox " << t_philox << " ms ("
+            << parallel::get_num_threads() << " threads)" << std::endl;
+
+  // マスクを保存する版は、活性と同じ大きさのマスクが逆伝播まで残る
+  auto x = as_variable(as_array(rng::normal(nc::Shape(rows, cols))));
+  const double ratio = 0.5;
+  double t_stored = bench(n, [&]() {
+    x->cleargrad();
+    auto u = rng::uniform(nc::Shape(rows, cols));
+    for (size_t i = 0; i < u.size(); i++) u[i] = u[i] >= ratio ? 1.0 : 0.0;
+    auto mask = as_variable(as_array(std::move(u)));
+    F::sum(x * mask / (1.0 - ratio))->backward();
+  });
+  double t_fused = bench(n, [&]() {
+    x->cleargrad();
+    F::sum(F::dropout(x, ratio))->backward();
+  });
+  std::cout << "dropout forward + backward: stored mask " << t_stored
+            << " ms, regenerated mask " << t_fused << " ms, saves "
+            << buf.size() * sizeof(double) / (1 << 20) << " MB per layer"
+            << std::endl;
+}
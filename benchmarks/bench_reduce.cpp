@@ -0,0 +1,60 @@
+// 総和カーネルとnumcppの総和の比較（行方向・列方向・全要素）
+// numcpp側はutils::sum_toが以前使っていたsum(axis)(+transpose)と同じ処理
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "dezero.h"
+#include "kernels.h"
+
+template <typename Fn>
+double bench(int n, Fn fn) {
+  fn();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) fn();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::micro>(end - start).count() / n;
+}
+
+void report(const std::string& name, const nc::Shape& shape, double base,
+            double fast) {
+  std::cout << name << " (" << shape.rows << ", " << shape.cols
+            << "): numcpp " << base << " us, kernels " << fast
+            << " us, speedup " << base / fast << "x" << std::endl;
+}
+
+int main(int argc, char** argv) {
+  const double budget = argc > 1 ? std::atof(argv[1]) : 2e8;
+  std::cout << "threads: " << parallel::get_num_threads() << std::endl;
+  const nc::Shape shapes[] = {{64, 64},     {1000, 10},  {10, 1000},
+                              {1000, 1000}, {100000, 8}, {8, 100000},
+                              {4000, 4000}, {1, 1000000}};
+  for (const auto& shape : shapes) {
+    nc::NdArray<double> x(shape);
+    for (nc::uint32 i = 0; i < x.size(); i++) x[i] = (i % 17) * 0.25;
+    // 要素数に反比例させて計測時間を揃える
+    const int n = std::max(3, static_cast<int>(budget / x.size() / 10));
+
+    double base = bench(n, [&]() { nc::sum(x, nc::Axis::ROW); });
+    double fast = bench(n, [&]() { kernels::sum(x, nc::Axis::ROW); });
+    report("row ", shape, base, fast);
+    base = bench(n, [&]() { nc::sum(x, nc::Axis::COL).transpose(); });
+    fast = bench(n, [&]() { kernels::sum(x, nc::Axis::COL); });
+    report("col ", shape, base, fast);
+    base = bench(n, [&]() { nc::sum(x); });
+    fast = bench(n, [&]() { kernels::sum(x, nc::Axis::NONE); });
+    report("all ", shape, base, fast);
+  }
+
+  // ブロードキャストしたAddの逆伝播（sum_toが呼ばれる）
+  auto a = as_variable(as_array(nc::NdArray<double>(2000, 500).fill(1.0)));
+  auto b = as_variable(as_array(nc::NdArray<double>(1, 500).fill(2.0)));
+  double us = bench(20, [&]() {
+    a->cleargrad();
+    b->cleargrad();
+    auto y = a + b;
+    y->backward();
+  });
+  std::cout << "broadcast add forward+backward (2000, 500) + (1, 500): " << us
+            << " us" << std::endl;
+}
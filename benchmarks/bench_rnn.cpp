@@ -0,0 +1,129 @@
+// LSTM/GRUの1ステップ: 基本関数で組んだセルとF::lstm_cell / F::gru_cellの
+// 系列全体の順伝播＋逆伝播の時間と、1ステップあたりの関数の数
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <tuple>
+#include <unordered_set>
+
+#include "dezero.h"
+
+template <typename Fn>
+double bench(int n, Fn fn) {
+  // ウォームアップ
+  fn();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) fn();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count() / n;
+}
+
+size_t count_functions(const VarPtr& y) {
+  std::unordered_set<Function*> seen;
+  std::vector<Function*> stack;
+  if (y->creator_ptr) stack.push_back(y->creator_ptr.get());
+  while (!stack.empty()) {
+    Function* f = stack.back();
+    stack.pop_back();
+    if (!seen.insert(f).second) continue;
+    for (const auto& x : f->inputs_) {
+      if (x->creator_ptr) stack.push_back(x->creator_ptr.get());
+    }
+  }
+  return seen.size();
+}
+
+VarPtr param(nc::uint32 rows, nc::uint32 cols) {
+  return as_variable(
+      as_array(rng::normal(nc::Shape(rows, cols), 0.0, 1.0 / std::sqrt(rows))));
+}
+
+int main(int argc, char** argv) {
+  const int n = argc > 1 ? std::atoi(argv[1]) : 3;
+  const int steps = argc > 2 ? std::atoi(argv[2]) : 50;
+  const nc::uint32 batch = argc > 3 ? std::atoi(argv[3]) : 32;
+  const nc::uint32 nh = argc > 4 ? std::atoi(argv[4]) : 128;
+  const nc::uint32 nx = nh / 2;
+  rng::manual_seed(0);
+  std::vector<VarPtr> xs;
+  for (int t = 0; t < steps; t++) {
+    xs.push_back(as_variable(as_array(rng::normal(nc::Shape(batch, nx)))));
+  }
+  auto h0 = as_variable(as_array(nc::zeros<double>(batch, nh)));
+
+  // LSTM: ゲートごとにx側とh側の重みを持つ基本関数の組み合わせ
+  std::vector<VarPtr> Wg, Ug, bg;
+  for (int k = 0; k < 4; k++) {
+    Wg.push_back(param(nx, nh));
+    Ug.push_back(param(nh, nh));
+    bg.push_back(as_variable(as_array(nc::zeros<double>(1, nh))));
+  }
+  auto W = param(nx + nh, 4 * nh);
+  auto b = as_variable(as_array(nc::zeros<double>(1, 4 * nh)));
+  size_t nodes_unfused = 0, nodes_fused = 0;
+  auto lstm_unfused = [&]() {
+    auto h = h0, c = h0;
+    for (const auto& x : xs) {
+      VarPtr a[4];
+      for (int k = 0; k < 4; k++) {
+        a[k] = F::matmul(x, Wg[k]) + F::matmul(h, Ug[k]) + bg[k];
+      }
+      c = F::sigmoid(a[1]) * c + F::sigmoid(a[0]) * F::tanh(a[2]);
+      h = F::sigmoid(a[3]) * F::tanh(c);
+    }
+    auto loss = F::sum(h);
+    nodes_unfused = count_functions(loss);
+    loss->backward();
+  };
+  auto lstm_fused = [&]() {
+    auto h = h0, c = h0;
+    for (const auto& x : xs) {
+      std::tie(h, c) = F::lstm_cell(x, h, c, W, b);
+    }
+    auto loss = F::sum(h);
+    nodes_fused = count_functions(loss);
+    loss->backward();
+  };
+  double t_unfused = bench(n, lstm_unfused);
+  double t_fused = bench(n, lstm_fused);
+  std::cout << "LSTM (" << batch << ", " << nx << " -> " << nh << ") x "
+            << steps << " steps, forward + backward: primitives " << t_unfused
+            << " ms (" << nodes_unfused / steps << " functions/step), "
+            << "lstm_cell " << t_fused << " ms (" << nodes_fused / steps
+            << " functions/step), speedup " << t_unfused / t_fused << "x"
+            << std::endl;
+
+  // GRU
+  auto Wx = param(nx, 3 * nh);
+  auto Wh = param(nh, 3 * nh);
+  auto bx = as_variable(as_array(nc::zeros<double>(1, 3 * nh)));
+  auto bh = as_variable(as_array(nc::zeros<double>(1, 3 * nh)));
+  auto gru_unfused = [&]() {
+    auto h = h0;
+    for (const auto& x : xs) {
+      auto r = F::sigmoid(F::matmul(x, Wg[0]) + F::matmul(h, Ug[0]) + bg[0]);
+      auto z = F::sigmoid(F::matmul(x, Wg[1]) + F::matmul(h, Ug[1]) + bg[1]);
+      auto m = F::tanh(F::matmul(x, Wg[2]) + bg[2] +
+                       r * (F::matmul(h, Ug[2]) + bg[3]));
+      h = (1.0 - z) * m + z * h;
+    }
+    auto loss = F::sum(h);
+    nodes_unfused = count_functions(loss);
+    loss->backward();
+  };
+  auto gru_fused = [&]() {
+    auto h = h0;
+    for (const auto& x : xs) h = F::gru_cell(x, h, Wx, Wh, bx, bh);
+    auto loss = F::sum(h);
+    nodes_fused = count_functions(loss);
+    loss->backward();
+  };
+  t_unfused = bench(n, gru_unfused);
+  t_fused = bench(n, gru_fused);
+  std::cout << "GRU  (" << batch << ", " << nx << " -> " << nh << ") x "
+            << steps << " steps, forward + backward: primitives " << t_unfused
+            << " ms (" << nodes_unfused / steps << " functions/step), "
+            << "gru_cell " << t_fused << " ms (" << nodes_fused / steps
+            << " functions/step), speedup " << t_unfused / t_fused << "x"
+            << std::endl;
+}
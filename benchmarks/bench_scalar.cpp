@@ -0,0 +1,77 @@
+// 数値との演算: 1x1のVariableにする従来の方法と定数用のFunction（MulScalarなど）の比較
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "dezero.h"
+
+template <typename Fn>
+double bench(const std::string& name, int n, Fn fn) {
+  fn();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) fn();
+  auto end = std::chrono::steady_clock::now();
+  double us =
+      std::chrono::duration<double, std::micro>(end - start).count() / n;
+  std::cout << name << ": " << us << " us/iter" << std::endl;
+  return us;
+}
+
+// 従来の方法（定数をVariableにしてAdd/Mulなどに渡す）
+VarPtr constant(double c) { return as_variable(as_array(c)); }
+
+// テイラー展開によるsin（ステップ27）
+template <typename Scalar>
+VarPtr taylor_sin(const VarPtr& x, Scalar c, double threshold = 1e-150) {
+  VarPtr y = x * c(0.0);
+  double fact = 1.0;
+  for (int i = 0; i < 100000; i++) {
+    if (i > 0) fact *= (2 * i) * (2 * i + 1);
+    const double coef = (i % 2 == 0 ? 1.0 : -1.0) / fact;
+    const auto t = pow(x, 2 * i + 1) * c(coef);
+    y = y + t;
+    if (std::abs((*t->data)[0]) < threshold) break;
+  }
+  return y;
+}
+
+template <typename Scalar>
+VarPtr rosenbrock(const VarPtr& x0, const VarPtr& x1, Scalar c) {
+  return pow(x1 - pow(x0, 2), 2) * c(100.0) + pow(c(1.0) - x0, 2);
+}
+
+int main(int argc, char** argv) {
+  const int n = argc > 1 ? std::atoi(argv[1]) : 2000;
+  auto as_var = [](double c) { return constant(c); };
+  auto as_num = [](double c) { return c; };
+
+  std::cout << "== taylor sin ==" << std::endl;
+  auto x = as_variable(as_array({M_PI / 4}));
+  double base = bench("variable constants", n, [&]() {
+    x->cleargrad();
+    taylor_sin(x, as_var)->backward();
+  });
+  double fast = bench("scalar functions", n, [&]() {
+    x->cleargrad();
+    taylor_sin(x, as_num)->backward();
+  });
+  std::cout << "speedup: " << base / fast << "x" << std::endl;
+
+  std::cout << "== rosenbrock gradient descent (100 steps) ==" << std::endl;
+  auto x0 = as_variable(as_array({0.0}));
+  auto x1 = as_variable(as_array({2.0}));
+  auto descent = [&](auto c) {
+    x0->data = as_array({0.0});
+    x1->data = as_array({2.0});
+    for (int i = 0; i < 100; i++) {
+      x0->cleargrad();
+      x1->cleargrad();
+      rosenbrock(x0, x1, c)->backward();
+      x0->data = as_array(*x0->data - 0.001 * *x0->grad->data);
+      x1->data = as_array(*x1->data - 0.001 * *x1->grad->data);
+    }
+  };
+  base = bench("variable constants", n / 20, [&]() { descent(as_var); });
+  fast = bench("scalar functions", n / 20, [&]() { descent(as_num); });
+  std::cout << "speedup: " << base / fast << "x" << std::endl;
+}
@@ -0,0 +1,52 @@
+// softmax交差エントロピー: 基本の関数の組み合わせと融合したFunctionの
+// 順伝播・逆伝播1回の時間（クラス数を変える）
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include "dezero.h"
+
+template <typename Fn>
+double bench(int n, Fn fn) {
+  // ウォームアップ
+  fn();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) fn();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count() / n;
+}
+
+int main(int argc, char** argv) {
+  const int n = argc > 1 ? std::atoi(argv[1]) : 10;
+  const size_t rows = argc > 2 ? std::atoi(argv[2]) : 256;
+  for (size_t cols : {size_t(10), size_t(1000), size_t(50000)}) {
+    nc::NdArray<double> logits(rows, cols);
+    for (size_t i = 0; i < logits.size(); i++) {
+      logits[i] = 3.0 * std::sin(0.37 * i);
+    }
+    std::vector<size_t> t(rows);
+    nc::NdArray<double> onehot = nc::zeros<double>(rows, cols);
+    for (size_t r = 0; r < rows; r++) {
+      t[r] = (r * 7919) % cols;
+      onehot(r, t[r]) = 1.0;
+    }
+    auto x = as_variable(as_array(logits));
+    auto target = as_variable(as_array(onehot));
+
+    double naive = bench(n, [&]() {
+      x->cleargrad();
+      // 最大値を引かないと大きなロジットでオーバーフローする
+      auto loss = (F::sum(F::log(F::sum(F::exp(x), nc::Axis::COL))) -
+                   F::sum(x * target)) /
+                  static_cast<double>(rows);
+      loss->backward();
+    });
+    double fused = bench(n, [&]() {
+      x->cleargrad();
+      F::softmax_cross_entropy(x, t)->backward();
+    });
+    std::cout << "(" << rows << ", " << cols << "): composed " << naive
+              << " ms, fused " << fused << " ms, speedup " << naive / fused
+              << "x" << std::endl;
+  }
+}
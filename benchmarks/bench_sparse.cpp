@@ -0,0 +1,60 @@
+// 疎な特徴量(N, D)と重み(D, H)の積の順伝播・逆伝播1回の時間
+// 密なndarrayにしてF::matmulする場合とF::sparse_matmul（密な勾配・行疎な勾配）の比較
+#include <chrono>
+#include <iostream>
+#include <random>
+
+#include "dezero.h"
+
+template <typename Fn>
+double bench(const std::string& name, int n, Fn fn) {
+  // ウォームアップ
+  fn();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) fn();
+  auto end = std::chrono::steady_clock::now();
+  double ms =
+      std::chrono::duration<double, std::milli>(end - start).count() / n;
+  std::cout << name << ": " << ms << " ms/iter" << std::endl;
+  return ms;
+}
+
+int main(int argc, char** argv) {
+  const int n = argc > 1 ? std::atoi(argv[1]) : 5;
+  const size_t rows = argc > 2 ? std::atoi(argv[2]) : 256;
+  const size_t features = argc > 3 ? std::atoi(argv[3]) : 20000;
+  // 1行あたりの非零要素数
+  const size_t nnz = argc > 4 ? std::atoi(argv[4]) : 16;
+  const size_t hidden = 64;
+
+  std::mt19937_64 rng(0);
+  std::uniform_int_distribution<size_t> col(0, features - 1);
+  sparse::COO coo(rows, features);
+  for (size_t i = 0; i < rows; i++) {
+    for (size_t k = 0; k < nnz; k++) {
+      coo.add(i, col(rng), 1.0);
+    }
+  }
+  auto x = sparse::as_csr(sparse::CSR(coo));
+  auto dense_x = as_variable(as_array(x->to_dense()));
+  auto W = as_variable(
+      as_array(nc::NdArray<double>(features, hidden).fill(0.01)));
+  std::cout << "x: (" << rows << ", " << features << "), nnz " << x->nnz()
+            << ", W: (" << features << ", " << hidden << ")" << std::endl;
+
+  double dense = bench("dense matmul", n, [&]() {
+    W->cleargrad();
+    F::sum(F::matmul(dense_x, W))->backward();
+  });
+  double csr = bench("sparse_matmul", n, [&]() {
+    W->cleargrad();
+    F::sum(F::sparse_matmul(x, W))->backward();
+  });
+  double row_sparse = bench("sparse_matmul (row-sparse grad)", n, [&]() {
+    W->cleargrad();
+    F::sum(F::sparse_matmul(x, W, true))->backward();
+  });
+  std::cout << "speedup: " << dense / csr << "x, " << dense / row_sparse
+            << "x (grad rows: " << W->sparse_grad->rows().size() << " / "
+            << features << ")" << std::endl;
+}
@@ -0,0 +1,53 @@
+// 逆伝播: creator_ptrで繋いだグラフ（Variable::backward）とテープ（tape::Tape）の比較
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "dezero.h"
+
+template <typename Fn>
+double bench(const std::string& name, int n, Fn fn) {
+  fn();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) fn();
+  auto end = std::chrono::steady_clock::now();
+  double us =
+      std::chrono::duration<double, std::micro>(end - start).count() / n;
+  std::cout << name << ": " << us << " us/iter" << std::endl;
+  return us;
+}
+
+// 小さなテンソルの長い鎖と、各ステップで分岐して合流するグラフ
+VarPtr chain(const VarPtr& x, int depth) {
+  auto h = x;
+  for (int i = 0; i < depth; i++) {
+    auto a = F::sin(h);
+    h = h + a * a * 0.5;
+  }
+  return F::sum(h);
+}
+
+int main(int argc, char** argv) {
+  const int n = argc > 1 ? std::atoi(argv[1]) : 200;
+  for (const int depth : {100, 1000, 10000}) {
+    std::cout << "== depth " << depth << " ==" << std::endl;
+    auto x = as_variable(as_array({0.1, 0.2, 0.3, 0.4}));
+    const int iters = std::max(1, n * 100 / depth);
+    double base = bench("forward+backward (graph)", iters, [&]() {
+      x->cleargrad();
+      chain(x, depth)->backward(false);
+    });
+    tape::Tape tape;
+    double fast = bench("forward+backward (tape)", iters, [&]() {
+      x->cleargrad();
+      tape.clear();
+      VarPtr y;
+      {
+        tape::Recording rec(tape);
+        y = chain(x, depth);
+      }
+      tape.backward(y, false);
+    });
+    std::cout << "speedup: " << base / fast << "x" << std::endl;
+  }
+}
@@ -0,0 +1,43 @@
+// 長い計算グラフの解放: その場での解放とrelease_asyncによるバックグラウンド解放
+// 既定では1000万ノードの鎖を作って捨てる（ノード1つあたり数百バイト使う）
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "dezero.h"
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+VarPtr build_chain(const VarPtr& x, long depth) {
+  auto y = x;
+  for (long i = 0; i < depth; i++) y = y + 1.0;
+  return y;
+}
+
+int main(int argc, char** argv) {
+  const long depth = argc > 1 ? std::atol(argv[1]) : 10000000;
+  auto x = as_variable(as_array({0.0}));
+
+  auto start = std::chrono::steady_clock::now();
+  auto y = build_chain(x, depth);
+  std::cout << "build " << depth << " nodes: " << elapsed_ms(start) << " ms"
+            << std::endl;
+  start = std::chrono::steady_clock::now();
+  y.reset();
+  std::cout << "release (iterative): " << elapsed_ms(start) << " ms"
+            << std::endl;
+
+  y = build_chain(x, depth);
+  start = std::chrono::steady_clock::now();
+  release_async(std::move(y));
+  std::cout << "release_async (caller blocked): " << elapsed_ms(start)
+            << " ms" << std::endl;
+  start = std::chrono::steady_clock::now();
+  wait_released();
+  std::cout << "background release finished after: " << elapsed_ms(start)
+            << " ms" << std::endl;
+}
@@ -0,0 +1,80 @@
+// vmathの超越関数とlibmのスループット・誤差の比較
+// 誤差はlong double版libmを真値としたULPで測る
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "dezero.h"
+
+template <typename Fn>
+double bench(int n, Fn fn) {
+  fn();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) fn();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::micro>(end - start).count() / n;
+}
+
+double ulp_error(double y, long double ref) {
+  if (std::isnan(y) && std::isnan(ref)) return 0.0;
+  if (y == ref) return 0.0;
+  const double r = static_cast<double>(ref);
+  const double ulp = std::nextafter(std::fabs(r), INFINITY) - std::fabs(r);
+  return static_cast<double>(std::fabs(y - ref) / ulp);
+}
+
+void run(const std::string& name, double lo, double hi,
+         void (*fn)(const double*, double*, size_t), double (*libm)(double),
+         long double (*ref)(long double), int iters) {
+  const size_t n = 1 << 20;
+  std::mt19937_64 rng(0);
+  std::uniform_real_distribution<double> dist(lo, hi);
+  std::vector<double> x(n), y(n);
+  for (auto& v : x) v = dist(rng);
+
+  double vec = bench(iters, [&]() { fn(x.data(), y.data(), n); });
+  double max_ulp = 0.0;
+  for (size_t i = 0; i < n; i++) {
+    max_ulp = std::max(max_ulp, ulp_error(y[i], ref(x[i])));
+  }
+  double base = bench(iters, [&]() {
+    for (size_t i = 0; i < n; i++) y[i] = libm(x[i]);
+  });
+  std::cout << name << " [" << lo << ", " << hi << "]: libm " << base
+            << " us, vmath " << vec << " us, speedup " << base / vec
+            << "x, max error " << max_ulp << " ulp" << std::endl;
+}
+
+double sigmoid(double x) { return 1.0 / (1.0 + std::exp(-x)); }
+long double sigmoidl(long double x) { return 1.0L / (1.0L + std::exp(-x)); }
+
+int main(int argc, char** argv) {
+  const int iters = argc > 1 ? std::atoi(argv[1]) : 20;
+  // 計測はシングルスレッドのポインタ版で行う
+  std::cout << "isa: " << vmath::isa() << std::endl;
+  auto ld = [](long double (*f)(long double)) { return f; };
+  run("exp", -745.0, 709.78, vmath::exp, std::exp, ld(std::exp), iters);
+  run("exp", -10.0, 10.0, vmath::exp, std::exp, ld(std::exp), iters);
+  run("log", 0.0, 1e10, vmath::log, std::log, ld(std::log), iters);
+  run("log", 0.0, 2.0, vmath::log, std::log, ld(std::log), iters);
+  run("sin", -10.0, 10.0, vmath::sin, std::sin, ld(std::sin), iters);
+  run("sin", -1.6e6, 1.6e6, vmath::sin, std::sin, ld(std::sin), iters);
+  run("cos", -10.0, 10.0, vmath::cos, std::cos, ld(std::cos), iters);
+  run("cos", -1.6e6, 1.6e6, vmath::cos, std::cos, ld(std::cos), iters);
+  run("tanh", -1.0, 1.0, vmath::tanh, std::tanh, ld(std::tanh), iters);
+  run("tanh", -20.0, 20.0, vmath::tanh, std::tanh, ld(std::tanh), iters);
+  run("sigmoid", -40.0, 40.0, vmath::sigmoid, sigmoid, sigmoidl, iters);
+
+  // F::tanhの順伝播と逆伝播
+  auto x = as_variable(as_array(nc::NdArray<double>(1000, 1000).fill(0.3)));
+  double us = bench(iters, [&]() {
+    x->cleargrad();
+    auto y = F::tanh(x);
+    y->backward();
+  });
+  std::cout << "F::tanh forward+backward (1000x1000): " << us << " us"
+            << std::endl;
+}
@@ -0,0 +1,589 @@
+#include "codegen.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+#include <tuple>
+#include <typeinfo>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+#include "functions.h"
+
+namespace codegen {
+namespace {
+// 作業領域の中の配列の境界（64バイト）
+constexpr size_t kAlignDoubles = 8;
+
+enum class OpKind {
+  Add,
+  Sub,
+  Mul,
+  Div,
+  Neg,
+  Pow,
+  AddScalar,
+  SubScalar,
+  RSubScalar,
+  MulScalar,
+  DivScalar,
+  RDivScalar,
+  Sin,
+  Cos,
+  Tanh,
+  Exp,
+  Log,
+  Sigmoid,
+  Reshape,
+  Transpose,
+  BroadcastTo,
+  SumTo,
+  Sum,
+  MatMul,
+  Softmax,
+};
+
+// 関数に対応する命令（対応していなければinvalid_argument）
+OpKind classify(const Function& f, double& c, nc::Axis& axis) {
+  const Function* p = &f;
+  if (auto* s = dynamic_cast<const ScalarFunction*>(p)) {
+    c = s->c;
+    if (dynamic_cast<const AddScalar*>(p)) return OpKind::AddScalar;
+    if (dynamic_cast<const SubScalar*>(p)) return OpKind::SubScalar;
+    if (dynamic_cast<const RSubScalar*>(p)) return OpKind::RSubScalar;
+    if (dynamic_cast<const MulScalar*>(p)) return OpKind::MulScalar;
+    if (dynamic_cast<const DivScalar*>(p)) return OpKind::DivScalar;
+    if (dynamic_cast<const RDivScalar*>(p)) return OpKind::RDivScalar;
+  } else if (auto* pw = dynamic_cast<const Pow*>(p)) {
+    c = pw->c;
+    return OpKind::Pow;
+  } else if (auto* sum = dynamic_cast<const F::Sum*>(p)) {
+    axis = sum->batched ? nc::Axis::COL : sum->axis;
+    return OpKind::Sum;
+  }
+  if (dynamic_cast<const Add*>(p)) return OpKind::Add;
+  if (dynamic_cast<const Sub*>(p)) return OpKind::Sub;
+  if (dynamic_cast<const Mul*>(p)) return OpKind::Mul;
+  if (dynamic_cast<const Div*>(p)) return OpKind::Div;
+  if (dynamic_cast<const Neg*>(p)) return OpKind::Neg;
+  if (dynamic_cast<const F::Sin*>(p)) return OpKind::Sin;
+  if (dynamic_cast<const F::Cos*>(p)) return OpKind::Cos;
+  if (dynamic_cast<const F::Tanh*>(p)) return OpKind::Tanh;
+  if (dynamic_cast<const F::Exp*>(p)) return OpKind::Exp;
+  if (dynamic_cast<const F::Log*>(p)) return OpKind::Log;
+  if (dynamic_cast<const F::Sigmoid*>(p)) return OpKind::Sigmoid;
+  if (dynamic_cast<const F::Reshape*>(p)) return OpKind::Reshape;
+  if (dynamic_cast<const F::Transpose*>(p)) return OpKind::Transpose;
+  if (dynamic_cast<const F::BroadcastTo*>(p)) return OpKind::BroadcastTo;
+  if (dynamic_cast<const F::SumTo*>(p)) return OpKind::SumTo;
+  if (dynamic_cast<const F::MatMul*>(p)) return OpKind::MatMul;
+  if (dynamic_cast<const F::Softmax*>(p)) return OpKind::Softmax;
+  throw std::invalid_argument(std::string("export_cpp: unsupported function ") +
+                              typeid(f).name());
+}
+
+enum class StorageKind { Input, Const, Arena, Output };
+
+struct Storage {
+  StorageKind kind;
+  // 入力・定数の番号
+  size_t index = 0;
+  size_t size = 0;
+  size_t offset = 0;
+  // 最後に読まれる命令の番号（-1なら読まれない）
+  int last_use = -1;
+};
+
+struct Value {
+  size_t storage;
+  nc::Shape shape;
+};
+
+struct Op {
+  OpKind kind;
+  double c = 0.0;
+  nc::Axis axis = nc::Axis::NONE;
+  std::vector<size_t> args;
+  size_t result;
+};
+
+// 計算グラフを命令列と領域の割り当てにしたもの
+struct Program {
+  std::vector<Op> ops;
+  std::vector<Value> values;
+  std::vector<Storage> storages;
+  std::vector<NdArrPtr> consts;
+  std::vector<nc::Shape> input_shapes;
+  size_t output;
+  size_t workspace_size = 0;
+  size_t naive_size = 0;
+};
+
+// outputの祖先の関数をトポロジカル順（入力に近い順）に並べる
+std::vector<FuncPtr> topological_order(const VarPtr& output) {
+  std::vector<FuncPtr> order;
+  if (!output->creator_ptr) {
+    return order;
+  }
+  // 深さ優先の帰りがけ順（再帰しない）
+  std::unordered_set<Function*> seen = {output->creator_ptr.get()};
+  std::vector<std::pair<FuncPtr, size_t>> stack = {{output->creator_ptr, 0}};
+  while (!stack.empty()) {
+    auto& [f, next] = stack.back();
+    if (next < f->inputs_.size()) {
+      const auto& creator = f->inputs_[next++]->creator_ptr;
+      if (creator && seen.insert(creator.get()).second) {
+        stack.emplace_back(creator, 0);
+      }
+      continue;
+    }
+    order.push_back(f);
+    stack.pop_back();
+  }
+  return order;
+}
+
+size_t round_up(size_t n) {
+  return (n + kAlignDoubles - 1) / kAlignDoubles * kAlignDoubles;
+}
+
+// 生存区間が重ならない領域を同じ場所に置く（先頭から空いている隙間に詰める）
+void allocate(Program& prog) {
+  std::vector<std::vector<size_t>> defined(prog.ops.size());
+  for (size_t k = 0; k < prog.ops.size(); k++) {
+    const auto& op = prog.ops[k];
+    const size_t s = prog.values[op.result].storage;
+    if (op.kind != OpKind::Reshape &&
+        prog.storages[s].kind == StorageKind::Arena) {
+      defined[k].push_back(s);
+    }
+  }
+  // (offset, size, storage)
+  std::vector<std::tuple<size_t, size_t, size_t>> live;
+  for (size_t k = 0; k < prog.ops.size(); k++) {
+    // 命令kより前で読み終わった領域を空ける（入力と出力は重ねない）
+    auto released = [&](const auto& block) {
+      const auto& st = prog.storages[std::get<2>(block)];
+      return st.last_use < static_cast<int>(k);
+    };
+    live.erase(std::remove_if(live.begin(), live.end(), released), live.end());
+    for (size_t s : defined[k]) {
+      auto& st = prog.storages[s];
+      const size_t size = round_up(st.size);
+      std::sort(live.begin(), live.end());
+      size_t offset = 0;
+      for (const auto& [begin, used, id] : live) {
+        if (offset + size <= begin) break;
+        offset = std::max(offset, begin + used);
+      }
+      st.offset = offset;
+      live.emplace_back(offset, size, s);
+      prog.workspace_size = std::max(prog.workspace_size, offset + size);
+      prog.naive_size += size;
+    }
+  }
+}
+
+Program build(const VarPtr& output, const std::vector<VarPtr>& inputs) {
+  Program prog;
+  std::unordered_map<const Variable*, size_t> value_of;
+  auto add_value = [&](const Variable* v, StorageKind kind, size_t index,
+                       const nc::Shape& shape) {
+    prog.storages.push_back({kind, index, shape.size()});
+    prog.values.push_back({prog.storages.size() - 1, shape});
+    value_of[v] = prog.values.size() - 1;
+    return prog.values.size() - 1;
+  };
+  for (size_t k = 0; k < inputs.size(); k++) {
+    if (value_of.count(inputs[k].get())) {
+      throw std::invalid_argument("export_cpp: duplicate input");
+    }
+    add_value(inputs[k].get(), StorageKind::Input, k, inputs[k]->shape());
+    prog.input_shapes.push_back(inputs[k]->shape());
+  }
+  auto value_for = [&](const VarPtr& v) {
+    auto it = value_of.find(v.get());
+    if (it != value_of.end()) {
+      return it->second;
+    }
+    // inputsにない葉は定数として埋め込む
+    prog.consts.push_back(v->data);
+    return add_value(v.get(), StorageKind::Const, prog.consts.size() - 1,
+                     v->shape());
+  };
+
+  for (const auto& f : topological_order(output)) {
+    Op op;
+    op.kind = classify(*f, op.c, op.axis);
+    for (const auto& x : f->inputs_) {
+      op.args.push_back(value_for(x));
+    }
+    auto y = f->outputs_.size() == 1 ? f->outputs_[0].lock() : nullptr;
+    if (!y) {
+      throw std::invalid_argument(
+          "export_cpp: functions must have exactly one live output");
+    }
+    if (op.kind == OpKind::Reshape) {
+      // 行優先なので同じ領域をそのまま別の形として読む
+      prog.values.push_back(
+          {prog.values[op.args[0]].storage, y->shape()});
+      value_of[y.get()] = prog.values.size() - 1;
+      op.result = prog.values.size() - 1;
+    } else {
+      op.result = add_value(y.get(), StorageKind::Arena, 0, y->shape());
+    }
+    prog.ops.push_back(std::move(op));
+  }
+  prog.output = value_for(output);
+
+  for (size_t k = 0; k < prog.ops.size(); k++) {
+    for (size_t a : prog.ops[k].args) {
+      auto& st = prog.storages[prog.values[a].storage];
+      st.last_use = std::max(st.last_use, static_cast<int>(k));
+    }
+  }
+  // 出力を作る命令は呼び出し側の配列に直接書く
+  auto& out = prog.storages[prog.values[prog.output].storage];
+  if (out.kind == StorageKind::Arena) {
+    out.kind = StorageKind::Output;
+  }
+  allocate(prog);
+  return prog;
+}
+
+std::string literal(double v) {
+  if (std::isnan(v)) return "std::numeric_limits<double>::quiet_NaN()";
+  if (std::isinf(v)) {
+    return v > 0 ? "std::numeric_limits<double>::infinity()"
+                 : "-std::numeric_limits<double>::infinity()";
+  }
+  // 16進の浮動小数点リテラルで丸めずに書く
+  std::ostringstream oss;
+  oss << std::hexfloat << v;
+  return oss.str();
+}
+
+std::string shape_str(const nc::Shape& s) {
+  return "(" + std::to_string(s.rows) + ", " + std::to_string(s.cols) + ")";
+}
+
+class Emitter {
+ public:
+  explicit Emitter(const Program& prog) : prog_(prog) {}
+
+  std::string ptr(size_t value) const {
+    const auto& st = prog_.storages[prog_.values[value].storage];
+    switch (st.kind) {
+      case StorageKind::Input:
+        return "in" + std::to_string(st.index);
+      case StorageKind::Const:
+        return "kConst" + std::to_string(st.index);
+      case StorageKind::Output:
+        return "out";
+      case StorageKind::Arena:
+        break;
+    }
+    return st.offset == 0 ? "workspace"
+                          : "workspace + " + std::to_string(st.offset);
+  }
+
+  // 形がshapeの値をoutの(i, j)に合わせて読む添字
+  static std::string index(const nc::Shape& shape, const nc::Shape& out) {
+    if ((shape.rows != 1 && shape.rows != out.rows) ||
+        (shape.cols != 1 && shape.cols != out.cols)) {
+      throw std::invalid_argument("export_cpp: cannot broadcast " +
+                                  shape_str(shape) + " to " + shape_str(out));
+    }
+    const std::string row =
+        shape.rows == 1 ? "" : "i * " + std::to_string(shape.cols);
+    const std::string col = shape.cols == 1 ? "" : "j";
+    if (row.empty() && col.empty()) return "0";
+    if (row.empty()) return col;
+    if (col.empty()) return row;
+    return row + " + " + col;
+  }
+
+  void line(const std::string& s) {
+    out_ << std::string(indent_, ' ') << s << "\n";
+  }
+
+  void emit(const Op& op, size_t k) {
+    const auto& y = prog_.values[op.result];
+    std::ostringstream head;
+    head << "// " << k << ": " << name(op.kind);
+    for (size_t a : op.args) head << " " << shape_str(prog_.values[a].shape);
+    head << " -> " << shape_str(y.shape);
+    line(head.str());
+    if (op.kind == OpKind::Reshape) {
+      line("// （" + ptr(op.args[0]) + "をそのまま使う）");
+      return;
+    }
+    line("{");
+    indent_ += 2;
+    for (size_t a = 0; a < op.args.size(); a++) {
+      line("const double* x" + std::to_string(a) + " = " + ptr(op.args[a]) +
+           ";");
+    }
+    line("double* y = " + ptr(op.result) + ";");
+    const size_t rows = y.shape.rows;
+    const size_t cols = y.shape.cols;
+    const std::string n = std::to_string(y.shape.size());
+    const std::string c = literal(op.c);
+    switch (op.kind) {
+      case OpKind::Add:
+      case OpKind::Sub:
+      case OpKind::Mul:
+      case OpKind::Div:
+        binary(op, y.shape);
+        break;
+      case OpKind::Neg:
+        unary(n, "-x0[i]");
+        break;
+      case OpKind::Pow:
+        unary(n, "std::pow(x0[i], " + c + ")");
+        break;
+      case OpKind::AddScalar:
+        unary(n, "x0[i] + " + c);
+        break;
+      case OpKind::SubScalar:
+        unary(n, "x0[i] - " + c);
+        break;
+      case OpKind::RSubScalar:
+        unary(n, c + " - x0[i]");
+        break;
+      case OpKind::MulScalar:
+        unary(n, "x0[i] * " + c);
+        break;
+      case OpKind::DivScalar:
+        unary(n, "x0[i] / " + c);
+        break;
+      case OpKind::RDivScalar:
+        unary(n, c + " / x0[i]");
+        break;
+      case OpKind::Sin:
+        unary(n, "std::sin(x0[i])");
+        break;
+      case OpKind::Cos:
+        unary(n, "std::cos(x0[i])");
+        break;
+      case OpKind::Tanh:
+        unary(n, "std::tanh(x0[i])");
+        break;
+      case OpKind::Exp:
+        unary(n, "std::exp(x0[i])");
+        break;
+      case OpKind::Log:
+        unary(n, "std::log(x0[i])");
+        break;
+      case OpKind::Sigmoid:
+        unary(n, "1.0 / (1.0 + std::exp(-x0[i]))");
+        break;
+      case OpKind::Transpose: {
+        const auto& x = prog_.values[op.args[0]].shape;
+        loops(x.rows, x.cols,
+              "y[j * " + std::to_string(x.rows) + " + i] = x0[i * " +
+                  std::to_string(x.cols) + " + j];");
+        break;
+      }
+      case OpKind::BroadcastTo:
+        loops(rows, cols,
+              "y[i * " + std::to_string(cols) + " + j] = x0[" +
+                  index(prog_.values[op.args[0]].shape, y.shape) + "];");
+        break;
+      case OpKind::SumTo: {
+        const auto& x = prog_.values[op.args[0]].shape;
+        line("for (std::size_t i = 0; i < " + n + "; i++) y[i] = 0.0;");
+        loops(x.rows, x.cols,
+              "y[" + index(y.shape, x) + "] += x0[i * " +
+                  std::to_string(x.cols) + " + j];");
+        break;
+      }
+      case OpKind::Sum: {
+        const auto& x = prog_.values[op.args[0]].shape;
+        line("for (std::size_t i = 0; i < " + n + "; i++) y[i] = 0.0;");
+        const std::string dst = op.axis == nc::Axis::ROW   ? "j"
+                                : op.axis == nc::Axis::COL ? "i"
+                                                           : "0";
+        loops(x.rows, x.cols,
+              "y[" + dst + "] += x0[i * " + std::to_string(x.cols) + " + j];");
+        break;
+      }
+      case OpKind::MatMul:
+        matmul(op, y.shape);
+        break;
+      case OpKind::Softmax:
+        softmax(y.shape);
+        break;
+      case OpKind::Reshape:
+        break;
+    }
+    indent_ -= 2;
+    line("}");
+  }
+
+  void copy(size_t value) {
+    line("// 出力は入力か定数そのもの");
+    line("for (std::size_t i = 0; i < " +
+         std::to_string(prog_.values[value].shape.size()) + "; i++) out[i] = " +
+         ptr(value) + "[i];");
+  }
+
+  std::string str() const { return out_.str(); }
+
+ private:
+  static const char* name(OpKind kind) {
+    // OpKindと同じ順
+    static const char* names[] = {
+        "add",         "sub",        "mul",        "div",
+        "neg",         "pow",        "add_scalar", "sub_scalar",
+        "rsub_scalar", "mul_scalar", "div_scalar", "rdiv_scalar",
+        "sin",         "cos",        "tanh",       "exp",
+        "log",         "sigmoid",    "reshape",    "transpose",
+        "broadcast_to", "sum_to",    "sum",        "matmul",
+        "softmax"};
+    return names[static_cast<int>(kind)];
+  }
+
+  void unary(const std::string& n, const std::string& expr) {
+    line("for (std::size_t i = 0; i < " + n + "; i++) y[i] = " + expr + ";");
+  }
+
+  void loops(size_t rows, size_t cols, const std::string& body) {
+    line("for (std::size_t i = 0; i < " + std::to_string(rows) + "; i++) {");
+    line("  for (std::size_t j = 0; j < " + std::to_string(cols) + "; j++) {");
+    line("    " + body);
+    line("  }");
+    line("}");
+  }
+
+  void binary(const Op& op, const nc::Shape& out) {
+    static const char* symbols[] = {" + ", " - ", " * ", " / "};
+    const std::string sym = symbols[static_cast<int>(op.kind)];
+    const auto& a = prog_.values[op.args[0]].shape;
+    const auto& b = prog_.values[op.args[1]].shape;
+    if (a == out && b == out) {
+      unary(std::to_string(out.size()), "x0[i]" + sym + "x1[i]");
+      return;
+    }
+    loops(out.rows, out.cols,
+          "y[i * " + std::to_string(out.cols) + " + j] = x0[" +
+              index(a, out) + "]" + sym + "x1[" + index(b, out) + "];");
+  }
+
+  void matmul(const Op& op, const nc::Shape& out) {
+    const auto& a = prog_.values[op.args[0]].shape;
+    const std::string m = std::to_string(out.rows);
+    const std::string k = std::to_string(a.cols);
+    const std::string n = std::to_string(out.cols);
+    // 内側をyとx1の行に沿った連続なループにする（ベクトル化しやすい）
+    line("for (std::size_t i = 0; i < " + std::to_string(out.size()) +
+         "; i++) y[i] = 0.0;");
+    line("for (std::size_t i = 0; i < " + m + "; i++) {");
+    line("  for (std::size_t p = 0; p < " + k + "; p++) {");
+    line("    const double a = x0[i * " + k + " + p];");
+    line("    for (std::size_t j = 0; j < " + n + "; j++) {");
+    line("      y[i * " + n + " + j] += a * x1[p * " + n + " + j];");
+    line("    }");
+    line("  }");
+    line("}");
+  }
+
+  void softmax(const nc::Shape& out) {
+    const std::string cols = std::to_string(out.cols);
+    line("for (std::size_t i = 0; i < " + std::to_string(out.rows) +
+         "; i++) {");
+    line("  const double* xr = x0 + i * " + cols + ";");
+    line("  double* yr = y + i * " + cols + ";");
+    line("  double m = xr[0];");
+    line("  for (std::size_t j = 1; j < " + cols +
+         "; j++) m = xr[j] > m ? xr[j] : m;");
+    line("  double s = 0.0;");
+    line("  for (std::size_t j = 0; j < " + cols + "; j++) {");
+    line("    yr[j] = std::exp(xr[j] - m);");
+    line("    s += yr[j];");
+    line("  }");
+    line("  for (std::size_t j = 0; j < " + cols + "; j++) yr[j] /= s;");
+    line("}");
+  }
+
+  const Program& prog_;
+  std::ostringstream out_;
+  int indent_ = 2;
+};
+
+bool is_identifier(const std::string& s) {
+  if (s.empty() || std::isdigit(static_cast<unsigned char>(s[0]))) {
+    return false;
+  }
+  return std::all_of(s.begin(), s.end(), [](char ch) {
+    return std::isalnum(static_cast<unsigned char>(ch)) || ch == '_';
+  });
+}
+}  // namespace
+
+std::string export_cpp(const VarPtr& output, const std::vector<VarPtr>& inputs,
+                       const std::string& name) {
+  if (!is_identifier(name)) {
+    throw std::invalid_argument("export_cpp: invalid function name " + name);
+  }
+  const Program prog = build(output, inputs);
+  std::ostringstream src;
+  src << "// DeZeroCxxの計算グラフから生成したソース（codegen::export_cpp）\n";
+  src << "#include <cmath>\n#include <cstddef>\n#include <limits>\n\n";
+
+  if (!prog.consts.empty()) {
+    src << "namespace {\n";
+    for (size_t k = 0; k < prog.consts.size(); k++) {
+      const auto& c = *prog.consts[k];
+      src << "// " << shape_str(c.shape()) << "\n";
+      src << "const double kConst" << k << "[" << c.size() << "] = {";
+      for (size_t i = 0; i < c.size(); i++) {
+        src << (i % 4 == 0 ? "\n    " : " ") << literal(c.data()[i]) << ",";
+      }
+      src << "\n};\n";
+    }
+    src << "}  // namespace\n\n";
+  }
+
+  std::string params;
+  for (size_t k = 0; k < inputs.size(); k++) {
+    params += "const double* in" + std::to_string(k) + ", ";
+    src << "// in" << k << ": " << shape_str(prog.input_shapes[k]) << "\n";
+  }
+  src << "// out: " << shape_str(prog.values[prog.output].shape) << "\n";
+  src << "constexpr std::size_t " << name
+      << "_workspace_size = " << prog.workspace_size << ";\n\n";
+
+  Emitter body(prog);
+  for (size_t k = 0; k < prog.ops.size(); k++) {
+    body.emit(prog.ops[k], k);
+  }
+  if (prog.storages[prog.values[prog.output].storage].kind !=
+      StorageKind::Output) {
+    body.copy(prog.output);
+  }
+  src << "void " << name << "(" << params
+      << "double* out, double* workspace) {\n";
+  src << "  (void)workspace;\n";
+  src << body.str() << "}\n\n";
+
+  std::string args;
+  for (size_t k = 0; k < inputs.size(); k++) {
+    args += "in" + std::to_string(k) + ", ";
+  }
+  src << "void " << name << "(" << params << "double* out) {\n";
+  src << "  static thread_local double workspace[" << name
+      << "_workspace_size > 0 ? " << name << "_workspace_size : 1];\n";
+  src << "  " << name << "(" << args << "out, workspace);\n";
+  src << "}\n";
+  return src.str();
+}
+
+Plan plan(const VarPtr& output, const std::vector<VarPtr>& inputs) {
+  const Program prog = build(output, inputs);
+  return {prog.ops.size(), prog.workspace_size, prog.naive_size};
+}
+}  // namespace codegen
@@ -0,0 +1,47 @@
+#ifndef CODEGEN_
+#define CODEGEN_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "core.h"
+
+// 計算グラフを単体でコンパイルできるC++のソースにする（組み込み向けの事前コンパイル）
+// outputからcreator_ptrを辿り（utils::get_dot_graphと同じ）、トポロジカル順に
+// 各関数を形を定数にしたループとして書き出す
+// - inputs以外の葉（重みなど）は定数の配列として埋め込む
+// - 中間結果は生存区間から配置を決めた1つの作業領域に置き、使い終わった領域は
+//   後の結果で使い回す（reshapeはコピーせず同じ領域を指す）
+// - shared_ptrも仮想関数もNumCppも使わない（<cmath>だけ）
+//
+//   auto x = as_variable(as_array(sample));  // 形を決めるための入力
+//   auto y = model(x);                       // 計算グラフを作る（no_gradにしない）
+//   std::ofstream("model.cpp") << codegen::export_cpp(y, {x}, "model");
+//
+// 生成されるソース:
+//   constexpr std::size_t model_workspace_size = ...;  // doubleの個数
+//   void model(const double* in0, double* out, double* workspace);
+//   void model(const double* in0, double* out);  // thread_localの作業領域を使う
+// 配列は行優先で、outと入力は重ならないこと
+namespace codegen {
+// 対応する関数: 四則演算（(R, 1)/(1, C)/(1, 1)のブロードキャストを含む）、
+// 定数との演算、neg、pow、sin/cos/tanh/exp/log/sigmoid、reshape、transpose、
+// broadcast_to、sum_to、sum、matmul、softmax
+// それ以外の関数があればinvalid_argument
+std::string export_cpp(const VarPtr& output, const std::vector<VarPtr>& inputs,
+                       const std::string& name = "forward");
+
+// 作業領域の割り当て結果（export_cppと同じ計画）
+struct Plan {
+  // 書き出す関数の数（reshapeを含む）
+  size_t num_ops = 0;
+  // 作業領域の大きさ（doubleの個数）
+  size_t workspace_size = 0;
+  // 中間結果を全て別の領域に置いた場合の大きさ
+  size_t naive_size = 0;
+};
+Plan plan(const VarPtr& output, const std::vector<VarPtr>& inputs);
+}  // namespace codegen
+
+#endif
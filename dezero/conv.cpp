@@ -0,0 +1,577 @@
+#include "conv.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include "functions.h"
+#include "parallel.h"
+
+namespace F {
+namespace {
+// 1単位あたりの仕事量がおよそwork要素のとき、grain_size分ずつ並列にする単位数
+size_t units_grain(size_t work) {
+  return std::max<size_t>(
+      1, parallel::get_grain_size() / std::max<size_t>(1, work));
+}
+
+size_t image_size(const Conv2dParam& p) {
+  return p.channels * p.height * p.width;
+}
+
+size_t kernel_size(const Conv2dParam& p) {
+  return p.channels * p.kernel_h * p.kernel_w;
+}
+
+void check_cols(const nc::NdArray<double>& x, size_t cols, const char* what) {
+  if (x.shape().cols != cols) {
+    throw std::invalid_argument(std::string(what) + ": expected " +
+                                std::to_string(cols) + " columns, got " +
+                                std::to_string(x.shape().cols));
+  }
+}
+
+// 入力の位置o * stride + k - padが[0, size)にあれば*iに入れてtrueを返す
+bool in_range(size_t o, size_t k, const Conv2dParam& p, size_t size,
+              size_t* i) {
+  const size_t v = o * p.stride + k;
+  if (v < p.pad || v - p.pad >= size) {
+    return false;
+  }
+  *i = v - p.pad;
+  return true;
+}
+
+// x[n0, n0 + t)をim2colする: (C * KH * KW, t * OH * OW)
+// 列s * OH * OW + oh * OW + owがサンプルsの出力位置(oh, ow)の窓
+nc::NdArray<double> im2col(const nc::NdArray<double>& x, size_t n0, size_t t,
+                           const Conv2dParam& p) {
+  const size_t oh_size = p.out_h();
+  const size_t ow_size = p.out_w();
+  const size_t ohw = oh_size * ow_size;
+  const size_t hw = p.height * p.width;
+  const size_t kk = p.kernel_h * p.kernel_w;
+  const size_t cols = t * ohw;
+  nc::NdArray<double> col(static_cast<nc::uint32>(kernel_size(p)),
+                          static_cast<nc::uint32>(cols));
+  const double* px = x.data() + n0 * image_size(p);
+  double* pc = col.data();
+  // (サンプル, チャンネル)ごとに書く行列の範囲が重ならない
+  parallel::parallel_for(
+      0, t * p.channels, units_grain(kk * ohw), [&](size_t begin, size_t end) {
+        for (size_t u = begin; u < end; u++) {
+          const size_t s = u / p.channels;
+          const size_t c = u % p.channels;
+          const double* img = px + s * image_size(p) + c * hw;
+          for (size_t ki = 0; ki < p.kernel_h; ki++) {
+            for (size_t kj = 0; kj < p.kernel_w; kj++) {
+              double* dst = pc + (c * kk + ki * p.kernel_w + kj) * cols +
+                            s * ohw;
+              for (size_t oh = 0; oh < oh_size; oh++) {
+                size_t ih;
+                if (!in_range(oh, ki, p, p.height, &ih)) {
+                  std::fill(dst + oh * ow_size, dst + (oh + 1) * ow_size, 0.0);
+                  continue;
+                }
+                for (size_t ow = 0; ow < ow_size; ow++) {
+                  size_t iw;
+                  dst[oh * ow_size + ow] =
+                      in_range(ow, kj, p, p.width, &iw) ? img[ih * p.width + iw]
+                                                        : 0.0;
+                }
+              }
+            }
+          }
+        }
+      });
+  return col;
+}
+
+// im2colの逆: colの窓の値を元の位置に足してgx[n0, n0 + t)に書く
+void col2im(const nc::NdArray<double>& col, size_t n0, size_t t,
+            const Conv2dParam& p, nc::NdArray<double>& gx) {
+  const size_t oh_size = p.out_h();
+  const size_t ow_size = p.out_w();
+  const size_t ohw = oh_size * ow_size;
+  const size_t hw = p.height * p.width;
+  const size_t kk = p.kernel_h * p.kernel_w;
+  const size_t cols = t * ohw;
+  const double* pc = col.data();
+  double* pg = gx.data() + n0 * image_size(p);
+  parallel::parallel_for(
+      0, t * p.channels, units_grain(kk * ohw), [&](size_t begin, size_t end) {
+        for (size_t u = begin; u < end; u++) {
+          const size_t s = u / p.channels;
+          const size_t c = u % p.channels;
+          double* img = pg + s * image_size(p) + c * hw;
+          std::fill(img, img + hw, 0.0);
+          for (size_t ki = 0; ki < p.kernel_h; ki++) {
+            for (size_t kj = 0; kj < p.kernel_w; kj++) {
+              const double* src =
+                  pc + (c * kk + ki * p.kernel_w + kj) * cols + s * ohw;
+              for (size_t oh = 0; oh < oh_size; oh++) {
+                size_t ih;
+                if (!in_range(oh, ki, p, p.height, &ih)) continue;
+                for (size_t ow = 0; ow < ow_size; ow++) {
+                  size_t iw;
+                  if (in_range(ow, kj, p, p.width, &iw)) {
+                    img[ih * p.width + iw] += src[oh * ow_size + ow];
+                  }
+                }
+              }
+            }
+          }
+        }
+      });
+}
+
+size_t tile_size(const Conv2dParam& p, size_t n) {
+  return p.tile == 0 ? std::max<size_t>(1, n) : p.tile;
+}
+
+// gy[n0, n0 + t)を(OC, t * OH * OW)に並べ替える（im2colの列の順）
+nc::NdArray<double> gather_tile(const nc::NdArray<double>& gy, size_t n0,
+                                size_t t, size_t out_channels, size_t ohw) {
+  nc::NdArray<double> g(static_cast<nc::uint32>(out_channels),
+                        static_cast<nc::uint32>(t * ohw));
+  for (size_t s = 0; s < t; s++) {
+    for (size_t oc = 0; oc < out_channels; oc++) {
+      std::memcpy(g.data() + oc * t * ohw + s * ohw,
+                  gy.data() + ((n0 + s) * out_channels + oc) * ohw,
+                  ohw * sizeof(double));
+    }
+  }
+  return g;
+}
+
+// y = conv(x, W) + b（bはnullptrなら足さない）
+nc::NdArray<double> conv_forward(const nc::NdArray<double>& x,
+                                 const nc::NdArray<double>& W,
+                                 const nc::NdArray<double>* b,
+                                 const Conv2dParam& p) {
+  check_cols(x, image_size(p), "conv2d(x)");
+  check_cols(W, kernel_size(p), "conv2d(W)");
+  const size_t n = x.shape().rows;
+  const size_t out_channels = W.shape().rows;
+  if (b && b->size() != out_channels) {
+    throw std::invalid_argument("conv2d: b must have one value per channel");
+  }
+  const size_t ohw = p.out_h() * p.out_w();
+  nc::NdArray<double> y(static_cast<nc::uint32>(n),
+                        static_cast<nc::uint32>(out_channels * ohw));
+  const size_t tile = tile_size(p, n);
+  for (size_t n0 = 0; n0 < n; n0 += tile) {
+    const size_t t = std::min(tile, n - n0);
+    const auto out = W.dot(im2col(x, n0, t, p));  // (OC, t * OH * OW)
+    for (size_t s = 0; s < t; s++) {
+      for (size_t oc = 0; oc < out_channels; oc++) {
+        const double* src = out.data() + oc * t * ohw + s * ohw;
+        double* dst = y.data() + ((n0 + s) * out_channels + oc) * ohw;
+        const double bias = b ? b->data()[oc] : 0.0;
+        for (size_t k = 0; k < ohw; k++) {
+          dst[k] = src[k] + bias;
+        }
+      }
+    }
+  }
+  return y;
+}
+
+// gx = deconv(gy, W)（conv_forwardのxについての転置）
+nc::NdArray<double> deconv_forward(const nc::NdArray<double>& gy,
+                                   const nc::NdArray<double>& W,
+                                   const Conv2dParam& p) {
+  check_cols(W, kernel_size(p), "deconv2d(W)");
+  const size_t out_channels = W.shape().rows;
+  const size_t ohw = p.out_h() * p.out_w();
+  check_cols(gy, out_channels * ohw, "deconv2d(gy)");
+  const size_t n = gy.shape().rows;
+  nc::NdArray<double> gx(static_cast<nc::uint32>(n),
+                         static_cast<nc::uint32>(image_size(p)));
+  const auto Wt = W.transpose();
+  const size_t tile = tile_size(p, n);
+  for (size_t n0 = 0; n0 < n; n0 += tile) {
+    const size_t t = std::min(tile, n - n0);
+    col2im(Wt.dot(gather_tile(gy, n0, t, out_channels, ohw)), n0, t, p, gx);
+  }
+  return gx;
+}
+
+// gW = sum_n gy_n col_n^T（conv_forwardのWについての転置）
+nc::NdArray<double> grad_w_forward(const nc::NdArray<double>& x,
+                                   const nc::NdArray<double>& gy,
+                                   const Conv2dParam& p) {
+  check_cols(x, image_size(p), "conv2d_grad_w(x)");
+  const size_t n = x.shape().rows;
+  const size_t ohw = p.out_h() * p.out_w();
+  if (gy.shape().rows != n || gy.shape().cols % ohw != 0) {
+    throw std::invalid_argument("conv2d_grad_w: gy shape mismatch");
+  }
+  const size_t out_channels = gy.shape().cols / ohw;
+  auto gW = nc::zeros<double>(static_cast<nc::uint32>(out_channels),
+                              static_cast<nc::uint32>(kernel_size(p)));
+  const size_t tile = tile_size(p, n);
+  for (size_t n0 = 0; n0 < n; n0 += tile) {
+    const size_t t = std::min(tile, n - n0);
+    // xのim2colは保存せず、タイルごとに作り直す
+    gW += gather_tile(gy, n0, t, out_channels, ohw)
+              .dot(im2col(x, n0, t, p).transpose());
+  }
+  return gW;
+}
+
+void check_pooling(const Conv2dParam& p) {
+  p.validate();
+  if (p.pad >= p.kernel_h || p.pad >= p.kernel_w) {
+    throw std::invalid_argument("pooling: pad must be smaller than the window");
+  }
+}
+
+// プーリングの窓を(n, c, oh, ow)ごとに回す
+// fn(n, 出力の番号（サンプル内）, 窓の入力の番号（サンプル内）のリスト)
+template <typename Fn>
+void for_windows(size_t n, const Conv2dParam& p, Fn fn) {
+  const size_t oh_size = p.out_h();
+  const size_t ow_size = p.out_w();
+  const size_t hw = p.height * p.width;
+  const size_t kk = p.kernel_h * p.kernel_w;
+  // サンプルごとに出力の行が分かれる
+  parallel::parallel_for(
+      0, n, units_grain(p.channels * oh_size * ow_size * kk),
+      [&](size_t begin, size_t end) {
+        std::vector<size_t> window;
+        window.reserve(kk);
+        for (size_t i = begin; i < end; i++) {
+          for (size_t c = 0; c < p.channels; c++) {
+            for (size_t oh = 0; oh < oh_size; oh++) {
+              for (size_t ow = 0; ow < ow_size; ow++) {
+                window.clear();
+                for (size_t ki = 0; ki < p.kernel_h; ki++) {
+                  size_t ih;
+                  if (!in_range(oh, ki, p, p.height, &ih)) continue;
+                  for (size_t kj = 0; kj < p.kernel_w; kj++) {
+                    size_t iw;
+                    if (in_range(ow, kj, p, p.width, &iw)) {
+                      window.push_back(c * hw + ih * p.width + iw);
+                    }
+                  }
+                }
+                fn(i, (c * oh_size + oh) * ow_size + ow, window);
+              }
+            }
+          }
+        }
+      });
+}
+
+size_t pooled_size(const Conv2dParam& p) {
+  return p.channels * p.out_h() * p.out_w();
+}
+
+// y[n, o] = x[n, indexes[n * 出力数 + o]]
+nc::NdArray<double> gather_indexes(const nc::NdArray<double>& x,
+                                   const std::vector<uint32_t>& indexes,
+                                   const Conv2dParam& p) {
+  check_cols(x, image_size(p), "max_pooling(x)");
+  const size_t n = x.shape().rows;
+  const size_t out = pooled_size(p);
+  if (indexes.size() != n * out) {
+    throw std::invalid_argument("max_pooling: batch size changed");
+  }
+  nc::NdArray<double> y(static_cast<nc::uint32>(n),
+                        static_cast<nc::uint32>(out));
+  for (size_t k = 0; k < n * out; k++) {
+    y.data()[k] = x.data()[(k / out) * image_size(p) + indexes[k]];
+  }
+  return y;
+}
+
+// gx[n, indexes[n * 出力数 + o]] += gy[n, o]
+nc::NdArray<double> scatter_indexes(const nc::NdArray<double>& gy,
+                                    const std::vector<uint32_t>& indexes,
+                                    const Conv2dParam& p) {
+  const size_t out = pooled_size(p);
+  check_cols(gy, out, "max_pooling_grad(gy)");
+  const size_t n = gy.shape().rows;
+  if (indexes.size() != n * out) {
+    throw std::invalid_argument("max_pooling_grad: batch size changed");
+  }
+  auto gx = nc::zeros<double>(static_cast<nc::uint32>(n),
+                              static_cast<nc::uint32>(image_size(p)));
+  parallel::parallel_for(0, n, units_grain(out), [&](size_t b, size_t e) {
+    for (size_t i = b; i < e; i++) {
+      double* dst = gx.data() + i * image_size(p);
+      for (size_t o = 0; o < out; o++) {
+        dst[indexes[i * out + o]] += gy.data()[i * out + o];
+      }
+    }
+  });
+  return gx;
+}
+
+nc::NdArray<double> average_pooling_forward(const nc::NdArray<double>& x,
+                                            const Conv2dParam& p) {
+  check_cols(x, image_size(p), "average_pooling(x)");
+  const size_t n = x.shape().rows;
+  const size_t out = pooled_size(p);
+  const double scale = 1.0 / (p.kernel_h * p.kernel_w);
+  nc::NdArray<double> y(static_cast<nc::uint32>(n),
+                        static_cast<nc::uint32>(out));
+  for_windows(n, p, [&](size_t i, size_t o, const std::vector<size_t>& w) {
+    const double* src = x.data() + i * image_size(p);
+    double s = 0.0;
+    for (size_t k : w) s += src[k];
+    y.data()[i * out + o] = s * scale;
+  });
+  return y;
+}
+
+nc::NdArray<double> average_pooling_grad(const nc::NdArray<double>& gy,
+                                         const Conv2dParam& p) {
+  const size_t out = pooled_size(p);
+  check_cols(gy, out, "average_pooling_grad(gy)");
+  const size_t n = gy.shape().rows;
+  const double scale = 1.0 / (p.kernel_h * p.kernel_w);
+  auto gx = nc::zeros<double>(static_cast<nc::uint32>(n),
+                              static_cast<nc::uint32>(image_size(p)));
+  for_windows(n, p, [&](size_t i, size_t o, const std::vector<size_t>& w) {
+    double* dst = gx.data() + i * image_size(p);
+    const double g = gy.data()[i * out + o] * scale;
+    for (size_t k : w) dst[k] += g;
+  });
+  return gx;
+}
+}  // namespace
+
+void Conv2dParam::validate() const {
+  if (channels == 0 || kernel_h == 0 || kernel_w == 0 || stride == 0) {
+    throw std::invalid_argument(
+        "Conv2dParam: channels, kernel and stride must be positive");
+  }
+  if (height + 2 * pad < kernel_h || width + 2 * pad < kernel_w) {
+    throw std::invalid_argument(
+        "Conv2dParam: kernel is larger than the padded image");
+  }
+}
+
+Conv2d::Conv2d(const Conv2dParam& param) : param(param) { param.validate(); }
+std::vector<NdArrPtr> Conv2d::forward(const std::vector<NdArrPtr>& xs) {
+  assert(xs.size() == 2 || xs.size() == 3);
+  const nc::NdArray<double>* b = xs.size() == 3 ? xs[2].get() : nullptr;
+  std::vector<NdArrPtr> ys = {
+      as_array(conv_forward(*xs[0], *xs[1], b, this->param))};
+  return ys;
+}
+std::vector<VarPtr> Conv2d::backward(const std::vector<VarPtr>& gy) {
+  assert(gy.size() == 1);
+  const auto& x = this->inputs_[0];
+  const auto& W = this->inputs_[1];
+  std::vector<VarPtr> gx = {
+      this->needs_input_grad(0) ? deconv2d(gy[0], W, this->param) : nullptr,
+      this->needs_input_grad(1) ? conv2d_grad_w(x, gy[0], this->param)
+                                : nullptr};
+  if (this->inputs_.size() == 3) {
+    VarPtr gb = nullptr;
+    if (this->needs_input_grad(2)) {
+      // (N, OC * OH * OW) -> (N * OC, 1) -> (N, OC) -> (1, OC)
+      const auto n = gy[0]->shape().rows;
+      const auto out_channels = W->shape().rows;
+      const auto ohw = static_cast<nc::uint32>(this->param.out_h() *
+                                               this->param.out_w());
+      auto per_map = sum(reshape(gy[0], nc::Shape(n * out_channels, ohw)),
+                         nc::Axis::COL);
+      gb = sum(reshape(per_map, nc::Shape(n, out_channels)), nc::Axis::ROW);
+      gb = reshape(gb, this->inputs_[2]->shape());
+    }
+    gx.push_back(gb);
+  }
+  return gx;
+}
+std::vector<NdArrPtr> Conv2d::jvp(const std::vector<NdArrPtr>& xs,
+                                  const std::vector<NdArrPtr>& ys,
+                                  const std::vector<NdArrPtr>& txs) {
+  const nc::NdArray<double>* tb = xs.size() == 3 ? txs[2].get() : nullptr;
+  return {as_array(conv_forward(*txs[0], *xs[1], tb, this->param) +
+                   conv_forward(*xs[0], *txs[1], nullptr, this->param))};
+}
+
+Deconv2d::Deconv2d(const Conv2dParam& param) : param(param) {
+  param.validate();
+}
+std::vector<NdArrPtr> Deconv2d::forward(const std::vector<NdArrPtr>& xs) {
+  assert(xs.size() == 2);
+  std::vector<NdArrPtr> ys = {
+      as_array(deconv_forward(*xs[0], *xs[1], this->param))};
+  return ys;
+}
+std::vector<VarPtr> Deconv2d::backward(const std::vector<VarPtr>& gy) {
+  assert(gy.size() == 1);
+  const auto& g = this->inputs_[0];
+  const auto& W = this->inputs_[1];
+  std::vector<VarPtr> gx = {
+      this->needs_input_grad(0) ? conv2d(gy[0], W, this->param) : nullptr,
+      this->needs_input_grad(1) ? conv2d_grad_w(gy[0], g, this->param)
+                                : nullptr};
+  return gx;
+}
+std::vector<NdArrPtr> Deconv2d::jvp(const std::vector<NdArrPtr>& xs,
+                                    const std::vector<NdArrPtr>& ys,
+                                    const std::vector<NdArrPtr>& txs) {
+  return {as_array(deconv_forward(*txs[0], *xs[1], this->param) +
+                   deconv_forward(*xs[0], *txs[1], this->param))};
+}
+
+Conv2dGradW::Conv2dGradW(const Conv2dParam& param) : param(param) {
+  param.validate();
+}
+std::vector<NdArrPtr> Conv2dGradW::forward(const std::vector<NdArrPtr>& xs) {
+  assert(xs.size() == 2);
+  std::vector<NdArrPtr> ys = {
+      as_array(grad_w_forward(*xs[0], *xs[1], this->param))};
+  return ys;
+}
+std::vector<VarPtr> Conv2dGradW::backward(const std::vector<VarPtr>& gy) {
+  assert(gy.size() == 1);
+  const auto& x = this->inputs_[0];
+  const auto& g = this->inputs_[1];
+  std::vector<VarPtr> gx = {
+      this->needs_input_grad(0) ? deconv2d(g, gy[0], this->param) : nullptr,
+      this->needs_input_grad(1) ? conv2d(x, gy[0], this->param) : nullptr};
+  return gx;
+}
+std::vector<NdArrPtr> Conv2dGradW::jvp(const std::vector<NdArrPtr>& xs,
+                                       const std::vector<NdArrPtr>& ys,
+                                       const std::vector<NdArrPtr>& txs) {
+  return {as_array(grad_w_forward(*txs[0], *xs[1], this->param) +
+                   grad_w_forward(*xs[0], *txs[1], this->param))};
+}
+
+MaxPooling::MaxPooling(const Conv2dParam& param) : param(param) {
+  check_pooling(param);
+}
+std::vector<NdArrPtr> MaxPooling::forward(const std::vector<NdArrPtr>& xs) {
+  assert(xs.size() == 1);
+  const auto& x = *xs[0];
+  check_cols(x, image_size(this->param), "max_pooling(x)");
+  const size_t n = x.shape().rows;
+  const size_t out = pooled_size(this->param);
+  const size_t in = image_size(this->param);
+  this->indexes = std::make_shared<std::vector<uint32_t>>(n * out);
+  auto& indexes = *this->indexes;
+  auto y = std::make_shared<nc::NdArray<double>>(n, out);
+  for_windows(n, this->param,
+              [&](size_t i, size_t o, const std::vector<size_t>& w) {
+                const double* src = x.data() + i * in;
+                // 窓には少なくとも1つ入力がある（pad < kernel）
+                size_t best = w[0];
+                for (size_t k : w) {
+                  if (src[k] > src[best]) best = k;
+                }
+                indexes[i * out + o] = static_cast<uint32_t>(best);
+                y->data()[i * out + o] = src[best];
+              });
+  return {y};
+}
+std::vector<VarPtr> MaxPooling::backward(const std::vector<VarPtr>& gy) {
+  assert(gy.size() == 1);
+  auto f = std::make_shared<MaxPoolingGrad>(this->param, this->indexes);
+  std::vector<VarPtr> gx = {(*f)(gy[0])[0]};
+  return gx;
+}
+std::vector<NdArrPtr> MaxPooling::jvp(const std::vector<NdArrPtr>& xs,
+                                      const std::vector<NdArrPtr>& ys,
+                                      const std::vector<NdArrPtr>& txs) {
+  return {as_array(gather_indexes(*txs[0], *this->indexes, this->param))};
+}
+
+MaxPoolingGrad::MaxPoolingGrad(const Conv2dParam& param,
+                               std::shared_ptr<std::vector<uint32_t>> indexes)
+    : param(param), indexes(std::move(indexes)) {}
+std::vector<NdArrPtr> MaxPoolingGrad::forward(
+    const std::vector<NdArrPtr>& xs) {
+  assert(xs.size() == 1);
+  std::vector<NdArrPtr> ys = {
+      as_array(scatter_indexes(*xs[0], *this->indexes, this->param))};
+  return ys;
+}
+std::vector<VarPtr> MaxPoolingGrad::backward(const std::vector<VarPtr>& gy) {
+  assert(gy.size() == 1);
+  auto f =
+      std::make_shared<MaxPoolingWithIndexes>(this->param, this->indexes);
+  std::vector<VarPtr> gx = {(*f)(gy[0])[0]};
+  return gx;
+}
+std::vector<NdArrPtr> MaxPoolingGrad::jvp(const std::vector<NdArrPtr>& xs,
+                                          const std::vector<NdArrPtr>& ys,
+                                          const std::vector<NdArrPtr>& txs) {
+  return this->forward(txs);
+}
+
+MaxPoolingWithIndexes::MaxPoolingWithIndexes(
+    const Conv2dParam& param, std::shared_ptr<std::vector<uint32_t>> indexes)
+    : param(param), indexes(std::move(indexes)) {}
+std::vector<NdArrPtr> MaxPoolingWithIndexes::forward(
+    const std::vector<NdArrPtr>& xs) {
+  assert(xs.size() == 1);
+  std::vector<NdArrPtr> ys = {
+      as_array(gather_indexes(*xs[0], *this->indexes, this->param))};
+  return ys;
+}
+std::vector<VarPtr> MaxPoolingWithIndexes::backward(
+    const std::vector<VarPtr>& gy) {
+  assert(gy.size() == 1);
+  auto f = std::make_shared<MaxPoolingGrad>(this->param, this->indexes);
+  std::vector<VarPtr> gx = {(*f)(gy[0])[0]};
+  return gx;
+}
+std::vector<NdArrPtr> MaxPoolingWithIndexes::jvp(
+    const std::vector<NdArrPtr>& xs, const std::vector<NdArrPtr>& ys,
+    const std::vector<NdArrPtr>& txs) {
+  return this->forward(txs);
+}
+
+AveragePooling::AveragePooling(const Conv2dParam& param) : param(param) {
+  check_pooling(param);
+}
+std::vector<NdArrPtr> AveragePooling::forward(
+    const std::vector<NdArrPtr>& xs) {
+  assert(xs.size() == 1);
+  std::vector<NdArrPtr> ys = {
+      as_array(average_pooling_forward(*xs[0], this->param))};
+  return ys;
+}
+std::vector<VarPtr> AveragePooling::backward(const std::vector<VarPtr>& gy) {
+  assert(gy.size() == 1);
+  auto f = std::make_shared<AveragePoolingGrad>(this->param);
+  std::vector<VarPtr> gx = {(*f)(gy[0])[0]};
+  return gx;
+}
+std::vector<NdArrPtr> AveragePooling::jvp(const std::vector<NdArrPtr>& xs,
+                                          const std::vector<NdArrPtr>& ys,
+                                          const std::vector<NdArrPtr>& txs) {
+  return this->forward(txs);
+}
+
+AveragePoolingGrad::AveragePoolingGrad(const Conv2dParam& param)
+    : param(param) {}
+std::vector<NdArrPtr> AveragePoolingGrad::forward(
+    const std::vector<NdArrPtr>& xs) {
+  assert(xs.size() == 1);
+  std::vector<NdArrPtr> ys = {
+      as_array(average_pooling_grad(*xs[0], this->param))};
+  return ys;
+}
+std::vector<VarPtr> AveragePoolingGrad::backward(
+    const std::vector<VarPtr>& gy) {
+  assert(gy.size() == 1);
+  std::vector<VarPtr> gx = {average_pooling(gy[0], this->param)};
+  return gx;
+}
+std::vector<NdArrPtr> AveragePoolingGrad::jvp(
+    const std::vector<NdArrPtr>& xs, const std::vector<NdArrPtr>& ys,
+    const std::vector<NdArrPtr>& txs) {
+  return this->forward(txs);
+}
+}  // namespace F
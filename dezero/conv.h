@@ -0,0 +1,176 @@
+#ifndef CONV_
+#define CONV_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "NumCpp.hpp"
+#include "core.h"
+
+// 畳み込みとプーリング
+// ndarrayは2次元なので、画像のバッチは(N, C * H * W)の行列で持つ
+// （行がサンプルで、各行はチャンネル・縦・横の順に並ぶ。出力も同じ並び）
+//
+//   F::Conv2dParam p{3, 32, 32, 3, 3};  // 3チャンネル32x32、3x3の窓
+//   p.pad = 1;
+//   auto y = F::conv2d(x, W, b, p);  // W: (OC, 3 * 3 * 3), b: (1, OC)
+//   // y: (N, OC * p.out_h() * p.out_w())
+namespace F {
+// 入力画像の形と窓（畳み込みの核・プーリングの窓）
+struct Conv2dParam {
+  size_t channels = 1;
+  size_t height = 1;
+  size_t width = 1;
+  size_t kernel_h = 1;
+  size_t kernel_w = 1;
+  size_t stride = 1;
+  size_t pad = 0;
+  // 畳み込みでim2colを一度に作るサンプル数（0なら全サンプル）
+  // im2colの行列は(C * KH * KW, tile * OH * OW)なので、ピークメモリを抑えられる
+  size_t tile = 0;
+
+  size_t out_h() const { return (height + 2 * pad - kernel_h) / stride + 1; }
+  size_t out_w() const { return (width + 2 * pad - kernel_w) / stride + 1; }
+  // 窓が入力に収まらない・strideが0ならinvalid_argument
+  void validate() const;
+};
+
+// 畳み込み: x (N, C * H * W)、W (OC, C * KH * KW)、b (1, OC)（省略可）
+// -> (N, OC * OH * OW)
+// im2colした行列とWの積で計算する。逆伝播のためにim2colの行列は保存せず作り直す
+class Conv2d : public Function {
+ public:
+  const Conv2dParam param;
+  explicit Conv2d(const Conv2dParam& param);
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
+};
+
+// 転置畳み込み（Conv2dの入力についての逆伝播）: gy (N, OC * OH * OW)、W -> (N, C * H * W)
+class Deconv2d : public Function {
+ public:
+  const Conv2dParam param;
+  explicit Deconv2d(const Conv2dParam& param);
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
+};
+
+// Conv2dの重みについての逆伝播: x、gy -> (OC, C * KH * KW)
+class Conv2dGradW : public Function {
+ public:
+  const Conv2dParam param;
+  explicit Conv2dGradW(const Conv2dParam& param);
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
+};
+
+// 最大値プーリング: (N, C * H * W) -> (N, C * OH * OW)
+// 逆伝播のために窓ではなく最大値の位置（サンプル内の番号）だけを持つ
+// パディングした位置は最大値に選ばれない
+class MaxPooling : public Function {
+ public:
+  const Conv2dParam param;
+  std::shared_ptr<std::vector<uint32_t>> indexes;
+  explicit MaxPooling(const Conv2dParam& param);
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
+};
+
+// MaxPoolingの逆伝播: gy (N, C * OH * OW)を最大値の位置に足す -> (N, C * H * W)
+class MaxPoolingGrad : public Function {
+ public:
+  const Conv2dParam param;
+  const std::shared_ptr<std::vector<uint32_t>> indexes;
+  MaxPoolingGrad(const Conv2dParam& param,
+                 std::shared_ptr<std::vector<uint32_t>> indexes);
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
+};
+
+// MaxPoolingGradの逆伝播: (N, C * H * W)から最大値の位置の値を取り出す
+class MaxPoolingWithIndexes : public Function {
+ public:
+  const Conv2dParam param;
+  const std::shared_ptr<std::vector<uint32_t>> indexes;
+  MaxPoolingWithIndexes(const Conv2dParam& param,
+                        std::shared_ptr<std::vector<uint32_t>> indexes);
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
+};
+
+// 平均値プーリング: (N, C * H * W) -> (N, C * OH * OW)
+// パディングした位置も0として数える（窓の大きさで割る）
+class AveragePooling : public Function {
+ public:
+  const Conv2dParam param;
+  explicit AveragePooling(const Conv2dParam& param);
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
+};
+
+// AveragePoolingの逆伝播: gyを窓に均等に配る
+class AveragePoolingGrad : public Function {
+ public:
+  const Conv2dParam param;
+  explicit AveragePoolingGrad(const Conv2dParam& param);
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
+};
+
+inline VarPtr conv2d(VarPtr x, VarPtr W, VarPtr b, const Conv2dParam& param) {
+  auto f = std::make_shared<Conv2d>(param);
+  return b ? (*f)(x, W, b)[0] : (*f)(x, W)[0];
+}
+
+inline VarPtr conv2d(VarPtr x, VarPtr W, const Conv2dParam& param) {
+  return conv2d(std::move(x), std::move(W), nullptr, param);
+}
+
+inline VarPtr deconv2d(VarPtr gy, VarPtr W, const Conv2dParam& param) {
+  auto f = std::make_shared<Deconv2d>(param);
+  return (*f)(gy, W)[0];
+}
+
+inline VarPtr conv2d_grad_w(VarPtr x, VarPtr gy, const Conv2dParam& param) {
+  auto f = std::make_shared<Conv2dGradW>(param);
+  return (*f)(x, gy)[0];
+}
+
+inline VarPtr max_pooling(VarPtr x, const Conv2dParam& param) {
+  auto f = std::make_shared<MaxPooling>(param);
+  return (*f)(x)[0];
+}
+
+inline VarPtr average_pooling(VarPtr x, const Conv2dParam& param) {
+  auto f = std::make_shared<AveragePooling>(param);
+  return (*f)(x)[0];
+}
+}  // namespace F
+
+#endif
@@ -1,18 +1,77 @@
 #include "core.h"
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
 #include "functions.h"
+#include "kernels.h"
 #include "utils.h"
 
-bool Config::enable_backprop = true;
+thread_local bool Config::enable_backprop = true;
+thread_local bool Config::batching = false;
+thread_local bool Config::train = true;
+
+Variable::Variable(DataPtr data, const std::string& name)
+    : data(std::move(data)), name(name){};
+
+Variable::~Variable() {
+  // 数千万ノードの鎖を再帰的に解放するとスタックが溢れるので、
+  // 自分だけが参照している関数を明示的なスタックに移して順に解放する
+  if (!creator_ptr || creator_ptr.use_count() > 1) {
+    return;
+  }
+  std::vector<FuncPtr> stack;
+  stack.push_back(std::move(creator_ptr));
+  while (!stack.empty()) {
+    FuncPtr f = std::move(stack.back());
+    stack.pop_back();
+    if (f.use_count() > 1) {
+      continue;
+    }
+    for (auto& input : f->inputs_) {
+      // この関数が入力の最後の参照なら、入力の生成元も引き取る
+      // （多出力の関数は兄弟の出力も参照しているので参照数によらず積み、
+      // 取り出したときに他の参照が残っていれば手放すだけにする）
+      if (input.use_count() == 1 && input->creator_ptr) {
+        stack.push_back(std::move(input->creator_ptr));
+      }
+    }
+    // 入力はcreator_ptrを持たない状態で解放される
+    f->inputs_.clear();
+  }
+}
 
-Variable::Variable(const NdArrPtr& data, const std::string& name)
-    : data(data), name(name){};
+namespace {
+// 勾配gをxの平坦なバッファ上の勾配に足し、x.gradをそのビューにする
+// （gradがビュー以外を指していれば、その値をビューに写してから足す）
+void add_to_grad_view(Variable& x, const nc::NdArray<double>& g) {
+  auto& view = *x.grad_view;
+  if (g.shape() != view.shape()) {
+    throw std::invalid_argument("gradient shape does not match grad_view");
+  }
+  if (!x.grad || x.grad->data->data() != view.data()) {
+    if (x.grad) {
+      std::copy(x.grad->data->begin(), x.grad->data->end(), view.begin());
+    } else {
+      std::fill(view.begin(), view.end(), 0.0);
+    }
+    x.grad = as_variable(x.grad_view);
+  }
+  kernels::accumulate(view.data(), g.data(), g.size());
+}
+}  // namespace
 
 void Variable::set_creator(FuncPtr creator) {
   creator_ptr = creator;
   this->generation = creator->generation + 1;
 }
 void Variable::backward(const bool retain_grad, const bool create_graph) {
+  // 非同期実行の出力なら、ストリームに先に積まれた順伝播が全て終わるまで待つ
+  // （各関数のbackwardは順伝播で保存した値を使う）
+  this->data.get();
   if (!this->grad) {
     // 勾配の初期値を設定
     this->grad = as_variable(as_array(nc::ones_like<double>(*this->data)));
@@ -21,119 +80,351 @@ void Variable::backward(const bool retain_grad, const bool create_graph) {
   // 処理済み関数
   std::unordered_set<FuncPtr> seen_set;
 
-  auto add_func = [&funcs, &seen_set](const FuncPtr& f) {
-    // TODO: 優先度キーでの実装が効率的
-    if (!seen_set.count(f)) {
+  // generationが最大の関数を先頭に置くヒープ
+  // （追加のたびに全体をソートするとグラフの大きさの2乗以上かかる）
+  const auto by_generation = [](const FuncPtr& lhs, const FuncPtr& rhs) {
+    return lhs->generation < rhs->generation;
+  };
+  auto add_func = [&funcs, &seen_set, &by_generation](const FuncPtr& f) {
+    if (seen_set.insert(f).second) {
       funcs.push_back(f);
-      seen_set.insert(f);
-      // generation昇順にソート
-      std::sort(funcs.begin(), funcs.end(),
-                [](const FuncPtr& lhs, const FuncPtr& rhs) {
-                  return lhs->generation < rhs->generation;
-                });
+      std::push_heap(funcs.begin(), funcs.end(), by_generation);
     }
   };
 
   add_func(this->creator_ptr);
 
+  // with_backprop_cfgが生きている間（このスコープを抜けるまで）Config::enable_backprop
+  // = create_graphとなる（Pythonで言うところのwith構文の代替）
+  UsingConfig with_backprop_cfg("enable_backprop", create_graph);
+
   while (!funcs.empty()) {
+    std::pop_heap(funcs.begin(), funcs.end(), by_generation);
     FuncPtr f = funcs.back();
     funcs.pop_back();
     std::vector<VarPtr> gys;
     for (auto& output : f->outputs_) {
-      gys.push_back(output.lock()->grad);
+      // 複数の出力のうち使われずに解放されたものの勾配はnullptr
+      auto y = output.lock();
+      gys.push_back(y ? y->grad : nullptr);
     }
-    {
-      // with_backprop_cfgが生きている間（このスコープを抜けるまで）Config::enable_backprop
-      // = create_graphとなる（Pythonで言うところのwith構文の代替）
-      UsingConfig with_backprop_cfg("enable_backprop", create_graph);
-
-      const auto& gxs = f->backward(gys);
-
-      // 入力データと勾配のサイズは等しい
-      assert(gxs.size() == f->inputs_.size());
-
-      for (int i = 0; i < f->inputs_.size(); i++) {
-        if (!f->inputs_[i]->grad) {
-          f->inputs_[i]->grad = gxs[i];
-        } else {
-          // 付録A参照
-          // 新しくインスタンスを作成（コピー）する必要がある。インプレース演算（*f->inputs_[i]->grad
-          // += *gxs[i]）にしてしまうと
-          // 例えばy.gradとx.gradが同じインスタンスを参照してしまう。
-          f->inputs_[i]->grad = as_variable(f->inputs_[i]->grad + gxs[i]);
-        }
-
-        if (f->inputs_[i]->creator_ptr) {
-          // １つ前の関数をリストに追加
-          add_func(f->inputs_[i]->creator_ptr);
-        }
+    const auto& gxs = f->backward(gys);
+
+    // 入力データと勾配のサイズは等しい
+    assert(gxs.size() == f->inputs_.size());
+
+    for (int i = 0; i < f->inputs_.size(); i++) {
+      if (!gxs[i]) {
+        continue;
+      }
+      if (f->inputs_[i]->grad_view && !create_graph) {
+        add_to_grad_view(*f->inputs_[i], *gxs[i]->data);
+      } else if (!f->inputs_[i]->grad) {
+        f->inputs_[i]->grad = gxs[i];
+      } else {
+        // 付録A参照
+        // 新しくインスタンスを作成（コピー）する必要がある。インプレース演算（*f->inputs_[i]->grad
+        // += *gxs[i]）にしてしまうと
+        // 例えばy.gradとx.gradが同じインスタンスを参照してしまう。
+        f->inputs_[i]->grad = as_variable(f->inputs_[i]->grad + gxs[i]);
+      }
+      if (f->inputs_[i]->grad_hook) {
+        f->inputs_[i]->grad_hook(f->inputs_[i]);
       }
 
-      if (!retain_grad) {
-        for (auto& output : f->outputs_) {
-          output.lock()->grad = nullptr;
-        }
+      if (f->inputs_[i]->creator_ptr) {
+        // １つ前の関数をリストに追加
+        add_func(f->inputs_[i]->creator_ptr);
+      }
+    }
+
+    if (!retain_grad) {
+      for (auto& output : f->outputs_) {
+        if (auto y = output.lock()) y->grad = nullptr;
+      }
+    }
+  }
+}
+void Variable::cleargrad() {
+  grad = nullptr;
+  sparse_grad = nullptr;
+}
+void Variable::unchain() {
+  // 最後の参照なら関数はここで解放される（入力の鎖の解放は~Variableが再帰せずに行う）
+  creator_ptr.reset();
+}
+void Variable::unchain_backward() {
+  if (!creator_ptr) {
+    return;
+  }
+  std::vector<FuncPtr> stack = {creator_ptr};
+  while (!stack.empty()) {
+    // 取り出した関数は、入力の生成元を切った後でこのループの終わりに解放される
+    FuncPtr f = std::move(stack.back());
+    stack.pop_back();
+    for (auto& input : f->inputs_) {
+      if (input->creator_ptr) {
+        stack.push_back(input->creator_ptr);
+        input->unchain();
       }
     }
   }
 }
-void Variable::cleargrad() { grad = nullptr; }
 VarPtr Variable::reshape(const nc::Shape& shape) {
   return F::reshape(shared_from_this(), shape);
 };
 VarPtr Variable::transpose() { return F::transpose(shared_from_this()); };
 VarPtr Variable::T() { return F::transpose(shared_from_this()); };
-nc::Shape Variable::shape() { return this->data->shape(); };
-nc::uint32 Variable::size() { return this->data->size(); }
+nc::Shape Variable::shape() { return this->data.shape(); };
+nc::uint32 Variable::size() { return this->data.shape().size(); }
 VarPtr Variable::sum(nc::Axis axis) {
   return F::sum(shared_from_this(), axis);
 };
 
+std::vector<VarPtr> grad(const std::vector<VarPtr>& outputs,
+                         const std::vector<VarPtr>& inputs,
+                         const bool create_graph) {
+  // outputsから辿れる関数を集める（値はinputsに到達するかどうか）
+  std::vector<Function*> funcs;
+  std::unordered_map<const Function*, bool> reaching;
+  for (const auto& y : outputs) {
+    if (y->creator_ptr && reaching.emplace(y->creator_ptr.get(), false).second) {
+      funcs.push_back(y->creator_ptr.get());
+    }
+  }
+  for (size_t i = 0; i < funcs.size(); i++) {
+    for (const auto& x : funcs[i]->inputs_) {
+      if (x->creator_ptr &&
+          reaching.emplace(x->creator_ptr.get(), false).second) {
+        funcs.push_back(x->creator_ptr.get());
+      }
+    }
+  }
+  // 入力の生成関数は必ず世代が小さいので、世代昇順に見ればinputsへの到達可否が決まる
+  std::sort(funcs.begin(), funcs.end(),
+            [](const Function* lhs, const Function* rhs) {
+              return lhs->generation < rhs->generation;
+            });
+  auto reaches = [&inputs, &reaching](const VarPtr& x) {
+    // inputsは少数なので線形探索
+    for (const auto& target : inputs) {
+      if (target == x) return true;
+    }
+    return x->creator_ptr && reaching[x->creator_ptr.get()];
+  };
+  for (const auto& f : funcs) {
+    for (const auto& x : f->inputs_) {
+      if (reaches(x)) {
+        reaching[f] = true;
+        break;
+      }
+    }
+  }
+
+  std::unordered_map<const Variable*, VarPtr> grads;
+  grads.reserve(funcs.size() * 2);
+  for (const auto& y : outputs) {
+    auto& gy = grads[y.get()];
+    auto ones = as_variable(as_array(nc::ones_like<double>(*y->data)));
+    gy = gy ? as_variable(gy + ones) : ones;
+  }
+
+  UsingConfig with_backprop_cfg("enable_backprop", create_graph);
+  for (auto it = funcs.rbegin(); it != funcs.rend(); ++it) {
+    Function* f = *it;
+    if (!reaching[f]) {
+      continue;
+    }
+    std::vector<VarPtr> gys;
+    for (auto& output : f->outputs_) {
+      auto y = output.lock();
+      auto found = y ? grads.find(y.get()) : grads.end();
+      gys.push_back(found != grads.end() ? found->second : nullptr);
+    }
+    // inputsに繋がらない入力の勾配は計算しなくてよい
+    f->needs_input_grad_.resize(f->inputs_.size());
+    for (int i = 0; i < f->inputs_.size(); i++) {
+      f->needs_input_grad_[i] = reaches(f->inputs_[i]);
+    }
+    const auto gxs = f->backward(gys);
+    f->needs_input_grad_.clear();
+    assert(gxs.size() == f->inputs_.size());
+
+    for (int i = 0; i < f->inputs_.size(); i++) {
+      if (!gxs[i] || !reaches(f->inputs_[i])) {
+        continue;
+      }
+      auto& gx = grads[f->inputs_[i].get()];
+      gx = gx ? as_variable(gx + gxs[i]) : gxs[i];
+    }
+  }
+
+  std::vector<VarPtr> gxs;
+  for (const auto& x : inputs) {
+    auto found = grads.find(x.get());
+    // 出力に影響しない入力の勾配は0
+    gxs.push_back(found != grads.end()
+                      ? found->second
+                      : as_variable(as_array(nc::zeros_like<double>(*x->data))));
+  }
+  return gxs;
+}
+
+std::pair<VarPtr, NdArrPtr> jvp(
+    const std::function<VarPtr(const VarPtr&)>& f, const VarPtr& x,
+    const NdArrPtr& v) {
+  assert(x->shape() == v->shape());
+  // 接ベクトルは値と一緒に流れるので逆伝播用のつながりは不要
+  UsingConfig with_backprop_cfg("enable_backprop", false);
+  const auto old_tangent = x->tangent;
+  x->tangent = v;
+  auto y = f(x);
+  x->tangent = old_tangent;
+  auto ty = y->tangent ? y->tangent
+                       : as_array(nc::zeros_like<double>(*y->data));
+  y->tangent = nullptr;
+  return {y, ty};
+}
+
+VarPtr hvp(const std::function<VarPtr(const VarPtr&)>& f, const VarPtr& x,
+           const VarPtr& v) {
+  // d/dx (∇f(x)・v) = H v
+  const auto y = f(x);
+  const auto gx = grad(y, x, true);
+  const auto gv = F::sum(gx * v);
+  return grad(gv, x);
+}
+
+namespace {
+// release_asyncで渡されたグラフを解放するスレッド
+class Releaser {
+ public:
+  Releaser() : worker_([this]() { run(); }) {}
+  ~Releaser() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    worker_.join();
+  }
+
+  void push(VarPtr&& v) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.push_back(std::move(v));
+    }
+    cv_.notify_all();
+  }
+
+  void wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this]() { return queue_.empty() && !busy_; });
+  }
+
+ private:
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return;
+      }
+      VarPtr v = std::move(queue_.front());
+      queue_.pop_front();
+      busy_ = true;
+      lock.unlock();
+      v.reset();
+      lock.lock();
+      busy_ = false;
+      done_cv_.notify_all();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::condition_variable done_cv_;
+  std::deque<VarPtr> queue_;
+  bool busy_ = false;
+  bool stop_ = false;
+  std::thread worker_;
+};
+
+Releaser& releaser() {
+  static Releaser instance;
+  return instance;
+}
+}  // namespace
+
+void release_async(VarPtr&& v) {
+  if (!v) {
+    return;
+  }
+  // 他にも参照があれば解放は起きないので、その場で手放す
+  if (v.use_count() > 1) {
+    v.reset();
+    return;
+  }
+  releaser().push(std::move(v));
+}
+
+void wait_released() { releaser().wait(); }
+
 std::vector<NdArrPtr> Add::forward(const std::vector<NdArrPtr>& xs) {
   assert(xs.size() == 2);
-  this->x0_shape = xs[0]->shape();
-  this->x1_shape = xs[1]->shape();
-  std::vector<NdArrPtr> ys = {as_array((*xs[0]) + (*xs[1]))};
+  std::vector<NdArrPtr> ys = {as_array(kernels::binary(*xs[0], *xs[1], std::plus<double>()))};
   return ys;
 }
 std::vector<VarPtr> Add::backward(const std::vector<VarPtr>& gy) {
-  auto gx0 = gy[0];
-  auto gx1 = gy[0];
-  if (this->x0_shape != this->x1_shape) {
-    gx0 = F::sum_to(gx0, this->x0_shape);
-    gx1 = F::sum_to(gx1, this->x1_shape);
+  // 不要な入力の勾配は計算しない（nullptrを返す）
+  VarPtr gx0 = this->needs_input_grad(0) ? gy[0] : nullptr;
+  VarPtr gx1 = this->needs_input_grad(1) ? gy[0] : nullptr;
+  // 形は入力から取る（遅延実行ではforwardが呼ばれない）
+  const auto x0_shape = this->inputs_[0]->shape();
+  const auto x1_shape = this->inputs_[1]->shape();
+  if (x0_shape != x1_shape) {
+    if (gx0) gx0 = F::sum_to(gx0, x0_shape);
+    if (gx1) gx1 = F::sum_to(gx1, x1_shape);
   }
   std::vector<VarPtr> gx = {gx0, gx1};
   return gx;
 }
+std::vector<NdArrPtr> Add::jvp(const std::vector<NdArrPtr>& xs,
+                               const std::vector<NdArrPtr>& ys,
+                               const std::vector<NdArrPtr>& txs) {
+  return {as_array(*txs[0] + *txs[1])};
+}
 
 std::vector<NdArrPtr> Mul::forward(const std::vector<NdArrPtr>& xs) {
   assert(xs.size() == 2);
-  this->x0_shape = xs[0]->shape();
-  this->x1_shape = xs[1]->shape();
-  std::vector<NdArrPtr> ys = {as_array((*xs[0]) * (*xs[1]))};
+  std::vector<NdArrPtr> ys = {as_array(
+      kernels::binary(*xs[0], *xs[1], std::multiplies<double>()))};
   return ys;
 }
 std::vector<VarPtr> Mul::backward(const std::vector<VarPtr>& gy) {
   assert(gy.size() == 1);
   const auto& x0 = this->inputs_[0]->data;
   const auto& x1 = this->inputs_[1]->data;
-  auto gx0 = this->inputs_[1] * gy[0];
-  auto gx1 = this->inputs_[0] * gy[0];
-  if (this->x0_shape != this->x1_shape) {
-    gx0 = F::sum_to(gx0, this->x0_shape);
-    gx1 = F::sum_to(gx1, this->x1_shape);
+  VarPtr gx0 = this->needs_input_grad(0) ? this->inputs_[1] * gy[0] : nullptr;
+  VarPtr gx1 = this->needs_input_grad(1) ? this->inputs_[0] * gy[0] : nullptr;
+  const auto x0_shape = this->inputs_[0]->shape();
+  const auto x1_shape = this->inputs_[1]->shape();
+  if (x0_shape != x1_shape) {
+    if (gx0) gx0 = F::sum_to(gx0, x0_shape);
+    if (gx1) gx1 = F::sum_to(gx1, x1_shape);
   }
   std::vector<VarPtr> gx = {gx0, gx1};
   return gx;
 }
+std::vector<NdArrPtr> Mul::jvp(const std::vector<NdArrPtr>& xs,
+                               const std::vector<NdArrPtr>& ys,
+                               const std::vector<NdArrPtr>& txs) {
+  return {as_array(*txs[0] * *xs[1] + *xs[0] * *txs[1])};
+}
 
 std::vector<NdArrPtr> Neg::forward(const std::vector<NdArrPtr>& xs) {
   assert(xs.size() == 1);
-  this->x0_shape = xs[0]->shape();
-  this->x1_shape = xs[1]->shape();
-  std::vector<NdArrPtr> ys = {as_array(-*xs[0])};
+  std::vector<NdArrPtr> ys = {as_array(kernels::unary(*xs[0], std::negate<double>()))};
   return ys;
 }
 std::vector<VarPtr> Neg::backward(const std::vector<VarPtr>& gy) {
@@ -141,32 +432,41 @@ std::vector<VarPtr> Neg::backward(const std::vector<VarPtr>& gy) {
   std::vector<VarPtr> gx = {-gy[0]};
   return gx;
 }
+std::vector<NdArrPtr> Neg::jvp(const std::vector<NdArrPtr>& xs,
+                               const std::vector<NdArrPtr>& ys,
+                               const std::vector<NdArrPtr>& txs) {
+  return {as_array(-*txs[0])};
+}
 
 std::vector<NdArrPtr> Sub::forward(const std::vector<NdArrPtr>& xs) {
   assert(xs.size() == 2);
-  this->x0_shape = xs[0]->shape();
-  this->x1_shape = xs[1]->shape();
-  auto res = as_array(*xs[0] - *xs[1]);
+  auto res = as_array(kernels::binary(*xs[0], *xs[1], std::minus<double>()));
   std::vector<NdArrPtr> ys = {res};
   return ys;
 }
 std::vector<VarPtr> Sub::backward(const std::vector<VarPtr>& gy) {
   assert(gy.size() == 1);
-  auto gx0 = gy[0];
-  auto gx1 = -gy[0];
-  if (this->x0_shape != this->x1_shape) {
-    gx0 = F::sum_to(gx0, this->x0_shape);
-    gx1 = F::sum_to(gx1, this->x1_shape);
+  VarPtr gx0 = this->needs_input_grad(0) ? gy[0] : nullptr;
+  VarPtr gx1 = this->needs_input_grad(1) ? -gy[0] : nullptr;
+  const auto x0_shape = this->inputs_[0]->shape();
+  const auto x1_shape = this->inputs_[1]->shape();
+  if (x0_shape != x1_shape) {
+    if (gx0) gx0 = F::sum_to(gx0, x0_shape);
+    if (gx1) gx1 = F::sum_to(gx1, x1_shape);
   }
   std::vector<VarPtr> gx = {gx0, gx1};
   return gx;
 }
+std::vector<NdArrPtr> Sub::jvp(const std::vector<NdArrPtr>& xs,
+                               const std::vector<NdArrPtr>& ys,
+                               const std::vector<NdArrPtr>& txs) {
+  return {as_array(*txs[0] - *txs[1])};
+}
 
 std::vector<NdArrPtr> Div::forward(const std::vector<NdArrPtr>& xs) {
   assert(xs.size() == 2);
-  this->x0_shape = xs[0]->shape();
-  this->x1_shape = xs[1]->shape();
-  auto res = as_array(*xs[0] / *xs[1]);
+  auto res =
+      as_array(kernels::binary(*xs[0], *xs[1], std::divides<double>()));
   std::vector<NdArrPtr> ys = {res};
   return ys;
 }
@@ -174,25 +474,135 @@ std::vector<VarPtr> Div::backward(const std::vector<VarPtr>& gy) {
   assert(gy.size() == 1);
   const auto& x0 = this->inputs_[0]->data;
   const auto& x1 = this->inputs_[1]->data;
-  auto gx0 = gy[0] / this->inputs_[1];
-  auto gx1 =
-      gy[0] * ((this->inputs_[0]) / (this->inputs_[1]) * (this->inputs_[1]));
-  if (this->x0_shape != this->x1_shape) {
-    gx0 = F::sum_to(gx0, this->x0_shape);
-    gx1 = F::sum_to(gx1, this->x1_shape);
+  VarPtr gx0 = this->needs_input_grad(0) ? gy[0] / this->inputs_[1] : nullptr;
+  VarPtr gx1 = this->needs_input_grad(1)
+                   ? gy[0] * (-this->inputs_[0] /
+                              (this->inputs_[1] * this->inputs_[1]))
+                   : nullptr;
+  const auto x0_shape = this->inputs_[0]->shape();
+  const auto x1_shape = this->inputs_[1]->shape();
+  if (x0_shape != x1_shape) {
+    if (gx0) gx0 = F::sum_to(gx0, x0_shape);
+    if (gx1) gx1 = F::sum_to(gx1, x1_shape);
   }
   std::vector<VarPtr> gx = {gx0, gx1};
   return gx;
 }
+std::vector<NdArrPtr> Div::jvp(const std::vector<NdArrPtr>& xs,
+                               const std::vector<NdArrPtr>& ys,
+                               const std::vector<NdArrPtr>& txs) {
+  return {as_array(*txs[0] / *xs[1] -
+                   *xs[0] * *txs[1] / (*xs[1] * *xs[1]))};
+}
+
+std::vector<NdArrPtr> AddScalar::forward(const std::vector<NdArrPtr>& xs) {
+  assert(xs.size() == 1);
+  const double c = this->c;
+  return {as_array(kernels::unary(*xs[0], [c](double x) { return x + c; }))};
+}
+std::vector<VarPtr> AddScalar::backward(const std::vector<VarPtr>& gy) {
+  assert(gy.size() == 1);
+  return {gy[0]};
+}
+std::vector<NdArrPtr> AddScalar::jvp(const std::vector<NdArrPtr>& xs,
+                                     const std::vector<NdArrPtr>& ys,
+                                     const std::vector<NdArrPtr>& txs) {
+  return {txs[0]};
+}
+
+std::vector<NdArrPtr> SubScalar::forward(const std::vector<NdArrPtr>& xs) {
+  assert(xs.size() == 1);
+  const double c = this->c;
+  return {as_array(kernels::unary(*xs[0], [c](double x) { return x - c; }))};
+}
+std::vector<VarPtr> SubScalar::backward(const std::vector<VarPtr>& gy) {
+  assert(gy.size() == 1);
+  return {gy[0]};
+}
+std::vector<NdArrPtr> SubScalar::jvp(const std::vector<NdArrPtr>& xs,
+                                     const std::vector<NdArrPtr>& ys,
+                                     const std::vector<NdArrPtr>& txs) {
+  return {txs[0]};
+}
+
+std::vector<NdArrPtr> RSubScalar::forward(const std::vector<NdArrPtr>& xs) {
+  assert(xs.size() == 1);
+  const double c = this->c;
+  return {as_array(kernels::unary(*xs[0], [c](double x) { return c - x; }))};
+}
+std::vector<VarPtr> RSubScalar::backward(const std::vector<VarPtr>& gy) {
+  assert(gy.size() == 1);
+  return {-gy[0]};
+}
+std::vector<NdArrPtr> RSubScalar::jvp(const std::vector<NdArrPtr>& xs,
+                                      const std::vector<NdArrPtr>& ys,
+                                      const std::vector<NdArrPtr>& txs) {
+  return {as_array(-*txs[0])};
+}
+
+std::vector<NdArrPtr> MulScalar::forward(const std::vector<NdArrPtr>& xs) {
+  assert(xs.size() == 1);
+  const double c = this->c;
+  return {as_array(kernels::unary(*xs[0], [c](double x) { return x * c; }))};
+}
+std::vector<VarPtr> MulScalar::backward(const std::vector<VarPtr>& gy) {
+  assert(gy.size() == 1);
+  return {mul_scalar(gy[0], this->c)};
+}
+std::vector<NdArrPtr> MulScalar::jvp(const std::vector<NdArrPtr>& xs,
+                                     const std::vector<NdArrPtr>& ys,
+                                     const std::vector<NdArrPtr>& txs) {
+  return {as_array(*txs[0] * this->c)};
+}
+
+std::vector<NdArrPtr> DivScalar::forward(const std::vector<NdArrPtr>& xs) {
+  assert(xs.size() == 1);
+  const double c = this->c;
+  return {as_array(kernels::unary(*xs[0], [c](double x) { return x / c; }))};
+}
+std::vector<VarPtr> DivScalar::backward(const std::vector<VarPtr>& gy) {
+  assert(gy.size() == 1);
+  return {div_scalar(gy[0], this->c)};
+}
+std::vector<NdArrPtr> DivScalar::jvp(const std::vector<NdArrPtr>& xs,
+                                     const std::vector<NdArrPtr>& ys,
+                                     const std::vector<NdArrPtr>& txs) {
+  return {as_array(*txs[0] / this->c)};
+}
+
+std::vector<NdArrPtr> RDivScalar::forward(const std::vector<NdArrPtr>& xs) {
+  assert(xs.size() == 1);
+  const double c = this->c;
+  return {as_array(kernels::unary(*xs[0], [c](double x) { return c / x; }))};
+}
+std::vector<VarPtr> RDivScalar::backward(const std::vector<VarPtr>& gy) {
+  assert(gy.size() == 1);
+  // d(c / x)/dx = -c / x^2
+  const auto& x = this->inputs_[0];
+  return {gy[0] * rdiv_scalar(x * x, -this->c)};
+}
+std::vector<NdArrPtr> RDivScalar::jvp(const std::vector<NdArrPtr>& xs,
+                                      const std::vector<NdArrPtr>& ys,
+                                      const std::vector<NdArrPtr>& txs) {
+  return {as_array(-this->c * *txs[0] / (*xs[0] * *xs[0]))};
+}
 
 Pow::Pow(int c) : c(c) {}
 std::vector<NdArrPtr> Pow::forward(const std::vector<NdArrPtr>& xs) {
   assert(xs.size() == 1);
-  return {as_array(nc::power(*xs[0], this->c))};
+  const int c = this->c;
+  return {as_array(
+      kernels::unary(*xs[0], [c](double x) { return kernels::ipow(x, c); }))};
 }
 std::vector<VarPtr> Pow::backward(const std::vector<VarPtr>& gy) {
   assert(gy.size() == 1);
-  std::vector<VarPtr> gx = {static_cast<double>(this->c) *
-                            pow(this->inputs_[0], this->c - 1) * (gy[0])};
+  std::vector<VarPtr> gx = {
+      mul_scalar(pow(this->inputs_[0], this->c - 1), this->c) * gy[0]};
   return gx;
+}
+std::vector<NdArrPtr> Pow::jvp(const std::vector<NdArrPtr>& xs,
+                               const std::vector<NdArrPtr>& ys,
+                               const std::vector<NdArrPtr>& txs) {
+  return {as_array(static_cast<double>(this->c) *
+                   nc::power(*xs[0], this->c - 1) * *txs[0])};
 }
\ No newline at end of file
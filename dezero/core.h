@@ -2,15 +2,22 @@
 #define CORE_
 
 #include <cassert>
+#include <chrono>
 #include <cmath>
+#include <cstdint>
 #include <exception>
+#include <functional>
+#include <future>
 #include <iostream>
 #include <memory>
+#include <stdexcept>
 #include <type_traits>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include "NumCpp.hpp"
+#include "sparse.h"
 
 class Function;
 class Variable;
@@ -20,39 +27,146 @@ using VarPtr = std::shared_ptr<Variable>;
 using VarPtrW = std::weak_ptr<Variable>;
 using NdArrPtr = std::shared_ptr<nc::NdArray<double>>;
 
+// expr.hの式テンプレートのノードの基底
+// 下の演算子テンプレートがノードを定数として受け取らないよう区別に使う
+struct LazyExpr {};
+template <typename T>
+using NotLazyExpr =
+    std::enable_if_t<!std::is_base_of<LazyExpr, std::decay_t<T>>::value, int>;
+
+namespace lazy {
+struct Node;
+}  // namespace lazy
+
+// Variable::dataの型
+// 通常はndarrayのshared_ptrと同じように振る舞うが、非同期実行（stream.h）で
+// 作られた出力はまだ計算されていない値のfutureを持ち、最初に参照したときに完了を待つ
+// 遅延実行（lazy.h）の出力は記号的な計算グラフのノードも持ち、参照されたときに
+// まとめて評価される
+class DataPtr {
+ public:
+  DataPtr() = default;
+  DataPtr(std::nullptr_t) {}
+  DataPtr(NdArrPtr ptr) : ptr_(std::move(ptr)) {}
+  explicit DataPtr(std::shared_future<NdArrPtr> future)
+      : future_(std::move(future)) {}
+  DataPtr(std::shared_future<NdArrPtr> future,
+          std::shared_ptr<lazy::Node> node, const nc::Shape& shape)
+      : future_(std::move(future)), node_(std::move(node)), shape_(shape) {}
+
+  // 値を返す（計算中なら待つ。計算中に投げられた例外はここで投げ直す）
+  const NdArrPtr& get() const { return future_.valid() ? future_.get() : ptr_; }
+  // 待たずに値を取り出せるか
+  bool ready() const {
+    return !future_.valid() || future_.wait_for(std::chrono::seconds(0)) ==
+                                   std::future_status::ready;
+  }
+  // 遅延実行のノードは値を評価せずに形がわかる
+  nc::Shape shape() const { return node_ ? shape_ : get()->shape(); }
+  const std::shared_ptr<lazy::Node>& node() const { return node_; }
+
+  operator const NdArrPtr&() const { return get(); }
+  nc::NdArray<double>& operator*() const { return *get(); }
+  nc::NdArray<double>* operator->() const { return get().get(); }
+  // 計算中の値は待たずに有効とみなす
+  explicit operator bool() const {
+    return future_.valid() || static_cast<bool>(ptr_);
+  }
+  friend bool operator==(const DataPtr& p, std::nullptr_t) { return !p; }
+  friend bool operator!=(const DataPtr& p, std::nullptr_t) {
+    return static_cast<bool>(p);
+  }
+
+ private:
+  NdArrPtr ptr_;
+  std::shared_future<NdArrPtr> future_;
+  std::shared_ptr<lazy::Node> node_;
+  nc::Shape shape_;
+};
+
+namespace tape {
+class Tape;
+// 記録中のテープ（なければnullptr）
+Tape* active();
+// Function::operator()から呼ばれ、関数と入出力をテープに追加する
+void record(Tape* tape, FuncPtr f, const std::vector<VarPtr>& outputs);
+}  // namespace tape
+
+namespace stream {
+class Stream;
+// 非同期実行が有効なストリーム（なければnullptr）
+Stream* active();
+// Function::operator()から呼ばれ、fの順伝播をストリームに積んで
+// 値が未確定の出力を返す
+std::vector<VarPtr> launch(Stream* s, FuncPtr f, std::vector<DataPtr> xs);
+}  // namespace stream
+
+namespace lazy {
+// 遅延実行が有効か
+bool active();
+// Function::operator()から呼ばれ、fが要素ごとの演算なら記号的なノードだけを作って
+// 値が未評価の出力を返す（対応しない関数なら空を返し、通常どおり実行される）
+std::vector<VarPtr> trace(const Function& f, const std::vector<DataPtr>& xs);
+}  // namespace lazy
+
+// 設定はスレッドごとに持つ（別々のスレッドで同時に計算グラフを作れるように）
 class Config {
  public:
-  static bool enable_backprop;
+  static thread_local bool enable_backprop;
+  // vmap用: 1サンプル分の関数をバッチ（行方向）に拡張して評価する
+  static thread_local bool batching;
+  // 学習中か（falseならF::dropoutなどは何もしない）
+  static thread_local bool train;
 };
 
 // RAIIパターン (Resource Acquisition Is Initialization)
 // https://qiita.com/wx257osn2/items/e2e3bcbfdd8bd02872aa
 class UsingConfig {
  public:
-  UsingConfig(const std::string& name, bool value)
-      : name_(name), old_value_(Config::enable_backprop) {
-    if (name == "enable_backprop") {
-      Config::enable_backprop = value;
+  UsingConfig(const std::string& name, bool value) : flag_(find_flag(name)) {
+    // 名前の比較は構築時の1回だけ
+    if (flag_) {
+      old_value_ = *flag_;
+      *flag_ = value;
     }
   }
 
   ~UsingConfig() {
-    if (name_ == "enable_backprop") {
-      Config::enable_backprop = old_value_;
+    if (flag_) {
+      *flag_ = old_value_;
     }
   }
 
  private:
-  std::string name_;
-  bool old_value_;
+  static bool* find_flag(const std::string& name) {
+    if (name == "enable_backprop") {
+      return &Config::enable_backprop;
+    }
+    if (name == "batching") {
+      return &Config::batching;
+    }
+    if (name == "train") {
+      return &Config::train;
+    }
+    return nullptr;
+  }
+
+  bool* flag_;
+  bool old_value_ = false;
 };
 
 inline UsingConfig no_grad() { return UsingConfig("enable_backprop", false); }
+inline UsingConfig test_mode() { return UsingConfig("train", false); }
 
 inline NdArrPtr as_array(const NdArrPtr& obj) { return obj; }
+inline NdArrPtr as_array(const DataPtr& obj) { return obj.get(); }
 inline NdArrPtr as_array(const nc::NdArray<double>& obj) {
   return std::make_shared<nc::NdArray<double>>(obj);
 }
+// 一時オブジェクトはコピーせずにムーブする
+inline NdArrPtr as_array(nc::NdArray<double>&& obj) {
+  return std::make_shared<nc::NdArray<double>>(std::move(obj));
+}
 inline NdArrPtr as_array(double obj) {
   nc::NdArray<double> data({obj});
   return std::make_shared<nc::NdArray<double>>(data);
@@ -73,6 +187,10 @@ inline VarPtr as_variable(const VarPtr& obj) { return obj; }
 inline VarPtr as_variable(const NdArrPtr& obj) {
   return std::make_shared<Variable>(obj);
 }
+// 計算中の値は待たずにそのまま共有する
+inline VarPtr as_variable(const DataPtr& obj) {
+  return std::make_shared<Variable>(obj);
+}
 template <typename T>
 inline VarPtr as_variable(const T&) {
   throw std::invalid_argument("Unsupported type passed to as_variable");
@@ -80,14 +198,37 @@ inline VarPtr as_variable(const T&) {
 
 class Variable : public std::enable_shared_from_this<Variable> {
  public:
-  NdArrPtr data;
+  DataPtr data;
   std::string name;
   VarPtr grad;
+  // 一部の行にだけ勾配がある場合の勾配（F::sparse_matmulでsparse_grad指定時）
+  // gradとは別に足され、cleargradで消える
+  std::shared_ptr<sparse::RowSparse> sparse_grad;
+  // flat::FlatParametersの平坦な勾配バッファ上のこの変数の部分（なければnullptr）
+  // 設定されていれば、計算グラフを作らない逆伝播は勾配を新しく確保せずここに足し、
+  // gradはこのビューを指す
+  NdArrPtr grad_view;
+  // 前進モード自動微分の接ベクトル（jvp中のみ設定される）
+  NdArrPtr tangent;
+  // tape::Tapeに記録されたときのテープの番号と変数の番号
+  uint64_t tape_id = 0;
+  int tape_slot = -1;
   FuncPtr creator_ptr;
-  explicit Variable(const NdArrPtr& data, const std::string& name = "");
+  // Variable::backwardでこの変数のgradに勾配が足されるたびに呼ばれる
+  // （data_parallelが勾配の確定した層から集約を始めるのに使う）
+  std::function<void(const VarPtr&)> grad_hook;
+  explicit Variable(DataPtr data, const std::string& name = "");
+  // creator_ptr -> inputs_ -> creator_ptrの鎖を再帰せずに解放する
+  ~Variable();
   void set_creator(FuncPtr creator);
   void backward(const bool retain_grad = true, const bool create_graph = false);
   void cleargrad();
+  // 生成元の関数との繋がりを切る（この変数は葉になり、逆伝播はここで止まる）
+  void unchain();
+  // この変数より前の全ての変数の生成元を切り、上流の関数と保存された入力を解放する
+  // （creator_ptr自体は残すので、直前の関数までは逆伝播できる）
+  // 長い系列の学習で窓ごとに呼ぶと計算グラフが伸び続けない（truncated BPTT）
+  void unchain_backward();
   VarPtr reshape(const nc::Shape& shape);
   VarPtr transpose();
   VarPtr T();
@@ -108,52 +249,101 @@ class Function : public std::enable_shared_from_this<Function> {
 
   virtual ~Function(){};
 
+  // forwardが返す出力の数（非同期実行では順伝播の前に出力を作るために使う）
+  virtual size_t num_outputs() const { return 1; }
+
   template <typename... Args>
   std::vector<VarPtr> operator()(const Args&... inputs);
 
   // 可変長テンプレートと純粋仮想関数は両立できない
   virtual std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) = 0;
   virtual std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) = 0;
+  // 前進モード: 入力xs, 出力ys, 入力の接ベクトルtxsから出力の接ベクトルを求める
+  // 計算グラフは作らずndarrayだけで計算する
+  virtual std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                                    const std::vector<NdArrPtr>& ys,
+                                    const std::vector<NdArrPtr>& txs) {
+    throw std::logic_error("jvp is not implemented for this function");
+  }
+
+  // backward中にi番目の入力の勾配が必要かどうか
+  // （不要な勾配はnullptrを返してよい。空なら全て必要）
+  std::vector<bool> needs_input_grad_;
+  bool needs_input_grad(int i) const {
+    return needs_input_grad_.empty() || needs_input_grad_[i];
+  }
 };
 
+// outputsの和をinputsで微分した勾配を返す（Variable::gradは書き換えない）
+// inputsに到達しない枝は辿らないので、必要な勾配だけが計算される
+std::vector<VarPtr> grad(const std::vector<VarPtr>& outputs,
+                         const std::vector<VarPtr>& inputs,
+                         const bool create_graph = false);
+inline VarPtr grad(const VarPtr& output, const VarPtr& input,
+                   const bool create_graph = false) {
+  return grad(std::vector<VarPtr>{output}, std::vector<VarPtr>{input},
+              create_graph)[0];
+}
+
+// ヘッセ行列とベクトルの積 H(f)(x) v を二階微分の計算グラフ1本で求める
+VarPtr hvp(const std::function<VarPtr(const VarPtr&)>& f, const VarPtr& x,
+           const VarPtr& v);
+
+// 前進モード自動微分: f(x)とヤコビアン・ベクトル積 J(f)(x) v を
+// 計算グラフを残さず1回の順伝播で求める
+std::pair<VarPtr, NdArrPtr> jvp(
+    const std::function<VarPtr(const VarPtr&)>& f, const VarPtr& x,
+    const NdArrPtr& v);
+
+// vの参照を手放し、vが最後の参照なら計算グラフの解放をバックグラウンドの
+// スレッドで行う（学習ループを長いグラフの解放で止めないため）
+void release_async(VarPtr&& v);
+// release_asyncに渡したグラフの解放が全て終わるまで待つ
+void wait_released();
+
 class Add : public Function {
  public:
-  nc::Shape x0_shape;
-  nc::Shape x1_shape;
   std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
   std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
 };
 
 class Mul : public Function {
  public:
-  nc::Shape x0_shape;
-  nc::Shape x1_shape;
   std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
   std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
 };
 
 class Neg : public Function {
  public:
-  nc::Shape x0_shape;
-  nc::Shape x1_shape;
   std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
   std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
 };
 
 class Sub : public Function {
  public:
-  nc::Shape x0_shape;
-  nc::Shape x1_shape;
   std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
   std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
 };
 
 class Div : public Function {
  public:
-  nc::Shape x0_shape;
-  nc::Shape x1_shape;
   std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
   std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
 };
 
 class Pow : public Function {
@@ -162,6 +352,84 @@ class Pow : public Function {
   explicit Pow(int c);
   std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
   std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
+};
+
+// 定数（double）との演算
+// 定数を1x1のndarrayのVariableにせずそのまま持つので、
+// 定数ごとの確保やbroadcast_to/sum_toが不要になる
+class ScalarFunction : public Function {
+ public:
+  const double c;
+  explicit ScalarFunction(double c) : c(c) {}
+};
+
+// x + c
+class AddScalar : public ScalarFunction {
+ public:
+  using ScalarFunction::ScalarFunction;
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
+};
+
+// x - c
+class SubScalar : public ScalarFunction {
+ public:
+  using ScalarFunction::ScalarFunction;
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
+};
+
+// c - x
+class RSubScalar : public ScalarFunction {
+ public:
+  using ScalarFunction::ScalarFunction;
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
+};
+
+// x * c
+class MulScalar : public ScalarFunction {
+ public:
+  using ScalarFunction::ScalarFunction;
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
+};
+
+// x / c
+class DivScalar : public ScalarFunction {
+ public:
+  using ScalarFunction::ScalarFunction;
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
+};
+
+// c / x
+class RDivScalar : public ScalarFunction {
+ public:
+  using ScalarFunction::ScalarFunction;
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
 };
 
 inline VarPtr add(VarPtr x0, VarPtr x1) {
@@ -200,32 +468,101 @@ inline VarPtr pow(VarPtr x0, int c) {
   return (*f)(x0)[0];
 }
 
+inline VarPtr add_scalar(VarPtr x, double c) {
+  auto f = std::make_shared<AddScalar>(c);
+  return (*f)(x)[0];
+}
+
+inline VarPtr sub_scalar(VarPtr x, double c) {
+  auto f = std::make_shared<SubScalar>(c);
+  return (*f)(x)[0];
+}
+
+inline VarPtr rsub_scalar(VarPtr x, double c) {
+  auto f = std::make_shared<RSubScalar>(c);
+  return (*f)(x)[0];
+}
+
+inline VarPtr mul_scalar(VarPtr x, double c) {
+  auto f = std::make_shared<MulScalar>(c);
+  return (*f)(x)[0];
+}
+
+inline VarPtr div_scalar(VarPtr x, double c) {
+  auto f = std::make_shared<DivScalar>(c);
+  return (*f)(x)[0];
+}
+
+inline VarPtr rdiv_scalar(VarPtr x, double c) {
+  auto f = std::make_shared<RDivScalar>(c);
+  return (*f)(x)[0];
+}
+
 // 演算子オーバーロード
 // テンプレートの実装はヘッダファイルに書く必要がある:
 // https://pknight.hatenablog.com/entry/20090826/1251303641
 // 可読性重視で演算子オーバーロードは全てヘッダファイルに書く
+// 数値との演算は定数用のFunction（AddScalarなど）を使う
 
 template <typename... Args>
 inline std::vector<VarPtr> Function::operator()(const Args&... inputs) {
-  // パック展開
-  std::vector<NdArrPtr> xs{inputs->data...};
-  const auto& ys = this->forward(xs);
-
   inputs_ = {inputs...};
+  bool has_tangent = false;
+  for (const auto& input : inputs_) {
+    has_tangent = has_tangent || input->tangent;
+  }
+
+  std::vector<NdArrPtr> xs;
+  std::vector<NdArrPtr> ys;
   std::vector<VarPtr> outputs;
-  for (const auto& y : ys) {
-    auto output = as_variable(y);
-    outputs.push_back(output);
+  // 接ベクトルの伝播とvmapのバッチ化は順伝播の値をその場で使うので同期で実行する
+  const bool deferrable = !has_tangent && !Config::batching;
+  if (deferrable && lazy::active()) {
+    // 要素ごとの演算なら記号的なノードになる
+    outputs = lazy::trace(*this, {inputs->data...});
+  }
+  if (outputs.empty()) {
+    auto* s = stream::active();
+    if (deferrable && s) {
+      outputs = stream::launch(s, shared_from_this(), {inputs->data...});
+    } else {
+      // パック展開
+      xs = {inputs->data...};
+      ys = this->forward(xs);
+      for (const auto& y : ys) {
+        auto output = as_variable(y);
+        outputs.push_back(output);
+      }
+    }
   }
 
   if (Config::enable_backprop) {
-    // 世代の設定
+    if (auto* tape = tape::active()) {
+      // テープに記録する場合はcreator_ptrで繋がない
+      tape::record(tape, shared_from_this(), outputs);
+    } else {
+      // 世代の設定
+      for (const auto& input : inputs_) {
+        generation = std::max(generation, input->generation);
+      }
+      // つながりの設定
+      for (const auto& output : outputs) {
+        output->set_creator(shared_from_this());
+      }
+    }
+  }
+
+  // 接ベクトルを持つ入力があれば出力の接ベクトルも順に伝播させる
+  if (has_tangent) {
+    std::vector<NdArrPtr> txs;
     for (const auto& input : inputs_) {
-      generation = std::max(generation, input->generation);
+      txs.push_back(input->tangent
+                        ? input->tangent
+                        : as_array(nc::zeros_like<double>(*input->data)));
     }
-    // つながりの設定
-    for (const auto& output : outputs) {
-      output->set_creator(shared_from_this());
+    const auto& tys = this->jvp(xs, ys, txs);
+    for (int i = 0; i < outputs.size(); i++) {
+      outputs[i]->tangent = tys[i];
     }
   }
 
@@ -261,46 +598,78 @@ inline std::ostream& operator<<(std::ostream& os, const VarPtr& var) {
 inline VarPtr operator+(const VarPtr& lv, const VarPtr& rv) {
   return add(lv, rv);
 }
-template <typename T>
+template <typename T, NotLazyExpr<T> = 0>
 inline VarPtr operator+(const VarPtr& lv, T rv) {
-  return add(lv, as_variable(as_array(rv)));
+  if constexpr (std::is_arithmetic<T>::value) {
+    return add_scalar(lv, static_cast<double>(rv));
+  } else {
+    return add(lv, as_variable(as_array(rv)));
+  }
 }
-template <typename T>
+template <typename T, NotLazyExpr<T> = 0>
 inline VarPtr operator+(T lv, const VarPtr& rv) {
-  return add(as_variable(as_array(lv)), rv);
+  if constexpr (std::is_arithmetic<T>::value) {
+    return add_scalar(rv, static_cast<double>(lv));
+  } else {
+    return add(as_variable(as_array(lv)), rv);
+  }
 }
 inline VarPtr operator-(const VarPtr& lv, const VarPtr& rv) {
   return sub(lv, rv);
 }
-template <typename T>
+template <typename T, NotLazyExpr<T> = 0>
 inline VarPtr operator-(const VarPtr& lv, T rv) {
-  return sub(lv, as_variable(as_array(rv)));
+  if constexpr (std::is_arithmetic<T>::value) {
+    return sub_scalar(lv, static_cast<double>(rv));
+  } else {
+    return sub(lv, as_variable(as_array(rv)));
+  }
 }
-template <typename T>
+template <typename T, NotLazyExpr<T> = 0>
 inline VarPtr operator-(T lv, const VarPtr& rv) {
-  return sub(as_variable(as_array(lv)), rv);
+  if constexpr (std::is_arithmetic<T>::value) {
+    return rsub_scalar(rv, static_cast<double>(lv));
+  } else {
+    return sub(as_variable(as_array(lv)), rv);
+  }
 }
 inline VarPtr operator/(const VarPtr& lv, const VarPtr& rv) {
   return div(lv, rv);
 }
-template <typename T>
+template <typename T, NotLazyExpr<T> = 0>
 inline VarPtr operator/(const VarPtr& lv, T rv) {
-  return div(lv, as_variable(as_array(rv)));
+  if constexpr (std::is_arithmetic<T>::value) {
+    return div_scalar(lv, static_cast<double>(rv));
+  } else {
+    return div(lv, as_variable(as_array(rv)));
+  }
 }
-template <typename T>
+template <typename T, NotLazyExpr<T> = 0>
 inline VarPtr operator/(T lv, const VarPtr& rv) {
-  return div(as_variable(as_array(lv)), rv);
+  if constexpr (std::is_arithmetic<T>::value) {
+    return rdiv_scalar(rv, static_cast<double>(lv));
+  } else {
+    return div(as_variable(as_array(lv)), rv);
+  }
 }
 inline VarPtr operator*(const VarPtr& lv, const VarPtr& rv) {
   return mul(lv, rv);
 }
-template <typename T>
+template <typename T, NotLazyExpr<T> = 0>
 inline VarPtr operator*(const VarPtr& lv, T rv) {
-  return mul(lv, as_variable(as_array(rv)));
+  if constexpr (std::is_arithmetic<T>::value) {
+    return mul_scalar(lv, static_cast<double>(rv));
+  } else {
+    return mul(lv, as_variable(as_array(rv)));
+  }
 }
-template <typename T>
+template <typename T, NotLazyExpr<T> = 0>
 inline VarPtr operator*(T lv, const VarPtr& rv) {
-  return mul(as_variable(as_array(lv)), rv);
+  if constexpr (std::is_arithmetic<T>::value) {
+    return mul_scalar(rv, static_cast<double>(lv));
+  } else {
+    return mul(as_variable(as_array(lv)), rv);
+  }
 }
 inline VarPtr operator-(const VarPtr& v) { return neg(v); }
 #endif
\ No newline at end of file
@@ -0,0 +1,209 @@
+#include "data_parallel.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "parallel.h"
+
+namespace data_parallel {
+namespace {
+// xの[begin, end)行
+nc::NdArray<double> rows(const nc::NdArray<double>& x, size_t begin,
+                         size_t end) {
+  const size_t cols = x.shape().cols;
+  nc::NdArray<double> y(static_cast<nc::uint32>(end - begin),
+                        static_cast<nc::uint32>(cols));
+  std::memcpy(y.data(), x.data() + begin * cols,
+              (end - begin) * cols * sizeof(double));
+  return y;
+}
+}  // namespace
+
+std::vector<int> count_uses(const VarPtr& y,
+                            const std::vector<VarPtr>& params) {
+  std::unordered_map<const Variable*, int> index;
+  for (size_t k = 0; k < params.size(); k++) {
+    index[params[k].get()] = k;
+  }
+  std::vector<int> uses(params.size(), 0);
+  std::vector<Function*> stack;
+  std::unordered_set<Function*> seen;
+  if (y->creator_ptr) {
+    stack.push_back(y->creator_ptr.get());
+    seen.insert(y->creator_ptr.get());
+  }
+  while (!stack.empty()) {
+    Function* f = stack.back();
+    stack.pop_back();
+    for (const auto& input : f->inputs_) {
+      auto found = index.find(input.get());
+      if (found != index.end()) {
+        uses[found->second]++;
+      }
+      Function* g = input->creator_ptr.get();
+      if (g && seen.insert(g).second) {
+        stack.push_back(g);
+      }
+    }
+  }
+  return uses;
+}
+
+std::vector<std::vector<int>> make_buckets(const std::vector<VarPtr>& params,
+                                           size_t bucket_size) {
+  bucket_size = std::max<size_t>(1, bucket_size);
+  std::vector<std::vector<int>> buckets;
+  size_t size = 0;
+  for (int k = static_cast<int>(params.size()) - 1; k >= 0; k--) {
+    if (size == 0) {
+      buckets.emplace_back();
+    }
+    buckets.back().push_back(k);
+    size += params[k]->size();
+    if (size >= bucket_size) {
+      size = 0;
+    }
+  }
+  return buckets;
+}
+
+DataParallel::DataParallel(std::vector<VarPtr> params, int num_replicas,
+                           size_t bucket_size)
+    : params_(std::move(params)),
+      num_replicas_(num_replicas > 0 ? num_replicas
+                                     : parallel::get_num_threads()),
+      bucket_of_(params_.size(), -1) {
+  for (const auto& ks : make_buckets(params_, bucket_size)) {
+    auto bucket = std::make_unique<Bucket>();
+    for (int k : ks) {
+      bucket->params.push_back(k);
+      bucket->offsets.push_back(bucket->size);
+      bucket->size += params_[k]->size();
+      bucket_of_[k] = buckets_.size();
+    }
+    buckets_.push_back(std::move(bucket));
+  }
+}
+
+double DataParallel::step(const LossFn& loss, const nc::NdArray<double>& x,
+                          const nc::NdArray<double>& t) {
+  const size_t n = x.shape().rows;
+  if (n == 0 || t.shape().rows != n) {
+    throw std::invalid_argument(
+        "DataParallel::step: x and t must have the same number of rows");
+  }
+  // 行数よりレプリカが多ければ空のシャードは作らない
+  const int replicas = static_cast<int>(
+      std::min<size_t>(static_cast<size_t>(num_replicas_), n));
+  for (auto& bucket : buckets_) {
+    bucket->buffer.assign(bucket->size * replicas, 0.0);
+    bucket->arrived = 0;
+  }
+
+  std::vector<double> losses(replicas);
+  parallel::parallel_for(0, replicas, 1, [&](size_t begin, size_t end) {
+    for (size_t r = begin; r < end; r++) {
+      losses[r] = run_replica(loss, x, t, static_cast<int>(r), replicas);
+    }
+  });
+  double total = 0.0;
+  for (double l : losses) {
+    total += l;
+  }
+  return total;
+}
+
+double DataParallel::run_replica(const LossFn& loss,
+                                 const nc::NdArray<double>& x,
+                                 const nc::NdArray<double>& t, int r,
+                                 int replicas) {
+  const size_t n = x.shape().rows;
+  const size_t begin = n * r / replicas;
+  const size_t end = n * (r + 1) / replicas;
+  const double weight = static_cast<double>(end - begin) / n;
+
+  // dataを共有し、勾配だけを別に持つレプリカ
+  std::vector<VarPtr> replica;
+  replica.reserve(params_.size());
+  for (const auto& param : params_) {
+    replica.push_back(std::make_shared<Variable>(param->data));
+  }
+
+  auto y = loss(replica, as_variable(as_array(rows(x, begin, end))),
+                as_variable(as_array(rows(t, begin, end))));
+  auto uses = count_uses(y, replica);
+
+  // バケットごとの未確定のパラメータの数
+  std::vector<int> pending(buckets_.size(), 0);
+  for (size_t k = 0; k < params_.size(); k++) {
+    if (uses[k] > 0) {
+      pending[bucket_of_[k]]++;
+    }
+  }
+  for (size_t k = 0; k < params_.size(); k++) {
+    if (uses[k] == 0) {
+      continue;
+    }
+    replica[k]->grad_hook = [&, k](const VarPtr&) {
+      if (--uses[k] == 0 && --pending[bucket_of_[k]] == 0) {
+        reduce(*buckets_[bucket_of_[k]], replica, weight, r, replicas);
+      }
+    };
+  }
+  // 損失に関係しないパラメータだけのバケットは勾配0として先に済ませる
+  for (size_t b = 0; b < buckets_.size(); b++) {
+    if (pending[b] == 0) {
+      reduce(*buckets_[b], replica, weight, r, replicas);
+    }
+  }
+
+  y->backward(false);
+  return (*y->data)[0] * weight;
+}
+
+void DataParallel::reduce(Bucket& bucket, const std::vector<VarPtr>& replica,
+                          double weight, int r, int replicas) {
+  // 自分の区間にだけ書くのでロックは要らない
+  double* dst = bucket.buffer.data() + bucket.size * r;
+  for (size_t i = 0; i < bucket.params.size(); i++) {
+    const auto& p = replica[bucket.params[i]];
+    if (p->grad) {
+      const double* src = p->grad->data->data();
+      const size_t size = p->grad->data->size();
+      for (size_t j = 0; j < size; j++) {
+        dst[bucket.offsets[i] + j] = weight * src[j];
+      }
+    }
+    // 行疎な勾配（F::embeddingなど）は密にして足す
+    if (p->sparse_grad) {
+      const auto shape = p->shape();
+      nc::NdArray<double> view(dst + bucket.offsets[i], shape.rows, shape.cols,
+                               false);
+      p->sparse_grad->add_to(view, weight);
+    }
+  }
+  if (bucket.arrived.fetch_add(1, std::memory_order_acq_rel) + 1 != replicas) {
+    return;
+  }
+
+  // 最後のレプリカがレプリカの順に足す（到着順によらず結果が同じになる）
+  double* sum = bucket.buffer.data();
+  for (int s = 1; s < replicas; s++) {
+    const double* src = bucket.buffer.data() + bucket.size * s;
+    for (size_t j = 0; j < bucket.size; j++) {
+      sum[j] += src[j];
+    }
+  }
+  for (size_t i = 0; i < bucket.params.size(); i++) {
+    auto& param = params_[bucket.params[i]];
+    nc::NdArray<double> g(param->shape());
+    std::memcpy(g.data(), sum + bucket.offsets[i], g.size() * sizeof(double));
+    // 集約はワーカースレッドで行われるので、計算グラフを作らずにndarrayで足す
+    param->grad = param->grad ? as_variable(as_array(*param->grad->data + g))
+                              : as_variable(as_array(std::move(g)));
+  }
+}
+}  // namespace data_parallel
@@ -0,0 +1,89 @@
+#ifndef DATA_PARALLEL_
+#define DATA_PARALLEL_
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "NumCpp.hpp"
+#include "core.h"
+
+// 1プロセス内のデータ並列学習
+// バッチを行方向にレプリカ数で分け、レプリカごとにスレッドプールのスレッドで
+// 順伝播とVariable::backwardを行う。レプリカのパラメータは元のパラメータとdataを
+// 共有する別のVariableなので、勾配だけがレプリカごとに分かれる
+//
+// 勾配はパラメータを後ろから数個ずつまとめたバケットごとに集約する
+// レプリカの逆伝播でバケット内の勾配が全て確定すると（Variable::grad_hook）、
+// そのレプリカの分を共有バッファに書き込み、最後に書き込んだレプリカが
+// レプリカの順に足し合わせて元のパラメータのgradに足す。バケットの集約は
+// 他のレプリカの逆伝播（より前の層）と並行に進む
+//
+//   data_parallel::DataParallel dp({W, b});
+//   auto loss = dp.step(
+//       [](const std::vector<VarPtr>& p, const VarPtr& x, const VarPtr& t) {
+//         auto d = F::matmul(x, p[0]) + p[1] - t;
+//         return F::sum(d * d) / static_cast<double>(x->shape().rows);
+//       },
+//       x, t);
+//   // W->grad, b->gradに勾配が入るので、そのまま更新する
+namespace data_parallel {
+// params（レプリカ）とバッチの一部x, tから損失（シャード内の平均）を返す
+using LossFn = std::function<VarPtr(const std::vector<VarPtr>& params,
+                                    const VarPtr& x, const VarPtr& t)>;
+
+// yの計算グラフでparams[k]を入力に持つ関数の数
+// （逆伝播でparams[k]->gradに勾配が足される回数。足し終わったら勾配は確定している）
+std::vector<int> count_uses(const VarPtr& y, const std::vector<VarPtr>& params);
+
+// パラメータを後ろから要素数がbucket_size以上になるまでまとめたバケット
+// （逆伝播では後ろの層の勾配から確定する）。各バケットはパラメータの番号の列
+std::vector<std::vector<int>> make_buckets(const std::vector<VarPtr>& params,
+                                           size_t bucket_size);
+
+class DataParallel {
+ public:
+  // num_replicasが0ならparallel::get_num_threads()
+  // bucket_sizeはバケット1つの要素数の目安
+  explicit DataParallel(std::vector<VarPtr> params, int num_replicas = 0,
+                        size_t bucket_size = 1 << 18);
+  DataParallel(const DataParallel&) = delete;
+  DataParallel& operator=(const DataParallel&) = delete;
+
+  // バッチ全体の平均損失の勾配をparams[k]->gradに足し、平均損失を返す
+  // （各レプリカの勾配をシャードの行数で重み付けして足し合わせる）
+  // レプリカの行疎な勾配（sparse_grad）も密にしてparams[k]->gradに足す
+  double step(const LossFn& loss, const nc::NdArray<double>& x,
+              const nc::NdArray<double>& t);
+
+  int num_replicas() const { return num_replicas_; }
+  size_t num_buckets() const { return buckets_.size(); }
+
+ private:
+  struct Bucket {
+    // バケットに入るパラメータの番号と、バッファ内の位置
+    std::vector<int> params;
+    std::vector<size_t> offsets;
+    size_t size = 0;
+    // レプリカごとの重み付きの勾配（レプリカrは[r * size, (r + 1) * size)）
+    std::vector<double> buffer;
+    std::atomic<int> arrived{0};
+  };
+
+  double run_replica(const LossFn& loss, const nc::NdArray<double>& x,
+                     const nc::NdArray<double>& t, int r, int replicas);
+  // レプリカrのバケットの勾配を書き込み、最後のレプリカなら集約する
+  void reduce(Bucket& bucket, const std::vector<VarPtr>& replica, double weight,
+              int r, int replicas);
+
+  std::vector<VarPtr> params_;
+  int num_replicas_;
+  std::vector<std::unique_ptr<Bucket>> buckets_;
+  // パラメータの番号 -> バケットの番号
+  std::vector<int> bucket_of_;
+};
+}  // namespace data_parallel
+
+#endif
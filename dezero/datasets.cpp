@@ -0,0 +1,531 @@
+#include "datasets.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+
+namespace datasets {
+namespace {
+constexpr char kMagic[8] = {'D', 'Z', 'S', 'H', 'A', 'R', 'D', '1'};
+constexpr char kIndexHeader[] = "dezero-shards 1";
+
+// シャードファイルのヘッダ（64byteにしてレコード先頭をキャッシュラインに揃える）
+struct ShardHeader {
+  char magic[8];
+  uint32_t record_size;
+  uint32_t reserved;
+  uint64_t num_records;
+  char pad[40];
+};
+static_assert(sizeof(ShardHeader) == 64, "shard header must be 64 bytes");
+
+std::string shard_path(const std::string& prefix, size_t i) {
+  char buf[16];
+  std::snprintf(buf, sizeof(buf), "-%05zu.shard", i);
+  return prefix + buf;
+}
+}  // namespace
+
+Shard::Shard(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("cannot open shard: " + path);
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ShardHeader)) {
+    ::close(fd);
+    throw std::runtime_error("invalid shard: " + path);
+  }
+  length_ = st.st_size;
+  // 読み取り専用（書き込めるとMADV_DONTNEEDで書き込みが黙って失われる）
+  addr_ = ::mmap(nullptr, length_, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (addr_ == MAP_FAILED) {
+    addr_ = nullptr;
+    throw std::runtime_error("mmap failed: " + path);
+  }
+
+  const auto* header = static_cast<const ShardHeader*>(addr_);
+  if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+      sizeof(ShardHeader) + header->num_records * header->record_size *
+                                sizeof(double) >
+          length_) {
+    ::munmap(addr_, length_);
+    addr_ = nullptr;
+    throw std::runtime_error("corrupted shard: " + path);
+  }
+  record_size_ = header->record_size;
+  num_records_ = header->num_records;
+  records_ = reinterpret_cast<double*>(static_cast<char*>(addr_) +
+                                       sizeof(ShardHeader));
+  // 既定ではランダムアクセス（先読みはprefetchで明示する）
+  ::madvise(addr_, length_, MADV_RANDOM);
+}
+
+Shard::~Shard() {
+  if (addr_) {
+    ::munmap(addr_, length_);
+  }
+}
+
+const double* Shard::record(uint64_t i) const {
+  assert(i < num_records_);
+  return records_ + i * record_size_;
+}
+
+void Shard::prefetch() const { ::madvise(addr_, length_, MADV_WILLNEED); }
+void Shard::release() const { ::madvise(addr_, length_, MADV_DONTNEED); }
+
+ShardWriter::ShardWriter(const std::string& prefix, uint32_t record_size,
+                         uint64_t records_per_shard)
+    : prefix_(prefix),
+      record_size_(record_size),
+      records_per_shard_(records_per_shard) {
+  if (record_size == 0 || records_per_shard == 0) {
+    throw std::invalid_argument(
+        "record_size and records_per_shard must be > 0");
+  }
+}
+
+ShardWriter::~ShardWriter() {
+  try {
+    close();
+  } catch (...) {
+  }
+}
+
+void ShardWriter::open_shard() {
+  const auto path = shard_path(prefix_, shards_.size());
+  fp_ = std::fopen(path.c_str(), "wb");
+  if (!fp_) {
+    throw std::runtime_error("cannot create shard: " + path);
+  }
+  ShardHeader header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.record_size = record_size_;
+  if (std::fwrite(&header, sizeof(header), 1, fp_) != 1) {
+    fail("cannot write shard header");
+  }
+  count_ = 0;
+}
+
+void ShardWriter::close_shard() {
+  // ヘッダのレコード数を書き戻す
+  if (std::fseek(fp_, offsetof(ShardHeader, num_records), SEEK_SET) != 0 ||
+      std::fwrite(&count_, sizeof(count_), 1, fp_) != 1) {
+    fail("cannot write shard header");
+  }
+  // バッファに残った分の書き込みの失敗はfcloseで分かる
+  const int closed = std::fclose(fp_);
+  fp_ = nullptr;
+  const auto path = shard_path(prefix_, shards_.size());
+  if (closed != 0) {
+    throw std::runtime_error("cannot write shard: " + path);
+  }
+  shards_.emplace_back(std::filesystem::path(path).filename().string(), count_);
+}
+
+void ShardWriter::fail(const std::string& what) {
+  std::fclose(fp_);
+  fp_ = nullptr;
+  throw std::runtime_error(what + ": " + shard_path(prefix_, shards_.size()));
+}
+
+void ShardWriter::write(const double* record) {
+  assert(!closed_);
+  if (!fp_) {
+    open_shard();
+  }
+  if (std::fwrite(record, sizeof(double), record_size_, fp_) != record_size_) {
+    fail("cannot write shard");
+  }
+  if (++count_ == records_per_shard_) {
+    close_shard();
+  }
+}
+
+void ShardWriter::write(const nc::NdArray<double>& rows) {
+  if (rows.shape().cols != record_size_) {
+    throw std::invalid_argument("record size mismatch");
+  }
+  for (nc::uint32 r = 0; r < rows.shape().rows; r++) {
+    write(rows.data() + r * record_size_);
+  }
+}
+
+void ShardWriter::close() {
+  if (closed_) {
+    return;
+  }
+  closed_ = true;
+  if (fp_) {
+    close_shard();
+  }
+  std::ofstream index(prefix_ + ".index");
+  index << kIndexHeader << "\n";
+  index << "record_size " << record_size_ << "\n";
+  for (const auto& [name, n] : shards_) {
+    index << "shard " << name << " " << n << "\n";
+  }
+  if (!index) {
+    throw std::runtime_error("cannot write index: " + prefix_ + ".index");
+  }
+}
+
+void convert_csv(const std::string& csv_path, const std::string& prefix,
+                 uint64_t records_per_shard, char delimiter, bool skip_header) {
+  std::ifstream in(csv_path);
+  if (!in) {
+    throw std::runtime_error("cannot open csv: " + csv_path);
+  }
+  std::string line;
+  if (skip_header) {
+    std::getline(in, line);
+  }
+  std::unique_ptr<ShardWriter> writer;
+  std::vector<double> record;
+  size_t record_size = 0;
+  while (std::getline(in, line)) {
+    if (line.empty() || line == "\r") {
+      continue;
+    }
+    record.clear();
+    const char* p = line.c_str();
+    while (true) {
+      char* end;
+      record.push_back(std::strtod(p, &end));
+      if (end == p) {
+        throw std::invalid_argument("non-numeric csv field: " + line);
+      }
+      p = end;
+      while (*p == ' ' || *p == '\r') p++;
+      if (*p != delimiter) break;
+      p++;
+    }
+    if (*p != '\0') {
+      throw std::invalid_argument("malformed csv row: " + line);
+    }
+    if (!writer) {
+      record_size = record.size();
+      writer = std::make_unique<ShardWriter>(prefix, record_size,
+                                             records_per_shard);
+    } else if (record.size() != record_size) {
+      throw std::invalid_argument("ragged csv row: " + line);
+    }
+    writer->write(record.data());
+  }
+  if (!writer) {
+    throw std::invalid_argument("empty csv: " + csv_path);
+  }
+  writer->close();
+}
+
+void convert_npy(const std::string& npy_path, const std::string& prefix,
+                 uint64_t records_per_shard) {
+  std::ifstream in(npy_path, std::ios::binary);
+  char magic[8];
+  if (!in.read(magic, sizeof(magic)) ||
+      std::memcmp(magic, "\x93NUMPY", 6) != 0) {
+    throw std::runtime_error("not a npy file: " + npy_path);
+  }
+  // v1.0はヘッダ長が2byte, v2.0以降は4byte
+  uint32_t header_len = 0;
+  if (magic[6] == 1) {
+    uint16_t len16;
+    in.read(reinterpret_cast<char*>(&len16), sizeof(len16));
+    header_len = len16;
+  } else {
+    in.read(reinterpret_cast<char*>(&header_len), sizeof(header_len));
+  }
+  std::string header(header_len, '\0');
+  in.read(&header[0], header_len);
+
+  auto value_of = [&header](const std::string& key) {
+    auto pos = header.find("'" + key + "'");
+    if (pos == std::string::npos) {
+      throw std::invalid_argument("npy header has no " + key);
+    }
+    pos = header.find(':', pos) + 1;
+    while (header[pos] == ' ') pos++;
+    return pos;
+  };
+  auto descr_pos = value_of("descr") + 1;
+  const auto descr =
+      header.substr(descr_pos, header.find('\'', descr_pos) - descr_pos);
+  if (header.compare(value_of("fortran_order"), 4, "True") == 0) {
+    throw std::invalid_argument("fortran ordered npy is not supported");
+  }
+  std::vector<uint64_t> dims;
+  {
+    auto pos = value_of("shape") + 1;
+    std::istringstream shape_ss(
+        header.substr(pos, header.find(')', pos) - pos));
+    std::string dim;
+    while (std::getline(shape_ss, dim, ',')) {
+      if (dim.find_first_of("0123456789") != std::string::npos) {
+        dims.push_back(std::stoull(dim));
+      }
+    }
+  }
+  if (dims.empty() || dims.size() > 2) {
+    throw std::invalid_argument("npy must be 1-D or 2-D");
+  }
+  const uint64_t rows = dims[0];
+  const uint32_t cols = dims.size() == 2 ? dims[1] : 1;
+
+  // リトルエンディアンの数値型のみ対応
+  size_t item_size;
+  if (descr == "<f8") {
+    item_size = 8;
+  } else if (descr == "<f4" || descr == "<i4") {
+    item_size = 4;
+  } else if (descr == "<i8") {
+    item_size = 8;
+  } else {
+    throw std::invalid_argument("unsupported npy dtype: " + descr);
+  }
+
+  ShardWriter writer(prefix, cols, records_per_shard);
+  std::vector<char> raw(item_size * cols);
+  std::vector<double> record(cols);
+  for (uint64_t r = 0; r < rows; r++) {
+    if (!in.read(raw.data(), raw.size())) {
+      throw std::runtime_error("truncated npy: " + npy_path);
+    }
+    for (uint32_t c = 0; c < cols; c++) {
+      const char* src = raw.data() + c * item_size;
+      if (descr == "<f8") {
+        std::memcpy(&record[c], src, 8);
+      } else if (descr == "<f4") {
+        float v;
+        std::memcpy(&v, src, 4);
+        record[c] = v;
+      } else if (descr == "<i4") {
+        int32_t v;
+        std::memcpy(&v, src, 4);
+        record[c] = v;
+      } else {
+        int64_t v;
+        std::memcpy(&v, src, 8);
+        record[c] = static_cast<double>(v);
+      }
+    }
+    writer.write(record.data());
+  }
+  writer.close();
+}
+
+ShardedDataset::ShardedDataset(const std::string& index_path) {
+  std::ifstream index(index_path);
+  std::string line;
+  if (!std::getline(index, line) || line != kIndexHeader) {
+    throw std::runtime_error("invalid index: " + index_path);
+  }
+  const auto dir = std::filesystem::path(index_path).parent_path();
+  while (std::getline(index, line)) {
+    std::istringstream iss(line);
+    std::string key;
+    iss >> key;
+    if (key == "record_size") {
+      iss >> record_size_;
+    } else if (key == "shard") {
+      std::string name;
+      uint64_t n;
+      iss >> name >> n;
+      auto shard = std::make_shared<Shard>((dir / name).string());
+      if (shard->num_records() != n || shard->record_size() != record_size_) {
+        throw std::runtime_error("shard does not match index: " + name);
+      }
+      offsets_.push_back(num_records_);
+      num_records_ += n;
+      shards_.push_back(shard);
+    }
+  }
+}
+
+std::pair<size_t, uint64_t> ShardedDataset::locate(uint64_t i) const {
+  assert(i < num_records_);
+  // offsets_は昇順なので二分探索
+  const auto it = std::upper_bound(offsets_.begin(), offsets_.end(), i);
+  const size_t s = std::distance(offsets_.begin(), it) - 1;
+  return {s, i - offsets_[s]};
+}
+
+bool ShardedDataset::release(size_t s) const {
+  // ビューのdeleterがシャードを持っているので、参照数でビューの有無がわかる
+  if (shards_[s].use_count() > 1) {
+    return false;
+  }
+  shards_[s]->release();
+  return true;
+}
+
+ConstNdArrPtr ShardedDataset::get(uint64_t i) const { return slice(i, 1); }
+
+ConstNdArrPtr ShardedDataset::slice(uint64_t start, uint64_t n) const {
+  assert(n > 0 && start + n <= num_records_);
+  const auto [s, local] = locate(start);
+  const auto& shard = shards_[s];
+  if (local + n <= shard->num_records()) {
+    // 所有権を持たないNdArrayでmmap領域を直接参照する
+    // deleterがシャードを保持するのでビューが生きている間はunmapされない
+    // NdArrayのコンストラクタは非constのポインタを取るが、constとしてしか返さない
+    auto* p = const_cast<double*>(shard->record(local));
+    return ConstNdArrPtr(new nc::NdArray<double>(p, n, record_size_, false),
+                         [shard](const nc::NdArray<double>* p) { delete p; });
+  }
+  std::vector<uint64_t> ids(n);
+  std::iota(ids.begin(), ids.end(), start);
+  return gather(ids);
+}
+
+NdArrPtr ShardedDataset::gather(const std::vector<uint64_t>& ids) const {
+  auto out = std::make_shared<nc::NdArray<double>>(ids.size(), record_size_);
+  double* dst = out->data();
+  for (const auto id : ids) {
+    const auto [s, local] = locate(id);
+    std::memcpy(dst, shards_[s]->record(local), sizeof(double) * record_size_);
+    dst += record_size_;
+  }
+  return out;
+}
+
+DataLoader::DataLoader(const ShardedDataset& dataset, uint64_t batch_size,
+                       bool shuffle, size_t memory_budget, uint64_t seed)
+    : dataset_(dataset),
+      batch_size_(batch_size),
+      shuffle_(shuffle),
+      memory_budget_(memory_budget),
+      rng_(seed) {
+  assert(batch_size > 0);
+  reset();
+}
+
+void DataLoader::build_windows() {
+  std::vector<size_t> shard_order(dataset_.num_shards());
+  std::iota(shard_order.begin(), shard_order.end(), 0);
+  std::shuffle(shard_order.begin(), shard_order.end(), rng_);
+  // 予算に収まる分だけシャードをまとめる（最低1シャード）
+  windows_.clear();
+  size_t bytes = 0;
+  for (const auto s : shard_order) {
+    const size_t shard_bytes = dataset_.shard(s).bytes();
+    if (windows_.empty() || bytes + shard_bytes > memory_budget_) {
+      windows_.emplace_back();
+      bytes = 0;
+    }
+    windows_.back().push_back(s);
+    bytes += shard_bytes;
+  }
+}
+
+void DataLoader::enter_window(size_t w) {
+  // 直前のウィンドウはバッチへのコピーが終わってから解放する
+  if (window_ < windows_.size()) {
+    released_.insert(released_.end(), windows_[window_].begin(),
+                     windows_[window_].end());
+  }
+  window_ = w;
+  order_.clear();
+  cursor_ = 0;
+  if (w >= windows_.size()) {
+    return;
+  }
+  // 次のウィンドウは読み進めている間にカーネルに先読みさせる
+  if (w + 1 < windows_.size()) {
+    for (const auto s : windows_[w + 1]) dataset_.prefetch(s);
+  }
+  for (const auto s : windows_[w]) {
+    const auto offset = dataset_.offset(s);
+    for (uint64_t i = 0; i < dataset_.shard(s).num_records(); i++) {
+      order_.push_back(offset + i);
+    }
+  }
+  std::shuffle(order_.begin(), order_.end(), rng_);
+}
+
+void DataLoader::reset() {
+  released_.clear();
+  cursor_ = 0;
+  if (!shuffle_) {
+    window_ = 0;
+    for (size_t s = 0; s < std::min<size_t>(2, dataset_.num_shards()); s++) {
+      dataset_.prefetch(s);
+    }
+    return;
+  }
+  build_windows();
+  if (!windows_.empty()) {
+    for (const auto s : windows_[0]) dataset_.prefetch(s);
+  }
+  window_ = windows_.size();
+  enter_window(0);
+  released_.clear();
+}
+
+bool DataLoader::next(ConstNdArrPtr& batch) {
+  // 前のバッチへの参照を手放してから解放する
+  batch.reset();
+  released_.erase(std::remove_if(released_.begin(), released_.end(),
+                                 [this](size_t s) {
+                                   return dataset_.release(s);
+                                 }),
+                  released_.end());
+
+  if (!shuffle_) {
+    // シャッフルなしは連続領域をそのまま返す（シャード内ならゼロコピー）
+    if (cursor_ >= dataset_.size()) {
+      return false;
+    }
+    const uint64_t n = std::min(batch_size_, dataset_.size() - cursor_);
+    batch = dataset_.slice(cursor_, n);
+    cursor_ += n;
+    // 読み終えたシャードは次の呼び出しで解放し、その次を先読みする
+    while (window_ < dataset_.num_shards() &&
+           dataset_.offset(window_) + dataset_.shard(window_).num_records() <=
+               cursor_) {
+      released_.push_back(window_++);
+      if (window_ + 1 < dataset_.num_shards()) {
+        dataset_.prefetch(window_ + 1);
+      }
+    }
+    return true;
+  }
+
+  std::vector<uint64_t> ids;
+  ids.reserve(batch_size_);
+  while (ids.size() < batch_size_ && window_ < windows_.size()) {
+    if (cursor_ == order_.size()) {
+      enter_window(window_ + 1);
+      continue;
+    }
+    const uint64_t n =
+        std::min<uint64_t>(batch_size_ - ids.size(), order_.size() - cursor_);
+    ids.insert(ids.end(), order_.begin() + cursor_,
+               order_.begin() + cursor_ + n);
+    cursor_ += n;
+  }
+  if (ids.empty()) {
+    return false;
+  }
+  batch = dataset_.gather(ids);
+  return true;
+}
+
+VarPtr as_input(const ConstNdArrPtr& batch) {
+  // 同じ制御ブロックを共有する（参照数でシャードのビューの有無を数えるため）
+  auto* p = const_cast<nc::NdArray<double>*>(batch.get());
+  return as_variable(NdArrPtr(batch, p));
+}
+}  // namespace datasets
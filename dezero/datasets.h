@@ -0,0 +1,158 @@
+#ifndef DATASETS_
+#define DATASETS_
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "NumCpp.hpp"
+#include "core.h"
+
+// シャード分割された固定長レコードのバイナリデータセット
+// ディレクトリ構成:
+//   <prefix>.index         シャード一覧（テキスト）
+//   <prefix>-00000.shard   ヘッダ(64byte) + double * record_size * n
+namespace datasets {
+
+// mmap領域を参照する読み取り専用の配列
+// （シャードは読み取り専用でmapするので、書き換える場合はコピーする。
+// 計算グラフの入力にはas_inputで変換する）
+using ConstNdArrPtr = std::shared_ptr<const nc::NdArray<double>>;
+
+// mmapしたシャード1つ分（読み取り専用）
+class Shard {
+ public:
+  explicit Shard(const std::string& path);
+  ~Shard();
+  Shard(const Shard&) = delete;
+  Shard& operator=(const Shard&) = delete;
+
+  const double* record(uint64_t i) const;
+  uint64_t num_records() const { return num_records_; }
+  uint32_t record_size() const { return record_size_; }
+  size_t bytes() const { return length_; }
+
+  // madviseでカーネルに先読み/解放を依頼する
+  void prefetch() const;
+  void release() const;
+
+ private:
+  void* addr_ = nullptr;
+  size_t length_ = 0;
+  double* records_ = nullptr;
+  uint64_t num_records_ = 0;
+  uint32_t record_size_ = 0;
+};
+
+class ShardWriter {
+ public:
+  ShardWriter(const std::string& prefix, uint32_t record_size,
+              uint64_t records_per_shard = 1 << 16);
+  ~ShardWriter();
+
+  void write(const double* record);
+  void write(const nc::NdArray<double>& rows);
+  // インデックスを書き出す（デストラクタでも呼ばれる）
+  void close();
+
+ private:
+  void open_shard();
+  void close_shard();
+  // 書きかけのシャードを閉じて投げる
+  [[noreturn]] void fail(const std::string& what);
+
+  std::string prefix_;
+  uint32_t record_size_;
+  uint64_t records_per_shard_;
+  std::FILE* fp_ = nullptr;
+  uint64_t count_ = 0;
+  std::vector<std::pair<std::string, uint64_t>> shards_;
+  bool closed_ = false;
+};
+
+// CSV (数値のみ) / .npy (2D, C order, f8/f4/i8/i4) からの変換
+void convert_csv(const std::string& csv_path, const std::string& prefix,
+                 uint64_t records_per_shard = 1 << 16, char delimiter = ',',
+                 bool skip_header = false);
+void convert_npy(const std::string& npy_path, const std::string& prefix,
+                 uint64_t records_per_shard = 1 << 16);
+
+class ShardedDataset {
+ public:
+  explicit ShardedDataset(const std::string& index_path);
+
+  uint64_t size() const { return num_records_; }
+  uint32_t record_size() const { return record_size_; }
+  size_t num_shards() const { return shards_.size(); }
+  const Shard& shard(size_t s) const { return *shards_[s]; }
+  // シャードsの先頭レコード番号
+  uint64_t offset(size_t s) const { return offsets_[s]; }
+
+  // (1, record_size)のゼロコピービュー
+  ConstNdArrPtr get(uint64_t i) const;
+  // 連続レコードのビュー（シャードを跨ぐ場合のみコピー）
+  ConstNdArrPtr slice(uint64_t start, uint64_t n) const;
+  // 任意のレコードを集めたコピー
+  NdArrPtr gather(const std::vector<uint64_t>& ids) const;
+
+  void prefetch(size_t s) const { shards_[s]->prefetch(); }
+  // シャードsのページを解放する。sを参照するビューが残っていれば何もせずfalse
+  bool release(size_t s) const;
+
+ private:
+  std::pair<size_t, uint64_t> locate(uint64_t i) const;
+
+  std::vector<std::shared_ptr<Shard>> shards_;
+  std::vector<uint64_t> offsets_;
+  uint64_t num_records_ = 0;
+  uint32_t record_size_ = 0;
+};
+
+// ミニバッチを順に返す
+// shuffle時はmemory_budgetバイトに収まるシャードのまとまり（ウィンドウ）単位で
+// シャード順とウィンドウ内レコード順をシャッフルし、
+// 次のウィンドウを先読み・使い終わったウィンドウを解放する
+// （先読み分を含めると常駐するのは最大でmemory_budgetの2倍）
+// 返したビューがまだ使われているシャードは、ビューが解放されるまで解放しない
+class DataLoader {
+ public:
+  DataLoader(const ShardedDataset& dataset, uint64_t batch_size,
+             bool shuffle = true, size_t memory_budget = size_t(1) << 30,
+             uint64_t seed = 0);
+
+  // 次のバッチ。エポック終了時はfalse
+  // シャッフルなしでシャード内のバッチはmmap領域のビュー（読み取り専用）
+  bool next(ConstNdArrPtr& batch);
+  void reset();
+
+ private:
+  void build_windows();
+  void enter_window(size_t w);
+
+  const ShardedDataset& dataset_;
+  uint64_t batch_size_;
+  bool shuffle_;
+  size_t memory_budget_;
+  std::mt19937_64 rng_;
+
+  // shuffle時はウィンドウ番号、それ以外は読んでいるシャード番号
+  std::vector<std::vector<size_t>> windows_;
+  size_t window_ = 0;
+  std::vector<uint64_t> order_;
+  uint64_t cursor_ = 0;
+  // 解放するシャード（ビューが残っているものは次のnextで再び試す）
+  std::vector<size_t> released_;
+};
+
+// 読み取り専用のバッチをコピーせずに計算グラフの入力にする
+// 関数は入力の値を書き換えないので順伝播・逆伝播はそのまま使えるが、
+// dataはmmap領域を指すので、要素を書き換える使い方（パラメータにして最適化する、
+// flat::FlatParametersに渡すなど）はできない（書き換えると書き込み違反になる）
+// 変数が生きている間はビューと同じくシャードは解放されない
+VarPtr as_input(const ConstNdArrPtr& batch);
+}  // namespace datasets
+
+#endif
@@ -7,8 +7,25 @@
 #include "utils.h"
 #endif
 #ifdef IS_CORE
+#include "codegen.h"
+#include "conv.h"
 #include "core.h"
+#include "data_parallel.h"
+#include "datasets.h"
+#include "distributed.h"
+#include "expr.h"
+#include "flat.h"
 #include "functions.h"
+#include "lazy.h"
+#include "parallel.h"
+#include "quantize.h"
+#include "random.h"
+#include "rnn.h"
+#include "sparse.h"
+#include "stream.h"
+#include "tape.h"
 #include "utils.h"
+#include "vmap.h"
+#include "vmath.h"
 #endif
 #endif
\ No newline at end of file
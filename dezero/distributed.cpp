@@ -0,0 +1,551 @@
+#include "distributed.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include "data_parallel.h"
+
+// macOSにはMSG_NOSIGNALがないので、ソケットにSO_NOSIGPIPEを設定する
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace distributed {
+namespace {
+std::string errno_message(const std::string& what) {
+  return what + ": " + std::strerror(errno);
+}
+
+// 共有メモリ上の1方向のリングバッファ（送信側と受信側が1つずつ）
+constexpr size_t kChannelCapacity = 1 << 16;
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "shared memory channels need lock-free atomics");
+
+struct alignas(64) Channel {
+  // 書き込んだ要素数（送信側だけが更新する）
+  std::atomic<uint64_t> head;
+  char pad[64 - sizeof(std::atomic<uint64_t>)];
+  // 読み出した要素数（受信側だけが更新する）
+  std::atomic<uint64_t> tail;
+  double data[kChannelCapacity];
+};
+
+// 先頭（キャッシュライン1本分）は空けて、その後にランクごとの送信用Channelを置く
+constexpr size_t kHeaderSize = 64;
+
+size_t segment_length(int world_size) {
+  return kHeaderSize + sizeof(Channel) * world_size;
+}
+
+Channel& channel(void* addr, int rank) {
+  return reinterpret_cast<Channel*>(static_cast<char*>(addr) +
+                                    kHeaderSize)[rank];
+}
+
+void set_nonblocking(int fd) {
+  const int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    throw std::runtime_error(errno_message("fcntl failed"));
+  }
+#ifdef SO_NOSIGPIPE
+  const int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+}
+
+sockaddr_un socket_address(const std::string& path) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    throw std::invalid_argument("socket path is too long: " + path);
+  }
+  std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  return addr;
+}
+
+std::string socket_path(const std::string& dir, int rank) {
+  return dir + "/rank-" + std::to_string(rank) + ".sock";
+}
+}  // namespace
+
+void SharedMemoryTransport::create(const std::string& name, int world_size) {
+  const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    throw std::runtime_error(errno_message("shm_open failed: " + name));
+  }
+  // ftruncateした領域は0で埋まっているので、カウンタは0から始まる
+  const size_t length = segment_length(world_size);
+  const bool ok = ftruncate(fd, length) == 0;
+  close(fd);
+  if (!ok) {
+    shm_unlink(name.c_str());
+    throw std::runtime_error(errno_message("ftruncate failed: " + name));
+  }
+}
+
+void SharedMemoryTransport::unlink(const std::string& name) {
+  shm_unlink(name.c_str());
+}
+
+SharedMemoryTransport::SharedMemoryTransport(const std::string& name,
+                                             int rank, int world_size)
+    : Transport(rank, world_size), length_(segment_length(world_size)) {
+  const int fd = shm_open(name.c_str(), O_RDWR, 0600);
+  if (fd < 0) {
+    throw std::runtime_error(errno_message("shm_open failed: " + name));
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) != length_) {
+    close(fd);
+    throw std::runtime_error("shared memory has a wrong size: " + name);
+  }
+  addr_ = mmap(nullptr, length_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr_ == MAP_FAILED) {
+    addr_ = nullptr;
+    throw std::runtime_error(errno_message("mmap failed: " + name));
+  }
+}
+
+SharedMemoryTransport::~SharedMemoryTransport() {
+  if (addr_) {
+    munmap(addr_, length_);
+  }
+}
+
+void SharedMemoryTransport::exchange(const double* send, size_t send_n,
+                                     double* recv, size_t recv_n) {
+  Channel& out = channel(addr_, rank());
+  Channel& in = channel(addr_, (rank() + world_size() - 1) % world_size());
+  size_t sent = 0;
+  size_t received = 0;
+  while (sent < send_n || received < recv_n) {
+    bool progress = false;
+    if (sent < send_n) {
+      const uint64_t head = out.head.load(std::memory_order_relaxed);
+      const uint64_t tail = out.tail.load(std::memory_order_acquire);
+      const size_t m = std::min<size_t>(kChannelCapacity - (head - tail),
+                                        send_n - sent);
+      for (size_t j = 0; j < m; j++) {
+        out.data[(head + j) % kChannelCapacity] = send[sent + j];
+      }
+      out.head.store(head + m, std::memory_order_release);
+      sent += m;
+      progress = progress || m > 0;
+    }
+    if (received < recv_n) {
+      const uint64_t head = in.head.load(std::memory_order_acquire);
+      const uint64_t tail = in.tail.load(std::memory_order_relaxed);
+      const size_t m = std::min<size_t>(head - tail, recv_n - received);
+      for (size_t j = 0; j < m; j++) {
+        recv[received + j] = in.data[(tail + j) % kChannelCapacity];
+      }
+      in.tail.store(tail + m, std::memory_order_release);
+      received += m;
+      progress = progress || m > 0;
+    }
+    if (!progress) {
+      sched_yield();
+    }
+  }
+}
+
+UnixSocketTransport::UnixSocketTransport(const std::string& dir, int rank,
+                                         int world_size)
+    : Transport(rank, world_size), path_(socket_path(dir, rank)) {
+  if (world_size == 1) {
+    return;
+  }
+  // 先に待ち受けてから次のランクに接続する（接続はacceptの前でも成立する）
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+  const auto self = socket_address(path_);
+  if (listen_fd_ < 0 ||
+      bind(listen_fd_, reinterpret_cast<const sockaddr*>(&self),
+           sizeof(self)) != 0 ||
+      listen(listen_fd_, 1) != 0) {
+    throw std::runtime_error(errno_message("cannot listen on " + path_));
+  }
+
+  const auto next = socket_address(socket_path(dir, (rank + 1) % world_size));
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(30);
+  while (true) {
+    next_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connect(next_fd_, reinterpret_cast<const sockaddr*>(&next),
+                sizeof(next)) == 0) {
+      break;
+    }
+    const int err = errno;
+    close(next_fd_);
+    next_fd_ = -1;
+    // ENOENT, ECONNREFUSEDなら次のランクがまだ待ち受けていない
+    errno = err;
+    if ((err != ENOENT && err != ECONNREFUSED) ||
+        std::chrono::steady_clock::now() > deadline) {
+      throw std::runtime_error(errno_message("cannot connect to rank " +
+                                             std::to_string((rank + 1) %
+                                                            world_size)));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  prev_fd_ = accept(listen_fd_, nullptr, nullptr);
+  if (prev_fd_ < 0) {
+    throw std::runtime_error(errno_message("accept failed"));
+  }
+  set_nonblocking(next_fd_);
+  set_nonblocking(prev_fd_);
+}
+
+UnixSocketTransport::~UnixSocketTransport() {
+  for (int fd : {next_fd_, prev_fd_, listen_fd_}) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+  if (listen_fd_ >= 0) {
+    ::unlink(path_.c_str());
+  }
+}
+
+void UnixSocketTransport::exchange(const double* send, size_t send_n,
+                                   double* recv, size_t recv_n) {
+  const char* out = reinterpret_cast<const char*>(send);
+  char* in = reinterpret_cast<char*>(recv);
+  size_t out_left = send_n * sizeof(double);
+  size_t in_left = recv_n * sizeof(double);
+  while (out_left > 0 || in_left > 0) {
+    pollfd fds[2];
+    nfds_t n = 0;
+    if (out_left > 0) fds[n++] = {next_fd_, POLLOUT, 0};
+    if (in_left > 0) fds[n++] = {prev_fd_, POLLIN, 0};
+    if (poll(fds, n, -1) < 0) {
+      if (errno == EINTR) continue;
+      throw std::runtime_error(errno_message("poll failed"));
+    }
+    for (nfds_t i = 0; i < n; i++) {
+      if (fds[i].revents & POLLNVAL) {
+        throw std::runtime_error("invalid socket");
+      }
+      if (fds[i].fd == next_fd_ && (fds[i].revents & (POLLERR | POLLHUP))) {
+        throw ConnectionLost("next rank closed the connection");
+      }
+      if (fds[i].fd == next_fd_ && (fds[i].revents & POLLOUT)) {
+        const ssize_t w = ::send(next_fd_, out, out_left, MSG_NOSIGNAL);
+        if (w < 0 && (errno == EPIPE || errno == ECONNRESET)) {
+          throw ConnectionLost(errno_message("send failed"));
+        }
+        if (w < 0 && errno != EAGAIN && errno != EINTR) {
+          throw std::runtime_error(errno_message("send failed"));
+        }
+        if (w > 0) {
+          out += w;
+          out_left -= w;
+        }
+      }
+      if (fds[i].fd == prev_fd_ &&
+          (fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+        const ssize_t r = ::recv(prev_fd_, in, in_left, 0);
+        if (r == 0 || (r < 0 && errno == ECONNRESET)) {
+          throw ConnectionLost("previous rank closed the connection");
+        }
+        if (r < 0 && errno != EAGAIN && errno != EINTR) {
+          throw std::runtime_error(errno_message("recv failed"));
+        }
+        if (r > 0) {
+          in += r;
+          in_left -= r;
+        }
+      }
+    }
+  }
+}
+
+void allreduce(Transport& transport, double* data, size_t n) {
+  const int p = transport.world_size();
+  const int r = transport.rank();
+  if (p == 1 || n == 0) {
+    return;
+  }
+  // c番目のチャンクは[n * c / p, n * (c + 1) / p)
+  auto begin = [n, p](int c) { return n * c / p; };
+  auto size = [n, p](int c) { return n * (c + 1) / p - n * c / p; };
+  std::vector<double> buf(n / p + 1);
+
+  // reduce-scatter: p - 1回で、ランクrはチャンク(r + 1) % pの和を持つ
+  for (int s = 0; s < p - 1; s++) {
+    const int send_c = (r - s + p) % p;
+    const int recv_c = (r - s - 1 + 2 * p) % p;
+    transport.exchange(data + begin(send_c), size(send_c), buf.data(),
+                       size(recv_c));
+    double* dst = data + begin(recv_c);
+    for (size_t j = 0; j < size(recv_c); j++) {
+      dst[j] += buf[j];
+    }
+  }
+  // all-gather: 和の確定したチャンクを順に回す
+  for (int s = 0; s < p - 1; s++) {
+    const int send_c = (r + 1 - s + p) % p;
+    const int recv_c = (r - s + p) % p;
+    transport.exchange(data + begin(send_c), size(send_c),
+                       data + begin(recv_c), size(recv_c));
+  }
+}
+
+DistributedDataParallel::DistributedDataParallel(Transport& transport,
+                                                 std::vector<VarPtr> params,
+                                                 size_t bucket_size)
+    : transport_(transport),
+      params_(std::move(params)),
+      buckets_(data_parallel::make_buckets(params_, bucket_size)) {}
+
+void DistributedDataParallel::backward(const VarPtr& loss) {
+  const size_t nb = buckets_.size();
+  std::vector<int> bucket_of(params_.size());
+  std::vector<size_t> offset_of(params_.size());
+  std::vector<std::vector<double>> buffers(nb);
+  for (size_t b = 0; b < nb; b++) {
+    size_t size = 0;
+    for (int k : buckets_[b]) {
+      bucket_of[k] = b;
+      offset_of[k] = size;
+      size += params_[k]->size();
+    }
+    buffers[b].assign(size, 0.0);
+  }
+
+  auto uses = data_parallel::count_uses(loss, params_);
+  std::vector<int> pending(nb, 0);
+  for (size_t k = 0; k < params_.size(); k++) {
+    if (uses[k] > 0) {
+      pending[bucket_of[k]]++;
+    }
+  }
+
+  // 通信用のスレッドはバケットを0番から順に、確定するのを待ってall-reduceする
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<bool> ready(nb, false);
+  bool aborted = false;
+  std::exception_ptr error;
+  std::thread comm([&]() {
+    try {
+      for (size_t b = 0; b < nb; b++) {
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          cv.wait(lock, [&]() { return ready[b] || aborted; });
+          if (aborted) {
+            return;
+          }
+        }
+        allreduce(transport_, buffers[b].data(), buffers[b].size());
+      }
+    } catch (...) {
+      error = std::current_exception();
+    }
+  });
+
+  // バケットの勾配をバッファに写して通信用のスレッドに渡す
+  auto submit = [&](size_t b) {
+    for (int k : buckets_[b]) {
+      const auto& g = params_[k]->grad;
+      if (g) {
+        std::copy(g->data->data(), g->data->data() + g->data->size(),
+                  buffers[b].begin() + offset_of[k]);
+      }
+      // 行疎な勾配は密にして足す（全ランクで同じ大きさのバッファを通信する）
+      if (const auto& sg = params_[k]->sparse_grad) {
+        const auto shape = params_[k]->shape();
+        nc::NdArray<double> view(buffers[b].data() + offset_of[k], shape.rows,
+                                 shape.cols, false);
+        sg->add_to(view);
+      }
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      ready[b] = true;
+    }
+    cv.notify_one();
+  };
+  for (size_t k = 0; k < params_.size(); k++) {
+    if (uses[k] == 0) {
+      continue;
+    }
+    params_[k]->grad_hook = [&, k](const VarPtr&) {
+      if (--uses[k] == 0 && --pending[bucket_of[k]] == 0) {
+        submit(bucket_of[k]);
+      }
+    };
+  }
+  for (size_t b = 0; b < nb; b++) {
+    if (pending[b] == 0) {
+      submit(b);
+    }
+  }
+
+  try {
+    loss->backward();
+  } catch (...) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      aborted = true;
+    }
+    cv.notify_one();
+    comm.join();
+    for (auto& param : params_) param->grad_hook = nullptr;
+    throw;
+  }
+  comm.join();
+  for (auto& param : params_) param->grad_hook = nullptr;
+  if (error) {
+    std::rethrow_exception(error);
+  }
+
+  const double scale = 1.0 / transport_.world_size();
+  for (size_t k = 0; k < params_.size(); k++) {
+    nc::NdArray<double> g(params_[k]->shape());
+    const double* src = buffers[bucket_of[k]].data() + offset_of[k];
+    for (size_t j = 0; j < g.size(); j++) {
+      g[j] = src[j] * scale;
+    }
+    params_[k]->grad = as_variable(as_array(std::move(g)));
+    // 行疎な勾配は平均に含めた
+    params_[k]->sparse_grad = nullptr;
+  }
+}
+
+int launch(int world_size, Backend backend,
+           const std::function<int(Transport&)>& fn) {
+  if (world_size < 1) {
+    throw std::invalid_argument("launch: world_size must be positive");
+  }
+  static std::atomic<int> counter{0};
+  std::string name;
+  if (backend == Backend::SharedMemory) {
+    name = "/dezero-" + std::to_string(getpid()) + "-" +
+           std::to_string(counter++);
+    SharedMemoryTransport::create(name, world_size);
+  } else {
+    char dir[] = "/tmp/dezero-XXXXXX";
+    if (!mkdtemp(dir)) {
+      throw std::runtime_error(errno_message("mkdtemp failed"));
+    }
+    name = dir;
+  }
+  auto cleanup = [&]() {
+    if (backend == Backend::SharedMemory) {
+      SharedMemoryTransport::unlink(name);
+    } else {
+      std::error_code ec;
+      std::filesystem::remove_all(name, ec);
+    }
+  };
+
+  // 出力のバッファが子プロセスに複製されないようにする
+  std::cout.flush();
+  std::fflush(nullptr);
+  std::vector<pid_t> pids;
+  for (int r = 0; r < world_size; r++) {
+    const pid_t pid = fork();
+    if (pid == 0) {
+      int code = 1;
+      try {
+        std::unique_ptr<Transport> transport;
+        if (backend == Backend::SharedMemory) {
+          transport =
+              std::make_unique<SharedMemoryTransport>(name, r, world_size);
+        } else {
+          transport =
+              std::make_unique<UnixSocketTransport>(name, r, world_size);
+        }
+        code = fn(*transport);
+      } catch (const ConnectionLost& e) {
+        std::cerr << "rank " << r << ": " << e.what() << std::endl;
+        code = kConnectionLostExitCode;
+      } catch (const std::exception& e) {
+        std::cerr << "rank " << r << ": " << e.what() << std::endl;
+      }
+      std::cout.flush();
+      std::fflush(nullptr);
+      // 親プロセスから引き継いだ静的オブジェクトは破棄しない
+      _exit(code);
+    }
+    if (pid < 0) {
+      for (pid_t p : pids) kill(p, SIGKILL);
+      for (pid_t p : pids) waitpid(p, nullptr, 0);
+      cleanup();
+      throw std::runtime_error(errno_message("fork failed"));
+    }
+    pids.push_back(pid);
+  }
+
+  // 巻き添えで終わったランク（接続が切れた、止めた）より原因のランクのコードを返す
+  int result = 0;
+  int secondary = 0;
+  size_t running = pids.size();
+  std::vector<bool> done(pids.size(), false);
+  bool stopping = false;
+  while (running > 0) {
+    bool reaped = false;
+    for (size_t r = 0; r < pids.size(); r++) {
+      int status;
+      if (done[r] || waitpid(pids[r], &status, WNOHANG) != pids[r]) {
+        continue;
+      }
+      done[r] = true;
+      running--;
+      reaped = true;
+      const int code = WIFEXITED(status) ? WEXITSTATUS(status)
+                                         : 128 + WTERMSIG(status);
+      if (code == 0) {
+        continue;
+      }
+      const bool caused = code != kConnectionLostExitCode &&
+                          !(stopping && WIFSIGNALED(status) &&
+                            WTERMSIG(status) == SIGTERM);
+      if (caused && result == 0) {
+        result = code;
+      } else if (!caused && secondary == 0) {
+        secondary = code;
+      }
+      if (!stopping) {
+        // 1つのランクが失敗すると他のランクは通信で待ち続けるので止める
+        stopping = true;
+        for (size_t q = 0; q < pids.size(); q++) {
+          if (!done[q]) kill(pids[q], SIGTERM);
+        }
+      }
+    }
+    if (!reaped) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  if (result == 0) {
+    result = secondary;
+  }
+  cleanup();
+  return result;
+}
+}  // namespace distributed
@@ -0,0 +1,137 @@
+#ifndef DISTRIBUTED_
+#define DISTRIBUTED_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "core.h"
+
+// 複数プロセスのデータ並列学習
+// 各ランクは自分の計算グラフで順伝播・逆伝播を行い、パラメータの勾配を
+// リング型のall-reduce（reduce-scatter + all-gather）で全ランクの平均にする
+// ランク間の通信はTransportで抽象化し、同じホスト内ではPOSIX共有メモリと
+// Unixドメインソケットを使える（ホストをまたぐ場合はTCPなどでTransportを実装する）
+//
+//   distributed::launch(4, distributed::Backend::SharedMemory,
+//                       [&](distributed::Transport& t) {
+//     distributed::DistributedDataParallel ddp(t, params);
+//     for (...) {
+//       auto loss = f(shard(x, t.rank()));
+//       ddp.backward(loss);  // gradは全ランクの平均になる
+//       ...
+//     }
+//     return 0;
+//   });
+namespace distributed {
+// 隣のランクとの接続が切れた（多くは隣のランクが先に失敗した）
+class ConnectionLost : public std::runtime_error {
+ public:
+  using std::runtime_error::runtime_error;
+};
+
+// リング上の隣のランクとの通信路
+// ランクrは(r + 1) % world_sizeに送り、(r - 1) % world_sizeから受け取る
+class Transport {
+ public:
+  virtual ~Transport() = default;
+  int rank() const { return rank_; }
+  int world_size() const { return world_size_; }
+
+  // 次のランクへsend_n個を送りながら、前のランクからrecv_n個を受け取る
+  // （全ランクが同時に呼ぶので、送信と受信を交互に進めてデッドロックを避ける）
+  virtual void exchange(const double* send, size_t send_n, double* recv,
+                        size_t recv_n) = 0;
+
+ protected:
+  Transport(int rank, int world_size) : rank_(rank), world_size_(world_size) {}
+
+ private:
+  int rank_;
+  int world_size_;
+};
+
+// POSIX共有メモリ上の、ランクごとの送信用リングバッファ
+class SharedMemoryTransport : public Transport {
+ public:
+  // 共有メモリを作る（ランクが開く前に1回だけ呼ぶ）
+  static void create(const std::string& name, int world_size);
+  // 共有メモリの名前を削除する（開いているランクはそのまま使える）
+  static void unlink(const std::string& name);
+
+  SharedMemoryTransport(const std::string& name, int rank, int world_size);
+  ~SharedMemoryTransport() override;
+  SharedMemoryTransport(const SharedMemoryTransport&) = delete;
+  SharedMemoryTransport& operator=(const SharedMemoryTransport&) = delete;
+
+  void exchange(const double* send, size_t send_n, double* recv,
+                size_t recv_n) override;
+
+ private:
+  void* addr_ = nullptr;
+  size_t length_ = 0;
+};
+
+// ランクごとにdir/rank-<r>.sockで待ち受け、次のランクに接続する
+class UnixSocketTransport : public Transport {
+ public:
+  UnixSocketTransport(const std::string& dir, int rank, int world_size);
+  ~UnixSocketTransport() override;
+  UnixSocketTransport(const UnixSocketTransport&) = delete;
+  UnixSocketTransport& operator=(const UnixSocketTransport&) = delete;
+
+  void exchange(const double* send, size_t send_n, double* recv,
+                size_t recv_n) override;
+
+ private:
+  int listen_fd_ = -1;
+  int next_fd_ = -1;
+  int prev_fd_ = -1;
+  std::string path_;
+};
+
+// 全ランクのdata[0, n)の和を全ランクのdataに入れる
+// 和を取る順番はランクによらないので、全ランクで結果が一致する
+void allreduce(Transport& transport, double* data, size_t n);
+
+// 勾配をバケットにまとめ、逆伝播と並行して（勾配の確定したバケットから）
+// 通信用のスレッドでall-reduceする
+// バケットは全ランクで同じ順に通信する
+class DistributedDataParallel {
+ public:
+  // bucket_sizeはバケット1つの要素数の目安
+  DistributedDataParallel(Transport& transport, std::vector<VarPtr> params,
+                          size_t bucket_size = 1 << 18);
+
+  // loss->backward()を行い、params[k]->gradを全ランクの平均にする
+  // （各ランクのlossはシャード内の平均で、シャードの大きさが等しいこと）
+  // 損失に関係しないパラメータの勾配は0として扱う
+  // 行疎な勾配（sparse_grad）は密にして平均に含め、gradに入れる
+  void backward(const VarPtr& loss);
+
+  size_t num_buckets() const { return buckets_.size(); }
+
+ private:
+  Transport& transport_;
+  std::vector<VarPtr> params_;
+  std::vector<std::vector<int>> buckets_;
+};
+
+enum class Backend { SharedMemory, UnixSocket };
+
+// launchでConnectionLostが投げられたランクの終了コード
+constexpr int kConnectionLostExitCode = 125;
+
+// world_size個のプロセスをforkし、それぞれでfn(transport)を実行する
+// 全てのプロセスが0を返せば0、どれかが失敗すれば残りを止めてその終了コードを返す
+// （ConnectionLostで終わったランクや止めたランクより、原因のランクのコードを優先する）
+// 子プロセスではスレッドプールは作り直されるが、fork前に使い始めた
+// stream::default_stream()やrelease_asyncのスレッドは使えない
+int launch(int world_size, Backend backend,
+           const std::function<int(Transport&)>& fn);
+}  // namespace distributed
+
+#endif
@@ -0,0 +1,309 @@
+#ifndef EXPR_
+#define EXPR_
+
+#include <cmath>
+#include <type_traits>
+#include <utility>
+
+#include "NumCpp.hpp"
+#include "core.h"
+#include "functions.h"
+#include "kernels.h"
+#include "parallel.h"
+
+// 要素ごとの演算の式テンプレート
+// lazy(x)で包んだVariableどうしの演算は中間結果を作らずに式の木（型）だけを組み立て、
+// VarPtrへの代入時に評価する
+//   - Config::enable_backprop: 通常どおりFunctionを繋いで計算グラフを作る
+//   - それ以外: 木全体を1回のループで評価し、出力以外のバッファを確保しない
+//
+// 例: VarPtr y = 1.0 - lazy(t) * lazy(t);
+//     VarPtr z = expr::tanh(lazy(a) * lazy(x) + lazy(b));
+namespace expr {
+template <typename T>
+using is_node = std::is_base_of<LazyExpr, T>;
+
+// 葉: Variableのデータを参照する
+// 次元が1の方向はstrideを0にしてブロードキャストする
+class Leaf : public LazyExpr {
+ public:
+  explicit Leaf(VarPtr var)
+      : var_(std::move(var)),
+        data_(var_->data),
+        p_(data_->data()),
+        rows_(var_->data->shape().rows),
+        cols_(var_->data->shape().cols),
+        row_stride_(rows_ == 1 ? 0 : cols_),
+        col_stride_(cols_ == 1 ? 0 : 1) {}
+
+  nc::Shape shape() const { return nc::Shape(rows_, cols_); }
+  // 出力と同じ形なら通し番号で読める
+  bool flat(const nc::Shape& s) const {
+    return rows_ == s.rows && cols_ == s.cols;
+  }
+  double at(size_t i) const { return p_[i]; }
+  double at(size_t r, size_t c) const {
+    return p_[r * row_stride_ + c * col_stride_];
+  }
+  VarPtr var() const { return var_; }
+  operator VarPtr() const { return var_; }
+
+ private:
+  VarPtr var_;
+  // 評価中にvar_->dataが差し替えられても参照先を保つ
+  NdArrPtr data_;
+  const double* p_;
+  size_t rows_, cols_;
+  size_t row_stride_, col_stride_;
+};
+
+// 定数
+class Scalar : public LazyExpr {
+ public:
+  explicit Scalar(double value) : value_(value) {}
+  nc::Shape shape() const { return nc::Shape(1, 1); }
+  bool flat(const nc::Shape&) const { return true; }
+  double at(size_t) const { return value_; }
+  double at(size_t, size_t) const { return value_; }
+  // 計算グラフでは定数用のFunction（AddScalarなど）になる
+  double var() const { return value_; }
+
+ private:
+  double value_;
+};
+
+template <typename Op, typename E>
+class Unary : public LazyExpr {
+ public:
+  Unary(Op op, E e) : op_(op), e_(std::move(e)) {}
+  nc::Shape shape() const { return e_.shape(); }
+  bool flat(const nc::Shape& s) const { return e_.flat(s); }
+  double at(size_t i) const { return op_(e_.at(i)); }
+  double at(size_t r, size_t c) const { return op_(e_.at(r, c)); }
+  VarPtr var() const { return op_.var(e_.var()); }
+  operator VarPtr() const;
+
+ private:
+  Op op_;
+  E e_;
+};
+
+template <typename Op, typename L, typename R>
+class Binary : public LazyExpr {
+ public:
+  Binary(L l, R r) : l_(std::move(l)), r_(std::move(r)) {}
+  nc::Shape shape() const {
+    return kernels::broadcast_shape(l_.shape(), r_.shape());
+  }
+  bool flat(const nc::Shape& s) const { return l_.flat(s) && r_.flat(s); }
+  double at(size_t i) const { return Op()(l_.at(i), r_.at(i)); }
+  double at(size_t r, size_t c) const {
+    return Op()(l_.at(r, c), r_.at(r, c));
+  }
+  VarPtr var() const { return Op::var(l_.var(), r_.var()); }
+  operator VarPtr() const;
+
+ private:
+  L l_;
+  R r_;
+};
+
+// 式をyに書き込む（yの形は式をブロードキャストした形と一致している必要がある）
+// 各要素は同じ位置の入力しか読まないので、yが式の葉と同じ配列でもよい
+template <typename E>
+inline void assign(nc::NdArray<double>& y, const E& e) {
+  const auto shape = y.shape();
+  if (kernels::broadcast_shape(e.shape(), shape) != shape) {
+    throw std::invalid_argument("expr::assign: shapes are not compatible");
+  }
+  double* dst = y.data();
+  if (e.flat(shape)) {
+    parallel::parallel_for(0, y.size(), [dst, &e](size_t b, size_t end) {
+      for (size_t i = b; i < end; i++) dst[i] = e.at(i);
+    });
+  } else {
+    const size_t cols = shape.cols;
+    const size_t grain = std::max<size_t>(1, parallel::get_grain_size() / cols);
+    parallel::parallel_for(0, shape.rows, grain,
+                           [dst, cols, &e](size_t b, size_t end) {
+                             for (size_t r = b; r < end; r++) {
+                               for (size_t c = 0; c < cols; c++) {
+                                 dst[r * cols + c] = e.at(r, c);
+                               }
+                             }
+                           });
+  }
+}
+
+template <typename E>
+inline nc::NdArray<double> eval(const E& e) {
+  nc::NdArray<double> y(e.shape());
+  assign(y, e);
+  return y;
+}
+
+template <typename E>
+inline VarPtr to_var(const E& e) {
+  if (Config::enable_backprop) {
+    return e.var();
+  }
+  return as_variable(as_array(eval(e)));
+}
+
+template <typename Op, typename E>
+inline Unary<Op, E>::operator VarPtr() const {
+  return to_var(*this);
+}
+template <typename Op, typename L, typename R>
+inline Binary<Op, L, R>::operator VarPtr() const {
+  return to_var(*this);
+}
+
+inline Leaf lazy(const VarPtr& x) { return Leaf(x); }
+
+// 演算の対象を式のノードにそろえる
+inline Leaf as_node(const VarPtr& x) { return Leaf(x); }
+inline Scalar as_node(double x) { return Scalar(x); }
+template <typename E, std::enable_if_t<is_node<E>::value, int> = 0>
+inline const E& as_node(const E& e) {
+  return e;
+}
+
+// 少なくとも片方がノードで、もう片方がノード・VarPtr・数値のとき
+template <typename L, typename R>
+using EnableBinary = std::enable_if_t<
+    (is_node<L>::value || is_node<R>::value) &&
+        (is_node<L>::value || std::is_same<L, VarPtr>::value ||
+         std::is_arithmetic<L>::value) &&
+        (is_node<R>::value || std::is_same<R, VarPtr>::value ||
+         std::is_arithmetic<R>::value),
+    int>;
+
+template <typename Op, typename L, typename R>
+inline auto make_binary(const L& l, const R& r) {
+  using LN = std::decay_t<decltype(as_node(l))>;
+  using RN = std::decay_t<decltype(as_node(r))>;
+  return Binary<Op, LN, RN>(as_node(l), as_node(r));
+}
+
+struct AddOp {
+  double operator()(double a, double b) const { return a + b; }
+  template <typename A, typename B>
+  static VarPtr var(const A& a, const B& b) {
+    return a + b;
+  }
+};
+struct SubOp {
+  double operator()(double a, double b) const { return a - b; }
+  template <typename A, typename B>
+  static VarPtr var(const A& a, const B& b) {
+    return a - b;
+  }
+};
+struct MulOp {
+  double operator()(double a, double b) const { return a * b; }
+  template <typename A, typename B>
+  static VarPtr var(const A& a, const B& b) {
+    return a * b;
+  }
+};
+struct DivOp {
+  double operator()(double a, double b) const { return a / b; }
+  template <typename A, typename B>
+  static VarPtr var(const A& a, const B& b) {
+    return a / b;
+  }
+};
+
+template <typename L, typename R, EnableBinary<L, R> = 0>
+inline auto operator+(const L& l, const R& r) {
+  return make_binary<AddOp>(l, r);
+}
+template <typename L, typename R, EnableBinary<L, R> = 0>
+inline auto operator-(const L& l, const R& r) {
+  return make_binary<SubOp>(l, r);
+}
+template <typename L, typename R, EnableBinary<L, R> = 0>
+inline auto operator*(const L& l, const R& r) {
+  return make_binary<MulOp>(l, r);
+}
+template <typename L, typename R, EnableBinary<L, R> = 0>
+inline auto operator/(const L& l, const R& r) {
+  return make_binary<DivOp>(l, r);
+}
+
+struct NegOp {
+  double operator()(double x) const { return -x; }
+  VarPtr var(const VarPtr& x) const { return -x; }
+};
+struct PowOp {
+  int c;
+  double operator()(double x) const { return kernels::ipow(x, c); }
+  VarPtr var(const VarPtr& x) const { return ::pow(x, c); }
+};
+struct SinOp {
+  double operator()(double x) const { return std::sin(x); }
+  VarPtr var(const VarPtr& x) const { return F::sin(x); }
+};
+struct CosOp {
+  double operator()(double x) const { return std::cos(x); }
+  VarPtr var(const VarPtr& x) const { return F::cos(x); }
+};
+struct TanhOp {
+  double operator()(double x) const { return std::tanh(x); }
+  VarPtr var(const VarPtr& x) const { return F::tanh(x); }
+};
+struct ExpOp {
+  double operator()(double x) const { return std::exp(x); }
+  VarPtr var(const VarPtr& x) const { return F::exp(x); }
+};
+struct LogOp {
+  double operator()(double x) const { return std::log(x); }
+  VarPtr var(const VarPtr& x) const { return F::log(x); }
+};
+struct SigmoidOp {
+  double operator()(double x) const { return 1.0 / (1.0 + std::exp(-x)); }
+  VarPtr var(const VarPtr& x) const { return F::sigmoid(x); }
+};
+
+template <typename Op, typename E>
+inline auto make_unary(Op op, const E& e) {
+  using N = std::decay_t<decltype(as_node(e))>;
+  return Unary<Op, N>(op, as_node(e));
+}
+
+template <typename E, std::enable_if_t<is_node<E>::value, int> = 0>
+inline auto operator-(const E& e) {
+  return make_unary(NegOp(), e);
+}
+template <typename E>
+inline auto pow(const E& e, int c) {
+  return make_unary(PowOp{c}, e);
+}
+template <typename E>
+inline auto sin(const E& e) {
+  return make_unary(SinOp(), e);
+}
+template <typename E>
+inline auto cos(const E& e) {
+  return make_unary(CosOp(), e);
+}
+template <typename E>
+inline auto tanh(const E& e) {
+  return make_unary(TanhOp(), e);
+}
+template <typename E>
+inline auto exp(const E& e) {
+  return make_unary(ExpOp(), e);
+}
+template <typename E>
+inline auto log(const E& e) {
+  return make_unary(LogOp(), e);
+}
+template <typename E>
+inline auto sigmoid(const E& e) {
+  return make_unary(SigmoidOp(), e);
+}
+}  // namespace expr
+
+#endif
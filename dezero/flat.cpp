@@ -0,0 +1,212 @@
+#include "flat.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "distributed.h"
+#include "kernels.h"
+#include "parallel.h"
+
+namespace flat {
+namespace {
+// bufferのoffsetからのshapeの部分を指すビュー
+// bufferの参照を持つので、ビューが残っている間はバッファは解放されない
+NdArrPtr make_view(const std::shared_ptr<std::vector<double>>& buffer,
+                   size_t offset, const nc::Shape& shape) {
+  auto* view = new nc::NdArray<double>(buffer->data() + offset, shape.rows,
+                                       shape.cols, false);
+  return NdArrPtr(view, [buffer](nc::NdArray<double>* p) { delete p; });
+}
+
+// 全要素の2乗和（kernels::sum_allと同じくgrainごとの部分和を木構造で足す）
+double sum_squares(const double* p, size_t n) {
+  auto chunk = [p](size_t b, size_t e) {
+    double acc[8] = {};
+    size_t i = b;
+    for (; i + 8 <= e; i += 8) {
+      for (int j = 0; j < 8; j++) acc[j] += p[i + j] * p[i + j];
+    }
+    for (; i < e; i++) acc[0] += p[i] * p[i];
+    return ((acc[0] + acc[1]) + (acc[2] + acc[3])) +
+           ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+  };
+  const size_t grain = parallel::get_grain_size();
+  if (n < 2 * grain) {
+    return chunk(0, n);
+  }
+  const size_t num = (n + grain - 1) / grain;
+  std::vector<double> parts(num);
+  parallel::parallel_for(0, num, 1, [&](size_t b, size_t e) {
+    for (size_t k = b; k < e; k++) {
+      parts[k] = chunk(k * grain, std::min(n, (k + 1) * grain));
+    }
+  });
+  kernels::tree_reduce(parts.data(), num, 1);
+  return parts[0];
+}
+}  // namespace
+
+FlatParameters::FlatParameters(std::vector<VarPtr> params)
+    : params_(std::move(params)) {
+  std::vector<Variable*> seen;
+  for (const auto& p : params_) {
+    if (!p) {
+      throw std::invalid_argument("FlatParameters: null parameter");
+    }
+    if (p->creator_ptr) {
+      throw std::invalid_argument("FlatParameters: parameter is not a leaf");
+    }
+    seen.push_back(p.get());
+  }
+  // 同じ変数が2回あるとバッファ上に2か所を持ってしまう
+  std::sort(seen.begin(), seen.end());
+  if (std::adjacent_find(seen.begin(), seen.end()) != seen.end()) {
+    throw std::invalid_argument("FlatParameters: duplicated parameter");
+  }
+
+  for (const auto& p : params_) {
+    offsets_.push_back(size_);
+    shapes_.push_back(p->data->shape());
+    size_ += p->data->size();
+  }
+  data_ = std::make_shared<std::vector<double>>(size_);
+  grad_ = std::make_shared<std::vector<double>>(size_, 0.0);
+  for (size_t k = 0; k < params_.size(); k++) {
+    auto& p = *params_[k];
+    std::copy(p.data->begin(), p.data->end(), data_->begin() + offsets_[k]);
+    p.data = make_view(data_, offsets_[k], shapes_[k]);
+    p.grad_view = make_view(grad_, offsets_[k], shapes_[k]);
+    // 今までの勾配は引き継ぐ
+    if (p.grad) {
+      std::copy(p.grad->data->begin(), p.grad->data->end(),
+                p.grad_view->begin());
+    }
+    p.grad = as_variable(p.grad_view);
+  }
+}
+
+void FlatParameters::sync() {
+  for (size_t k = 0; k < params_.size(); k++) {
+    auto& p = *params_[k];
+    double* data = data_->data() + offsets_[k];
+    double* grad = grad_->data() + offsets_[k];
+    const size_t n = shapes_[k].size();
+
+    const auto& d = p.data.get();
+    if (d->data() != data) {
+      if (d->shape() != shapes_[k]) {
+        throw std::invalid_argument("FlatParameters: parameter shape changed");
+      }
+      std::copy(d->begin(), d->end(), data);
+      p.data = make_view(data_, offsets_[k], shapes_[k]);
+    }
+
+    if (!p.grad || p.grad->data->data() != grad) {
+      if (!p.grad) {
+        std::fill(grad, grad + n, 0.0);
+      } else if (p.grad->data->shape() != shapes_[k]) {
+        throw std::invalid_argument("FlatParameters: gradient shape changed");
+      } else {
+        std::copy(p.grad->data->begin(), p.grad->data->end(), grad);
+      }
+      if (p.grad_view->data() != grad) {
+        p.grad_view = make_view(grad_, offsets_[k], shapes_[k]);
+      }
+      p.grad = as_variable(p.grad_view);
+    }
+    // 行疎の勾配は触れた行だけ足す
+    if (p.sparse_grad) {
+      p.sparse_grad->add_to(*p.grad_view);
+      p.sparse_grad = nullptr;
+    }
+  }
+}
+
+void FlatParameters::cleargrads() {
+  std::memset(grad_->data(), 0, size_ * sizeof(double));
+  for (size_t k = 0; k < params_.size(); k++) {
+    auto& p = *params_[k];
+    const double* grad = grad_->data() + offsets_[k];
+    if (p.grad_view->data() != grad) {
+      p.grad_view = make_view(grad_, offsets_[k], shapes_[k]);
+    }
+    if (!p.grad || p.grad->data->data() != grad) {
+      p.grad = as_variable(p.grad_view);
+    }
+    p.sparse_grad = nullptr;
+  }
+}
+
+double FlatParameters::grad_norm() {
+  sync();
+  return std::sqrt(sum_squares(grad_->data(), size_));
+}
+
+double FlatParameters::clip_grad_norm(double max_norm) {
+  const double norm = grad_norm();
+  if (norm > max_norm) {
+    const double scale = max_norm / (norm + 1e-6);
+    double* g = grad_->data();
+    parallel::parallel_for(0, size_, [g, scale](size_t b, size_t e) {
+      for (size_t i = b; i < e; i++) g[i] *= scale;
+    });
+  }
+  return norm;
+}
+
+void FlatParameters::sgd(double lr) {
+  sync();
+  double* x = data_->data();
+  const double* g = grad_->data();
+  parallel::parallel_for(0, size_, [x, g, lr](size_t b, size_t e) {
+    for (size_t i = b; i < e; i++) x[i] -= lr * g[i];
+  });
+}
+
+void FlatParameters::momentum_sgd(double lr, double momentum) {
+  sync();
+  m_.resize(size_, 0.0);
+  double* x = data_->data();
+  double* v = m_.data();
+  const double* g = grad_->data();
+  parallel::parallel_for(0, size_, [=](size_t b, size_t e) {
+    for (size_t i = b; i < e; i++) {
+      v[i] = momentum * v[i] - lr * g[i];
+      x[i] += v[i];
+    }
+  });
+}
+
+void FlatParameters::adam(double lr, double beta1, double beta2, double eps) {
+  sync();
+  m_.resize(size_, 0.0);
+  v_.resize(size_, 0.0);
+  adam_steps_++;
+  const double c1 = 1.0 - std::pow(beta1, adam_steps_);
+  const double c2 = 1.0 - std::pow(beta2, adam_steps_);
+  const double step = lr * std::sqrt(c2) / c1;
+  double* x = data_->data();
+  double* m = m_.data();
+  double* v = v_.data();
+  const double* g = grad_->data();
+  parallel::parallel_for(0, size_, [=](size_t b, size_t e) {
+    for (size_t i = b; i < e; i++) {
+      m[i] += (1.0 - beta1) * (g[i] - m[i]);
+      v[i] += (1.0 - beta2) * (g[i] * g[i] - v[i]);
+      x[i] -= step * m[i] / (std::sqrt(v[i]) + eps);
+    }
+  });
+}
+
+void FlatParameters::allreduce(distributed::Transport& transport) {
+  sync();
+  double* g = grad_->data();
+  distributed::allreduce(transport, g, size_);
+  const double scale = 1.0 / transport.world_size();
+  parallel::parallel_for(0, size_, [g, scale](size_t b, size_t e) {
+    for (size_t i = b; i < e; i++) g[i] *= scale;
+  });
+}
+}  // namespace flat
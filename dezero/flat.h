@@ -0,0 +1,80 @@
+#ifndef FLAT_
+#define FLAT_
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "NumCpp.hpp"
+#include "core.h"
+
+namespace distributed {
+class Transport;
+}  // namespace distributed
+
+// パラメータとその勾配を1本ずつの連続したバッファにまとめたもの
+// 各パラメータのdataとgrad_view（逆伝播で勾配が足される先）はバッファ上の
+// 自分の部分を指すビューになり、パラメータの数によらず、勾配の消去は1回のmemset、
+// 勾配ノルムによるクリッピングやパラメータの更新は全体を1回なめるだけになる
+//
+//   flat::FlatParameters flat({W1, b1, W2, b2});
+//   for (...) {
+//     flat.cleargrads();
+//     loss(x, t)->backward();
+//     flat.clip_grad_norm(1.0);
+//     flat.sgd(0.01);
+//   }
+//
+// ビューはバッファを共有して持つので、FlatParametersより長く生きてよい
+// 逆伝播は勾配をビューにその場で足すので、前のgradを取っておく場合はコピーする
+// *p->data = ...のようにdataやgradを別の配列に差し替えた場合（代入で配列は
+// 確保し直される）や、sparse_gradに足された勾配は、次の一括処理の前にsyncが
+// バッファに書き戻す（gradがnullptrのパラメータの勾配は0として扱う）
+namespace flat {
+class FlatParameters {
+ public:
+  explicit FlatParameters(std::vector<VarPtr> params);
+  FlatParameters(const FlatParameters&) = delete;
+  FlatParameters& operator=(const FlatParameters&) = delete;
+
+  // 全要素数とk番目のパラメータのバッファ内の位置
+  size_t size() const { return size_; }
+  size_t offset(size_t k) const { return offsets_[k]; }
+  const std::vector<VarPtr>& params() const { return params_; }
+  // 連続したパラメータと勾配（syncの後はparams()のdataとgradの値と一致する）
+  double* data() { return data_->data(); }
+  double* grad() { return grad_->data(); }
+
+  // 差し替えられたdataとgrad、sparse_gradをバッファに書き戻し、ビューを指し直す
+  void sync();
+  // 全パラメータの勾配を0にする（各gradは0のビューになる）
+  void cleargrads();
+  // 全勾配をつないだベクトルのL2ノルム
+  double grad_norm();
+  // 勾配ノルムがmax_normを超えていれば、全勾配をmax_norm / ノルム倍する
+  // 縮める前のノルムを返す
+  double clip_grad_norm(double max_norm);
+  // data -= lr * grad
+  void sgd(double lr);
+  // v = momentum * v - lr * grad, data += v
+  void momentum_sgd(double lr, double momentum = 0.9);
+  // Adam（バイアス補正あり）。状態もバッファと同じ並びの連続した配列に持つ
+  void adam(double lr = 0.001, double beta1 = 0.9, double beta2 = 0.999,
+            double eps = 1e-8);
+  // 全ランクの勾配の平均を1回のall-reduceで求める
+  void allreduce(distributed::Transport& transport);
+
+ private:
+  std::vector<VarPtr> params_;
+  std::vector<size_t> offsets_;
+  std::vector<nc::Shape> shapes_;
+  size_t size_ = 0;
+  std::shared_ptr<std::vector<double>> data_;
+  std::shared_ptr<std::vector<double>> grad_;
+  // 最適化手法の状態（最初に使うときに確保する）
+  std::vector<double> m_, v_;
+  long adam_steps_ = 0;
+};
+}  // namespace flat
+
+#endif
@@ -1,45 +1,258 @@
 #include "functions.h"
 
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <tuple>
+#include <utility>
+#include <string>
+
+#include "expr.h"
+#include "kernels.h"
+#include "parallel.h"
+#include "vmath.h"
+
 namespace F {
+namespace {
+// 勾配を行疎のままVariable::sparse_gradに足せるか
+// テープに記録された変数は葉かどうかわからないので密な勾配にする
+bool takes_sparse_grad(const Variable& x) {
+  return !Config::enable_backprop && !x.creator_ptr && x.tape_slot < 0;
+}
+
+// gradに足す場合と同じく、足したらgrad_hookを呼ぶ
+// （Variable::backwardはnullptrの勾配ではフックを呼ばないので、ここで呼ぶ。
+// data_parallelなどはフックが呼ばれた回数で勾配が確定したことを知る）
+void add_sparse_grad(Variable& x, sparse::RowSparse g) {
+  x.sparse_grad = x.sparse_grad
+                      ? std::make_shared<sparse::RowSparse>(*x.sparse_grad + g)
+                      : std::make_shared<sparse::RowSparse>(std::move(g));
+  if (x.grad_hook) {
+    x.grad_hook(x.shared_from_this());
+  }
+}
+
+// 行を分けてfn(begin, end)を並列に呼ぶ
+template <typename Fn>
+void for_rows(size_t rows, size_t cols, Fn fn) {
+  const size_t grain = std::max<size_t>(
+      1, parallel::get_grain_size() / std::max<size_t>(1, cols));
+  parallel::parallel_for(0, rows, grain, fn);
+}
+
+// 1行の最大値mとsum(exp(x - m))（log-sum-expはm + log(和)）
+// ブロックごとに最大値を取り、それまでの和をexp(古い最大値 - 新しい最大値)倍して
+// 合わせるので、行を1回なめるだけで済む（expはブロック単位でvmathに渡す）
+constexpr size_t kLogSumExpBlock = 256;
+std::pair<double, double> max_sum_exp(const double* x, size_t n) {
+  double buf[kLogSumExpBlock];
+  double m = -std::numeric_limits<double>::infinity();
+  double s = 0.0;
+  for (size_t b = 0; b < n; b += kLogSumExpBlock) {
+    const size_t len = std::min(kLogSumExpBlock, n - b);
+    double bm = x[b];
+    for (size_t k = 1; k < len; k++) bm = std::max(bm, x[b + k]);
+    if (bm > m) {
+      s *= std::exp(m - bm);
+      m = bm;
+    }
+    for (size_t k = 0; k < len; k++) buf[k] = x[b + k] - m;
+    vmath::exp(buf, buf, len);
+    s += kernels::sum_contiguous(buf, len);
+  }
+  return {m, s};
+}
+
+// (rows, cols)の[begin, end)行のmax_sum_exp
+// 列が少なければ複数の行をまとめてvmathに渡す
+void max_sum_exp_rows(const double* x, size_t cols, size_t begin, size_t end,
+                      double* m, double* s) {
+  if (cols == 0 || cols >= kLogSumExpBlock) {
+    for (size_t r = begin; r < end; r++) {
+      std::tie(m[r], s[r]) = max_sum_exp(x + r * cols, cols);
+    }
+    return;
+  }
+  double buf[kLogSumExpBlock];
+  const size_t per = kLogSumExpBlock / cols;
+  for (size_t r0 = begin; r0 < end; r0 += per) {
+    const size_t r1 = std::min(end, r0 + per);
+    for (size_t r = r0; r < r1; r++) {
+      const double* row = x + r * cols;
+      double* dst = buf + (r - r0) * cols;
+      m[r] = *std::max_element(row, row + cols);
+      for (size_t k = 0; k < cols; k++) dst[k] = row[k] - m[r];
+    }
+    vmath::exp(buf, buf, (r1 - r0) * cols);
+    for (size_t r = r0; r < r1; r++) {
+      s[r] = kernels::sum_contiguous(buf + (r - r0) * cols, cols);
+    }
+  }
+}
+
+// [begin, end)行のscale * softmax: y = exp(x - m) * (scale / s)
+// （exp(x - logsumexp)より、丸められたlogsumexpの誤差が入らない）
+void softmax_rows(const double* x, size_t cols, size_t begin, size_t end,
+                  const double* m, const double* s, double scale, double* y) {
+  for (size_t r = begin; r < end; r++) {
+    for (size_t k = 0; k < cols; k++) {
+      y[r * cols + k] = x[r * cols + k] - m[r];
+    }
+  }
+  // 連続した行はまとめて1回でexpする
+  vmath::exp(y + begin * cols, y + begin * cols, (end - begin) * cols);
+  for (size_t r = begin; r < end; r++) {
+    const double c = scale / s[r];
+    for (size_t k = 0; k < cols; k++) y[r * cols + k] *= c;
+  }
+}
+
+// softmaxの出力yでのヤコビアンとgの積 y * (g - sum(y * g))
+// ヤコビアンは対称なので前進モードと逆伝播で共通
+nc::NdArray<double> softmax_jacobian_dot(const nc::NdArray<double>& y,
+                                         const nc::NdArray<double>& g) {
+  const size_t rows = y.shape().rows;
+  const size_t cols = y.shape().cols;
+  nc::NdArray<double> gx(y.shape());
+  const double* py = y.data();
+  const double* pg = g.data();
+  double* pgx = gx.data();
+  for_rows(rows, cols, [=](size_t begin, size_t end) {
+    for (size_t r = begin; r < end; r++) {
+      const double* yr = py + r * cols;
+      const double* gr = pg + r * cols;
+      double dot = 0.0;
+      for (size_t k = 0; k < cols; k++) dot += yr[k] * gr[k];
+      for (size_t k = 0; k < cols; k++) {
+        pgx[r * cols + k] = yr[k] * (gr[k] - dot);
+      }
+    }
+  });
+  return gx;
+}
+}  // namespace
+
 std::vector<NdArrPtr> Sin::forward(const std::vector<NdArrPtr>& xs) {
   assert(xs.size() == 1);
-  std::vector<NdArrPtr> ys = {as_array(nc::sin(*xs[0]))};
+  std::vector<NdArrPtr> ys = {
+      as_array(vmath::sin(*xs[0]))};
   return ys;
 }
 std::vector<VarPtr> Sin::backward(const std::vector<VarPtr>& gy) {
   assert(gy.size() == 1);
+  // 逆伝播のグラフを作らないときはndarrayのまま1回で計算する
+  if (!Config::enable_backprop) {
+    auto c = vmath::cos(*this->inputs_[0]->data);
+    return {as_variable(as_array(kernels::binary(
+        *gy[0]->data, c, [](double g, double c) { return g * c; })))};
+  }
   std::vector<VarPtr> gx = {gy[0] * cos(this->inputs_[0])};
   return gx;
 }
+std::vector<NdArrPtr> Sin::jvp(const std::vector<NdArrPtr>& xs,
+                               const std::vector<NdArrPtr>& ys,
+                               const std::vector<NdArrPtr>& txs) {
+  return {as_array(vmath::cos(*xs[0]) * *txs[0])};
+}
 
 std::vector<NdArrPtr> Cos::forward(const std::vector<NdArrPtr>& xs) {
   assert(xs.size() == 1);
-  std::vector<NdArrPtr> ys = {as_array(nc::cos(*xs[0]))};
+  std::vector<NdArrPtr> ys = {
+      as_array(vmath::cos(*xs[0]))};
   return ys;
 }
 std::vector<VarPtr> Cos::backward(const std::vector<VarPtr>& gy) {
   assert(gy.size() == 1);
+  if (!Config::enable_backprop) {
+    auto s = vmath::sin(*this->inputs_[0]->data);
+    return {as_variable(as_array(kernels::binary(
+        *gy[0]->data, s, [](double g, double s) { return -g * s; })))};
+  }
   std::vector<VarPtr> gx = {gy[0] * -sin(this->inputs_[0])};
   return gx;
 }
+std::vector<NdArrPtr> Cos::jvp(const std::vector<NdArrPtr>& xs,
+                               const std::vector<NdArrPtr>& ys,
+                               const std::vector<NdArrPtr>& txs) {
+  return {as_array(-vmath::sin(*xs[0]) * *txs[0])};
+}
 
 std::vector<NdArrPtr> Tanh::forward(const std::vector<NdArrPtr>& xs) {
   assert(xs.size() == 1);
-  std::vector<NdArrPtr> ys = {as_array(nc::tanh(*xs[0]))};
+  std::vector<NdArrPtr> ys = {
+      as_array(vmath::tanh(*xs[0]))};
   return ys;
 }
 std::vector<VarPtr> Tanh::backward(const std::vector<VarPtr>& gy) {
   assert(gy.size() == 1);
-  std::vector<VarPtr> gx = {
-      gy[0] * (1.0 - this->outputs_[0].lock() * this->outputs_[0].lock())};
+  // 逆伝播のグラフを作らないときは式全体を1回のループで計算する
+  const auto y = expr::lazy(this->outputs_[0].lock());
+  std::vector<VarPtr> gx = {expr::lazy(gy[0]) * (1.0 - y * y)};
   return gx;
 }
 
+std::vector<NdArrPtr> Exp::forward(const std::vector<NdArrPtr>& xs) {
+  assert(xs.size() == 1);
+  std::vector<NdArrPtr> ys = {as_array(vmath::exp(*xs[0]))};
+  return ys;
+}
+std::vector<VarPtr> Exp::backward(const std::vector<VarPtr>& gy) {
+  assert(gy.size() == 1);
+  std::vector<VarPtr> gx = {gy[0] * this->outputs_[0].lock()};
+  return gx;
+}
+std::vector<NdArrPtr> Exp::jvp(const std::vector<NdArrPtr>& xs,
+                               const std::vector<NdArrPtr>& ys,
+                               const std::vector<NdArrPtr>& txs) {
+  return {as_array(*ys[0] * *txs[0])};
+}
+
+std::vector<NdArrPtr> Log::forward(const std::vector<NdArrPtr>& xs) {
+  assert(xs.size() == 1);
+  std::vector<NdArrPtr> ys = {as_array(vmath::log(*xs[0]))};
+  return ys;
+}
+std::vector<VarPtr> Log::backward(const std::vector<VarPtr>& gy) {
+  assert(gy.size() == 1);
+  std::vector<VarPtr> gx = {gy[0] / this->inputs_[0]};
+  return gx;
+}
+std::vector<NdArrPtr> Log::jvp(const std::vector<NdArrPtr>& xs,
+                               const std::vector<NdArrPtr>& ys,
+                               const std::vector<NdArrPtr>& txs) {
+  return {as_array(*txs[0] / *xs[0])};
+}
+
+std::vector<NdArrPtr> Sigmoid::forward(const std::vector<NdArrPtr>& xs) {
+  assert(xs.size() == 1);
+  std::vector<NdArrPtr> ys = {as_array(vmath::sigmoid(*xs[0]))};
+  return ys;
+}
+std::vector<VarPtr> Sigmoid::backward(const std::vector<VarPtr>& gy) {
+  assert(gy.size() == 1);
+  const auto y = expr::lazy(this->outputs_[0].lock());
+  std::vector<VarPtr> gx = {expr::lazy(gy[0]) * y * (1.0 - y)};
+  return gx;
+}
+std::vector<NdArrPtr> Sigmoid::jvp(const std::vector<NdArrPtr>& xs,
+                                   const std::vector<NdArrPtr>& ys,
+                                   const std::vector<NdArrPtr>& txs) {
+  return {as_array(*ys[0] * (1.0 - *ys[0]) * *txs[0])};
+}
+std::vector<NdArrPtr> Tanh::jvp(const std::vector<NdArrPtr>& xs,
+                                const std::vector<NdArrPtr>& ys,
+                                const std::vector<NdArrPtr>& txs) {
+  return {as_array((1.0 - *ys[0] * *ys[0]) * *txs[0])};
+}
+
 Reshape::Reshape(const nc::Shape& shape) : shape(shape) {}
 std::vector<NdArrPtr> Reshape::forward(const std::vector<NdArrPtr>& xs) {
   assert(xs.size() == 1);
   this->x_shape = xs[0]->shape();
-  std::vector<NdArrPtr> ys = {as_array(xs[0]->reshape(this->shape))};
+  // NdArray::reshapeはその場で形を変えるので、複製してから変える
+  // （入力の変数の形が変わらないように）
+  nc::NdArray<double> y = *xs[0];
+  std::vector<NdArrPtr> ys = {as_array(y.reshape(this->shape))};
   return ys;
 }
 std::vector<VarPtr> Reshape::backward(const std::vector<VarPtr>& gy) {
@@ -47,6 +260,12 @@ std::vector<VarPtr> Reshape::backward(const std::vector<VarPtr>& gy) {
   std::vector<VarPtr> gx = {F::reshape(gy[0], this->x_shape)};
   return gx;
 }
+std::vector<NdArrPtr> Reshape::jvp(const std::vector<NdArrPtr>& xs,
+                                   const std::vector<NdArrPtr>& ys,
+                                   const std::vector<NdArrPtr>& txs) {
+  nc::NdArray<double> ty = *txs[0];
+  return {as_array(ty.reshape(this->shape))};
+}
 
 std::vector<NdArrPtr> Transpose::forward(const std::vector<NdArrPtr>& xs) {
   assert(xs.size() == 1);
@@ -58,6 +277,11 @@ std::vector<VarPtr> Transpose::backward(const std::vector<VarPtr>& gy) {
   std::vector<VarPtr> gx = {transpose(gy[0])};
   return gx;
 }
+std::vector<NdArrPtr> Transpose::jvp(const std::vector<NdArrPtr>& xs,
+                                     const std::vector<NdArrPtr>& ys,
+                                     const std::vector<NdArrPtr>& txs) {
+  return {as_array(nc::transpose(*txs[0]))};
+}
 
 BroadcastTo::BroadcastTo(const nc::Shape& shape) : shape(shape) {}
 std::vector<NdArrPtr> BroadcastTo::forward(const std::vector<NdArrPtr>& xs) {
@@ -72,6 +296,11 @@ std::vector<VarPtr> BroadcastTo::backward(const std::vector<VarPtr>& gy) {
   std::vector<VarPtr> gx = {sum_to(gy[0], nc::Shape(this->x_shape))};
   return gx;
 }
+std::vector<NdArrPtr> BroadcastTo::jvp(const std::vector<NdArrPtr>& xs,
+                                       const std::vector<NdArrPtr>& ys,
+                                       const std::vector<NdArrPtr>& txs) {
+  return {as_array(utils::broadcast_to(*txs[0], this->shape))};
+}
 
 SumTo::SumTo(const nc::Shape& shape) : shape(shape) {}
 std::vector<NdArrPtr> SumTo::forward(const std::vector<NdArrPtr>& xs) {
@@ -86,21 +315,34 @@ std::vector<VarPtr> SumTo::backward(const std::vector<VarPtr>& gy) {
   std::vector<VarPtr> gx = {broadcast_to(gy[0], this->x_shape)};
   return gx;
 }
+std::vector<NdArrPtr> SumTo::jvp(const std::vector<NdArrPtr>& xs,
+                                 const std::vector<NdArrPtr>& ys,
+                                 const std::vector<NdArrPtr>& txs) {
+  return {as_array(utils::sum_to(*txs[0], this->shape))};
+}
 
-Sum::Sum(nc::Axis axis) : axis(axis) {}
+Sum::Sum(nc::Axis axis)
+    : axis(axis), batched(Config::batching && axis == nc::Axis::NONE) {}
 std::vector<NdArrPtr> Sum::forward(const std::vector<NdArrPtr>& xs) {
   assert(xs.size() == 1);
   this->x_shape = xs[0]->shape();
-  // 現状の実装だと軸に限らずshapeが(1, N)になる点に注意
-  std::vector<NdArrPtr> ys = {as_array(nc::sum(*xs[0], this->axis))};
+  // 1行 = 1サンプルとみなして行ごとに総和を取る: (N, D) -> (N, 1)
+  const auto axis = this->batched ? nc::Axis::COL : this->axis;
+  std::vector<NdArrPtr> ys = {as_array(kernels::sum(*xs[0], axis))};
   return ys;
 }
 std::vector<VarPtr> Sum::backward(const std::vector<VarPtr>& gy) {
   assert(gy.size() == 1);
-  // numcppのndarrayは2Dなのでreshape不要
+  // keepdimsの形なのでreshapeせずにそのままbroadcastできる
   std::vector<VarPtr> gx = {broadcast_to(gy[0], this->x_shape)};
   return gx;
 }
+std::vector<NdArrPtr> Sum::jvp(const std::vector<NdArrPtr>& xs,
+                               const std::vector<NdArrPtr>& ys,
+                               const std::vector<NdArrPtr>& txs) {
+  const auto axis = this->batched ? nc::Axis::COL : this->axis;
+  return {as_array(kernels::sum(*txs[0], axis))};
+}
 
 std::vector<NdArrPtr> MatMul::forward(const std::vector<NdArrPtr>& xs) {
   assert(xs.size() == 2);
@@ -111,10 +353,278 @@ std::vector<VarPtr> MatMul::backward(const std::vector<VarPtr>& gy) {
   assert(gy.size() == 1);
   const auto& x0 = this->inputs_[0];
   const auto& W = this->inputs_[1];
-  auto gx0 = F::matmul(gy[0], W->T());
-  auto gW = F::matmul(x0->T(), gy[0]);
+  VarPtr gx0 = this->needs_input_grad(0) ? F::matmul(gy[0], W->T()) : nullptr;
+  VarPtr gW = this->needs_input_grad(1) ? F::matmul(x0->T(), gy[0]) : nullptr;
   std::vector<VarPtr> gx = {gx0, gW};
   return gx;
 }
+std::vector<NdArrPtr> MatMul::jvp(const std::vector<NdArrPtr>& xs,
+                                  const std::vector<NdArrPtr>& ys,
+                                  const std::vector<NdArrPtr>& txs) {
+  return {as_array(txs[0]->dot(*xs[1]) + xs[0]->dot(*txs[1]))};
+}
+
+SparseMatMul::SparseMatMul(sparse::CSRPtr x, bool transposed, bool sparse_grad)
+    : x(std::move(x)), transposed(transposed), sparse_grad(sparse_grad) {}
+std::vector<NdArrPtr> SparseMatMul::forward(const std::vector<NdArrPtr>& xs) {
+  assert(xs.size() == 1);
+  std::vector<NdArrPtr> ys = {
+      as_array(this->transposed ? x->tdot(*xs[0]) : x->dot(*xs[0]))};
+  return ys;
+}
+std::vector<VarPtr> SparseMatMul::backward(const std::vector<VarPtr>& gy) {
+  assert(gy.size() == 1);
+  if (!this->needs_input_grad(0)) {
+    return {nullptr};
+  }
+  const auto& W = this->inputs_[0];
+  if (this->sparse_grad && !this->transposed && takes_sparse_grad(*W)) {
+    add_sparse_grad(*W, sparse::RowSparse::tdot(*x, *gy[0]->data));
+    return {nullptr};
+  }
+  // op(x)^T gyも同じ関数で表せるので、高階微分もそのまま計算グラフになる
+  auto f = std::make_shared<SparseMatMul>(x, !this->transposed, false);
+  std::vector<VarPtr> gx = {(*f)(gy[0])[0]};
+  return gx;
+}
+std::vector<NdArrPtr> SparseMatMul::jvp(const std::vector<NdArrPtr>& xs,
+                                        const std::vector<NdArrPtr>& ys,
+                                        const std::vector<NdArrPtr>& txs) {
+  return {as_array(this->transposed ? x->tdot(*txs[0]) : x->dot(*txs[0]))};
+}
+
+GetItem::GetItem(std::vector<size_t> indices, bool sparse_grad)
+    : indices(std::move(indices)), sparse_grad(sparse_grad) {}
+std::vector<NdArrPtr> GetItem::forward(const std::vector<NdArrPtr>& xs) {
+  assert(xs.size() == 1);
+  const auto& x = xs[0];
+  const size_t rows = x->shape().rows;
+  const size_t cols = x->shape().cols;
+  const size_t n = this->indices.size();
+  bool contiguous = n > 0;
+  for (size_t k = 0; k < n; k++) {
+    if (this->indices[k] >= rows) {
+      throw std::out_of_range("get_item: index " +
+                              std::to_string(this->indices[k]) +
+                              " is out of range");
+    }
+    contiguous = contiguous && this->indices[k] == this->indices[0] + k;
+  }
+  if (contiguous) {
+    // 所有権を持たないNdArrayでxの行を直接参照する
+    // deleterがxを保持するので、ビューが生きている間は解放されない
+    return {NdArrPtr(
+        new nc::NdArray<double>(x->data() + this->indices[0] * cols, n, cols,
+                                false),
+        [x](nc::NdArray<double>* p) { delete p; })};
+  }
+  auto y = std::make_shared<nc::NdArray<double>>(n, cols);
+  const double* src = x->data();
+  double* dst = y->data();
+  const size_t grain = std::max<size_t>(
+      1, parallel::get_grain_size() / std::max<size_t>(1, cols));
+  parallel::parallel_for(0, n, grain, [&](size_t begin, size_t end) {
+    for (size_t k = begin; k < end; k++) {
+      std::memcpy(dst + k * cols, src + this->indices[k] * cols,
+                  cols * sizeof(double));
+    }
+  });
+  return {y};
+}
+std::vector<VarPtr> GetItem::backward(const std::vector<VarPtr>& gy) {
+  assert(gy.size() == 1);
+  if (!this->needs_input_grad(0)) {
+    return {nullptr};
+  }
+  const auto& x = this->inputs_[0];
+  if (!Config::enable_backprop) {
+    // 重複した行をまとめてから足すので、語彙数ではなくバッチの大きさに比例する
+    auto g = sparse::RowSparse::scatter(x->shape(), this->indices,
+                                        *gy[0]->data);
+    if (this->sparse_grad && takes_sparse_grad(*x)) {
+      add_sparse_grad(*x, std::move(g));
+      return {nullptr};
+    }
+    return {as_variable(as_array(g.to_dense()))};
+  }
+  auto f = std::make_shared<GetItemGrad>(this->indices, x->shape());
+  std::vector<VarPtr> gx = {(*f)(gy[0])[0]};
+  return gx;
+}
+std::vector<NdArrPtr> GetItem::jvp(const std::vector<NdArrPtr>& xs,
+                                   const std::vector<NdArrPtr>& ys,
+                                   const std::vector<NdArrPtr>& txs) {
+  return this->forward(txs);
+}
+
+GetItemGrad::GetItemGrad(std::vector<size_t> indices, const nc::Shape& x_shape)
+    : indices(std::move(indices)), x_shape(x_shape) {}
+std::vector<NdArrPtr> GetItemGrad::forward(const std::vector<NdArrPtr>& xs) {
+  assert(xs.size() == 1);
+  std::vector<NdArrPtr> ys = {as_array(
+      sparse::RowSparse::scatter(this->x_shape, this->indices, *xs[0])
+          .to_dense())};
+  return ys;
+}
+std::vector<VarPtr> GetItemGrad::backward(const std::vector<VarPtr>& gy) {
+  assert(gy.size() == 1);
+  std::vector<VarPtr> gx = {get_item(gy[0], this->indices)};
+  return gx;
+}
+std::vector<NdArrPtr> GetItemGrad::jvp(const std::vector<NdArrPtr>& xs,
+                                       const std::vector<NdArrPtr>& ys,
+                                       const std::vector<NdArrPtr>& txs) {
+  return this->forward(txs);
+}
+
+std::vector<NdArrPtr> Softmax::forward(const std::vector<NdArrPtr>& xs) {
+  assert(xs.size() == 1);
+  const auto& x = *xs[0];
+  const size_t rows = x.shape().rows;
+  const size_t cols = x.shape().cols;
+  auto y = std::make_shared<nc::NdArray<double>>(x.shape());
+  std::vector<double> m(rows);
+  std::vector<double> s(rows);
+  const double* px = x.data();
+  double* py = y->data();
+  for_rows(rows, cols, [&](size_t begin, size_t end) {
+    max_sum_exp_rows(px, cols, begin, end, m.data(), s.data());
+    softmax_rows(px, cols, begin, end, m.data(), s.data(), 1.0, py);
+  });
+  return {y};
+}
+std::vector<VarPtr> Softmax::backward(const std::vector<VarPtr>& gy) {
+  assert(gy.size() == 1);
+  const auto y = this->outputs_[0].lock();
+  if (!Config::enable_backprop) {
+    return {
+        as_variable(as_array(softmax_jacobian_dot(*y->data, *gy[0]->data)))};
+  }
+  auto yg = y * gy[0];
+  std::vector<VarPtr> gx = {yg - y * sum(yg, nc::Axis::COL)};
+  return gx;
+}
+std::vector<NdArrPtr> Softmax::jvp(const std::vector<NdArrPtr>& xs,
+                                   const std::vector<NdArrPtr>& ys,
+                                   const std::vector<NdArrPtr>& txs) {
+  return {as_array(softmax_jacobian_dot(*ys[0], *txs[0]))};
+}
+
+SoftmaxCrossEntropy::SoftmaxCrossEntropy(std::vector<size_t> t)
+    : t(std::move(t)) {}
+std::vector<NdArrPtr> SoftmaxCrossEntropy::forward(
+    const std::vector<NdArrPtr>& xs) {
+  assert(xs.size() == 1);
+  const auto& x = *xs[0];
+  const size_t rows = x.shape().rows;
+  const size_t cols = x.shape().cols;
+  if (this->t.size() != rows) {
+    throw std::invalid_argument(
+        "softmax_cross_entropy: the number of labels must match the rows");
+  }
+  for (size_t label : this->t) {
+    if (label >= cols) {
+      throw std::out_of_range("softmax_cross_entropy: label " +
+                              std::to_string(label) + " is out of range");
+    }
+  }
+  // -log softmax(x)[t] = m + log(sum(exp(x - m))) - x[t]
+  this->row_max.resize(rows);
+  this->row_sum.resize(rows);
+  std::vector<double> losses(rows);
+  const double* px = x.data();
+  for_rows(rows, cols, [&](size_t begin, size_t end) {
+    max_sum_exp_rows(px, cols, begin, end, this->row_max.data(),
+                     this->row_sum.data());
+    for (size_t r = begin; r < end; r++) {
+      losses[r] = this->row_max[r] + std::log(this->row_sum[r]) -
+                  px[r * cols + this->t[r]];
+    }
+  });
+  // 行ごとの値を決まった順に足す（スレッド数によらない）
+  std::vector<NdArrPtr> ys = {
+      as_array(kernels::sum_contiguous(losses.data(), rows) / rows)};
+  return ys;
+}
+std::vector<VarPtr> SoftmaxCrossEntropy::backward(
+    const std::vector<VarPtr>& gy) {
+  assert(gy.size() == 1);
+  const auto& x = this->inputs_[0];
+  const size_t rows = x->shape().rows;
+  const size_t cols = x->shape().cols;
+  if (!Config::enable_backprop) {
+    // (softmax(x) - onehot(t)) * gy / N を1行ずつ直接書き込む
+    const double g = (*gy[0]->data)[0] / rows;
+    nc::NdArray<double> gx(x->shape());
+    const double* px = x->data->data();
+    double* pgx = gx.data();
+    for_rows(rows, cols, [&](size_t begin, size_t end) {
+      softmax_rows(px, cols, begin, end, this->row_max.data(),
+                   this->row_sum.data(), g, pgx);
+      for (size_t r = begin; r < end; r++) {
+        pgx[r * cols + this->t[r]] -= g;
+      }
+    });
+    return {as_variable(as_array(std::move(gx)))};
+  }
+  nc::NdArray<double> onehot = nc::zeros<double>(x->shape());
+  for (size_t r = 0; r < rows; r++) {
+    onehot(r, this->t[r]) = 1.0;
+  }
+  std::vector<VarPtr> gx = {(softmax(x) - as_variable(as_array(onehot))) *
+                            (gy[0] / static_cast<double>(rows))};
+  return gx;
+}
+std::vector<NdArrPtr> SoftmaxCrossEntropy::jvp(
+    const std::vector<NdArrPtr>& xs, const std::vector<NdArrPtr>& ys,
+    const std::vector<NdArrPtr>& txs) {
+  // sum((softmax(x) - onehot) * tx) / N
+  const size_t rows = xs[0]->shape().rows;
+  const size_t cols = xs[0]->shape().cols;
+  std::vector<double> dots(rows);
+  nc::NdArray<double> p(xs[0]->shape());
+  const double* px = xs[0]->data();
+  const double* pt = txs[0]->data();
+  double* pp = p.data();
+  for_rows(rows, cols, [&](size_t begin, size_t end) {
+    softmax_rows(px, cols, begin, end, this->row_max.data(),
+                 this->row_sum.data(), 1.0, pp);
+    for (size_t r = begin; r < end; r++) {
+      double dot = -pt[r * cols + this->t[r]];
+      for (size_t k = 0; k < cols; k++) {
+        dot += pp[r * cols + k] * pt[r * cols + k];
+      }
+      dots[r] = dot;
+    }
+  });
+  return {as_array(kernels::sum_contiguous(dots.data(), rows) / rows)};
+}
+
+Dropout::Dropout(double ratio, uint64_t seed, uint64_t offset)
+    : ratio(ratio), seed(seed), offset(offset) {
+  if (!(ratio >= 0.0 && ratio < 1.0)) {
+    throw std::invalid_argument("dropout: ratio must be in [0, 1)");
+  }
+}
+std::vector<NdArrPtr> Dropout::forward(const std::vector<NdArrPtr>& xs) {
+  assert(xs.size() == 1);
+  const auto& x = *xs[0];
+  auto y = std::make_shared<nc::NdArray<double>>(x.shape());
+  rng::dropout(x.data(), y->data(), x.size(), this->seed, this->offset,
+               this->ratio, 1.0 / (1.0 - this->ratio));
+  return {y};
+}
+std::vector<VarPtr> Dropout::backward(const std::vector<VarPtr>& gy) {
+  assert(gy.size() == 1);
+  // 同じマスクを掛ける線形な関数なので、gyに同じFunctionを適用すればよい
+  auto f = std::make_shared<Dropout>(this->ratio, this->seed, this->offset);
+  std::vector<VarPtr> gx = {(*f)(gy[0])[0]};
+  return gx;
+}
+std::vector<NdArrPtr> Dropout::jvp(const std::vector<NdArrPtr>& xs,
+                                   const std::vector<NdArrPtr>& ys,
+                                   const std::vector<NdArrPtr>& txs) {
+  return this->forward(txs);
+}
 
 }  // namespace F
\ No newline at end of file
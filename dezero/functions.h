@@ -5,6 +5,8 @@
 
 #include "NumCpp.hpp"
 #include "core.h"
+#include "random.h"
+#include "sparse.h"
 #include "utils.h"
 class Function;
 class Variable;
@@ -19,18 +21,54 @@ class Sin : public Function {
  public:
   std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
   std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
 };
 
 class Cos : public Function {
  public:
   std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
   std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
 };
 
 class Tanh : public Function {
  public:
   std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
   std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
+};
+
+class Exp : public Function {
+ public:
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
+};
+
+class Log : public Function {
+ public:
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
+};
+
+class Sigmoid : public Function {
+ public:
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
 };
 
 class Reshape : public Function {
@@ -40,12 +78,18 @@ class Reshape : public Function {
   explicit Reshape(const nc::Shape& shape);
   std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
   std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
 };
 
 class Transpose : public Function {
  public:
   std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
   std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
 };
 
 class BroadcastTo : public Function {
@@ -55,6 +99,9 @@ class BroadcastTo : public Function {
   explicit BroadcastTo(const nc::Shape& shape);
   std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
   std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
 };
 
 class SumTo : public Function {
@@ -64,22 +111,122 @@ class SumTo : public Function {
   explicit SumTo(const nc::Shape& shape);
   std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
   std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
 };
 
-// numcppのndarrayは2Dなのでkeepdims不要
+// 軸の次元は1として残る（keepdims=True相当）
+// Axis::ROW: (R, C) -> (1, C)、Axis::COL: (R, C) -> (R, 1)、Axis::NONE: (1, 1)
 class Sum : public Function {
  public:
   nc::Axis axis;
+  // Config::batchingで作られた全要素の和は行ごとの和になる
+  const bool batched;
   nc::Shape x_shape;
   explicit Sum(nc::Axis axis);
   std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
   std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
 };
 
 class MatMul : public Function {
  public:
   std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
   std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
+};
+
+// 疎行列x（定数）と密な行列Wの積 op(x) W（op(x)はxかx^T）
+// xの勾配は求めない
+// sparse_gradなら、Wが葉の変数で計算グラフを作らない逆伝播のとき、Wの勾配を
+// 触れた行だけのsparse::RowSparseとしてW->sparse_gradに足す（W->gradには足さない）
+// この場合もgradに足したときと同じくW->grad_hookを呼ぶ
+class SparseMatMul : public Function {
+ public:
+  const sparse::CSRPtr x;
+  const bool transposed;
+  const bool sparse_grad;
+  SparseMatMul(sparse::CSRPtr x, bool transposed, bool sparse_grad);
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
+};
+
+// xの行indices[k]を並べた(indices.size(), C)の行列
+// indicesが連続した範囲ならコピーせずにxのデータを参照する
+// sparse_gradの意味はSparseMatMulと同じ（同じ行への勾配はまとめて足す）
+class GetItem : public Function {
+ public:
+  const std::vector<size_t> indices;
+  const bool sparse_grad;
+  GetItem(std::vector<size_t> indices, bool sparse_grad);
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
+};
+
+// GetItemの逆伝播: gyのk行目をx_shapeの0行列のindices[k]行目に足す
+class GetItemGrad : public Function {
+ public:
+  const std::vector<size_t> indices;
+  const nc::Shape x_shape;
+  GetItemGrad(std::vector<size_t> indices, const nc::Shape& x_shape);
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
+};
+
+// 行ごとのsoftmax（各行の和が1になる）
+// 最大値を引いてからexpするのでオーバーフローしない
+class Softmax : public Function {
+ public:
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
+};
+
+// 行ごとのsoftmaxとラベルt（各行の正解の列番号）の交差エントロピーの平均 (1, 1)
+// log-sum-expで1行を1回なめて求め、逆伝播はsoftmax - onehotを直接計算する
+class SoftmaxCrossEntropy : public Function {
+ public:
+  const std::vector<size_t> t;
+  // 行ごとの最大値mとsum(exp(x - m))（逆伝播でsoftmaxを求め直すのに使う）
+  std::vector<double> row_max;
+  std::vector<double> row_sum;
+  explicit SoftmaxCrossEntropy(std::vector<size_t> t);
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
+};
+
+// ドロップアウト: 確率ratioで0、それ以外は1 / (1 - ratio)倍
+// マスクは保存せず、逆伝播ではseedとoffset（rng::dropoutのカウンタ）から作り直す
+class Dropout : public Function {
+ public:
+  const double ratio;
+  const uint64_t seed;
+  const uint64_t offset;
+  Dropout(double ratio, uint64_t seed, uint64_t offset);
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
 };
 
 inline VarPtr sin(VarPtr x) {
@@ -97,6 +244,21 @@ inline VarPtr tanh(VarPtr x) {
   return (*f)(x)[0];
 }
 
+inline VarPtr exp(VarPtr x) {
+  auto f = std::make_shared<Exp>();
+  return (*f)(x)[0];
+}
+
+inline VarPtr log(VarPtr x) {
+  auto f = std::make_shared<Log>();
+  return (*f)(x)[0];
+}
+
+inline VarPtr sigmoid(VarPtr x) {
+  auto f = std::make_shared<Sigmoid>();
+  return (*f)(x)[0];
+}
+
 inline VarPtr reshape(VarPtr x, const nc::Shape& shape) {
   if (x->shape() == shape) {
     return as_variable(x);
@@ -134,5 +296,55 @@ inline VarPtr matmul(VarPtr x0, VarPtr x1) {
   return (*f)(x0, x1)[0];
 }
 
+inline VarPtr sparse_matmul(sparse::CSRPtr x, VarPtr W,
+                            bool sparse_grad = false) {
+  auto f = std::make_shared<SparseMatMul>(std::move(x), false, sparse_grad);
+  return (*f)(W)[0];
+}
+
+inline VarPtr get_item(VarPtr x, std::vector<size_t> indices) {
+  auto f = std::make_shared<GetItem>(std::move(indices), false);
+  return (*f)(x)[0];
+}
+
+// xの[begin, end)行（コピーしない）
+inline VarPtr get_item(VarPtr x, size_t begin, size_t end) {
+  std::vector<size_t> indices(end > begin ? end - begin : 0);
+  for (size_t k = 0; k < indices.size(); k++) {
+    indices[k] = begin + k;
+  }
+  return get_item(std::move(x), std::move(indices));
+}
+
+// 埋め込み表W（語彙数, D）からidsの行を引く
+// 表は大きいので、既定では勾配を引いた行だけのW->sparse_gradに足す
+inline VarPtr embedding(VarPtr W, std::vector<size_t> ids,
+                        bool sparse_grad = true) {
+  auto f = std::make_shared<GetItem>(std::move(ids), sparse_grad);
+  return (*f)(W)[0];
+}
+
+inline VarPtr softmax(VarPtr x) {
+  auto f = std::make_shared<Softmax>();
+  return (*f)(x)[0];
+}
+
+inline VarPtr softmax_cross_entropy(VarPtr x, std::vector<size_t> t) {
+  auto f = std::make_shared<SoftmaxCrossEntropy>(std::move(t));
+  return (*f)(x)[0];
+}
+
+// 学習時（Config::train）だけ適用し、乱数はrng::default_generatorから取る
+inline VarPtr dropout(VarPtr x, double ratio = 0.5) {
+  if (!Config::train) {
+    return as_variable(x);
+  }
+  auto& generator = rng::default_generator();
+  const uint64_t seed = generator.seed();
+  const uint64_t offset = generator.advance(rng::blocks_dropout(x->size()));
+  auto f = std::make_shared<Dropout>(ratio, seed, offset);
+  return (*f)(x)[0];
+}
+
 }  // namespace F
 #endif
\ No newline at end of file
@@ -0,0 +1,279 @@
+#ifndef KERNELS_
+#define KERNELS_
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "NumCpp.hpp"
+#include "parallel.h"
+
+// 要素ごとの演算・総和・ブロードキャストのカーネル
+// 出力を直接確保し、大きなテンソルはparallel::parallel_forでチャンクに分けて並列に計算する
+namespace kernels {
+template <typename Op>
+inline nc::NdArray<double> unary(const nc::NdArray<double>& x, Op op) {
+  nc::NdArray<double> y(x.shape());
+  const double* src = x.data();
+  double* dst = y.data();
+  parallel::parallel_for(0, x.size(), [src, dst, &op](size_t b, size_t e) {
+    for (size_t i = b; i < e; i++) dst[i] = op(src[i]);
+  });
+  return y;
+}
+
+// ブロードキャスト後の形（各次元が等しいか片方が1）
+inline nc::Shape broadcast_shape(const nc::Shape& a, const nc::Shape& b) {
+  auto dim = [](nc::uint32 x, nc::uint32 y) {
+    if (x != y && x != 1 && y != 1) {
+      throw std::invalid_argument("operands could not be broadcast together");
+    }
+    return std::max(x, y);
+  };
+  return nc::Shape(dim(a.rows, b.rows), dim(a.cols, b.cols));
+}
+
+template <typename Op>
+inline nc::NdArray<double> binary(const nc::NdArray<double>& a,
+                                  const nc::NdArray<double>& b, Op op) {
+  const auto a_shape = a.shape();
+  const auto b_shape = b.shape();
+  const auto shape = broadcast_shape(a_shape, b_shape);
+  nc::NdArray<double> y(shape);
+  const double* pa = a.data();
+  const double* pb = b.data();
+  double* dst = y.data();
+
+  if (a_shape == b_shape) {
+    parallel::parallel_for(0, y.size(), [=, &op](size_t s, size_t e) {
+      for (size_t i = s; i < e; i++) dst[i] = op(pa[i], pb[i]);
+    });
+  } else if (b.size() == 1) {
+    const double vb = pb[0];
+    parallel::parallel_for(0, y.size(), [=, &op](size_t s, size_t e) {
+      for (size_t i = s; i < e; i++) dst[i] = op(pa[i], vb);
+    });
+  } else if (a.size() == 1) {
+    const double va = pa[0];
+    parallel::parallel_for(0, y.size(), [=, &op](size_t s, size_t e) {
+      for (size_t i = s; i < e; i++) dst[i] = op(va, pb[i]);
+    });
+  } else {
+    // 行・列ベクトルのブロードキャスト: 次元が1の側はstrideを0にする
+    const size_t cols = shape.cols;
+    const size_t a_row = a_shape.rows == 1 ? 0 : a_shape.cols;
+    const size_t a_col = a_shape.cols == 1 ? 0 : 1;
+    const size_t b_row = b_shape.rows == 1 ? 0 : b_shape.cols;
+    const size_t b_col = b_shape.cols == 1 ? 0 : 1;
+    parallel::parallel_for(0, y.size(), [=, &op](size_t s, size_t e) {
+      size_t r = s / cols, c = s % cols;
+      for (size_t i = s; i < e; i++) {
+        dst[i] = op(pa[r * a_row + c * a_col], pb[r * b_row + c * b_col]);
+        if (++c == cols) {
+          c = 0;
+          r++;
+        }
+      }
+    });
+  }
+  return y;
+}
+
+// 連続したn要素の和
+// 8本のアキュムレータに分けて依存を切り、SIMDで足せるようにする
+inline double sum_contiguous(const double* p, size_t n) {
+  double acc[8] = {};
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    for (int j = 0; j < 8; j++) acc[j] += p[i + j];
+  }
+  for (; i < n; i++) acc[0] += p[i];
+  return ((acc[0] + acc[1]) + (acc[2] + acc[3])) +
+         ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+}
+
+// dst[0, n) += src[0, n)
+inline void accumulate(double* __restrict dst, const double* __restrict src,
+                       size_t n) {
+  for (size_t i = 0; i < n; i++) dst[i] += src[i];
+}
+
+// parts[0], ..., parts[num - 1]（それぞれn要素）を2つずつ足し合わせてparts[0]に集める
+inline void tree_reduce(double* parts, size_t num, size_t n) {
+  for (size_t stride = 1; stride < num; stride *= 2) {
+    const size_t pairs = (num - stride + 2 * stride - 1) / (2 * stride);
+    const size_t grain = std::max<size_t>(1, parallel::get_grain_size() / n);
+    parallel::parallel_for(0, pairs, grain, [=](size_t b, size_t e) {
+      for (size_t k = b; k < e; k++) {
+        const size_t i = 2 * stride * k;
+        accumulate(parts + i * n, parts + (i + stride) * n, n);
+      }
+    });
+  }
+}
+
+// 全要素の和
+// grainごとの部分和を木構造で足すので、スレッド数によらず結果は同じ
+inline double sum_all(const double* p, size_t n) {
+  const size_t grain = parallel::get_grain_size();
+  if (n < 2 * grain) {
+    return sum_contiguous(p, n);
+  }
+  const size_t num = (n + grain - 1) / grain;
+  std::vector<double> parts(num);
+  parallel::parallel_for(0, num, 1, [&](size_t b, size_t e) {
+    for (size_t k = b; k < e; k++) {
+      const size_t s = k * grain;
+      parts[k] = sum_contiguous(p + s, std::min(grain, n - s));
+    }
+  });
+  tree_reduce(parts.data(), num, 1);
+  return parts[0];
+}
+
+// 行方向に畳み込む: (R, C) -> (1, C)
+inline nc::NdArray<double> sum_rows(const nc::NdArray<double>& x) {
+  const size_t rows = x.shape().rows;
+  const size_t cols = x.shape().cols;
+  if (rows == 1) {
+    return x;
+  }
+  nc::NdArray<double> y(1, cols);
+  const double* src = x.data();
+  double* dst = y.data();
+  std::fill(dst, dst + cols, 0.0);
+  const size_t grain = parallel::get_grain_size();
+  const size_t threads = parallel::get_num_threads();
+
+  if (rows * cols < 2 * grain) {
+    for (size_t r = 0; r < rows; r++) accumulate(dst, src + r * cols, cols);
+  } else if (cols >= 64 * threads) {
+    // 列が多ければ列の範囲で分け、各スレッドは全行の担当範囲を上から足す
+    parallel::parallel_for(0, cols, 64, [=](size_t b, size_t e) {
+      for (size_t r = 0; r < rows; r++) {
+        accumulate(dst + b, src + r * cols + b, e - b);
+      }
+    });
+  } else {
+    // 列が少なければ行のブロックごとに部分和を作り、木構造で足し合わせる
+    const size_t num =
+        std::min({(rows * cols + grain - 1) / grain, 4 * threads, rows});
+    const size_t rows_per = (rows + num - 1) / num;
+    std::vector<double> parts(num * cols, 0.0);
+    parallel::parallel_for(0, num, 1, [&](size_t b, size_t e) {
+      for (size_t k = b; k < e; k++) {
+        const size_t end = std::min(rows, (k + 1) * rows_per);
+        for (size_t r = k * rows_per; r < end; r++) {
+          accumulate(parts.data() + k * cols, src + r * cols, cols);
+        }
+      }
+    });
+    tree_reduce(parts.data(), num, cols);
+    std::memcpy(dst, parts.data(), sizeof(double) * cols);
+  }
+  return y;
+}
+
+// 列方向に畳み込む: (R, C) -> (R, 1)
+inline nc::NdArray<double> sum_cols(const nc::NdArray<double>& x) {
+  const size_t rows = x.shape().rows;
+  const size_t cols = x.shape().cols;
+  nc::NdArray<double> y(rows, 1);
+  const double* src = x.data();
+  double* dst = y.data();
+  if (rows < static_cast<size_t>(parallel::get_num_threads())) {
+    // 行が少なければ1行ずつ行の中で並列に足す
+    for (size_t r = 0; r < rows; r++) dst[r] = sum_all(src + r * cols, cols);
+  } else {
+    const size_t grain = std::max<size_t>(1, parallel::get_grain_size() / cols);
+    parallel::parallel_for(0, rows, grain, [=](size_t b, size_t e) {
+      for (size_t r = b; r < e; r++) {
+        dst[r] = sum_contiguous(src + r * cols, cols);
+      }
+    });
+  }
+  return y;
+}
+
+// 軸の次元を1として残す総和（keepdims=True相当）
+//   Axis::ROW: (R, C) -> (1, C)、Axis::COL: (R, C) -> (R, 1)、Axis::NONE: (1, 1)
+inline nc::NdArray<double> sum(const nc::NdArray<double>& x, nc::Axis axis) {
+  switch (axis) {
+    case nc::Axis::ROW:
+      return sum_rows(x);
+    case nc::Axis::COL:
+      return sum_cols(x);
+    default: {
+      nc::NdArray<double> y(1, 1);
+      y[0] = sum_all(x.data(), x.size());
+      return y;
+    }
+  }
+}
+
+// 出力の形に直接書き込むsum_to / broadcast_to
+inline nc::NdArray<double> sum_to(const nc::NdArray<double>& x,
+                                  const nc::Shape& shape) {
+  const auto x_shape = x.shape();
+  if (shape == x_shape) {
+    return x;
+  }
+  if (shape.rows == 1 && shape.cols == 1) {
+    return sum(x, nc::Axis::NONE);
+  }
+  if (shape.rows == 1 && shape.cols == x_shape.cols) {
+    return sum_rows(x);
+  }
+  if (shape.cols == 1 && shape.rows == x_shape.rows) {
+    return sum_cols(x);
+  }
+  throw std::invalid_argument("sum_to: shapes are not compatible");
+}
+
+inline nc::NdArray<double> broadcast_to(const nc::NdArray<double>& x,
+                                        const nc::Shape& shape) {
+  const auto x_shape = x.shape();
+  if (shape == x_shape) {
+    return x;
+  }
+  if (broadcast_shape(x_shape, shape) != shape) {
+    throw std::invalid_argument("broadcast_to: shapes are not compatible");
+  }
+  nc::NdArray<double> y(shape);
+  const double* src = x.data();
+  double* dst = y.data();
+  const size_t cols = shape.cols;
+  const size_t grain = std::max<size_t>(1, parallel::get_grain_size() / cols);
+  parallel::parallel_for(0, shape.rows, grain, [=](size_t b, size_t e) {
+    for (size_t r = b; r < e; r++) {
+      double* row = dst + r * cols;
+      if (x_shape.cols == cols) {
+        // (1, C): 同じ行をコピー
+        std::memcpy(row, src, sizeof(double) * cols);
+      } else {
+        // (R, 1)と(1, 1): 1つの値で埋める
+        std::fill(row, row + cols, src[x_shape.rows == 1 ? 0 : r]);
+      }
+    }
+  });
+  return y;
+}
+
+// 整数乗（std::powより速く、負の指数にも対応）
+inline double ipow(double x, int c) {
+  if (c < 0) {
+    return 1.0 / ipow(x, -c);
+  }
+  double result = 1.0;
+  while (c) {
+    if (c & 1) result *= x;
+    x *= x;
+    c >>= 1;
+  }
+  return result;
+}
+}  // namespace kernels
+
+#endif
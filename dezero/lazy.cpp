@@ -0,0 +1,348 @@
+#include "lazy.h"
+
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+#include "functions.h"
+#include "kernels.h"
+#include "parallel.h"
+#include "vmath.h"
+
+namespace lazy {
+namespace {
+thread_local bool tracing = false;
+std::atomic<size_t> kernel_runs{0};
+
+// 1回に評価する要素数（中間結果1つあたり4KBでL1に収まる）
+constexpr size_t kChunk = 512;
+
+// 関数に対応する命令（要素ごとの演算でなければfalse）
+bool classify(const Function& f, OpCode& op, double& c) {
+  const Function* p = &f;
+  if (auto* s = dynamic_cast<const ScalarFunction*>(p)) {
+    c = s->c;
+    if (dynamic_cast<const AddScalar*>(p)) {
+      op = OpCode::AddScalar;
+    } else if (dynamic_cast<const SubScalar*>(p)) {
+      op = OpCode::SubScalar;
+    } else if (dynamic_cast<const RSubScalar*>(p)) {
+      op = OpCode::RSubScalar;
+    } else if (dynamic_cast<const MulScalar*>(p)) {
+      op = OpCode::MulScalar;
+    } else if (dynamic_cast<const DivScalar*>(p)) {
+      op = OpCode::DivScalar;
+    } else if (dynamic_cast<const RDivScalar*>(p)) {
+      op = OpCode::RDivScalar;
+    } else {
+      return false;
+    }
+  } else if (auto* pw = dynamic_cast<const Pow*>(p)) {
+    op = OpCode::Pow;
+    c = pw->c;
+  } else if (dynamic_cast<const Add*>(p)) {
+    op = OpCode::Add;
+  } else if (dynamic_cast<const Sub*>(p)) {
+    op = OpCode::Sub;
+  } else if (dynamic_cast<const Mul*>(p)) {
+    op = OpCode::Mul;
+  } else if (dynamic_cast<const Div*>(p)) {
+    op = OpCode::Div;
+  } else if (dynamic_cast<const Neg*>(p)) {
+    op = OpCode::Neg;
+  } else if (dynamic_cast<const F::Sin*>(p)) {
+    op = OpCode::Sin;
+  } else if (dynamic_cast<const F::Cos*>(p)) {
+    op = OpCode::Cos;
+  } else if (dynamic_cast<const F::Tanh*>(p)) {
+    op = OpCode::Tanh;
+  } else if (dynamic_cast<const F::Exp*>(p)) {
+    op = OpCode::Exp;
+  } else if (dynamic_cast<const F::Log*>(p)) {
+    op = OpCode::Log;
+  } else if (dynamic_cast<const F::Sigmoid*>(p)) {
+    op = OpCode::Sigmoid;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool evaluated(const Node& node) {
+  return node.op == OpCode::Leaf || node.result ||
+         node.value.wait_for(std::chrono::seconds(0)) ==
+             std::future_status::ready;
+}
+
+// 評価済みのノードの値
+const NdArrPtr& value_of(const Node& node) {
+  if (node.op == OpCode::Leaf) {
+    return node.data.get();
+  }
+  return node.result ? node.result : node.value.get();
+}
+
+// 根と同じ形で未評価のノードを1つのカーネルにまとめたもの
+// 命令は後置順に並び、k番目の命令の結果をk番目のレジスタ（チャンク分の配列）に置く
+// 途中のノードのうち逆伝播で値が読まれるものは、レジスタの代わりに配列に書き出す
+class Kernel {
+ public:
+  explicit Kernel(Node& root);
+  NdArrPtr run();
+
+ private:
+  // Leafならaは入力の番号、それ以外はa, bが引数のレジスタ
+  struct Instr {
+    OpCode op;
+    double c;
+    int a;
+    int b;
+  };
+  struct Input {
+    NdArrPtr array;
+    const double* p;
+    bool flat;
+    size_t row_stride, col_stride;
+  };
+
+  int load(const NdArrPtr& array);
+  void load_chunk(const Input& in, size_t begin, size_t len, double* buf,
+                  const double*& reg) const;
+
+  nc::Shape shape_;
+  std::vector<Instr> code_;
+  std::vector<Input> inputs_;
+  // 値を書き出す途中のノードとその命令の番号
+  std::vector<std::pair<Node*, int>> stores_;
+};
+
+Kernel::Kernel(Node& root) : shape_(root.shape) {
+  // 深い鎖でもスタックが溢れないよう、後置順の走査を明示的なスタックで行う
+  std::unordered_map<const Node*, int> regs;
+  std::vector<std::pair<Node*, bool>> stack = {{&root, false}};
+  while (!stack.empty()) {
+    auto [node, expanded] = stack.back();
+    stack.pop_back();
+    if (regs.count(node)) {
+      continue;
+    }
+    // 評価済みのノードと形の違うノード（ブロードキャストされる側）は配列として読む
+    // 形の違うノードはここで別のカーネルとして評価される
+    if (node != &root && (evaluated(*node) || node->shape != shape_)) {
+      code_.push_back({OpCode::Leaf, 0.0, load(value_of(*node)), -1});
+      regs[node] = static_cast<int>(code_.size()) - 1;
+      continue;
+    }
+    if (!expanded) {
+      stack.push_back({node, true});
+      for (const auto& arg : node->args) {
+        stack.push_back({arg.get(), false});
+      }
+      continue;
+    }
+    Instr ins{node->op, node->c, regs.at(node->args[0].get()), -1};
+    if (node->args.size() > 1) {
+      ins.b = regs.at(node->args[1].get());
+    }
+    code_.push_back(ins);
+    regs[node] = static_cast<int>(code_.size()) - 1;
+    if (node != &root && node->retain && !node->var.expired()) {
+      stores_.push_back({node, regs[node]});
+    }
+  }
+}
+
+int Kernel::load(const NdArrPtr& array) {
+  const auto s = array->shape();
+  inputs_.push_back({array, array->data(), s == shape_,
+                     s.rows == 1 ? 0 : static_cast<size_t>(s.cols),
+                     s.cols == 1 ? size_t(0) : size_t(1)});
+  return static_cast<int>(inputs_.size()) - 1;
+}
+
+void Kernel::load_chunk(const Input& in, size_t begin, size_t len,
+                        double* buf, const double*& reg) const {
+  if (in.flat) {
+    // 同じ形ならコピーせずに直接読む
+    reg = in.p + begin;
+    return;
+  }
+  const size_t cols = shape_.cols;
+  size_t r = begin / cols;
+  size_t c = begin % cols;
+  for (size_t j = 0; j < len; j++) {
+    buf[j] = in.p[r * in.row_stride + c * in.col_stride];
+    if (++c == cols) {
+      c = 0;
+      r++;
+    }
+  }
+  reg = buf;
+}
+
+NdArrPtr Kernel::run() {
+  kernel_runs++;
+  auto y = std::make_shared<nc::NdArray<double>>(shape_);
+  const size_t n = code_.size();
+  // 命令ごとの書き出し先（なければチャンク分のレジスタに置く）
+  std::vector<double*> outs(n, nullptr);
+  outs[n - 1] = y->data();
+  std::vector<NdArrPtr> stored;
+  for (const auto& [node, k] : stores_) {
+    stored.push_back(std::make_shared<nc::NdArray<double>>(shape_));
+    outs[k] = stored.back()->data();
+  }
+  parallel::parallel_for(0, y->size(), [&](size_t begin, size_t end) {
+    std::vector<double> scratch(n * kChunk);
+    std::vector<const double*> regs(n);
+    for (size_t i0 = begin; i0 < end; i0 += kChunk) {
+      const size_t len = std::min(kChunk, end - i0);
+      for (size_t k = 0; k < n; k++) {
+        const Instr& ins = code_[k];
+        // 最後の命令（根）と書き出すノードは出力に直接書く
+        double* d = outs[k] ? outs[k] + i0 : scratch.data() + k * kChunk;
+        regs[k] = d;
+        if (ins.op == OpCode::Leaf) {
+          load_chunk(inputs_[ins.a], i0, len, d, regs[k]);
+          continue;
+        }
+        const double* a = regs[ins.a];
+        const double* b = ins.b >= 0 ? regs[ins.b] : nullptr;
+        const double c = ins.c;
+        switch (ins.op) {
+          case OpCode::Add:
+            for (size_t j = 0; j < len; j++) d[j] = a[j] + b[j];
+            break;
+          case OpCode::Sub:
+            for (size_t j = 0; j < len; j++) d[j] = a[j] - b[j];
+            break;
+          case OpCode::Mul:
+            for (size_t j = 0; j < len; j++) d[j] = a[j] * b[j];
+            break;
+          case OpCode::Div:
+            for (size_t j = 0; j < len; j++) d[j] = a[j] / b[j];
+            break;
+          case OpCode::Neg:
+            for (size_t j = 0; j < len; j++) d[j] = -a[j];
+            break;
+          case OpCode::Pow: {
+            const int e = static_cast<int>(c);
+            for (size_t j = 0; j < len; j++) d[j] = kernels::ipow(a[j], e);
+            break;
+          }
+          case OpCode::AddScalar:
+            for (size_t j = 0; j < len; j++) d[j] = a[j] + c;
+            break;
+          case OpCode::SubScalar:
+            for (size_t j = 0; j < len; j++) d[j] = a[j] - c;
+            break;
+          case OpCode::RSubScalar:
+            for (size_t j = 0; j < len; j++) d[j] = c - a[j];
+            break;
+          case OpCode::MulScalar:
+            for (size_t j = 0; j < len; j++) d[j] = a[j] * c;
+            break;
+          case OpCode::DivScalar:
+            for (size_t j = 0; j < len; j++) d[j] = a[j] / c;
+            break;
+          case OpCode::RDivScalar:
+            for (size_t j = 0; j < len; j++) d[j] = c / a[j];
+            break;
+          case OpCode::Sin:
+            vmath::sin(a, d, len);
+            break;
+          case OpCode::Cos:
+            vmath::cos(a, d, len);
+            break;
+          case OpCode::Tanh:
+            vmath::tanh(a, d, len);
+            break;
+          case OpCode::Exp:
+            vmath::exp(a, d, len);
+            break;
+          case OpCode::Log:
+            vmath::log(a, d, len);
+            break;
+          case OpCode::Sigmoid:
+            vmath::sigmoid(a, d, len);
+            break;
+          case OpCode::Leaf:
+            break;
+        }
+      }
+    }
+  });
+  for (size_t i = 0; i < stores_.size(); i++) {
+    stores_[i].first->result = std::move(stored[i]);
+  }
+  return y;
+}
+
+std::shared_ptr<Node> as_node(const DataPtr& x) {
+  if (x.node()) {
+    return x.node();
+  }
+  auto leaf = std::make_shared<Node>();
+  leaf->op = OpCode::Leaf;
+  leaf->shape = x.shape();
+  leaf->data = x;
+  return leaf;
+}
+}  // namespace
+
+Node::~Node() {
+  // 引数は参照数によらず全てスタックに移す（残しておくと、最後の参照が
+  // argsのデストラクタで外れたときに~Nodeが入れ子で呼ばれる）
+  std::vector<std::shared_ptr<Node>> stack;
+  for (auto& arg : args) stack.push_back(std::move(arg));
+  while (!stack.empty()) {
+    auto node = std::move(stack.back());
+    stack.pop_back();
+    // 他からも参照されているノードは参照を手放すだけにする
+    if (!node || node.use_count() > 1) {
+      continue;
+    }
+    for (auto& arg : node->args) stack.push_back(std::move(arg));
+    // nodeは引数を持たない状態で解放される
+  }
+}
+
+bool active() { return tracing; }
+
+std::vector<VarPtr> trace(const Function& f, const std::vector<DataPtr>& xs) {
+  auto node = std::make_shared<Node>();
+  if (!classify(f, node->op, node->c)) {
+    return {};
+  }
+  for (const auto& x : xs) {
+    node->args.push_back(as_node(x));
+    // この関数が入力の変数を持ち、backwardで値を読む
+    if (Config::enable_backprop) {
+      node->args.back()->retain = true;
+    }
+  }
+  node->shape = node->args[0]->shape;
+  if (node->args.size() > 1) {
+    // 形が合わなければ評価を待たずにここで投げる
+    node->shape = kernels::broadcast_shape(node->shape, node->args[1]->shape);
+  }
+  // 評価はノードを参照しているDataPtrから呼ばれるので、ノードは弱参照で持つ
+  // （強参照にするとノードとfutureが互いを持ち続ける）
+  std::weak_ptr<Node> weak = node;
+  node->value = std::async(std::launch::deferred, [weak]() {
+                  auto n = weak.lock();
+                  // 他のカーネルが書き出していれば計算し直さない
+                  return n->result ? n->result : Kernel(*n).run();
+                }).share();
+  auto y = as_variable(DataPtr(node->value, node, node->shape));
+  node->var = y;
+  return {y};
+}
+
+size_t num_kernel_runs() { return kernel_runs; }
+
+Tracing::Tracing() : prev_(tracing) { tracing = true; }
+Tracing::~Tracing() { tracing = prev_; }
+}  // namespace lazy
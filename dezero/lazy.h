@@ -0,0 +1,90 @@
+#ifndef LAZY_
+#define LAZY_
+
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "core.h"
+
+// 遅延実行
+// Tracingが有効な間に呼ばれた要素ごとの演算（四則演算、定数との演算、pow、
+// sin/cos/tanh/exp/log/sigmoid）は計算せずに記号的なノードだけを作る
+// 値が必要になったとき（*y->data、出力の表示、backwardなど）に、まだ評価されていない
+// 同じ形のノードをまとめて1つのカーネルにし、チャンクごとに1回のループで評価する
+// 中間結果はチャンク（L1に収まる大きさ）の中にしか作らないので、
+// 要素ごとの演算の鎖ではメモリの読み書きが入力と出力の分だけになる
+//
+//   {
+//     lazy::Tracing tracing;
+//     y = F::sin(x) * F::cos(x) + x;  // ノードを作るだけ
+//   }
+//   std::cout << y;                   // ここで1つのループとして評価される
+//
+// 計算グラフのつながりは通常どおり作られるのでbackwardもできる
+// 逆伝播が有効なら、backwardで値が読まれる途中のノード（変数が生きているもの）は
+// カーネルが根と一緒に配列に書き出すので、backwardで鎖を評価し直すことはない
+// 要素ごとでない関数（matmul、sumなど）は入力を評価してからその場で実行する
+namespace lazy {
+enum class OpCode : uint8_t {
+  // 評価済みの配列（ブロードキャストしながら読む）
+  Leaf,
+  Add,
+  Sub,
+  Mul,
+  Div,
+  Neg,
+  Pow,
+  AddScalar,
+  SubScalar,
+  RSubScalar,
+  MulScalar,
+  DivScalar,
+  RDivScalar,
+  Sin,
+  Cos,
+  Tanh,
+  Exp,
+  Log,
+  Sigmoid,
+};
+
+struct Node {
+  // 長い鎖を再帰せずに解放する
+  ~Node();
+
+  OpCode op;
+  // 定数（定数との演算とpowの指数）
+  double c = 0.0;
+  std::vector<std::shared_ptr<Node>> args;
+  nc::Shape shape;
+  // Leafの値
+  DataPtr data;
+  // Leaf以外: 初めて参照されたときに評価される値
+  std::shared_future<NdArrPtr> value;
+  // 逆伝播が有効な間に他の関数の入力になった（backwardで値が読まれる）か
+  bool retain = false;
+  // このノードを値に持つ変数
+  std::weak_ptr<Variable> var;
+  // 他のノードのカーネルが途中の値として書き出した値（valueはこれを返す）
+  NdArrPtr result;
+};
+
+// これまでに実行したカーネルの数（融合と再計算の回数の確認用）
+size_t num_kernel_runs();
+
+// 有効な間、このスレッドで呼ばれた要素ごとの演算を遅延させる
+class Tracing {
+ public:
+  Tracing();
+  ~Tracing();
+  Tracing(const Tracing&) = delete;
+  Tracing& operator=(const Tracing&) = delete;
+
+ private:
+  bool prev_;
+};
+}  // namespace lazy
+
+#endif
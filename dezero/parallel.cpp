@@ -0,0 +1,193 @@
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <thread>
+#include <vector>
+
+namespace parallel {
+namespace {
+// ワーカースレッド内かどうか（入れ子のparallel_forは直列にする）
+thread_local bool in_worker = false;
+
+class ThreadPool {
+ public:
+  explicit ThreadPool(int num_threads) {
+    // 呼び出し元も処理するのでワーカーは1つ少なくてよい
+    for (int i = 0; i < num_threads - 1; i++) {
+      workers_.emplace_back([this]() { run(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  int num_threads() const { return workers_.size() + 1; }
+
+  void submit(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks_.push_back(std::move(task));
+    }
+    cv_.notify_one();
+  }
+
+ private:
+  void run() {
+    in_worker = true;
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return stop_ || !tasks_.empty(); });
+        if (stop_ && tasks_.empty()) {
+          return;
+        }
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+      }
+      task();
+    }
+  }
+
+  std::vector<std::thread> workers_;
+  std::deque<std::function<void()>> tasks_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_ = false;
+};
+
+int default_num_threads() {
+  if (const char* env = std::getenv("DEZERO_NUM_THREADS")) {
+    const int n = std::atoi(env);
+    if (n > 0) {
+      return n;
+    }
+  }
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+std::mutex pool_mutex;
+std::shared_ptr<ThreadPool> pool;
+std::atomic<size_t> grain_size{1 << 15};
+
+// fork後の子プロセスにはワーカースレッドがないので、プールを作り直させる
+// （古いプールはjoinできないので破棄せずに手放す）
+void before_fork() { pool_mutex.lock(); }
+void after_fork_parent() { pool_mutex.unlock(); }
+void after_fork_child() {
+  new std::shared_ptr<ThreadPool>(std::move(pool));
+  pool_mutex.unlock();
+}
+[[maybe_unused]] const int fork_handlers_registered =
+    pthread_atfork(before_fork, after_fork_parent, after_fork_child);
+
+std::shared_ptr<ThreadPool> get_pool() {
+  std::lock_guard<std::mutex> lock(pool_mutex);
+  if (!pool) {
+    pool = std::make_shared<ThreadPool>(default_num_threads());
+  }
+  return pool;
+}
+
+// 1回のparallel_forの状態。チャンクはatomicなカウンタで取り合う
+struct Job {
+  const std::function<void(size_t, size_t)>* fn;
+  size_t begin, end, chunk, num_chunks;
+  std::atomic<size_t> next{0};
+  std::atomic<size_t> done{0};
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::exception_ptr error;
+
+  void work() {
+    size_t i;
+    while ((i = next.fetch_add(1)) < num_chunks) {
+      const size_t b = begin + i * chunk;
+      try {
+        (*fn)(b, std::min(end, b + chunk));
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error) error = std::current_exception();
+      }
+      if (done.fetch_add(1) + 1 == num_chunks) {
+        std::lock_guard<std::mutex> lock(mutex);
+        cv.notify_all();
+      }
+    }
+  }
+};
+}  // namespace
+
+void set_num_threads(int n) {
+  auto new_pool =
+      std::make_shared<ThreadPool>(n > 0 ? n : default_num_threads());
+  std::shared_ptr<ThreadPool> old_pool;
+  {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    old_pool = std::move(pool);
+    pool = std::move(new_pool);
+  }
+  // 実行中のparallel_forがあれば古いプールはそれが終わった後に破棄される
+}
+
+int get_num_threads() { return get_pool()->num_threads(); }
+
+void set_grain_size(size_t n) { grain_size = std::max<size_t>(1, n); }
+
+size_t get_grain_size() { return grain_size; }
+
+void parallel_for(size_t begin, size_t end, size_t grain,
+                  const std::function<void(size_t, size_t)>& fn) {
+  if (begin >= end) {
+    return;
+  }
+  const size_t n = end - begin;
+  grain = std::max<size_t>(1, grain);
+  if (n < 2 * grain || in_worker) {
+    fn(begin, end);
+    return;
+  }
+  auto current = get_pool();
+  const size_t threads = current->num_threads();
+  if (threads == 1) {
+    fn(begin, end);
+    return;
+  }
+
+  auto job = std::make_shared<Job>();
+  job->fn = &fn;
+  job->begin = begin;
+  job->end = end;
+  job->chunk = grain;
+  job->num_chunks = (n + grain - 1) / grain;
+
+  const size_t helpers = std::min(threads - 1, job->num_chunks - 1);
+  for (size_t i = 0; i < helpers; i++) {
+    current->submit([job]() { job->work(); });
+  }
+  job->work();
+  {
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->cv.wait(lock, [&job]() { return job->done == job->num_chunks; });
+  }
+  if (job->error) {
+    std::rethrow_exception(job->error);
+  }
+}
+}  // namespace parallel
@@ -0,0 +1,29 @@
+#ifndef PARALLEL_
+#define PARALLEL_
+
+#include <cstddef>
+#include <functional>
+
+// ライブラリ共通のスレッドプール
+// 大きなテンソルの演算をキャッシュに収まる大きさのチャンクに分けて並列に処理する
+namespace parallel {
+// スレッド数（呼び出し元のスレッドを含む）。0ならハードウェアのスレッド数
+// 既定値は環境変数DEZERO_NUM_THREADS、なければハードウェアのスレッド数
+void set_num_threads(int n);
+int get_num_threads();
+
+// この要素数未満の処理は直列に実行する（チャンクの大きさにも使う）
+void set_grain_size(size_t n);
+size_t get_grain_size();
+
+// [begin, end)をgrain以上のチャンクに分け、fn(chunk_begin, chunk_end)を並列に呼ぶ
+// ワーカースレッド内から呼ばれた場合は直列に実行する
+void parallel_for(size_t begin, size_t end, size_t grain,
+                  const std::function<void(size_t, size_t)>& fn);
+inline void parallel_for(size_t begin, size_t end,
+                         const std::function<void(size_t, size_t)>& fn) {
+  parallel_for(begin, end, get_grain_size(), fn);
+}
+}  // namespace parallel
+
+#endif
@@ -0,0 +1,260 @@
+#include "quantize.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include "parallel.h"
+
+namespace quant {
+namespace {
+// 重みの行をこの数ずつまとめ、キャッシュに載せたまま全ての入力の行と掛ける
+constexpr size_t kBlockN = 64;
+
+#if defined(__AVX512VNNI__) && defined(__AVX512BW__)
+// vpdpbusdは符号なし x 符号付きなので、aに128を足して符号なしにし、
+// 128 * sum(b)を後で引く
+using AType = uint8_t;
+constexpr const char* kIsa = "avx512vnni";
+
+std::vector<AType> prepare(const int8_t* a, size_t size) {
+  std::vector<AType> out(size);
+  for (size_t i = 0; i < size; i++) {
+    out[i] = static_cast<uint8_t>(a[i]) ^ 0x80;
+  }
+  return out;
+}
+
+// out[r] = a . b[r]（r < R）
+template <int R>
+void dot(const AType* a, const int8_t* b, size_t ldk, int32_t* out) {
+  __m512i acc[R];
+  for (int r = 0; r < R; r++) acc[r] = _mm512_setzero_si512();
+  for (size_t k = 0; k < ldk; k += 64) {
+    const __m512i va = _mm512_loadu_si512(a + k);
+    for (int r = 0; r < R; r++) {
+      acc[r] = _mm512_dpbusd_epi32(acc[r], va,
+                                   _mm512_loadu_si512(b + r * ldk + k));
+    }
+  }
+  for (int r = 0; r < R; r++) out[r] = _mm512_reduce_add_epi32(acc[r]);
+}
+
+int32_t correction(int32_t b_sum) { return 128 * b_sum; }
+#elif defined(__AVX2__)
+// aは一度int16に広げておき、bは読みながら広げてvpmaddwdで積和する
+using AType = int16_t;
+constexpr const char* kIsa = "avx2";
+
+std::vector<AType> prepare(const int8_t* a, size_t size) {
+  return std::vector<AType>(a, a + size);
+}
+
+int32_t reduce_add(__m256i v) {
+  __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v),
+                            _mm256_extracti128_si256(v, 1));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(s);
+}
+
+template <int R>
+void dot(const AType* a, const int8_t* b, size_t ldk, int32_t* out) {
+  __m256i acc[R];
+  for (int r = 0; r < R; r++) acc[r] = _mm256_setzero_si256();
+  for (size_t k = 0; k < ldk; k += 16) {
+    const __m256i va =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + k));
+    for (int r = 0; r < R; r++) {
+      const __m256i vb = _mm256_cvtepi8_epi16(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + r * ldk + k)));
+      acc[r] = _mm256_add_epi32(acc[r], _mm256_madd_epi16(va, vb));
+    }
+  }
+  for (int r = 0; r < R; r++) out[r] = reduce_add(acc[r]);
+}
+
+int32_t correction(int32_t) { return 0; }
+#else
+using AType = int8_t;
+constexpr const char* kIsa = "scalar";
+
+std::vector<AType> prepare(const int8_t* a, size_t size) {
+  return std::vector<AType>(a, a + size);
+}
+
+template <int R>
+void dot(const AType* a, const int8_t* b, size_t ldk, int32_t* out) {
+  for (int r = 0; r < R; r++) {
+    int32_t s = 0;
+    for (size_t k = 0; k < ldk; k++) {
+      s += static_cast<int32_t>(a[k]) * b[r * ldk + k];
+    }
+    out[r] = s;
+  }
+}
+
+int32_t correction(int32_t) { return 0; }
+#endif
+}  // namespace
+
+void gemm_s8(const int8_t* a, const int8_t* b, const int32_t* b_sums,
+             int32_t* c, size_t m, size_t n, size_t ldk) {
+  if (ldk % kAlign != 0) {
+    throw std::invalid_argument("gemm_s8: ldk must be a multiple of kAlign");
+  }
+  const std::vector<AType> pa = prepare(a, m * ldk);
+  const size_t blocks = (n + kBlockN - 1) / kBlockN;
+  const size_t work = kBlockN * std::max<size_t>(1, m) * ldk;
+  const size_t grain = std::max<size_t>(1, parallel::get_grain_size() / work);
+  parallel::parallel_for(0, blocks, grain, [&](size_t begin, size_t end) {
+    for (size_t blk = begin; blk < end; blk++) {
+      const size_t j0 = blk * kBlockN;
+      const size_t j1 = std::min(n, j0 + kBlockN);
+      for (size_t i = 0; i < m; i++) {
+        const AType* arow = pa.data() + i * ldk;
+        int32_t* crow = c + i * n;
+        size_t j = j0;
+        // 4行ずつ掛けてaの読み込みを共有する
+        for (; j + 4 <= j1; j += 4) {
+          dot<4>(arow, b + j * ldk, ldk, crow + j);
+        }
+        for (; j < j1; j++) {
+          dot<1>(arow, b + j * ldk, ldk, crow + j);
+        }
+        for (j = j0; j < j1; j++) {
+          crow[j] -= correction(b_sums[j]);
+        }
+      }
+    }
+  });
+}
+
+const char* isa() { return kIsa; }
+
+QuantizedWeight::QuantizedWeight(const nc::NdArray<double>& W)
+    : in_(W.shape().rows),
+      out_(W.shape().cols),
+      ldk_(aligned(W.shape().rows)),
+      values_(out_ * ldk_, 0),
+      scales_(out_, 1.0),
+      sums_(out_, 0) {
+  const double* pw = W.data();
+  for (size_t j = 0; j < out_; j++) {
+    double max_abs = 0.0;
+    for (size_t i = 0; i < in_; i++) {
+      max_abs = std::max(max_abs, std::abs(pw[i * out_ + j]));
+    }
+    // 全て0の列はscaleを1のままにする（値は全て0）
+    if (max_abs > 0.0) {
+      scales_[j] = max_abs / 127.0;
+    }
+    int8_t* row = values_.data() + j * ldk_;
+    for (size_t i = 0; i < in_; i++) {
+      row[i] = static_cast<int8_t>(std::lround(pw[i * out_ + j] / scales_[j]));
+      sums_[j] += row[i];
+    }
+  }
+}
+
+nc::NdArray<double> QuantizedWeight::dequantize() const {
+  nc::NdArray<double> W(static_cast<nc::uint32>(in_),
+                        static_cast<nc::uint32>(out_));
+  for (size_t i = 0; i < in_; i++) {
+    for (size_t j = 0; j < out_; j++) {
+      W.data()[i * out_ + j] = values_[j * ldk_ + i] * scales_[j];
+    }
+  }
+  return W;
+}
+
+void Calibrator::observe(const nc::NdArray<double>& x) {
+  for (size_t i = 0; i < x.size(); i++) {
+    max_abs_ = std::max(max_abs_, std::abs(x.data()[i]));
+  }
+}
+
+std::vector<int8_t> quantize_rows(const nc::NdArray<double>& x, double scale,
+                                  size_t ldk) {
+  const size_t m = x.shape().rows;
+  const size_t k = x.shape().cols;
+  if (ldk < k || ldk % kAlign != 0) {
+    throw std::invalid_argument("quantize_rows: invalid ldk");
+  }
+  std::vector<int8_t> q(m * ldk, 0);
+  const double inv = 1.0 / scale;
+  const double* px = x.data();
+  const size_t grain = std::max<size_t>(
+      1, parallel::get_grain_size() / std::max<size_t>(1, k));
+  parallel::parallel_for(0, m, grain, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      for (size_t j = 0; j < k; j++) {
+        const double v = std::nearbyint(px[i * k + j] * inv);
+        q[i * ldk + j] =
+            static_cast<int8_t>(std::min(127.0, std::max(-127.0, v)));
+      }
+    }
+  });
+  return q;
+}
+}  // namespace quant
+
+namespace F {
+QuantizedMatMul::QuantizedMatMul(
+    std::shared_ptr<const quant::QuantizedWeight> weight, double x_scale)
+    : weight(std::move(weight)), x_scale(x_scale) {}
+std::vector<NdArrPtr> QuantizedMatMul::forward(
+    const std::vector<NdArrPtr>& xs) {
+  assert(xs.size() == 1 || xs.size() == 2);
+  const auto& x = *xs[0];
+  const auto& w = *this->weight;
+  const size_t m = x.shape().rows;
+  const size_t n = w.out_features();
+  if (x.shape().cols != w.in_features()) {
+    throw std::invalid_argument(
+        "quantized_matmul: x has " + std::to_string(x.shape().cols) +
+        " columns but the weight expects " + std::to_string(w.in_features()));
+  }
+  const double* pb = nullptr;
+  if (xs.size() == 2) {
+    if (xs[1]->size() != n) {
+      throw std::invalid_argument("quantized_linear: b must be (1, out)");
+    }
+    pb = xs[1]->data();
+  }
+  double scale = this->x_scale;
+  if (!(scale > 0.0)) {
+    quant::Calibrator calib;
+    calib.observe(x);
+    scale = calib.max_abs() > 0.0 ? calib.scale() : 1.0;
+  }
+  const auto q = quant::quantize_rows(x, scale, w.ldk());
+  std::vector<int32_t> acc(m * n);
+  quant::gemm_s8(q.data(), w.values().data(), w.sums().data(), acc.data(), m,
+                 n, w.ldk());
+  auto y = std::make_shared<nc::NdArray<double>>(m, n);
+  double* py = y->data();
+  const auto& scales = w.scales();
+  for (size_t i = 0; i < m; i++) {
+    for (size_t j = 0; j < n; j++) {
+      py[i * n + j] =
+          acc[i * n + j] * (scale * scales[j]) + (pb ? pb[j] : 0.0);
+    }
+  }
+  return {y};
+}
+std::vector<VarPtr> QuantizedMatMul::backward(const std::vector<VarPtr>& gy) {
+  throw std::logic_error(
+      "quantized_matmul is inference only; call it under no_grad()");
+}
+std::vector<NdArrPtr> QuantizedMatMul::jvp(const std::vector<NdArrPtr>& xs,
+                                           const std::vector<NdArrPtr>& ys,
+                                           const std::vector<NdArrPtr>& txs) {
+  throw std::logic_error("quantized_matmul is inference only");
+}
+}  // namespace F
@@ -0,0 +1,114 @@
+#ifndef QUANTIZE_
+#define QUANTIZE_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "NumCpp.hpp"
+#include "core.h"
+
+// 推論用のint8量子化（学習後量子化）
+// 重みは出力チャンネルごと、活性はテンソル全体で対称に量子化し
+// （値 = int8 * scale、ゼロ点なし）、int8 x int8 -> int32の行列積で計算する
+//
+//   auto qW = std::make_shared<quant::QuantizedWeight>(*W->data);
+//   quant::Calibrator calib;
+//   for (auto& x : samples) calib.observe(x);  // 代表的な入力で範囲を測る
+//   auto mode = no_grad();
+//   auto y = F::quantized_linear(x, qW, b, calib.scale());
+namespace quant {
+// 量子化した行列のKの並びの境界（この倍数まで0で埋める）
+constexpr size_t kAlign = 64;
+
+inline size_t aligned(size_t k) { return (k + kAlign - 1) / kAlign * kAlign; }
+
+// c (m, n) = a (m, K) * b (n, K)^T（aとbはどちらも行がKの並び）
+// a、bの行の長さはldk（kAlignの倍数、K以降は0）
+// b_sumsはbの行ごとの和（VNNI版でaを符号なしにずらした分の補正に使う）
+// int32で累積するので、Kが約66000以下ならオーバーフローしない
+void gemm_s8(const int8_t* a, const int8_t* b, const int32_t* b_sums,
+             int32_t* c, size_t m, size_t n, size_t ldk);
+
+// 使われている命令セット（"avx512vnni", "avx2", "scalar"）
+// vmathと同じくコンパイル時の命令セットで決まる
+const char* isa();
+
+// 重みW (in, out)を出力チャンネル（列）ごとに量子化したもの
+// scales[j] = max_i |W(i, j)| / 127
+class QuantizedWeight {
+ public:
+  explicit QuantizedWeight(const nc::NdArray<double>& W);
+
+  size_t in_features() const { return in_; }
+  size_t out_features() const { return out_; }
+  size_t ldk() const { return ldk_; }
+  // (out, ldk)の行優先（Wの転置）
+  const std::vector<int8_t>& values() const { return values_; }
+  const std::vector<double>& scales() const { return scales_; }
+  const std::vector<int32_t>& sums() const { return sums_; }
+  // 量子化した値を倍精度に戻す (in, out)
+  nc::NdArray<double> dequantize() const;
+
+ private:
+  size_t in_;
+  size_t out_;
+  size_t ldk_;
+  std::vector<int8_t> values_;
+  std::vector<double> scales_;
+  std::vector<int32_t> sums_;
+};
+
+// 代表的な入力の絶対値の最大値から活性のscaleを決める
+class Calibrator {
+ public:
+  void observe(const nc::NdArray<double>& x);
+  double max_abs() const { return max_abs_; }
+  // まだ何も観測していなければ0（F::quantized_matmulでは動的量子化になる）
+  double scale() const { return max_abs_ / 127.0; }
+
+ private:
+  double max_abs_ = 0.0;
+};
+
+// x (m, K)をscaleで量子化して(m, ldk)のint8にする（範囲外は±127に丸める）
+std::vector<int8_t> quantize_rows(const nc::NdArray<double>& x, double scale,
+                                  size_t ldk);
+}  // namespace quant
+
+namespace F {
+// 量子化した重みとの行列積 x W (+ b)（推論専用）
+// x_scaleは活性のscale（quant::Calibrator::scale）。0以下なら入力ごとに最大値から
+// 決める（動的量子化）
+// no_gradの中で使う（逆伝播とjvpはlogic_errorを投げる）
+class QuantizedMatMul : public Function {
+ public:
+  const std::shared_ptr<const quant::QuantizedWeight> weight;
+  const double x_scale;
+  QuantizedMatMul(std::shared_ptr<const quant::QuantizedWeight> weight,
+                  double x_scale);
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
+};
+
+inline VarPtr quantized_matmul(
+    VarPtr x, std::shared_ptr<const quant::QuantizedWeight> weight,
+    double x_scale = 0.0) {
+  auto f = std::make_shared<QuantizedMatMul>(std::move(weight), x_scale);
+  return (*f)(x)[0];
+}
+
+// 全結合層 x W + b（bは(1, out)）
+inline VarPtr quantized_linear(
+    VarPtr x, std::shared_ptr<const quant::QuantizedWeight> weight, VarPtr b,
+    double x_scale = 0.0) {
+  auto f = std::make_shared<QuantizedMatMul>(std::move(weight), x_scale);
+  return b ? (*f)(x, b)[0] : (*f)(x)[0];
+}
+}  // namespace F
+
+#endif
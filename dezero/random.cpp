@@ -0,0 +1,118 @@
+#include "random.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "parallel.h"
+#include "vmath.h"
+
+namespace rng {
+namespace {
+// 1ブロックあたりlanes要素のとき、grain_size要素分ずつ並列にするブロック数
+size_t blocks_grain(size_t lanes) {
+  return std::max<size_t>(1, parallel::get_grain_size() / lanes);
+}
+
+// 2つの32ビットの乱数から[0, 1)の倍精度（53ビット）
+double to_unit(uint32_t hi, uint32_t lo) {
+  const uint64_t bits = (static_cast<uint64_t>(hi) << 32) | lo;
+  return static_cast<double>(bits >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// ブロックbから作ったlanes個の値のうち、[0, n)に入るものをfnに渡す
+// ブロックの範囲で分けるので、結果は分け方（スレッド数）によらない
+template <typename Fn>
+void for_blocks(size_t n, size_t lanes, Fn fn) {
+  const size_t blocks = (n + lanes - 1) / lanes;
+  parallel::parallel_for(0, blocks, blocks_grain(lanes),
+                         [&](size_t begin, size_t end) {
+                           for (size_t b = begin; b < end; b++) {
+                             fn(b, b * lanes, std::min(lanes, n - b * lanes));
+                           }
+                         });
+}
+}  // namespace
+
+void uniform(double* y, size_t n, uint64_t seed, uint64_t offset, double low,
+             double high) {
+  const double scale = high - low;
+  for_blocks(n, 2, [&](size_t b, size_t i, size_t m) {
+    const Counter r = philox4x32(seed, offset + b);
+    y[i] = low + scale * to_unit(r[0], r[1]);
+    if (m > 1) y[i + 1] = low + scale * to_unit(r[2], r[3]);
+  });
+}
+
+void normal(double* y, size_t n, uint64_t seed, uint64_t offset, double mean,
+            double stddev) {
+  constexpr double kTwoPi = 6.283185307179586;
+  // logとsin/cosはvmathでまとめて計算する
+  // まとめる範囲をブロック番号で固定するので、vmathの端数の処理も含めて
+  // 結果は分け方（スレッド数）によらない
+  constexpr size_t kGroup = 256;
+  const size_t blocks = (n + 1) / 2;
+  const size_t groups = (blocks + kGroup - 1) / kGroup;
+  parallel::parallel_for(
+      0, groups, blocks_grain(2 * kGroup), [&](size_t begin, size_t end) {
+        double u1[kGroup], theta[kGroup], c[kGroup], s[kGroup];
+        for (size_t g = begin; g < end; g++) {
+          const size_t b0 = g * kGroup;
+          const size_t m = std::min(kGroup, blocks - b0);
+          for (size_t k = 0; k < m; k++) {
+            const Counter r = philox4x32(seed, offset + b0 + k);
+            // log(0)を避けるために(0, 1]にする
+            u1[k] = 1.0 - to_unit(r[0], r[1]);
+            theta[k] = kTwoPi * to_unit(r[2], r[3]);
+          }
+          vmath::log(u1, u1, m);
+          vmath::cos(theta, c, m);
+          vmath::sin(theta, s, m);
+          for (size_t k = 0; k < m; k++) {
+            const double radius = stddev * std::sqrt(-2.0 * u1[k]);
+            const size_t i = 2 * (b0 + k);
+            y[i] = mean + radius * c[k];
+            if (i + 1 < n) y[i + 1] = mean + radius * s[k];
+          }
+        }
+      });
+}
+
+void dropout(const double* x, double* y, size_t n, uint64_t seed,
+             uint64_t offset, double ratio, double scale) {
+  // r < thresholdなら0（32ビットの精度でratioに丸める）
+  const uint64_t threshold = static_cast<uint64_t>(
+      std::min(1.0, std::max(0.0, ratio)) * 4294967296.0);
+  for_blocks(n, 4, [&](size_t b, size_t i, size_t m) {
+    const Counter r = philox4x32(seed, offset + b);
+    for (size_t k = 0; k < m; k++) {
+      y[i + k] = r[k] < threshold ? 0.0 : x[i + k] * scale;
+    }
+  });
+}
+
+void Generator::manual_seed(uint64_t seed) {
+  seed_.store(seed);
+  offset_.store(0);
+}
+
+nc::NdArray<double> Generator::uniform(const nc::Shape& shape, double low,
+                                       double high) {
+  nc::NdArray<double> y(shape);
+  const uint64_t offset = advance(blocks_uniform(y.size()));
+  rng::uniform(y.data(), y.size(), seed(), offset, low, high);
+  return y;
+}
+
+nc::NdArray<double> Generator::normal(const nc::Shape& shape, double mean,
+                                      double stddev) {
+  nc::NdArray<double> y(shape);
+  const uint64_t offset = advance(blocks_normal(y.size()));
+  rng::normal(y.data(), y.size(), seed(), offset, mean, stddev);
+  return y;
+}
+
+Generator& default_generator() {
+  static Generator generator;
+  return generator;
+}
+}  // namespace rng
@@ -0,0 +1,108 @@
+#ifndef RANDOM_
+#define RANDOM_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "NumCpp.hpp"
+
+// カウンタベースの乱数（Philox4x32-10）
+// 乱数列の位置（カウンタ）から直接値を計算するので、大きなテンソルを
+// チャンクに分けて並列に埋めても、スレッド数によらず同じ値になる
+// 各演算はGeneratorから使うカウンタの範囲（offset）を確保し、
+// (seed, offset)を覚えておけば同じ乱数をいつでも作り直せる
+namespace rng {
+using Counter = std::array<uint32_t, 4>;
+using Key = std::array<uint32_t, 2>;
+
+// Philox4x32-10: 128ビットのカウンタと64ビットの鍵から32ビットの乱数を4つ作る
+inline Counter philox4x32(Counter ctr, Key key) {
+  constexpr uint32_t kMul0 = 0xD2511F53;
+  constexpr uint32_t kMul1 = 0xCD9E8D57;
+  constexpr uint32_t kWeyl0 = 0x9E3779B9;
+  constexpr uint32_t kWeyl1 = 0xBB67AE85;
+  for (int round = 0; round < 10; round++) {
+    if (round > 0) {
+      key[0] += kWeyl0;
+      key[1] += kWeyl1;
+    }
+    const uint64_t p0 = static_cast<uint64_t>(kMul0) * ctr[0];
+    const uint64_t p1 = static_cast<uint64_t>(kMul1) * ctr[2];
+    const uint32_t hi0 = static_cast<uint32_t>(p0 >> 32);
+    const uint32_t hi1 = static_cast<uint32_t>(p1 >> 32);
+    ctr = {hi1 ^ ctr[1] ^ key[0], static_cast<uint32_t>(p1),
+           hi0 ^ ctr[3] ^ key[1], static_cast<uint32_t>(p0)};
+  }
+  return ctr;
+}
+
+// 64ビットのseedとカウンタ（ブロック番号）から乱数を4つ作る
+inline Counter philox4x32(uint64_t seed, uint64_t counter) {
+  return philox4x32(
+      Counter{static_cast<uint32_t>(counter),
+              static_cast<uint32_t>(counter >> 32), 0, 0},
+      Key{static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)});
+}
+
+// 以下の関数はy[i]をブロックoffset + i / (1ブロックあたりの要素数)から作る
+// 使ったブロック数はblocks_*で求める
+
+// [low, high)の一様乱数（1ブロックで2要素）
+void uniform(double* y, size_t n, uint64_t seed, uint64_t offset,
+             double low = 0.0, double high = 1.0);
+inline uint64_t blocks_uniform(size_t n) { return (n + 1) / 2; }
+
+// 正規乱数（Box-Muller法、1ブロックで2要素）
+void normal(double* y, size_t n, uint64_t seed, uint64_t offset,
+            double mean = 0.0, double stddev = 1.0);
+inline uint64_t blocks_normal(size_t n) { return (n + 1) / 2; }
+
+// y = 確率ratioで0、それ以外はx * scale（1ブロックで4要素、x == yでもよい）
+// 同じ(seed, offset)なら同じ要素が0になる
+void dropout(const double* x, double* y, size_t n, uint64_t seed,
+             uint64_t offset, double ratio, double scale);
+inline uint64_t blocks_dropout(size_t n) { return (n + 3) / 4; }
+
+// seedと次に使うカウンタを持つ
+// 複数のスレッドから使ってよい（カウンタの確保だけが同期する）
+class Generator {
+ public:
+  explicit Generator(uint64_t seed = 0) : seed_(seed) {}
+  Generator(const Generator&) = delete;
+  Generator& operator=(const Generator&) = delete;
+
+  uint64_t seed() const { return seed_.load(); }
+  uint64_t offset() const { return offset_.load(); }
+  // seedを変えてカウンタを先頭に戻す
+  void manual_seed(uint64_t seed);
+  // blocks個のブロックを確保して先頭のカウンタを返す
+  uint64_t advance(uint64_t blocks) { return offset_.fetch_add(blocks); }
+
+  nc::NdArray<double> uniform(const nc::Shape& shape, double low = 0.0,
+                              double high = 1.0);
+  nc::NdArray<double> normal(const nc::Shape& shape, double mean = 0.0,
+                             double stddev = 1.0);
+
+ private:
+  std::atomic<uint64_t> seed_;
+  std::atomic<uint64_t> offset_{0};
+};
+
+// ライブラリ共通のGenerator（F::dropoutなどが使う）
+Generator& default_generator();
+inline void manual_seed(uint64_t seed) {
+  default_generator().manual_seed(seed);
+}
+inline nc::NdArray<double> uniform(const nc::Shape& shape, double low = 0.0,
+                                   double high = 1.0) {
+  return default_generator().uniform(shape, low, high);
+}
+inline nc::NdArray<double> normal(const nc::Shape& shape, double mean = 0.0,
+                                  double stddev = 1.0) {
+  return default_generator().normal(shape, mean, stddev);
+}
+}  // namespace rng
+
+#endif
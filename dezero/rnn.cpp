@@ -0,0 +1,433 @@
+#include "rnn.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include "functions.h"
+#include "kernels.h"
+#include "parallel.h"
+#include "vmath.h"
+
+namespace F {
+namespace {
+template <typename Fn>
+void for_rows(size_t rows, size_t cols, Fn fn) {
+  const size_t grain = std::max<size_t>(
+      1, parallel::get_grain_size() / std::max<size_t>(1, cols));
+  parallel::parallel_for(0, rows, grain, fn);
+}
+
+void check_shape(const char* func, const char* name,
+                 const nc::NdArray<double>& a, size_t rows, size_t cols) {
+  if (a.shape().rows != rows || a.shape().cols != cols) {
+    throw std::invalid_argument(std::string(func) + ": " + name + " must be (" +
+                                std::to_string(rows) + ", " +
+                                std::to_string(cols) + ")");
+  }
+}
+
+// [x h] (N, I + H)
+nc::NdArray<double> concat_cols(const nc::NdArray<double>& x,
+                                const nc::NdArray<double>& h) {
+  const size_t n = x.shape().rows;
+  const size_t in = x.shape().cols;
+  const size_t hidden = h.shape().cols;
+  nc::NdArray<double> xh(n, in + hidden);
+  double* p = xh.data();
+  for (size_t r = 0; r < n; r++) {
+    std::copy(x.data() + r * in, x.data() + (r + 1) * in, p);
+    std::copy(h.data() + r * hidden, h.data() + (r + 1) * hidden, p + in);
+    p += in + hidden;
+  }
+  return xh;
+}
+
+// 列[begin, begin + cols)を取り出す
+nc::NdArray<double> slice_cols(const nc::NdArray<double>& a, size_t begin,
+                               size_t cols) {
+  const size_t n = a.shape().rows;
+  const size_t total = a.shape().cols;
+  nc::NdArray<double> y(n, cols);
+  for (size_t r = 0; r < n; r++) {
+    const double* src = a.data() + r * total + begin;
+    std::copy(src, src + cols, y.data() + r * cols);
+  }
+  return y;
+}
+
+// 行ごとにbを足す
+void add_row(nc::NdArray<double>& a, const nc::NdArray<double>& b) {
+  const size_t cols = a.shape().cols;
+  for (size_t r = 0; r < a.shape().rows; r++) {
+    double* ar = a.data() + r * cols;
+    for (size_t k = 0; k < cols; k++) ar[k] += b.data()[k];
+  }
+}
+
+VarPtr wrap(nc::NdArray<double>&& a) {
+  return as_variable(as_array(std::move(a)));
+}
+
+// create_graph用: 列のブロックの取り出しと埋め込みを定数の行列との積で表す
+// （基本関数だけで組むので高階微分もそのまま計算グラフになる）
+// 単位行列の列[offset, offset + n)を並べた(total, n)の行列
+VarPtr selector(size_t total, size_t offset, size_t n) {
+  nc::NdArray<double> s(total, n);
+  std::fill(s.data(), s.data() + s.size(), 0.0);
+  for (size_t k = 0; k < n; k++) s.data()[(offset + k) * n + k] = 1.0;
+  return wrap(std::move(s));
+}
+// (N, total)のk番目の幅nの列ブロック
+VarPtr block(const VarPtr& a, size_t total, size_t k, size_t n) {
+  return matmul(a, selector(total, k * n, n));
+}
+// (N, n)を(N, total)のk番目の列ブロックに置く（他は0）
+VarPtr place(const VarPtr& v, size_t total, size_t k, size_t n) {
+  return matmul(v, transpose(selector(total, k * n, n)));
+}
+
+std::vector<VarPtr> lstm_backward_graph(const std::vector<VarPtr>& in,
+                                        const VarPtr& gh, const VarPtr& gc) {
+  const auto& x = in[0];
+  const auto& h = in[1];
+  const auto& c = in[2];
+  const auto& W = in[3];
+  const size_t nx = x->shape().cols;
+  const size_t nh = h->shape().cols;
+  const size_t g4 = 4 * nh;
+  auto sx = selector(nx + nh, 0, nx);
+  auto sh = selector(nx + nh, nx, nh);
+  auto Wx = matmul(transpose(sx), W);
+  auto Wh = matmul(transpose(sh), W);
+  auto a = matmul(x, Wx) + matmul(h, Wh) + in[4];
+  auto i = sigmoid(block(a, g4, 0, nh));
+  auto f = sigmoid(block(a, g4, 1, nh));
+  auto g = tanh(block(a, g4, 2, nh));
+  auto o = sigmoid(block(a, g4, 3, nh));
+  auto tc = tanh(f * c + i * g);
+  VarPtr dc = gc;
+  if (gh) {
+    auto t = gh * o * (1.0 - tc * tc);
+    dc = dc ? dc + t : t;
+  }
+  auto da = place(dc * g * i * (1.0 - i), g4, 0, nh) +
+            place(dc * c * f * (1.0 - f), g4, 1, nh) +
+            place(dc * i * (1.0 - g * g), g4, 2, nh);
+  if (gh) {
+    da = da + place(gh * tc * o * (1.0 - o), g4, 3, nh);
+  }
+  return {matmul(da, transpose(Wx)), matmul(da, transpose(Wh)), dc * f,
+          matmul(sx, matmul(transpose(x), da)) +
+              matmul(sh, matmul(transpose(h), da)),
+          sum(da, nc::Axis::ROW)};
+}
+
+std::vector<VarPtr> gru_backward_graph(const std::vector<VarPtr>& in,
+                                       const VarPtr& gy) {
+  const auto& x = in[0];
+  const auto& h = in[1];
+  const auto& Wx = in[2];
+  const auto& Wh = in[3];
+  const size_t nh = h->shape().cols;
+  const size_t g3 = 3 * nh;
+  auto ax = matmul(x, Wx) + in[4];
+  auto ah = matmul(h, Wh) + in[5];
+  auto r = sigmoid(block(ax, g3, 0, nh) + block(ah, g3, 0, nh));
+  auto z = sigmoid(block(ax, g3, 1, nh) + block(ah, g3, 1, nh));
+  auto ahn = block(ah, g3, 2, nh);
+  auto n = tanh(block(ax, g3, 2, nh) + r * ahn);
+  auto dan = gy * (1.0 - z) * (1.0 - n * n);
+  auto dar = dan * ahn * r * (1.0 - r);
+  auto daz = gy * (h - n) * z * (1.0 - z);
+  auto drz = place(dar, g3, 0, nh) + place(daz, g3, 1, nh);
+  auto dax = drz + place(dan, g3, 2, nh);
+  auto dah = drz + place(dan * r, g3, 2, nh);
+  return {matmul(dax, transpose(Wx)),
+          matmul(dah, transpose(Wh)) + gy * z,
+          matmul(transpose(x), dax),
+          matmul(transpose(h), dah),
+          sum(dax, nc::Axis::ROW),
+          sum(dah, nc::Axis::ROW)};
+}
+}  // namespace
+
+std::vector<NdArrPtr> LstmCell::forward(const std::vector<NdArrPtr>& xs) {
+  assert(xs.size() == 5);
+  const auto& x = *xs[0];
+  const auto& h = *xs[1];
+  const auto& c = *xs[2];
+  const size_t n = x.shape().rows;
+  const size_t nx = x.shape().cols;
+  const size_t nh = h.shape().cols;
+  check_shape("lstm_cell", "h", h, n, nh);
+  check_shape("lstm_cell", "c", c, n, nh);
+  check_shape("lstm_cell", "W", *xs[3], nx + nh, 4 * nh);
+  check_shape("lstm_cell", "b", *xs[4], 1, 4 * nh);
+  // 全てのゲートを1回の行列積で求める
+  nc::NdArray<double> a = concat_cols(x, h).dot(*xs[3]);
+  auto hy = std::make_shared<nc::NdArray<double>>(n, nh);
+  auto cy = std::make_shared<nc::NdArray<double>>(n, nh);
+  double* pa = a.data();
+  const double* pb = xs[4]->data();
+  const double* pc = c.data();
+  double* ph = hy->data();
+  double* pcy = cy->data();
+  for_rows(n, 4 * nh, [&](size_t begin, size_t end) {
+    for (size_t r = begin; r < end; r++) {
+      double* ar = pa + r * 4 * nh;
+      for (size_t k = 0; k < 4 * nh; k++) ar[k] += pb[k];
+      vmath::sigmoid(ar, ar, 2 * nh);
+      vmath::tanh(ar + 2 * nh, ar + 2 * nh, nh);
+      vmath::sigmoid(ar + 3 * nh, ar + 3 * nh, nh);
+      const double* i = ar;
+      const double* f = ar + nh;
+      const double* g = ar + 2 * nh;
+      const double* o = ar + 3 * nh;
+      const double* cr = pc + r * nh;
+      double* cyr = pcy + r * nh;
+      double* hr = ph + r * nh;
+      for (size_t k = 0; k < nh; k++) cyr[k] = f[k] * cr[k] + i[k] * g[k];
+      vmath::tanh(cyr, hr, nh);
+      for (size_t k = 0; k < nh; k++) hr[k] *= o[k];
+    }
+  });
+  this->gates = std::move(a);
+  return {hy, cy};
+}
+std::vector<VarPtr> LstmCell::backward(const std::vector<VarPtr>& gy) {
+  assert(gy.size() == 2);
+  // 使われなかった出力の勾配はnullptr
+  const auto& gh = gy[0];
+  const auto& gc = gy[1];
+  if (!gh && !gc) {
+    return std::vector<VarPtr>(5, nullptr);
+  }
+  std::vector<VarPtr> gx;
+  if (Config::enable_backprop) {
+    gx = lstm_backward_graph(this->inputs_, gh, gc);
+  } else {
+    const auto& x = *this->inputs_[0]->data;
+    const auto& h = *this->inputs_[1]->data;
+    const auto& W = *this->inputs_[3]->data;
+    const size_t n = x.shape().rows;
+    const size_t nx = x.shape().cols;
+    const size_t nh = h.shape().cols;
+    nc::NdArray<double> da(n, 4 * nh);
+    nc::NdArray<double> gc_prev(n, nh);
+    const double* pgates = this->gates.data();
+    const double* pc = this->inputs_[2]->data->data();
+    const double* pgh = gh ? gh->data->data() : nullptr;
+    const double* pgc = gc ? gc->data->data() : nullptr;
+    double* pda = da.data();
+    double* pgcp = gc_prev.data();
+    for_rows(n, 4 * nh, [&](size_t begin, size_t end) {
+      std::vector<double> tc(nh);
+      for (size_t r = begin; r < end; r++) {
+        const double* i = pgates + r * 4 * nh;
+        const double* f = i + nh;
+        const double* g = i + 2 * nh;
+        const double* o = i + 3 * nh;
+        const double* cr = pc + r * nh;
+        for (size_t k = 0; k < nh; k++) tc[k] = f[k] * cr[k] + i[k] * g[k];
+        vmath::tanh(tc.data(), tc.data(), nh);
+        double* dr = pda + r * 4 * nh;
+        for (size_t k = 0; k < nh; k++) {
+          const double ghk = pgh ? pgh[r * nh + k] : 0.0;
+          const double dc = (pgc ? pgc[r * nh + k] : 0.0) +
+                            ghk * o[k] * (1.0 - tc[k] * tc[k]);
+          dr[k] = dc * g[k] * i[k] * (1.0 - i[k]);
+          dr[nh + k] = dc * cr[k] * f[k] * (1.0 - f[k]);
+          dr[2 * nh + k] = dc * i[k] * (1.0 - g[k] * g[k]);
+          dr[3 * nh + k] = ghk * tc[k] * o[k] * (1.0 - o[k]);
+          pgcp[r * nh + k] = dc * f[k];
+        }
+      }
+    });
+    gx.resize(5);
+    if (this->needs_input_grad(0) || this->needs_input_grad(1)) {
+      // [gx gh] = da W^T も1回の行列積
+      const auto gxh = da.dot(W.transpose());
+      gx[0] = wrap(slice_cols(gxh, 0, nx));
+      gx[1] = wrap(slice_cols(gxh, nx, nh));
+    }
+    gx[2] = wrap(std::move(gc_prev));
+    if (this->needs_input_grad(3)) {
+      gx[3] = wrap(concat_cols(x, h).transpose().dot(da));
+    }
+    gx[4] = wrap(kernels::sum_rows(da));
+  }
+  for (int k = 0; k < 5; k++) {
+    if (!this->needs_input_grad(k)) gx[k] = nullptr;
+  }
+  return gx;
+}
+std::vector<NdArrPtr> LstmCell::jvp(const std::vector<NdArrPtr>& xs,
+                                    const std::vector<NdArrPtr>& ys,
+                                    const std::vector<NdArrPtr>& txs) {
+  const size_t n = xs[0]->shape().rows;
+  const size_t nh = xs[1]->shape().cols;
+  auto ta = concat_cols(*txs[0], *txs[1]).dot(*xs[3]) +
+            concat_cols(*xs[0], *xs[1]).dot(*txs[3]);
+  add_row(ta, *txs[4]);
+  auto th = std::make_shared<nc::NdArray<double>>(n, nh);
+  auto tc = std::make_shared<nc::NdArray<double>>(n, nh);
+  const double* pgates = this->gates.data();
+  std::vector<double> tanh_c(nh);
+  for (size_t r = 0; r < n; r++) {
+    const double* i = pgates + r * 4 * nh;
+    const double* f = i + nh;
+    const double* g = i + 2 * nh;
+    const double* o = i + 3 * nh;
+    const double* tar = ta.data() + r * 4 * nh;
+    const double* cr = xs[2]->data() + r * nh;
+    const double* tcr = txs[2]->data() + r * nh;
+    vmath::tanh(ys[1]->data() + r * nh, tanh_c.data(), nh);
+    for (size_t k = 0; k < nh; k++) {
+      const double ti = i[k] * (1.0 - i[k]) * tar[k];
+      const double tf = f[k] * (1.0 - f[k]) * tar[nh + k];
+      const double tg = (1.0 - g[k] * g[k]) * tar[2 * nh + k];
+      const double to = o[k] * (1.0 - o[k]) * tar[3 * nh + k];
+      const double t = tf * cr[k] + f[k] * tcr[k] + ti * g[k] + i[k] * tg;
+      (*tc)[r * nh + k] = t;
+      (*th)[r * nh + k] =
+          to * tanh_c[k] + o[k] * (1.0 - tanh_c[k] * tanh_c[k]) * t;
+    }
+  }
+  return {th, tc};
+}
+
+std::vector<NdArrPtr> GruCell::forward(const std::vector<NdArrPtr>& xs) {
+  assert(xs.size() == 6);
+  const auto& x = *xs[0];
+  const auto& h = *xs[1];
+  const size_t n = x.shape().rows;
+  const size_t nx = x.shape().cols;
+  const size_t nh = h.shape().cols;
+  check_shape("gru_cell", "h", h, n, nh);
+  check_shape("gru_cell", "Wx", *xs[2], nx, 3 * nh);
+  check_shape("gru_cell", "Wh", *xs[3], nh, 3 * nh);
+  check_shape("gru_cell", "bx", *xs[4], 1, 3 * nh);
+  check_shape("gru_cell", "bh", *xs[5], 1, 3 * nh);
+  const auto ax = x.dot(*xs[2]);
+  const auto ah = h.dot(*xs[3]);
+  // r、z、n、ah_n
+  nc::NdArray<double> s(n, 4 * nh);
+  auto y = std::make_shared<nc::NdArray<double>>(n, nh);
+  const double* pbx = xs[4]->data();
+  const double* pbh = xs[5]->data();
+  for_rows(n, 4 * nh, [&](size_t begin, size_t end) {
+    for (size_t r = begin; r < end; r++) {
+      const double* axr = ax.data() + r * 3 * nh;
+      const double* ahr = ah.data() + r * 3 * nh;
+      double* sr = s.data() + r * 4 * nh;
+      for (size_t k = 0; k < 2 * nh; k++) {
+        sr[k] = axr[k] + pbx[k] + ahr[k] + pbh[k];
+      }
+      vmath::sigmoid(sr, sr, 2 * nh);
+      for (size_t k = 0; k < nh; k++) {
+        const double ahn = ahr[2 * nh + k] + pbh[2 * nh + k];
+        sr[3 * nh + k] = ahn;
+        sr[2 * nh + k] = axr[2 * nh + k] + pbx[2 * nh + k] + sr[k] * ahn;
+      }
+      vmath::tanh(sr + 2 * nh, sr + 2 * nh, nh);
+      const double* z = sr + nh;
+      const double* nr = sr + 2 * nh;
+      const double* hr = h.data() + r * nh;
+      double* yr = y->data() + r * nh;
+      for (size_t k = 0; k < nh; k++) {
+        yr[k] = (1.0 - z[k]) * nr[k] + z[k] * hr[k];
+      }
+    }
+  });
+  this->gates = std::move(s);
+  return {y};
+}
+std::vector<VarPtr> GruCell::backward(const std::vector<VarPtr>& gy) {
+  assert(gy.size() == 1);
+  if (!gy[0]) {
+    return std::vector<VarPtr>(6, nullptr);
+  }
+  std::vector<VarPtr> gx;
+  if (Config::enable_backprop) {
+    gx = gru_backward_graph(this->inputs_, gy[0]);
+  } else {
+    const auto& x = *this->inputs_[0]->data;
+    const auto& h = *this->inputs_[1]->data;
+    const size_t n = x.shape().rows;
+    const size_t nh = h.shape().cols;
+    nc::NdArray<double> dax(n, 3 * nh);
+    nc::NdArray<double> dah(n, 3 * nh);
+    nc::NdArray<double> gh_direct(n, nh);
+    const double* pg = gy[0]->data->data();
+    for_rows(n, 4 * nh, [&](size_t begin, size_t end) {
+      for (size_t r = begin; r < end; r++) {
+        const double* rr = this->gates.data() + r * 4 * nh;
+        const double* z = rr + nh;
+        const double* nr = rr + 2 * nh;
+        const double* ahn = rr + 3 * nh;
+        const double* hr = h.data() + r * nh;
+        const double* gr = pg + r * nh;
+        double* dxr = dax.data() + r * 3 * nh;
+        double* dhr = dah.data() + r * 3 * nh;
+        for (size_t k = 0; k < nh; k++) {
+          const double dan = gr[k] * (1.0 - z[k]) * (1.0 - nr[k] * nr[k]);
+          const double dar = dan * ahn[k] * rr[k] * (1.0 - rr[k]);
+          const double daz = gr[k] * (hr[k] - nr[k]) * z[k] * (1.0 - z[k]);
+          dxr[k] = dhr[k] = dar;
+          dxr[nh + k] = dhr[nh + k] = daz;
+          dxr[2 * nh + k] = dan;
+          dhr[2 * nh + k] = dan * rr[k];
+          gh_direct[r * nh + k] = gr[k] * z[k];
+        }
+      }
+    });
+    gx.resize(6);
+    if (this->needs_input_grad(0)) {
+      gx[0] = wrap(dax.dot(this->inputs_[2]->data->transpose()));
+    }
+    if (this->needs_input_grad(1)) {
+      gx[1] = wrap(dah.dot(this->inputs_[3]->data->transpose()) + gh_direct);
+    }
+    if (this->needs_input_grad(2)) gx[2] = wrap(x.transpose().dot(dax));
+    if (this->needs_input_grad(3)) gx[3] = wrap(h.transpose().dot(dah));
+    gx[4] = wrap(kernels::sum_rows(dax));
+    gx[5] = wrap(kernels::sum_rows(dah));
+  }
+  for (int k = 0; k < 6; k++) {
+    if (!this->needs_input_grad(k)) gx[k] = nullptr;
+  }
+  return gx;
+}
+std::vector<NdArrPtr> GruCell::jvp(const std::vector<NdArrPtr>& xs,
+                                   const std::vector<NdArrPtr>& ys,
+                                   const std::vector<NdArrPtr>& txs) {
+  const size_t n = xs[0]->shape().rows;
+  const size_t nh = xs[1]->shape().cols;
+  auto tax = txs[0]->dot(*xs[2]) + xs[0]->dot(*txs[2]);
+  auto tah = txs[1]->dot(*xs[3]) + xs[1]->dot(*txs[3]);
+  add_row(tax, *txs[4]);
+  add_row(tah, *txs[5]);
+  auto ty = std::make_shared<nc::NdArray<double>>(n, nh);
+  for (size_t r = 0; r < n; r++) {
+    const double* rr = this->gates.data() + r * 4 * nh;
+    const double* z = rr + nh;
+    const double* nr = rr + 2 * nh;
+    const double* ahn = rr + 3 * nh;
+    const double* txr = tax.data() + r * 3 * nh;
+    const double* thr = tah.data() + r * 3 * nh;
+    const double* hr = xs[1]->data() + r * nh;
+    const double* tr_h = txs[1]->data() + r * nh;
+    for (size_t k = 0; k < nh; k++) {
+      const double tr = rr[k] * (1.0 - rr[k]) * (txr[k] + thr[k]);
+      const double tz = z[k] * (1.0 - z[k]) * (txr[nh + k] + thr[nh + k]);
+      const double ta_n =
+          txr[2 * nh + k] + tr * ahn[k] + rr[k] * thr[2 * nh + k];
+      const double tn = (1.0 - nr[k] * nr[k]) * ta_n;
+      (*ty)[r * nh + k] =
+          tz * (hr[k] - nr[k]) + (1.0 - z[k]) * tn + z[k] * tr_h[k];
+    }
+  }
+  return {ty};
+}
+}  // namespace F
@@ -0,0 +1,70 @@
+#ifndef RNN_
+#define RNN_
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "NumCpp.hpp"
+#include "core.h"
+
+// 再帰型ネットワークの1ステップを1つの関数にまとめたもの
+// 基本関数で組むとLSTMの1ステップは20個ほどの関数と中間結果になるが、
+// ゲートを1回の行列積と1回の要素ごとの計算で求め、逆伝播も手で導いた式で計算する
+//
+//   auto [h, c] = F::lstm_cell(x, h, c, W, b);  // W: (I + H, 4H), b: (1, 4H)
+//   h = F::gru_cell(x, h, Wx, Wh, bx, bh);      // Wx: (I, 3H), Wh: (H, 3H)
+//
+// 逆伝播で計算グラフを作る場合（create_graph）は、同じ式を基本関数で組み直す
+namespace F {
+// LSTM: x (N, I)、h (N, H)、c (N, H)、W (I + H, 4H)、b (1, 4H)
+// -> h' (N, H)、c' (N, H)
+// Wの列はゲートi、f、g、oの順で、a = [x h] W + bとして
+//   c' = sigmoid(a_f) * c + sigmoid(a_i) * tanh(a_g)
+//   h' = sigmoid(a_o) * tanh(c')
+// 逆伝播のために活性化後のゲート(N, 4H)だけを保存する（tanh(c')は作り直す）
+class LstmCell : public Function {
+ public:
+  nc::NdArray<double> gates;
+  size_t num_outputs() const override { return 2; }
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
+};
+
+// GRU: x (N, I)、h (N, H)、Wx (I, 3H)、Wh (H, 3H)、bx (1, 3H)、bh (1, 3H)
+// -> h' (N, H)
+// 列はゲートr、z、nの順で（PyTorchのGRUCellと同じ）、ax = x Wx + bx、
+// ah = h Wh + bhとして
+//   r = sigmoid(ax_r + ah_r)、z = sigmoid(ax_z + ah_z)
+//   n = tanh(ax_n + r * ah_n)、h' = (1 - z) * n + z * h
+// rはhの側の積にだけ掛かるので、行列積はxとhの2回に分ける
+// 逆伝播のためにr、z、nとah_n(N, 4H)だけを保存する
+class GruCell : public Function {
+ public:
+  nc::NdArray<double> gates;
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override;
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override;
+  std::vector<NdArrPtr> jvp(const std::vector<NdArrPtr>& xs,
+                            const std::vector<NdArrPtr>& ys,
+                            const std::vector<NdArrPtr>& txs) override;
+};
+
+// (h', c')を返す
+inline std::pair<VarPtr, VarPtr> lstm_cell(VarPtr x, VarPtr h, VarPtr c,
+                                           VarPtr W, VarPtr b) {
+  auto f = std::make_shared<LstmCell>();
+  auto ys = (*f)(x, h, c, W, b);
+  return {ys[0], ys[1]};
+}
+
+inline VarPtr gru_cell(VarPtr x, VarPtr h, VarPtr Wx, VarPtr Wh, VarPtr bx,
+                       VarPtr bh) {
+  auto f = std::make_shared<GruCell>();
+  return (*f)(x, h, Wx, Wh, bx, bh)[0];
+}
+}  // namespace F
+
+#endif
@@ -0,0 +1,307 @@
+#include "sparse.h"
+
+#include <algorithm>
+#include <iterator>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "parallel.h"
+
+namespace sparse {
+namespace {
+// 1行あたりの仕事量がおよそwork要素のとき、grain_size分ずつ並列にする行数
+size_t rows_grain(size_t work) {
+  return std::max<size_t>(
+      1, parallel::get_grain_size() / std::max<size_t>(1, work));
+}
+
+// dst[0, n) += v * src[0, n)
+void axpy(double* dst, const double* src, double v, size_t n) {
+  for (size_t k = 0; k < n; k++) {
+    dst[k] += v * src[k];
+  }
+}
+}  // namespace
+
+void COO::add(size_t i, size_t j, double v) {
+  if (i >= rows || j >= cols) {
+    throw std::out_of_range("COO::add: index out of range");
+  }
+  row.push_back(i);
+  col.push_back(j);
+  value.push_back(v);
+}
+
+CSR::CSR(size_t rows, size_t cols, std::vector<size_t> indptr,
+         std::vector<size_t> indices, std::vector<double> values)
+    : rows_(rows),
+      cols_(cols),
+      indptr_(std::move(indptr)),
+      indices_(std::move(indices)),
+      values_(std::move(values)) {
+  if (indptr_.size() != rows_ + 1 || indptr_[0] != 0 ||
+      indptr_[rows_] != values_.size() || indices_.size() != values_.size()) {
+    throw std::invalid_argument("CSR: inconsistent indptr/indices/values");
+  }
+  for (size_t i = 0; i < rows_; i++) {
+    if (indptr_[i] > indptr_[i + 1]) {
+      throw std::invalid_argument("CSR: indptr must be non-decreasing");
+    }
+    for (size_t p = indptr_[i]; p < indptr_[i + 1]; p++) {
+      if (indices_[p] >= cols_ ||
+          (p > indptr_[i] && indices_[p - 1] >= indices_[p])) {
+        throw std::invalid_argument(
+            "CSR: column indices must be in range and increasing in row " +
+            std::to_string(i));
+      }
+    }
+  }
+}
+
+CSR::CSR(const COO& coo) : rows_(coo.rows), cols_(coo.cols) {
+  // 行ごとに数えて並べ（計数ソート）、行の中を列の順に並べて同じ位置を足す
+  std::vector<size_t> start(rows_ + 1, 0);
+  for (size_t i : coo.row) {
+    start[i + 1]++;
+  }
+  for (size_t i = 0; i < rows_; i++) {
+    start[i + 1] += start[i];
+  }
+  std::vector<std::pair<size_t, double>> entries(coo.nnz());
+  std::vector<size_t> next(start.begin(), start.end() - 1);
+  for (size_t p = 0; p < coo.nnz(); p++) {
+    entries[next[coo.row[p]]++] = {coo.col[p], coo.value[p]};
+  }
+  indptr_.assign(rows_ + 1, 0);
+  indices_.reserve(coo.nnz());
+  values_.reserve(coo.nnz());
+  for (size_t i = 0; i < rows_; i++) {
+    auto first = entries.begin() + start[i];
+    auto last = entries.begin() + start[i + 1];
+    std::stable_sort(first, last, [](const auto& a, const auto& b) {
+      return a.first < b.first;
+    });
+    for (auto it = first; it != last; ++it) {
+      if (indices_.size() > indptr_[i] && indices_.back() == it->first) {
+        values_.back() += it->second;
+      } else {
+        indices_.push_back(it->first);
+        values_.push_back(it->second);
+      }
+    }
+    indptr_[i + 1] = indices_.size();
+  }
+}
+
+CSR CSR::from_dense(const nc::NdArray<double>& x) {
+  const size_t rows = x.shape().rows;
+  const size_t cols = x.shape().cols;
+  std::vector<size_t> indptr(rows + 1, 0);
+  std::vector<size_t> indices;
+  std::vector<double> values;
+  for (size_t i = 0; i < rows; i++) {
+    for (size_t j = 0; j < cols; j++) {
+      const double v = x.data()[i * cols + j];
+      if (v != 0.0) {
+        indices.push_back(j);
+        values.push_back(v);
+      }
+    }
+    indptr[i + 1] = indices.size();
+  }
+  return CSR(rows, cols, std::move(indptr), std::move(indices),
+             std::move(values));
+}
+
+nc::NdArray<double> CSR::to_dense() const {
+  auto y = nc::zeros<double>(shape());
+  for (size_t i = 0; i < rows_; i++) {
+    for (size_t p = indptr_[i]; p < indptr_[i + 1]; p++) {
+      y.data()[i * cols_ + indices_[p]] = values_[p];
+    }
+  }
+  return y;
+}
+
+CSR CSR::transpose() const {
+  std::vector<size_t> indptr(cols_ + 1, 0);
+  for (size_t j : indices_) {
+    indptr[j + 1]++;
+  }
+  for (size_t j = 0; j < cols_; j++) {
+    indptr[j + 1] += indptr[j];
+  }
+  // 行の順に入れるので、転置後の各行の列番号は昇順になる
+  std::vector<size_t> next(indptr.begin(), indptr.end() - 1);
+  std::vector<size_t> indices(nnz());
+  std::vector<double> values(nnz());
+  for (size_t i = 0; i < rows_; i++) {
+    for (size_t p = indptr_[i]; p < indptr_[i + 1]; p++) {
+      const size_t q = next[indices_[p]]++;
+      indices[q] = i;
+      values[q] = values_[p];
+    }
+  }
+  return CSR(cols_, rows_, std::move(indptr), std::move(indices),
+             std::move(values));
+}
+
+nc::NdArray<double> CSR::dot(const nc::NdArray<double>& w) const {
+  if (w.shape().rows != cols_) {
+    throw std::invalid_argument("CSR::dot: shape mismatch");
+  }
+  const size_t h = w.shape().cols;
+  auto y = nc::zeros<double>(static_cast<nc::uint32>(rows_),
+                             static_cast<nc::uint32>(h));
+  const double* pw = w.data();
+  double* py = y.data();
+  // 出力の行ごとに独立なので行で分ける
+  const size_t work =
+      h * std::max<size_t>(1, nnz() / std::max<size_t>(1, rows_));
+  parallel::parallel_for(
+      0, rows_, rows_grain(work), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+          for (size_t p = indptr_[i]; p < indptr_[i + 1]; p++) {
+            axpy(py + i * h, pw + indices_[p] * h, values_[p], h);
+          }
+        }
+      });
+  return y;
+}
+
+nc::NdArray<double> CSR::tdot(const nc::NdArray<double>& g) const {
+  if (g.shape().rows != rows_) {
+    throw std::invalid_argument("CSR::tdot: shape mismatch");
+  }
+  // 転置してから掛ける（出力の行に散らばって足すと並列にできない）
+  return transpose().dot(g);
+}
+
+RowSparse::RowSparse(const nc::Shape& shape, std::vector<size_t> rows,
+                     nc::NdArray<double> values)
+    : shape_(shape), rows_(std::move(rows)), values_(std::move(values)) {
+  if (values_.shape().rows != rows_.size() ||
+      values_.shape().cols != shape_.cols) {
+    throw std::invalid_argument(
+        "RowSparse: values must be (rows.size(), cols)");
+  }
+  for (size_t k = 0; k < rows_.size(); k++) {
+    if (rows_[k] >= shape_.rows || (k > 0 && rows_[k - 1] >= rows_[k])) {
+      throw std::invalid_argument(
+          "RowSparse: rows must be in range and increasing");
+    }
+  }
+}
+
+RowSparse RowSparse::tdot(const CSR& x, const nc::NdArray<double>& g) {
+  if (g.shape().rows != x.rows()) {
+    throw std::invalid_argument("RowSparse::tdot: shape mismatch");
+  }
+  const CSR xt = x.transpose();
+  std::vector<size_t> rows;
+  for (size_t j = 0; j < xt.rows(); j++) {
+    if (xt.indptr()[j] != xt.indptr()[j + 1]) {
+      rows.push_back(j);
+    }
+  }
+  const size_t h = g.shape().cols;
+  auto values = nc::zeros<double>(static_cast<nc::uint32>(rows.size()),
+                                  static_cast<nc::uint32>(h));
+  const double* pg = g.data();
+  double* pv = values.data();
+  const size_t work =
+      h * std::max<size_t>(1, x.nnz() / std::max<size_t>(1, rows.size()));
+  const auto& indptr = xt.indptr();
+  const auto& indices = xt.indices();
+  const auto& xv = xt.values();
+  parallel::parallel_for(
+      0, rows.size(), rows_grain(work), [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++) {
+          for (size_t p = indptr[rows[k]]; p < indptr[rows[k] + 1]; p++) {
+            axpy(pv + k * h, pg + indices[p] * h, xv[p], h);
+          }
+        }
+      });
+  return RowSparse(nc::Shape(static_cast<nc::uint32>(x.cols()),
+                             static_cast<nc::uint32>(h)),
+                   std::move(rows), std::move(values));
+}
+
+RowSparse RowSparse::scatter(const nc::Shape& shape,
+                             const std::vector<size_t>& indices,
+                             const nc::NdArray<double>& g) {
+  const size_t cols = shape.cols;
+  if (g.shape().rows != indices.size() || g.shape().cols != cols) {
+    throw std::invalid_argument("RowSparse::scatter: shape mismatch");
+  }
+  // 行番号で安定ソートし、同じ行の勾配を元の順に足す（結果がスレッド数によらない）
+  std::vector<size_t> order(indices.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return indices[a] < indices[b];
+  });
+  std::vector<size_t> rows;
+  std::vector<size_t> start;
+  for (size_t k = 0; k < order.size(); k++) {
+    if (rows.empty() || rows.back() != indices[order[k]]) {
+      rows.push_back(indices[order[k]]);
+      start.push_back(k);
+    }
+  }
+  start.push_back(order.size());
+  auto values = nc::zeros<double>(static_cast<nc::uint32>(rows.size()),
+                                  static_cast<nc::uint32>(cols));
+  const double* pg = g.data();
+  double* pv = values.data();
+  parallel::parallel_for(
+      0, rows.size(), rows_grain(cols), [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++) {
+          for (size_t q = start[k]; q < start[k + 1]; q++) {
+            axpy(pv + k * cols, pg + order[q] * cols, 1.0, cols);
+          }
+        }
+      });
+  return RowSparse(shape, std::move(rows), std::move(values));
+}
+
+RowSparse RowSparse::operator+(const RowSparse& other) const {
+  if (shape_ != other.shape_) {
+    throw std::invalid_argument("RowSparse::operator+: shape mismatch");
+  }
+  // 両方の昇順の行番号を合わせる
+  std::vector<size_t> rows;
+  std::set_union(rows_.begin(), rows_.end(), other.rows_.begin(),
+                 other.rows_.end(), std::back_inserter(rows));
+  const size_t cols = shape_.cols;
+  auto values = nc::zeros<double>(static_cast<nc::uint32>(rows.size()),
+                                  static_cast<nc::uint32>(cols));
+  for (const RowSparse* src : {this, &other}) {
+    size_t k = 0;
+    for (size_t s = 0; s < src->rows_.size(); s++) {
+      while (rows[k] != src->rows_[s]) k++;
+      axpy(values.data() + k * cols, src->values_.data() + s * cols, 1.0,
+           cols);
+    }
+  }
+  return RowSparse(shape_, std::move(rows), std::move(values));
+}
+
+nc::NdArray<double> RowSparse::to_dense() const {
+  auto y = nc::zeros<double>(shape_);
+  add_to(y);
+  return y;
+}
+
+void RowSparse::add_to(nc::NdArray<double>& dense, double scale) const {
+  if (dense.shape() != shape_) {
+    throw std::invalid_argument("RowSparse::add_to: shape mismatch");
+  }
+  const size_t cols = shape_.cols;
+  for (size_t k = 0; k < rows_.size(); k++) {
+    axpy(dense.data() + rows_[k] * cols, values_.data() + k * cols, scale,
+         cols);
+  }
+}
+}  // namespace sparse
@@ -0,0 +1,102 @@
+#ifndef SPARSE_
+#define SPARSE_
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "NumCpp.hpp"
+
+// 疎行列
+// 推薦モデルの特徴量のようなほとんどが0の行列を密なndarrayにせずに持ち、
+// F::sparse_matmulで密な重みと掛ける
+namespace sparse {
+// 座標形式（(row, col, value)の組）
+// 組み立て用で、同じ位置が複数あってもよい（CSRにするときに足す）
+struct COO {
+  size_t rows = 0;
+  size_t cols = 0;
+  std::vector<size_t> row;
+  std::vector<size_t> col;
+  std::vector<double> value;
+
+  COO(size_t rows, size_t cols) : rows(rows), cols(cols) {}
+  void add(size_t i, size_t j, double v);
+  size_t nnz() const { return value.size(); }
+};
+
+// 圧縮行形式
+// 行iの非零要素はindices/values[indptr[i], indptr[i + 1])で、列番号の昇順
+class CSR {
+ public:
+  CSR(size_t rows, size_t cols, std::vector<size_t> indptr,
+      std::vector<size_t> indices, std::vector<double> values);
+  explicit CSR(const COO& coo);
+  // 0でない要素だけを取り出す
+  static CSR from_dense(const nc::NdArray<double>& x);
+
+  nc::Shape shape() const {
+    return nc::Shape(static_cast<nc::uint32>(rows_),
+                     static_cast<nc::uint32>(cols_));
+  }
+  size_t rows() const { return rows_; }
+  size_t cols() const { return cols_; }
+  size_t nnz() const { return values_.size(); }
+  const std::vector<size_t>& indptr() const { return indptr_; }
+  const std::vector<size_t>& indices() const { return indices_; }
+  const std::vector<double>& values() const { return values_; }
+
+  nc::NdArray<double> to_dense() const;
+  CSR transpose() const;
+
+  // X w（(rows, cols) x (cols, H) -> (rows, H)）
+  nc::NdArray<double> dot(const nc::NdArray<double>& w) const;
+  // X^T g（(rows, cols)^T x (rows, H) -> (cols, H)）
+  nc::NdArray<double> tdot(const nc::NdArray<double>& g) const;
+
+ private:
+  size_t rows_;
+  size_t cols_;
+  std::vector<size_t> indptr_;
+  std::vector<size_t> indices_;
+  std::vector<double> values_;
+};
+
+using CSRPtr = std::shared_ptr<const CSR>;
+
+inline CSRPtr as_csr(CSR x) {
+  return std::make_shared<const CSR>(std::move(x));
+}
+
+// 一部の行だけが0でない勾配
+// rows[k]行目の値がvaluesのk行目（rowsは昇順で重複しない）
+// 埋め込みや疎な特徴量の重みの勾配で、触れた行だけを持つ
+class RowSparse {
+ public:
+  RowSparse(const nc::Shape& shape, std::vector<size_t> rows,
+            nc::NdArray<double> values);
+  // X^T gの0でない行だけを求める
+  static RowSparse tdot(const CSR& x, const nc::NdArray<double>& g);
+  // gのk行目をindices[k]行目に足したもの（同じ行が複数あれば足しておく）
+  static RowSparse scatter(const nc::Shape& shape,
+                           const std::vector<size_t>& indices,
+                           const nc::NdArray<double>& g);
+
+  const nc::Shape& shape() const { return shape_; }
+  const std::vector<size_t>& rows() const { return rows_; }
+  const nc::NdArray<double>& values() const { return values_; }
+
+  // 行を合わせて足したものを返す（同じ行は足す）
+  RowSparse operator+(const RowSparse& other) const;
+  nc::NdArray<double> to_dense() const;
+  // dense += scale * thisを持っている行だけに行う（SGDの更新など）
+  void add_to(nc::NdArray<double>& dense, double scale = 1.0) const;
+
+ private:
+  nc::Shape shape_;
+  std::vector<size_t> rows_;
+  nc::NdArray<double> values_;
+};
+}  // namespace sparse
+
+#endif
@@ -0,0 +1,119 @@
+#include "stream.h"
+
+#include <memory>
+#include <stdexcept>
+
+namespace stream {
+namespace {
+thread_local Stream* current = nullptr;
+}  // namespace
+
+Stream* active() { return current; }
+
+Stream::Stream() : worker_([this]() { run(); }) {}
+
+Stream::~Stream() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  // 積まれている処理は全て実行してから終わる
+  worker_.join();
+}
+
+void Stream::enqueue(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(std::move(task));
+  }
+  cv_.notify_all();
+}
+
+void Stream::synchronize() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cv_.wait(lock, [this]() { return queue_.empty() && !busy_; });
+  if (error_) {
+    auto e = error_;
+    error_ = nullptr;
+    std::rethrow_exception(e);
+  }
+}
+
+void Stream::set_error(std::exception_ptr e) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!error_) {
+    error_ = e;
+  }
+}
+
+void Stream::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+    if (queue_.empty()) {
+      return;
+    }
+    auto task = std::move(queue_.front());
+    queue_.pop_front();
+    busy_ = true;
+    lock.unlock();
+    // 関数の参照などはロックの外で手放す
+    task();
+    task = nullptr;
+    lock.lock();
+    busy_ = false;
+    done_cv_.notify_all();
+  }
+}
+
+Stream& default_stream() {
+  static Stream instance;
+  return instance;
+}
+
+std::vector<VarPtr> launch(Stream* s, FuncPtr f, std::vector<DataPtr> xs) {
+  const size_t n = f->num_outputs();
+  auto promises = std::make_shared<std::vector<std::promise<NdArrPtr>>>(n);
+  std::vector<VarPtr> outputs;
+  outputs.reserve(n);
+  for (auto& p : *promises) {
+    outputs.push_back(
+        std::make_shared<Variable>(DataPtr(p.get_future().share())));
+  }
+
+  s->enqueue([s, f = std::move(f), xs = std::move(xs), promises]() {
+    std::vector<NdArrPtr> ys;
+    try {
+      // 入力を作った関数は先に実行されているので、ここで待つことはない
+      // （入力の計算が失敗していれば例外がそのまま出力に伝わる）
+      std::vector<NdArrPtr> arrs;
+      arrs.reserve(xs.size());
+      for (const auto& x : xs) {
+        arrs.push_back(x.get());
+      }
+      ys = f->forward(arrs);
+      if (ys.size() != promises->size()) {
+        throw std::logic_error("stream: forward returned " +
+                               std::to_string(ys.size()) +
+                               " outputs but num_outputs() is " +
+                               std::to_string(promises->size()));
+      }
+    } catch (...) {
+      auto e = std::current_exception();
+      s->set_error(e);
+      for (auto& p : *promises) {
+        p.set_exception(e);
+      }
+      return;
+    }
+    for (size_t i = 0; i < ys.size(); i++) {
+      (*promises)[i].set_value(std::move(ys[i]));
+    }
+  });
+  return outputs;
+}
+
+Async::Async(Stream& s) : prev_(current) { current = &s; }
+Async::~Async() { current = prev_; }
+}  // namespace stream
@@ -0,0 +1,75 @@
+#ifndef STREAM_
+#define STREAM_
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "core.h"
+
+// 非同期実行
+// Asyncが有効な間に呼ばれたFunctionは順伝播をストリームに積むだけで戻り、
+// 出力のVariable::dataは値が確定していないfutureになる
+// 値は最初に参照したとき（*y->dataなど）に完了を待って取り出される
+//
+//   {
+//     stream::Async async_mode;
+//     y = F::matmul(a, b);   // すぐ戻る
+//     prepare_next_batch();  // matmulと並行して進む
+//   }
+//   stream::synchronize();   // 積んだ計算が全て終わるまで待つ
+//
+// ストリームは積まれた順に1つずつ実行するので、ある関数の入力を作った関数は
+// 必ずその関数より先に終わっている（データ依存が守られる）
+// 計算グラフのつながりやテープへの記録は呼び出し時に（同期的に）行われる
+namespace stream {
+class Stream {
+ public:
+  Stream();
+  ~Stream();
+  Stream(const Stream&) = delete;
+  Stream& operator=(const Stream&) = delete;
+
+  void enqueue(std::function<void()> task);
+  // 積まれた処理が全て終わるまで待つ
+  // 途中で例外が起きていれば最初の1つを投げ直す
+  void synchronize();
+  // 関数の実行中に起きた例外を記録する
+  void set_error(std::exception_ptr e);
+
+ private:
+  void run();
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::condition_variable done_cv_;
+  std::deque<std::function<void()>> queue_;
+  std::exception_ptr error_;
+  bool busy_ = false;
+  bool stop_ = false;
+  std::thread worker_;
+};
+
+// プロセスで共有する既定のストリーム
+Stream& default_stream();
+
+// 有効な間、このスレッドで呼ばれたFunctionをstreamで非同期に実行する
+class Async {
+ public:
+  explicit Async(Stream& s = default_stream());
+  ~Async();
+  Async(const Async&) = delete;
+  Async& operator=(const Async&) = delete;
+
+ private:
+  Stream* prev_;
+};
+
+// 既定のストリームに積んだ計算が全て終わるまで待つ
+inline void synchronize() { default_stream().synchronize(); }
+}  // namespace stream
+
+#endif
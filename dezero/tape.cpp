@@ -0,0 +1,132 @@
+#include "tape.h"
+
+#include <atomic>
+#include <stdexcept>
+
+namespace tape {
+namespace {
+thread_local Tape* current = nullptr;
+// clearのたびに番号を変え、古い記録の番号を持つ変数と区別する
+std::atomic<uint64_t> next_id{1};
+
+// 有効な間は記録を止める
+struct Pause {
+  Tape* prev = current;
+  Pause() { current = nullptr; }
+  ~Pause() { current = prev; }
+};
+}  // namespace
+
+Tape* active() { return current; }
+
+void record(Tape* tape, FuncPtr f, const std::vector<VarPtr>& outputs) {
+  tape->add(std::move(f), outputs);
+}
+
+Tape::Tape() : id_(next_id++), in_offsets_{0}, out_offsets_{0} {}
+
+int Tape::slot(const VarPtr& v) {
+  if (v->tape_id != id_) {
+    v->tape_id = id_;
+    v->tape_slot = vars_.size();
+    vars_.push_back(v);
+    producer_.push_back(-1);
+  }
+  return v->tape_slot;
+}
+
+void Tape::add(FuncPtr f, const std::vector<VarPtr>& outputs) {
+  for (const auto& input : f->inputs_) {
+    in_slots_.push_back(this->slot(input));
+  }
+  in_offsets_.push_back(in_slots_.size());
+  const int index = funcs_.size();
+  for (const auto& output : outputs) {
+    output->tape_id = id_;
+    output->tape_slot = vars_.size();
+    vars_.push_back(output);
+    producer_.push_back(index);
+    out_slots_.push_back(output->tape_slot);
+  }
+  out_offsets_.push_back(out_slots_.size());
+  funcs_.push_back(std::move(f));
+}
+
+void Tape::backward(const VarPtr& y, bool retain_grad, bool create_graph) {
+  if (y->tape_id != id_) {
+    throw std::invalid_argument("tape: y is not recorded on this tape");
+  }
+  // 非同期実行の出力なら順伝播が終わるまで待つ
+  y->data.get();
+  if (!y->grad) {
+    y->grad = as_variable(as_array(nc::ones_like<double>(*y->data)));
+  }
+  // 逆伝播中の関数呼び出しは記録しない
+  Pause pause;
+  UsingConfig with_backprop_cfg("enable_backprop", create_graph);
+
+  std::vector<VarPtr> grads(vars_.size());
+  grads[y->tape_slot] = y->grad;
+  std::vector<VarPtr> gys;
+  // yより後に記録された関数はyに影響しない
+  for (int i = producer_[y->tape_slot]; i >= 0; i--) {
+    gys.clear();
+    bool has_grad = false;
+    for (int k = out_offsets_[i]; k < out_offsets_[i + 1]; k++) {
+      gys.push_back(grads[out_slots_[k]]);
+      has_grad = has_grad || gys.back();
+    }
+    if (!has_grad) {
+      continue;
+    }
+    // 勾配が流れてこなかった出力は0とする
+    for (int k = 0; k < gys.size(); k++) {
+      if (!gys[k]) {
+        const auto& data = *vars_[out_slots_[out_offsets_[i] + k]]->data;
+        gys[k] = as_variable(as_array(nc::zeros_like<double>(data)));
+      }
+    }
+
+    const auto& gxs = funcs_[i]->backward(gys);
+    const int begin = in_offsets_[i];
+    assert(gxs.size() == in_offsets_[i + 1] - begin);
+    for (int k = 0; k < gxs.size(); k++) {
+      if (!gxs[k]) {
+        continue;
+      }
+      auto& g = grads[in_slots_[begin + k]];
+      g = g ? g + gxs[k] : gxs[k];
+    }
+
+    for (int k = out_offsets_[i]; k < out_offsets_[i + 1]; k++) {
+      if (retain_grad) {
+        vars_[out_slots_[k]]->grad = grads[out_slots_[k]];
+      }
+      // 使い終わった勾配はすぐに解放する
+      grads[out_slots_[k]] = nullptr;
+    }
+  }
+
+  for (int s = 0; s < vars_.size(); s++) {
+    if (producer_[s] >= 0 || !grads[s]) {
+      continue;
+    }
+    auto& g = vars_[s]->grad;
+    g = g ? g + grads[s] : grads[s];
+  }
+}
+
+void Tape::clear() {
+  id_ = next_id++;
+  funcs_.clear();
+  in_offsets_.assign(1, 0);
+  in_slots_.clear();
+  out_offsets_.assign(1, 0);
+  out_slots_.clear();
+  vars_.clear();
+  producer_.clear();
+}
+
+Recording::Recording(Tape& tape) : prev_(current) { current = &tape; }
+Recording::~Recording() { current = prev_; }
+}  // namespace tape
@@ -0,0 +1,74 @@
+#ifndef TAPE_
+#define TAPE_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "core.h"
+
+// 計算の記録（Wengert list）
+// Recordingが有効な間に呼ばれたFunctionを呼び出し順に配列へ記録し、
+// 関数の入出力は変数の番号（int）で持つ。逆伝播は配列を後ろから1回なめるだけで、
+// generationによる並べ替えやハッシュ表、weak_ptrのlockが要らない
+//
+//   tape::Tape tape;
+//   {
+//     tape::Recording rec(tape);
+//     y = f(x);
+//   }
+//   tape.backward(y);  // x->gradに勾配が入る
+//
+// 記録した関数はcreator_ptrで繋がないので、y->backward()ではなくtape.backwardを使う
+// 1つの変数を記録できるテープは同時に1つだけ
+namespace tape {
+class Tape {
+ public:
+  Tape();
+  Tape(const Tape&) = delete;
+  Tape& operator=(const Tape&) = delete;
+
+  void add(FuncPtr f, const std::vector<VarPtr>& outputs);
+
+  // yから逆伝播し、テープの外で作られた変数（葉）のgradに勾配を足す
+  // retain_gradなら途中の変数のgradも残す
+  // create_graphなら勾配の計算グラフを（テープではなく）通常どおり作る
+  void backward(const VarPtr& y, bool retain_grad = true,
+                bool create_graph = false);
+
+  // 記録を捨てる（変数と関数の参照も手放す）
+  void clear();
+
+  size_t num_functions() const { return funcs_.size(); }
+  size_t num_variables() const { return vars_.size(); }
+
+ private:
+  int slot(const VarPtr& v);
+
+  uint64_t id_;
+  // 記録順の関数（テープが所有する）
+  std::vector<FuncPtr> funcs_;
+  // i番目の関数の入力はin_slots_[in_offsets_[i], in_offsets_[i + 1])（CSR形式）
+  std::vector<int> in_offsets_;
+  std::vector<int> in_slots_;
+  std::vector<int> out_offsets_;
+  std::vector<int> out_slots_;
+  std::vector<VarPtr> vars_;
+  // 変数を出力した関数の番号（テープの外で作られた変数は-1）
+  std::vector<int> producer_;
+};
+
+// 有効な間、このスレッドで呼ばれたFunctionをtapeに記録する
+class Recording {
+ public:
+  explicit Recording(Tape& tape);
+  ~Recording();
+  Recording(const Recording&) = delete;
+  Recording& operator=(const Recording&) = delete;
+
+ private:
+  Tape* prev_;
+};
+}  // namespace tape
+
+#endif
@@ -11,6 +11,7 @@
 
 #include "NumCpp.hpp"
 #include "core.h"
+#include "kernels.h"
 
 namespace utils {
 inline std::string _dot_var(const VarPtr& v, bool verbose = false) {
@@ -114,61 +115,18 @@ inline void plot_dot_graph(const VarPtr& output, bool verbose = true,
 // ndarrayは2Dなので、それを前提に実装
 // 参考にしたブロードキャストルール:
 // https://note.nkmk.me/python-numpy-broadcasting/
+// 例: [[1,2,3]] (1, 3) -> [[1,2,3], [1,2,3], [1,2,3]] (3, 3)
+// 例: [[1], [2]] (2, 1) -> [[1, 1], [2, 2]] (2, 2)
+// 例: [[1]] (1, 1) -> [[1], [1]]  (2, 1)
 inline nc::NdArray<double> broadcast_to(const nc::NdArray<double>& in_array,
                                         const nc::Shape& shape) {
-  nc::NdArray<double> out_array;
-
-  // 目的のshapeと行数が列数が一致している時にのみbroadcastする
-  // 例: [[1,2,3], [1,2,3]] (2, 3) -> [[1,2,3], [1,2,3], [1,2,3]] (3, 3)
-  // 例: [[1], [2]] (2, 1) -> [[1, 1], [2, 2]] (2, 2)
-  // 例: [[1]] (1, 1) -> [[1], [1]]  (2, 1)
-  assert((in_array.shape().rows == 1 && in_array.shape().cols == shape.cols &&
-          in_array.shape().rows <= shape.rows) ||
-         (in_array.shape().cols == 1 && in_array.shape().rows == shape.rows &&
-          in_array.shape().cols <= shape.cols));
-
-  // スカラー値
-  if (in_array.shape().rows == 1 && in_array.shape().cols == 1) {
-    out_array = nc::NdArray<double>(shape).fill(in_array[0]);
-  }
-  // 列方向のbroadcast
-  else if (in_array.shape().rows == 1) {
-    std::vector<std::vector<double>> mat;
-    std::vector<double> row_vec = in_array.toStlVector();
-    for (int i = 0; i < shape.rows; i++) mat.push_back(row_vec);
-    out_array = nc::NdArray(mat);
-  }
-  // 行方向のbroadcast
-  else if (in_array.shape().cols == 1) {
-    std::vector<std::vector<double>> mat;
-    std::vector<double> col_vec = in_array.toStlVector();
-    for (int i = 0; i < shape.cols; i++) mat.push_back(col_vec);
-    out_array = nc::NdArray(mat).transpose();
-  } else {
-    // broadcast必要なし
-    out_array = in_array;
-  }
-
-  return out_array;
+  return kernels::broadcast_to(in_array, shape);
 }
 
+// broadcast_toの逆: 目的のshapeで1になっている次元について総和を取る
 inline nc::NdArray<double> sum_to(const nc::NdArray<double>& in_array,
                                   const nc::Shape& shape) {
-  nc::NdArray<double> out_array;
-  assert((shape.rows == 1 && in_array.shape().cols == shape.cols) ||
-         (shape.cols == 1 && in_array.shape().rows == shape.rows));
-
-  // スカラー値
-  if (shape.rows == 1 && shape.cols == 1) {
-    out_array = in_array.sum();
-  } else if (shape.rows == 1) {
-    out_array = in_array.sum(nc::Axis::COL);
-  } else if (shape.cols == 1) {
-    out_array = in_array.sum(nc::Axis::ROW).transpose();
-  } else {
-    out_array = in_array;
-  }
-  return out_array;
+  return kernels::sum_to(in_array, shape);
 }
 }  // namespace utils
 
@@ -0,0 +1,166 @@
+#include "vmap.h"
+
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <typeinfo>
+#include <unordered_set>
+#include <vector>
+
+#include "functions.h"
+
+namespace vmap {
+namespace {
+// 要素ごとの演算でパラメータ側に流れる勾配（sum_to前）Gを
+// 行ごとにパラメータの形へ畳み込んでoutに足す
+void accumulate_rows(const nc::NdArray<double>& G, const nc::Shape& p_shape,
+                     nc::NdArray<double>& out) {
+  const auto N = out.shape().rows;
+  const auto g_shape = G.shape();
+  if (p_shape.rows != 1 || g_shape.rows != N) {
+    throw std::invalid_argument(
+        "vmap: parameters must be broadcast along the batch axis");
+  }
+  if (p_shape.cols == g_shape.cols) {
+    for (nc::uint32 n = 0; n < N; n++) {
+      for (nc::uint32 c = 0; c < g_shape.cols; c++) {
+        out(n, c) += G(n, c);
+      }
+    }
+  } else if (p_shape.cols == 1) {
+    for (nc::uint32 n = 0; n < N; n++) {
+      for (nc::uint32 c = 0; c < g_shape.cols; c++) {
+        out(n, 0) += G(n, c);
+      }
+    }
+  } else {
+    throw std::invalid_argument("vmap: unsupported parameter shape");
+  }
+}
+
+// MatMul(x, W)のWに対するサンプルごとの勾配は外積 x_n^T gy_n
+void accumulate_outer(const nc::NdArray<double>& x,
+                      const nc::NdArray<double>& gy, nc::NdArray<double>& out) {
+  const auto N = out.shape().rows;
+  const auto D = x.shape().cols;
+  const auto H = gy.shape().cols;
+  if (x.shape().rows != N || gy.shape().rows != N) {
+    throw std::invalid_argument("vmap: matmul input is not batched");
+  }
+  for (nc::uint32 n = 0; n < N; n++) {
+    double* dst = out.data() + n * D * H;
+    const double* gy_n = gy.data() + n * H;
+    for (nc::uint32 d = 0; d < D; d++) {
+      const double x_nd = x(n, d);
+      for (nc::uint32 h = 0; h < H; h++) {
+        dst[d * H + h] += x_nd * gy_n[h];
+      }
+    }
+  }
+}
+
+// 逆伝播で上書きされる勾配を退避して消し、抜けるとき（例外でも）に戻す
+// grad_viewがあると逆伝播がそこへ直接足すので、grad_hookと一緒に外しておく
+class SavedGrads {
+ public:
+  explicit SavedGrads(const std::vector<VarPtr>& vars) {
+    for (const auto& v : vars) {
+      saved_.push_back(
+          {v, v->grad, v->sparse_grad, v->grad_view, v->grad_hook});
+      v->cleargrad();
+      v->grad_view = nullptr;
+      v->grad_hook = nullptr;
+    }
+  }
+  ~SavedGrads() {
+    // 同じ変数が2回あれば最初に退避した値が残るよう逆順に戻す
+    for (auto it = saved_.rbegin(); it != saved_.rend(); ++it) {
+      it->var->grad = it->grad;
+      it->var->sparse_grad = it->sparse_grad;
+      it->var->grad_view = it->grad_view;
+      it->var->grad_hook = it->grad_hook;
+    }
+  }
+  SavedGrads(const SavedGrads&) = delete;
+  SavedGrads& operator=(const SavedGrads&) = delete;
+
+ private:
+  struct Saved {
+    VarPtr var;
+    VarPtr grad;
+    std::shared_ptr<sparse::RowSparse> sparse_grad;
+    NdArrPtr grad_view;
+    std::function<void(const VarPtr&)> grad_hook;
+  };
+  std::vector<Saved> saved_;
+};
+}  // namespace
+
+VarPtr vmap(const std::function<VarPtr(const VarPtr&)>& f, const VarPtr& x) {
+  UsingConfig with_batching_cfg("batching", true);
+  return f(x);
+}
+
+std::vector<nc::NdArray<double>> per_sample_grad(
+    const std::function<VarPtr(const VarPtr&)>& f, const VarPtr& x,
+    const std::vector<VarPtr>& params) {
+  const auto N = x->shape().rows;
+  std::vector<nc::NdArray<double>> grads;
+  for (const auto& p : params) {
+    grads.push_back(nc::zeros<double>(N, p->size()));
+  }
+  std::vector<VarPtr> vars = params;
+  vars.push_back(x);
+  SavedGrads saved(vars);
+
+  const auto loss = vmap(f, x);
+  if (loss->shape() != nc::Shape(N, 1)) {
+    throw std::invalid_argument("vmap: f must return one scalar per sample");
+  }
+  // サンプルnの損失は行nにしか依存しないので、損失の総和の逆伝播1回で
+  // 各関数の出力勾配の行nがサンプルnの勾配になる
+  loss->backward(true);
+
+  std::vector<FuncPtr> funcs = {loss->creator_ptr};
+  std::unordered_set<FuncPtr> seen_set = {loss->creator_ptr};
+  while (!funcs.empty()) {
+    FuncPtr func = funcs.back();
+    funcs.pop_back();
+    for (int i = 0; i < func->inputs_.size(); i++) {
+      const auto& input = func->inputs_[i];
+      if (input->creator_ptr && seen_set.insert(input->creator_ptr).second) {
+        funcs.push_back(input->creator_ptr);
+      }
+      int k = 0;
+      while (k < params.size() && params[k] != input) k++;
+      if (k == params.size()) {
+        continue;
+      }
+
+      const auto& gy = *func->outputs_[0].lock()->grad->data;
+      const auto& p_shape = input->shape();
+      if (dynamic_cast<F::MatMul*>(func.get()) && i == 1) {
+        accumulate_outer(*func->inputs_[0]->data, gy, grads[k]);
+      } else if (dynamic_cast<Add*>(func.get())) {
+        accumulate_rows(gy, p_shape, grads[k]);
+      } else if (dynamic_cast<Sub*>(func.get())) {
+        accumulate_rows(i == 0 ? gy : -gy, p_shape, grads[k]);
+      } else if (dynamic_cast<Mul*>(func.get())) {
+        accumulate_rows(gy * *func->inputs_[1 - i]->data, p_shape, grads[k]);
+      } else if (dynamic_cast<Div*>(func.get())) {
+        const auto& x0 = *func->inputs_[0]->data;
+        const auto& x1 = *func->inputs_[1]->data;
+        accumulate_rows(i == 0 ? gy / x1 : -gy * x0 / (x1 * x1), p_shape,
+                        grads[k]);
+      } else {
+        throw std::invalid_argument(
+            std::string("vmap: no batching rule for parameter input of ") +
+            typeid(*func).name());
+      }
+    }
+  }
+
+  return grads;
+}
+}  // namespace vmap
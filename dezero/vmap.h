@@ -0,0 +1,29 @@
+#ifndef VMAP_
+#define VMAP_
+
+#include <functional>
+#include <vector>
+
+#include "NumCpp.hpp"
+#include "core.h"
+
+// 1サンプル（1行）分の入力に対して書いた関数をバッチ(N, D)に拡張する
+// - 行列積・要素ごとの演算はそのまま行ごとのバッチ演算になる
+// - Config::batching中のF::sum(x)は行ごとの和 (N, 1) になる
+// パラメータは行方向にブロードキャストされる使い方（MatMulの右側、
+// (1, H)や(1, 1)との加減乗除）のみ対応
+namespace vmap {
+// f(x)をバッチに対して評価する（戻り値の行nがサンプルnの結果）
+VarPtr vmap(const std::function<VarPtr(const VarPtr&)>& f, const VarPtr& x);
+
+// サンプルごとのパラメータの勾配を1回の順伝播・逆伝播で求める
+// 戻り値のk番目はparams[k]に対する(N, params[k]->size())の行列で、
+// 行nがサンプルnの勾配を平坦化したもの
+// paramsとxの勾配（flat::FlatParametersのバッファも含む）は、例外で抜けた場合も
+// 呼ぶ前のまま残る
+std::vector<nc::NdArray<double>> per_sample_grad(
+    const std::function<VarPtr(const VarPtr&)>& f, const VarPtr& x,
+    const std::vector<VarPtr>& params);
+}  // namespace vmap
+
+#endif
@@ -0,0 +1,473 @@
+#include "vmath.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include "parallel.h"
+
+namespace vmath {
+namespace {
+// 命令セットごとのSIMDレジスタのラッパー
+// Tは倍精度のベクトル、Mは比較結果のマスク、Iは64bit整数のベクトル
+// 倍精度の四則演算はGCC/Clangのベクトル拡張の演算子をそのまま使う
+struct Scalar {
+  using T = double;
+  using M = bool;
+  using I = int64_t;
+  static constexpr size_t width = 1;
+  static const char* name() { return "scalar"; }
+
+  static T load(const double* p) { return *p; }
+  static void store(double* p, T v) { *p = v; }
+  static T set1(double v) { return v; }
+  // FMA命令がない環境でstd::fmaを使うとソフトウェア実装になり遅い
+  static T fmadd(T a, T b, T c) { return a * b + c; }
+  static T round(T x) { return std::nearbyint(x); }
+  static T min(T a, T b) { return a < b ? a : b; }
+  static T max(T a, T b) { return a > b ? a : b; }
+  static T abs(T x) { return std::fabs(x); }
+
+  static M lt(T a, T b) { return a < b; }
+  static M gt(T a, T b) { return a > b; }
+  static M eq(T a, T b) { return a == b; }
+  static M isnan(T x) { return x != x; }
+  static M mor(M a, M b) { return a || b; }
+  static bool any(M m) { return m; }
+  static T select(M m, T a, T b) { return m ? a : b; }
+
+  static I as_int(T x) {
+    I i;
+    std::memcpy(&i, &x, sizeof(i));
+    return i;
+  }
+  static T as_double(I i) {
+    T x;
+    std::memcpy(&x, &i, sizeof(x));
+    return x;
+  }
+  static I set1_i(int64_t v) { return v; }
+  static I add_i(I a, I b) { return a + b; }
+  static I sub_i(I a, I b) { return a - b; }
+  static I and_i(I a, I b) { return a & b; }
+  static I or_i(I a, I b) { return a | b; }
+  static I xor_i(I a, I b) { return a ^ b; }
+  template <int N>
+  static I shl(I a) {
+    return static_cast<I>(static_cast<uint64_t>(a) << N);
+  }
+  template <int N>
+  static I shr(I a) {
+    return static_cast<I>(static_cast<uint64_t>(a) >> N);
+  }
+  static M eq_i(I a, I b) { return a == b; }
+};
+
+#if defined(__AVX2__) && defined(__FMA__)
+struct Avx2 {
+  using T = __m256d;
+  using M = __m256d;
+  using I = __m256i;
+  static constexpr size_t width = 4;
+  static const char* name() { return "avx2"; }
+
+  static T load(const double* p) { return _mm256_loadu_pd(p); }
+  static void store(double* p, T v) { _mm256_storeu_pd(p, v); }
+  static T set1(double v) { return _mm256_set1_pd(v); }
+  static T fmadd(T a, T b, T c) { return _mm256_fmadd_pd(a, b, c); }
+  static T round(T x) {
+    return _mm256_round_pd(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  }
+  static T min(T a, T b) { return _mm256_min_pd(a, b); }
+  static T max(T a, T b) { return _mm256_max_pd(a, b); }
+  static T abs(T x) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), x); }
+
+  static M lt(T a, T b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+  static M gt(T a, T b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+  static M eq(T a, T b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+  static M isnan(T x) { return _mm256_cmp_pd(x, x, _CMP_UNORD_Q); }
+  static M mor(M a, M b) { return _mm256_or_pd(a, b); }
+  static bool any(M m) { return _mm256_movemask_pd(m) != 0; }
+  static T select(M m, T a, T b) { return _mm256_blendv_pd(b, a, m); }
+
+  static I as_int(T x) { return _mm256_castpd_si256(x); }
+  static T as_double(I i) { return _mm256_castsi256_pd(i); }
+  static I set1_i(int64_t v) { return _mm256_set1_epi64x(v); }
+  static I add_i(I a, I b) { return _mm256_add_epi64(a, b); }
+  static I sub_i(I a, I b) { return _mm256_sub_epi64(a, b); }
+  static I and_i(I a, I b) { return _mm256_and_si256(a, b); }
+  static I or_i(I a, I b) { return _mm256_or_si256(a, b); }
+  static I xor_i(I a, I b) { return _mm256_xor_si256(a, b); }
+  template <int N>
+  static I shl(I a) {
+    return _mm256_slli_epi64(a, N);
+  }
+  template <int N>
+  static I shr(I a) {
+    return _mm256_srli_epi64(a, N);
+  }
+  static M eq_i(I a, I b) {
+    return _mm256_castsi256_pd(_mm256_cmpeq_epi64(a, b));
+  }
+};
+#endif
+
+#if defined(__AVX512F__)
+struct Avx512 {
+  using T = __m512d;
+  using M = __mmask8;
+  using I = __m512i;
+  static constexpr size_t width = 8;
+  static const char* name() { return "avx512"; }
+
+  static T load(const double* p) { return _mm512_loadu_pd(p); }
+  static void store(double* p, T v) { _mm512_storeu_pd(p, v); }
+  static T set1(double v) { return _mm512_set1_pd(v); }
+  static T fmadd(T a, T b, T c) { return _mm512_fmadd_pd(a, b, c); }
+  static T round(T x) {
+    return _mm512_roundscale_pd(x,
+                                _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  }
+  static T min(T a, T b) { return _mm512_min_pd(a, b); }
+  static T max(T a, T b) { return _mm512_max_pd(a, b); }
+  static T abs(T x) { return _mm512_abs_pd(x); }
+
+  static M lt(T a, T b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+  static M gt(T a, T b) { return _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ); }
+  static M eq(T a, T b) { return _mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ); }
+  static M isnan(T x) { return _mm512_cmp_pd_mask(x, x, _CMP_UNORD_Q); }
+  static M mor(M a, M b) { return a | b; }
+  static bool any(M m) { return m != 0; }
+  static T select(M m, T a, T b) { return _mm512_mask_blend_pd(m, b, a); }
+
+  static I as_int(T x) { return _mm512_castpd_si512(x); }
+  static T as_double(I i) { return _mm512_castsi512_pd(i); }
+  static I set1_i(int64_t v) { return _mm512_set1_epi64(v); }
+  static I add_i(I a, I b) { return _mm512_add_epi64(a, b); }
+  static I sub_i(I a, I b) { return _mm512_sub_epi64(a, b); }
+  static I and_i(I a, I b) { return _mm512_and_si512(a, b); }
+  static I or_i(I a, I b) { return _mm512_or_si512(a, b); }
+  static I xor_i(I a, I b) { return _mm512_xor_si512(a, b); }
+  template <int N>
+  static I shl(I a) {
+    return _mm512_slli_epi64(a, N);
+  }
+  template <int N>
+  static I shr(I a) {
+    return _mm512_srli_epi64(a, N);
+  }
+  static M eq_i(I a, I b) { return _mm512_cmpeq_epi64_mask(a, b); }
+};
+using Simd = Avx512;
+#elif defined(__AVX2__) && defined(__FMA__)
+using Simd = Avx2;
+#else
+using Simd = Scalar;
+#endif
+
+constexpr double kInf = std::numeric_limits<double>::infinity();
+constexpr double kNaN = std::numeric_limits<double>::quiet_NaN();
+// 1.5 * 2^52を足すと仮数部の下位ビットに整数がそのまま入る
+constexpr double kMagic = 6755399441055744.0;
+constexpr double kLog2e = 1.4426950408889634074;
+// ln2を上位（下位ビットが0）と下位に分けたもの（Cody-Waite）
+constexpr double kLn2Hi = 6.93147180369123816490e-01;
+constexpr double kLn2Lo = 1.90821492927058770002e-10;
+// pi/2を33bitずつ3つに分けたもの（fdlibm）
+constexpr double kTwoOverPi = 6.36619772367581382433e-01;
+constexpr double kPio2_1 = 1.57079632673412561417e+00;
+constexpr double kPio2_2 = 6.07710050630396597660e-11;
+constexpr double kPio2_3 = 2.02226624871116645580e-21;
+// kPio2_1 * kが丸めなしで計算できる範囲（k < 2^20）
+constexpr double kSinCosMax = 1.6e6;
+
+// 整数値のdoubleを64bit整数に変換する（|n| < 2^51）
+template <class V>
+inline typename V::I to_int(typename V::T n) {
+  return V::sub_i(V::as_int(n + V::set1(kMagic)),
+                  V::as_int(V::set1(kMagic)));
+}
+
+// 64bit整数をdoubleに変換する（|i| < 2^51）
+template <class V>
+inline typename V::T to_double(typename V::I i) {
+  return V::as_double(V::add_i(i, V::as_int(V::set1(kMagic)))) -
+         V::set1(kMagic);
+}
+
+// 2^n（nは整数値のdoubleで[-1022, 1023]）
+template <class V>
+inline typename V::T pow2(typename V::T n) {
+  return V::as_double(
+      V::template shl<52>(V::add_i(to_int<V>(n), V::set1_i(1023))));
+}
+
+// exp(x) = 2^n * exp(r), |r| <= ln2/2
+template <class V>
+inline typename V::T exp_kernel(typename V::T x) {
+  using T = typename V::T;
+  const T xc = V::min(V::max(x, V::set1(-746.0)), V::set1(710.0));
+  const T n = V::round(xc * V::set1(kLog2e));
+  T r = V::fmadd(n, V::set1(-kLn2Hi), xc);
+  r = V::fmadd(n, V::set1(-kLn2Lo), r);
+
+  // 13次のテイラー展開（打ち切り誤差は1e-18以下）
+  T p = V::set1(1.0 / 6227020800.0);
+  p = V::fmadd(p, r, V::set1(1.0 / 479001600.0));
+  p = V::fmadd(p, r, V::set1(1.0 / 39916800.0));
+  p = V::fmadd(p, r, V::set1(1.0 / 3628800.0));
+  p = V::fmadd(p, r, V::set1(1.0 / 362880.0));
+  p = V::fmadd(p, r, V::set1(1.0 / 40320.0));
+  p = V::fmadd(p, r, V::set1(1.0 / 5040.0));
+  p = V::fmadd(p, r, V::set1(1.0 / 720.0));
+  p = V::fmadd(p, r, V::set1(1.0 / 120.0));
+  p = V::fmadd(p, r, V::set1(1.0 / 24.0));
+  p = V::fmadd(p, r, V::set1(1.0 / 6.0));
+  p = V::fmadd(p, r, V::set1(0.5));
+  p = V::fmadd(p, r, V::set1(1.0));
+  p = V::fmadd(p, r, V::set1(1.0));
+
+  // 非正規化数やn = 1024でも指数部が溢れないよう2回に分けて掛ける
+  const T n1 = V::round(n * V::set1(0.5));
+  T y = p * pow2<V>(n1) * pow2<V>(n - n1);
+
+  y = V::select(V::gt(x, V::set1(709.782712893384)), V::set1(kInf), y);
+  y = V::select(V::lt(x, V::set1(-745.1332191019412)), V::set1(0.0), y);
+  return V::select(V::isnan(x), x, y);
+}
+
+// log(x) = e * ln2 + log(m), m in [sqrt(2)/2, sqrt(2))
+// log(m)はs = (m - 1) / (m + 1)の級数（fdlibmの係数）
+template <class V>
+inline typename V::T log_kernel(typename V::T x) {
+  using T = typename V::T;
+  using I = typename V::I;
+  // 非正規化数は2^52倍して正規化する
+  const auto subnormal = V::lt(x, V::set1(2.2250738585072014e-308));
+  const T xs = V::select(subnormal, x * V::set1(4503599627370496.0), x);
+  const I bits = V::as_int(xs);
+  T e = to_double<V>(
+      V::sub_i(V::template shr<52>(bits), V::set1_i(1023)));
+  e = e - V::select(subnormal, V::set1(52.0), V::set1(0.0));
+  T m = V::as_double(V::or_i(V::and_i(bits, V::set1_i(0x000fffffffffffffLL)),
+                             V::set1_i(0x3ff0000000000000LL)));
+  const auto big = V::gt(m, V::set1(1.4142135623730951));
+  m = V::select(big, m * V::set1(0.5), m);
+  e = V::select(big, e + V::set1(1.0), e);
+
+  const T f = m - V::set1(1.0);
+  const T s = f / (f + V::set1(2.0));
+  const T z = s * s;
+  T R = V::set1(1.479819860511658591e-01);
+  R = V::fmadd(R, z, V::set1(1.531383769920937332e-01));
+  R = V::fmadd(R, z, V::set1(1.818357216161805012e-01));
+  R = V::fmadd(R, z, V::set1(2.222219843214978396e-01));
+  R = V::fmadd(R, z, V::set1(2.857142874366239149e-01));
+  R = V::fmadd(R, z, V::set1(3.999999999940941908e-01));
+  R = V::fmadd(R, z, V::set1(6.666666666666735130e-01));
+  R = R * z;
+  const T hfsq = V::set1(0.5) * f * f;
+  T y = e * V::set1(kLn2Hi) -
+        ((hfsq - (s * (hfsq + R) + e * V::set1(kLn2Lo))) - f);
+
+  y = V::select(V::eq(x, V::set1(kInf)), x, y);
+  y = V::select(V::eq(x, V::set1(0.0)), V::set1(-kInf), y);
+  return V::select(V::mor(V::lt(x, V::set1(0.0)), V::isnan(x)),
+                   V::set1(kNaN), y);
+}
+
+// sin/cos: x = k * pi/2 + r, |r| <= pi/4 に帰着して象限で選ぶ（fdlibmの係数）
+template <class V>
+inline typename V::T sincos_kernel(typename V::T x, bool is_cos) {
+  using T = typename V::T;
+  using I = typename V::I;
+  const T k = V::round(x * V::set1(kTwoOverPi));
+  T r = V::fmadd(k, V::set1(-kPio2_1), x);
+  r = V::fmadd(k, V::set1(-kPio2_2), r);
+  r = V::fmadd(k, V::set1(-kPio2_3), r);
+  const T z = r * r;
+
+  T ps = V::set1(1.58969099521155010221e-10);
+  ps = V::fmadd(ps, z, V::set1(-2.50507602534068634195e-08));
+  ps = V::fmadd(ps, z, V::set1(2.75573137070700676789e-06));
+  ps = V::fmadd(ps, z, V::set1(-1.98412698298579493134e-04));
+  ps = V::fmadd(ps, z, V::set1(8.33333333332248946124e-03));
+  ps = V::fmadd(ps, z, V::set1(-1.66666666666666324348e-01));
+  const T s = V::fmadd(r * z, ps, r);
+
+  T pc = V::set1(-1.13596475577881948265e-11);
+  pc = V::fmadd(pc, z, V::set1(2.08757232129817482790e-09));
+  pc = V::fmadd(pc, z, V::set1(-2.75573143513906633035e-07));
+  pc = V::fmadd(pc, z, V::set1(2.48015872894767294178e-05));
+  pc = V::fmadd(pc, z, V::set1(-1.38888888888741095749e-03));
+  pc = V::fmadd(pc, z, V::set1(4.16666666666666019037e-02));
+  const T hz = V::set1(0.5) * z;
+  const T w = V::set1(1.0) - hz;
+  const T c = w + (((V::set1(1.0) - w) - hz) + z * z * pc);
+
+  // 象限qの下位ビットでsin/cosを入れ替え、2ビット目で符号を反転する
+  I q = to_int<V>(k);
+  if (is_cos) {
+    q = V::add_i(q, V::set1_i(1));
+  }
+  const I one = V::set1_i(1);
+  const auto swap = V::eq_i(V::and_i(q, one), one);
+  const T y = V::select(swap, c, s);
+  const I sign = V::template shl<62>(V::and_i(q, V::set1_i(2)));
+  return V::as_double(V::xor_i(V::as_int(y), sign));
+}
+
+// tanh: |x| < 0.625は有理関数近似（Cephes）、それ以外は1 - 2 / (exp(2|x|) + 1)
+template <class V>
+inline typename V::T tanh_kernel(typename V::T x) {
+  using T = typename V::T;
+  const T ax = V::abs(x);
+  const T z = x * x;
+  T P = V::set1(-9.64399179425052238628e-1);
+  P = V::fmadd(P, z, V::set1(-9.92877231001918586564e1));
+  P = V::fmadd(P, z, V::set1(-1.61468768441708447952e3));
+  T Q = z + V::set1(1.12811678491632931402e2);
+  Q = V::fmadd(Q, z, V::set1(2.23548839060100448583e3));
+  Q = V::fmadd(Q, z, V::set1(4.84406305325125486048e3));
+  const T small = V::fmadd(x * z, P / Q, x);
+
+  const T e = exp_kernel<V>(V::set1(2.0) * ax);
+  T large = V::set1(1.0) - V::set1(2.0) / (e + V::set1(1.0));
+  // xの符号ビットを付ける
+  large = V::as_double(V::or_i(
+      V::as_int(large),
+      V::and_i(V::as_int(x), V::set1_i(static_cast<int64_t>(1ULL << 63)))));
+  return V::select(V::lt(ax, V::set1(0.625)), small, large);
+}
+
+// sigmoid: 両側の裾で桁落ちしないようexp(-|x|)から計算する
+template <class V>
+inline typename V::T sigmoid_kernel(typename V::T x) {
+  using T = typename V::T;
+  const T e = exp_kernel<V>(V::set1(0.0) - V::abs(x));
+  const T inv = V::set1(1.0) / (V::set1(1.0) + e);
+  return V::select(V::lt(x, V::set1(0.0)), e * inv, inv);
+}
+
+// 幅に満たない端数は一時バッファに詰めて同じカーネルで計算する
+template <class V, class Kernel>
+inline void apply(const double* x, double* y, size_t n, Kernel kernel) {
+  size_t i = 0;
+  for (; i + V::width <= n; i += V::width) {
+    V::store(y + i, kernel(V::load(x + i)));
+  }
+  if (i < n) {
+    double buf[V::width] = {};
+    std::memcpy(buf, x + i, sizeof(double) * (n - i));
+    V::store(buf, kernel(V::load(buf)));
+    std::memcpy(y + i, buf, sizeof(double) * (n - i));
+  }
+}
+
+// 幅ぶんの入力を計算する。範囲外の入力（と無限大・NaN）だけlibmで計算し直す
+// xとyが同じ配列でもよいように、入力をレジスタから取り出してから直す
+template <class V>
+inline void sincos_block(const double* x, double* y, bool is_cos) {
+  const auto v = V::load(x);
+  const auto a = V::abs(v);
+  const auto max = V::set1(kSinCosMax);
+  V::store(y, sincos_kernel<V>(v, is_cos));
+  if (!V::any(V::mor(V::mor(V::gt(a, max), V::eq(a, max)), V::isnan(v)))) {
+    return;
+  }
+  double in[V::width];
+  V::store(in, v);
+  for (size_t j = 0; j < V::width; j++) {
+    if (!(std::fabs(in[j]) < kSinCosMax)) {
+      y[j] = is_cos ? std::cos(in[j]) : std::sin(in[j]);
+    }
+  }
+}
+
+template <class V>
+inline void sincos(const double* x, double* y, size_t n, bool is_cos) {
+  size_t i = 0;
+  for (; i + V::width <= n; i += V::width) {
+    sincos_block<V>(x + i, y + i, is_cos);
+  }
+  if (i < n) {
+    double buf[V::width] = {};
+    std::memcpy(buf, x + i, sizeof(double) * (n - i));
+    sincos_block<V>(buf, buf, is_cos);
+    std::memcpy(y + i, buf, sizeof(double) * (n - i));
+  }
+}
+
+nc::NdArray<double> apply_parallel(const nc::NdArray<double>& x,
+                                   void (*fn)(const double*, double*, size_t)) {
+  nc::NdArray<double> y(x.shape());
+  const double* src = x.data();
+  double* dst = y.data();
+  parallel::parallel_for(0, x.size(), [src, dst, fn](size_t b, size_t e) {
+    fn(src + b, dst + b, e - b);
+  });
+  return y;
+}
+
+// SIMD命令がない場合は多項式近似よりlibmの方が速いのでそのまま使う
+template <double (*Libm)(double)>
+inline void libm(const double* x, double* y, size_t n) {
+  for (size_t i = 0; i < n; i++) y[i] = Libm(x[i]);
+}
+
+inline double sigmoid_libm(double x) { return 1.0 / (1.0 + std::exp(-x)); }
+
+constexpr bool kUseLibm = Simd::width == 1;
+}  // namespace
+
+void exp(const double* x, double* y, size_t n) {
+  if (kUseLibm) return libm<std::exp>(x, y, n);
+  apply<Simd>(x, y, n, exp_kernel<Simd>);
+}
+void log(const double* x, double* y, size_t n) {
+  if (kUseLibm) return libm<std::log>(x, y, n);
+  apply<Simd>(x, y, n, log_kernel<Simd>);
+}
+void sin(const double* x, double* y, size_t n) {
+  if (kUseLibm) return libm<std::sin>(x, y, n);
+  sincos<Simd>(x, y, n, false);
+}
+void cos(const double* x, double* y, size_t n) {
+  if (kUseLibm) return libm<std::cos>(x, y, n);
+  sincos<Simd>(x, y, n, true);
+}
+void tanh(const double* x, double* y, size_t n) {
+  if (kUseLibm) return libm<std::tanh>(x, y, n);
+  apply<Simd>(x, y, n, tanh_kernel<Simd>);
+}
+void sigmoid(const double* x, double* y, size_t n) {
+  if (kUseLibm) return libm<sigmoid_libm>(x, y, n);
+  apply<Simd>(x, y, n, sigmoid_kernel<Simd>);
+}
+
+const char* isa() { return Simd::name(); }
+
+nc::NdArray<double> exp(const nc::NdArray<double>& x) {
+  return apply_parallel(x, exp);
+}
+nc::NdArray<double> log(const nc::NdArray<double>& x) {
+  return apply_parallel(x, log);
+}
+nc::NdArray<double> sin(const nc::NdArray<double>& x) {
+  return apply_parallel(x, sin);
+}
+nc::NdArray<double> cos(const nc::NdArray<double>& x) {
+  return apply_parallel(x, cos);
+}
+nc::NdArray<double> tanh(const nc::NdArray<double>& x) {
+  return apply_parallel(x, tanh);
+}
+nc::NdArray<double> sigmoid(const nc::NdArray<double>& x) {
+  return apply_parallel(x, sigmoid);
+}
+}  // namespace vmath
@@ -0,0 +1,42 @@
+#ifndef VMATH_
+#define VMATH_
+
+#include <cstddef>
+
+#include "NumCpp.hpp"
+
+// ベクトル化した倍精度の超越関数
+// コンパイル時の命令セットでAVX-512 / AVX2+FMA / スカラーを切り替える
+// （-march=nativeなどでAVX2を有効にしないとスカラー版になる）
+// スカラー版は多項式近似の利点がないのでlibmをそのまま呼ぶ
+//
+// 真値（long double）との誤差（bench_vmathで一様乱数1M点を実測した最大値）
+//   exp     [-745, 709.78]        1 ULP
+//   log     (0, inf)              1 ULP
+//   sin/cos |x| < 10              1.5 ULP
+//           |x| < 1.6e6           2.5 ULP（それより大きい入力はlibmで計算）
+//   tanh    全域                  1.5 ULP
+//   sigmoid 全域                  2.5 ULP
+// NaNはそのまま伝播する
+// ポインタ版はxとyが同じ配列でもよい（その場で計算する）
+namespace vmath {
+void exp(const double* x, double* y, size_t n);
+void log(const double* x, double* y, size_t n);
+void sin(const double* x, double* y, size_t n);
+void cos(const double* x, double* y, size_t n);
+void tanh(const double* x, double* y, size_t n);
+void sigmoid(const double* x, double* y, size_t n);
+
+// 使われている命令セット（"avx512", "avx2", "scalar"）
+const char* isa();
+
+// ndarray版（大きな配列はparallel_forでスレッドに分割する）
+nc::NdArray<double> exp(const nc::NdArray<double>& x);
+nc::NdArray<double> log(const nc::NdArray<double>& x);
+nc::NdArray<double> sin(const nc::NdArray<double>& x);
+nc::NdArray<double> cos(const nc::NdArray<double>& x);
+nc::NdArray<double> tanh(const nc::NdArray<double>& x);
+nc::NdArray<double> sigmoid(const nc::NdArray<double>& x);
+}  // namespace vmath
+
+#endif
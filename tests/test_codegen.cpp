@@ -0,0 +1,128 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "NumCpp.hpp"
+#include "dezero.h"
+
+class CodegenTest : public ::testing::Test {
+ protected:
+  virtual void SetUp(){};
+  virtual void TearDown(){};
+};
+
+nc::NdArray<double> codegen_test_input(size_t rows, size_t cols,
+                                       double phase) {
+  nc::NdArray<double> x(rows, cols);
+  for (size_t i = 0; i < x.size(); i++) {
+    x[i] = std::sin(0.37 * i + phase);
+  }
+  return x;
+}
+
+// 生成したソースにmainを付けてコンパイルし、出力を読む
+// コンパイラがなければfalse
+bool run_generated(const std::string& src, const std::vector<VarPtr>& inputs,
+                   size_t out_size, std::vector<double>& out) {
+  if (std::system("c++ --version > /dev/null 2>&1") != 0) {
+    return false;
+  }
+  const std::string dir = ::testing::TempDir();
+  const std::string path = dir + "dezero_codegen_test.cpp";
+  const std::string exe = dir + "dezero_codegen_test";
+  std::ofstream ofs(path);
+  ofs << src << "\n#include <cstdio>\n\nint main() {\n";
+  std::string args;
+  for (size_t k = 0; k < inputs.size(); k++) {
+    const auto& x = *inputs[k]->data;
+    ofs << "  static const double in" << k << "[] = {";
+    for (size_t i = 0; i < x.size(); i++) {
+      ofs << std::hexfloat << x.data()[i] << ", ";
+    }
+    ofs << "};\n";
+    args += "in" + std::to_string(k) + ", ";
+  }
+  ofs << "  static double out[" << out_size << "];\n";
+  ofs << "  net(" << args << "out);\n";
+  ofs << "  for (double v : out) std::printf(\"%.17g\\n\", v);\n}\n";
+  ofs.close();
+  const std::string cmd =
+      "c++ -std=c++17 -O2 -Wall -Werror -o " + exe + " " + path;
+  if (std::system(cmd.c_str()) != 0) {
+    ADD_FAILURE() << "generated source does not compile:\n" << src;
+    return true;
+  }
+  FILE* fp = popen(exe.c_str(), "r");
+  double v;
+  while (std::fscanf(fp, "%lf", &v) == 1) out.push_back(v);
+  pclose(fp);
+  return true;
+}
+
+// 小さなMLP（行列積、ブロードキャスト、reshape、softmaxなど）
+VarPtr codegen_test_net(const VarPtr& x) {
+  auto W1 = as_variable(as_array(codegen_test_input(3, 6, 1.0)));
+  auto b1 = as_variable(as_array(codegen_test_input(1, 6, 2.0)));
+  auto W2 = as_variable(as_array(codegen_test_input(6, 2, 3.0)));
+  auto h = F::tanh(F::matmul(x, W1) + b1);
+  // 形を変えて戻す（コピーしない）
+  h = F::reshape(F::reshape(h, nc::Shape(2, 12)), nc::Shape(4, 6));
+  auto s = F::sum(F::sigmoid(x), nc::Axis::COL);  // (4, 1)
+  auto y = F::matmul(h, W2) * 2.0 - s + F::transpose(F::exp(W2))->sum();
+  return F::softmax(y) / 3.0;
+}
+
+TEST_F(CodegenTest, exportTest) {
+  auto x = as_variable(as_array(codegen_test_input(4, 3, 0.0)));
+  auto y = codegen_test_net(x);
+  ASSERT_EQ(y->shape(), nc::Shape(4, 2));
+  // reshapeは入力の変数の形を変えない
+  auto h = F::tanh(x);
+  F::reshape(h, nc::Shape(2, 6));
+  EXPECT_EQ(h->shape(), nc::Shape(4, 3));
+
+  const auto src = codegen::export_cpp(y, {x}, "net");
+  EXPECT_NE(src.find("constexpr std::size_t net_workspace_size"),
+            std::string::npos);
+  EXPECT_EQ(src.find("NdArray"), std::string::npos);
+  EXPECT_EQ(src.find("shared_ptr"), std::string::npos);
+
+  std::vector<double> out;
+  if (!run_generated(src, {x}, y->data->size(), out)) {
+    GTEST_SKIP() << "no C++ compiler";
+  }
+  ASSERT_EQ(out.size(), y->data->size());
+  for (size_t i = 0; i < out.size(); i++) {
+    EXPECT_NEAR(out[i], (*y->data)[i], 1e-12) << i;
+  }
+}
+
+TEST_F(CodegenTest, planTest) {
+  auto x = as_variable(as_array(codegen_test_input(4, 3, 0.0)));
+  auto y = codegen_test_net(x);
+  const auto p = codegen::plan(y, {x});
+  EXPECT_GT(p.num_ops, 10);
+  // 使い終わった中間結果の領域を使い回す
+  EXPECT_GT(p.workspace_size, 0);
+  EXPECT_LT(p.workspace_size, p.naive_size);
+
+  // 要素ごとの演算の列は2つの領域を交互に使う
+  auto z = x;
+  for (int i = 0; i < 10; i++) z = F::sin(z) + 1.0;
+  z = F::exp(z);
+  EXPECT_EQ(codegen::plan(z, {x}).workspace_size, 2 * 16);
+}
+
+TEST_F(CodegenTest, unsupportedTest) {
+  auto x = as_variable(as_array(codegen_test_input(4, 3, 0.0)));
+  auto y = F::get_item(x, {0, 2});
+  EXPECT_THROW(codegen::export_cpp(y, {x}), std::invalid_argument);
+  EXPECT_THROW(codegen::export_cpp(F::exp(x), {x}, "1net"),
+               std::invalid_argument);
+}
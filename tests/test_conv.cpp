@@ -0,0 +1,239 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <functional>
+
+#include "NumCpp.hpp"
+#include "dezero.h"
+
+class ConvTest : public ::testing::Test {
+ protected:
+  virtual void SetUp(){};
+  virtual void TearDown(){};
+};
+
+nc::NdArray<double> conv_test_input(size_t rows, size_t cols, double phase) {
+  nc::NdArray<double> x(rows, cols);
+  for (size_t i = 0; i < x.size(); i++) {
+    x[i] = std::sin(0.71 * i + phase);
+  }
+  return x;
+}
+
+// fの要素ごとの中心差分
+nc::NdArray<double> conv_numerical_grad(
+    const std::function<double(const nc::NdArray<double>&)>& f,
+    const nc::NdArray<double>& x, double eps = 1e-5) {
+  nc::NdArray<double> g(x.shape());
+  auto xe = x.copy();
+  for (size_t i = 0; i < x.size(); i++) {
+    xe[i] = x[i] + eps;
+    const double y1 = f(xe);
+    xe[i] = x[i] - eps;
+    const double y0 = f(xe);
+    xe[i] = x[i];
+    g[i] = (y1 - y0) / (2 * eps);
+  }
+  return g;
+}
+
+// 定義どおりのループで書いた畳み込み
+nc::NdArray<double> naive_conv2d(const nc::NdArray<double>& x,
+                                 const nc::NdArray<double>& W,
+                                 const nc::NdArray<double>& b,
+                                 const F::Conv2dParam& p) {
+  const int n = x.shape().rows;
+  const int oc_size = W.shape().rows;
+  const int oh_size = p.out_h();
+  const int ow_size = p.out_w();
+  nc::NdArray<double> y(n, oc_size * oh_size * ow_size);
+  for (int i = 0; i < n; i++) {
+    for (int oc = 0; oc < oc_size; oc++) {
+      for (int oh = 0; oh < oh_size; oh++) {
+        for (int ow = 0; ow < ow_size; ow++) {
+          double s = b[oc];
+          for (int c = 0; c < static_cast<int>(p.channels); c++) {
+            for (int ki = 0; ki < static_cast<int>(p.kernel_h); ki++) {
+              for (int kj = 0; kj < static_cast<int>(p.kernel_w); kj++) {
+                const int ih = oh * p.stride + ki - p.pad;
+                const int iw = ow * p.stride + kj - p.pad;
+                if (ih < 0 || iw < 0 || ih >= static_cast<int>(p.height) ||
+                    iw >= static_cast<int>(p.width)) {
+                  continue;
+                }
+                s += x(i, (c * p.height + ih) * p.width + iw) *
+                     W(oc, (c * p.kernel_h + ki) * p.kernel_w + kj);
+              }
+            }
+          }
+          y(i, (oc * oh_size + oh) * ow_size + ow) = s;
+        }
+      }
+    }
+  }
+  return y;
+}
+
+// 2チャンネル5x4、3x2の窓、stride 2、pad 1
+F::Conv2dParam conv_test_param() {
+  F::Conv2dParam p{2, 5, 4, 3, 2};
+  p.stride = 2;
+  p.pad = 1;
+  return p;
+}
+
+TEST_F(ConvTest, conv2dTest) {
+  auto p = conv_test_param();
+  ASSERT_EQ(p.out_h(), 3);
+  ASSERT_EQ(p.out_w(), 3);
+  auto x = conv_test_input(3, 40, 0.0);
+  auto W = conv_test_input(4, 12, 1.0);
+  auto b = conv_test_input(1, 4, 2.0);
+  auto expected = naive_conv2d(x, W, b, p);
+  auto y = F::conv2d(as_variable(as_array(x)), as_variable(as_array(W)),
+                     as_variable(as_array(b)), p);
+  EXPECT_TRUE(nc::allclose(*y->data, expected, 1e-12));
+
+  // im2colを1サンプルずつ作っても同じ
+  for (size_t tile : {1, 2}) {
+    p.tile = tile;
+    auto yt = F::conv2d(as_variable(as_array(x)), as_variable(as_array(W)),
+                        as_variable(as_array(b)), p);
+    EXPECT_TRUE(nc::allclose(*yt->data, expected, 1e-12));
+  }
+
+  EXPECT_THROW(F::conv2d(as_variable(as_array(W)), as_variable(as_array(W)),
+                         conv_test_param()),
+               std::invalid_argument);
+  F::Conv2dParam too_small{1, 2, 2, 5, 5};
+  EXPECT_THROW(F::Conv2d{too_small}, std::invalid_argument);
+}
+
+TEST_F(ConvTest, conv2dGradTest) {
+  auto x0 = conv_test_input(2, 40, 0.0);
+  auto W0 = conv_test_input(3, 12, 1.0);
+  auto b0 = conv_test_input(1, 3, 2.0);
+  auto w = conv_test_input(2, 27, 3.0);
+  for (size_t tile : {0, 1}) {
+    auto p = conv_test_param();
+    p.tile = tile;
+    auto loss = [&](const nc::NdArray<double>& x, const nc::NdArray<double>& W,
+                    const nc::NdArray<double>& b) {
+      return (naive_conv2d(x, W, b, p) * w).sum()[0];
+    };
+    auto x = as_variable(as_array(x0));
+    auto W = as_variable(as_array(W0));
+    auto b = as_variable(as_array(b0));
+    F::sum(F::conv2d(x, W, b, p) * as_variable(as_array(w)))->backward();
+    auto gx = conv_numerical_grad(
+        [&](const nc::NdArray<double>& v) { return loss(v, W0, b0); }, x0);
+    auto gW = conv_numerical_grad(
+        [&](const nc::NdArray<double>& v) { return loss(x0, v, b0); }, W0);
+    auto gb = conv_numerical_grad(
+        [&](const nc::NdArray<double>& v) { return loss(x0, W0, v); }, b0);
+    EXPECT_TRUE(nc::allclose(*x->grad->data, gx, 1e-8));
+    EXPECT_TRUE(nc::allclose(*W->grad->data, gW, 1e-8));
+    EXPECT_TRUE(nc::allclose(*b->grad->data, gb, 1e-8));
+  }
+}
+
+// 2階微分: Wについての勾配をxで微分する
+TEST_F(ConvTest, conv2dDoubleBackwardTest) {
+  auto p = conv_test_param();
+  auto x0 = conv_test_input(2, 40, 0.0);
+  auto W = as_variable(as_array(conv_test_input(3, 12, 1.0)));
+  auto v = as_variable(as_array(conv_test_input(3, 12, 4.0)));
+  auto g_dot_v = [&](const VarPtr& x, bool create_graph) {
+    auto g = grad(F::sum(pow(F::conv2d(x, W, p), 3)), W, create_graph);
+    return F::sum(g * v);
+  };
+  auto x = as_variable(as_array(x0));
+  auto hv = grad(g_dot_v(x, true), x);
+  auto expected = conv_numerical_grad(
+      [&](const nc::NdArray<double>& a) {
+        return (*g_dot_v(as_variable(as_array(a)), false)->data)[0];
+      },
+      x0);
+  EXPECT_TRUE(nc::allclose(*hv->data, expected, 1e-7));
+}
+
+TEST_F(ConvTest, maxPoolingTest) {
+  // 1チャンネル4x4、2x2の窓、stride 2
+  F::Conv2dParam p{1, 4, 4, 2, 2};
+  p.stride = 2;
+  auto x = as_variable(as_array({{1.0, 2.0, 5.0, 0.0,  //
+                                  3.0, 4.0, 1.0, 6.0,  //
+                                  -1.0, -2.0, 0.0, 0.0,  //
+                                  -3.0, -0.5, 0.0, 7.0}}));
+  auto y = F::max_pooling(x, p);
+  EXPECT_TRUE(
+      nc::allclose(*y->data, nc::NdArray<double>{{4.0, 6.0, -0.5, 7.0}}));
+  F::sum(y * as_variable(as_array({{1.0, 2.0, 3.0, 4.0}})))->backward();
+  EXPECT_TRUE(nc::allclose(
+      *x->grad->data,
+      nc::NdArray<double>{{0.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0, 2.0,  //
+                           0.0, 0.0, 0.0, 0.0, 0.0, 3.0, 0.0, 4.0}}));
+
+  // 重なる窓とパディング（パディングは最大値に選ばれない）
+  F::Conv2dParam q{2, 5, 4, 3, 2};
+  q.pad = 1;
+  auto x0 = conv_test_input(2, 40, 0.5) - 2.0;
+  auto w = conv_test_input(2, 2 * q.out_h() * q.out_w(), 1.5);
+  auto wv = as_variable(as_array(w));
+  auto xv = as_variable(as_array(x0));
+  auto g = grad(F::sum(pow(F::max_pooling(xv, q), 2) * wv), xv, true);
+  auto expected = conv_numerical_grad(
+      [&](const nc::NdArray<double>& a) {
+        auto ya = F::max_pooling(as_variable(as_array(a)), q);
+        return (nc::power(*ya->data, 2) * w).sum()[0];
+      },
+      x0);
+  EXPECT_TRUE(nc::allclose(*g->data, expected, 1e-8));
+  // xは全て負なので、パディングを0として数えると0が選ばれる
+  auto pooled = *F::max_pooling(xv, q)->data;
+  for (size_t i = 0; i < pooled.size(); i++) {
+    EXPECT_LT(pooled[i], 0.0);
+  }
+
+  // 2階微分: 最大値の位置に2wが戻る
+  auto v = conv_test_input(2, 40, 2.5);
+  auto hv = grad(F::sum(g * as_variable(as_array(v))), xv);
+  auto expected_hv = conv_numerical_grad(
+      [&](const nc::NdArray<double>& a) {
+        auto av = as_variable(as_array(a));
+        auto ga = grad(F::sum(pow(F::max_pooling(av, q), 2) * wv), av);
+        return (*ga->data * v).sum()[0];
+      },
+      x0);
+  EXPECT_TRUE(nc::allclose(*hv->data, expected_hv, 1e-7));
+}
+
+TEST_F(ConvTest, averagePoolingTest) {
+  F::Conv2dParam p{1, 2, 2, 2, 2};
+  p.pad = 1;
+  // パディングも窓の大きさに数える
+  auto y = F::average_pooling(as_variable(as_array({{1.0, 2.0, 3.0, 4.0}})), p);
+  EXPECT_TRUE(nc::allclose(
+      *y->data,
+      nc::NdArray<double>{{0.25, 0.75, 0.5, 1.0, 2.5, 1.5, 0.75, 1.75, 1.0}}));
+
+  F::Conv2dParam q{2, 5, 4, 3, 2};
+  q.stride = 2;
+  q.pad = 1;
+  auto x0 = conv_test_input(3, 40, 0.0);
+  auto w = conv_test_input(3, 2 * q.out_h() * q.out_w(), 1.0);
+  auto x = as_variable(as_array(x0));
+  auto wv = as_variable(as_array(w));
+  F::sum(pow(F::average_pooling(x, q), 2) * wv)->backward();
+  auto expected = conv_numerical_grad(
+      [&](const nc::NdArray<double>& a) {
+        auto ya = F::average_pooling(as_variable(as_array(a)), q);
+        return (nc::power(*ya->data, 2) * w).sum()[0];
+      },
+      x0);
+  EXPECT_TRUE(nc::allclose(*x->grad->data, expected, 1e-8));
+
+  F::Conv2dParam bad_pad{1, 4, 4, 2, 2};
+  bad_pad.pad = 2;
+  EXPECT_THROW(F::average_pooling(x, bad_pad), std::invalid_argument);
+}
@@ -0,0 +1,161 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "NumCpp.hpp"
+#include "dezero.h"
+
+class DataParallelTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() { parallel::set_num_threads(4); };
+  virtual void TearDown() { parallel::set_num_threads(0); };
+};
+
+nc::NdArray<double> dp_test_input(size_t rows, size_t cols, double scale) {
+  nc::NdArray<double> a(rows, cols);
+  for (size_t i = 0; i < a.size(); i++) {
+    a[i] = scale * (static_cast<double>(i % 11) - 5.0);
+  }
+  return a;
+}
+
+VarPtr dp_test_loss(const std::vector<VarPtr>& p, const VarPtr& x,
+                    const VarPtr& t) {
+  // 2層のMLPと二乗誤差（W1を2回使う）
+  auto h = F::tanh(F::matmul(x, p[0]) + p[1]);
+  auto d = F::matmul(h, p[2]) + p[3] + F::sum(p[0]) * 0.1 - t;
+  return F::sum(d * d) / static_cast<double>(x->shape().rows);
+}
+
+TEST_F(DataParallelTest, matchesSingleTest) {
+  std::vector<VarPtr> params = {
+      as_variable(as_array(dp_test_input(3, 4, 0.1))),
+      as_variable(as_array(dp_test_input(1, 4, 0.05))),
+      as_variable(as_array(dp_test_input(4, 2, -0.2))),
+      as_variable(as_array(dp_test_input(1, 2, 0.3)))};
+  const auto x = dp_test_input(10, 3, 0.3);
+  const auto t = dp_test_input(10, 2, -0.1);
+
+  auto y = dp_test_loss(params, as_variable(as_array(x)),
+                        as_variable(as_array(t)));
+  y->backward();
+  std::vector<nc::NdArray<double>> expected;
+  for (auto& p : params) {
+    expected.push_back(*p->grad->data);
+    p->cleargrad();
+  }
+
+  // バケットがパラメータごとの場合と1つの場合
+  for (size_t bucket_size : {size_t(1), size_t(1) << 20}) {
+    data_parallel::DataParallel dp(params, 3, bucket_size);
+    EXPECT_EQ(dp.num_buckets(), bucket_size == 1 ? params.size() : 1);
+    const double loss = dp.step(dp_test_loss, x, t);
+    EXPECT_NEAR(loss, (*y->data)[0], 1e-12);
+    for (size_t k = 0; k < params.size(); k++) {
+      EXPECT_TRUE(nc::allclose(*params[k]->grad->data, expected[k]));
+      params[k]->cleargrad();
+    }
+  }
+}
+
+VarPtr dp_test_sparse_loss(const std::vector<VarPtr>& p, const VarPtr& x,
+                           const VarPtr& t) {
+  // 入力を疎行列としてWに掛ける（Wの勾配は行疎なsparse_gradに足される）
+  auto csr = sparse::as_csr(sparse::CSR::from_dense(*x->data));
+  auto h = F::tanh(F::sparse_matmul(csr, p[0], true) + p[1]);
+  auto d = F::matmul(h, p[2]) - t;
+  return F::sum(d * d) / static_cast<double>(x->shape().rows);
+}
+
+TEST_F(DataParallelTest, sparseGradTest) {
+  std::vector<VarPtr> params = {
+      as_variable(as_array(dp_test_input(6, 4, 0.1))),
+      as_variable(as_array(dp_test_input(1, 4, 0.05))),
+      as_variable(as_array(dp_test_input(4, 2, -0.2)))};
+  const auto x = dp_test_input(10, 6, 0.3);
+  const auto t = dp_test_input(10, 2, -0.1);
+
+  dp_test_sparse_loss(params, as_variable(as_array(x)),
+                      as_variable(as_array(t)))
+      ->backward();
+  ASSERT_TRUE(params[0]->sparse_grad);
+  std::vector<nc::NdArray<double>> expected = {
+      params[0]->sparse_grad->to_dense(), *params[1]->grad->data,
+      *params[2]->grad->data};
+  for (auto& p : params) p->cleargrad();
+
+  // 行疎な勾配も集約され、同じバケットの密な勾配も失われない
+  for (size_t bucket_size : {size_t(1), size_t(1) << 20}) {
+    data_parallel::DataParallel dp(params, 3, bucket_size);
+    dp.step(dp_test_sparse_loss, x, t);
+    for (size_t k = 0; k < params.size(); k++) {
+      ASSERT_TRUE(params[k]->grad) << k;
+      EXPECT_TRUE(nc::allclose(*params[k]->grad->data, expected[k])) << k;
+      params[k]->cleargrad();
+    }
+  }
+}
+
+// xの各行は語彙のid（埋め込みの勾配は行疎なsparse_gradに足される）
+VarPtr dp_test_embedding_loss(const std::vector<VarPtr>& p, const VarPtr& x,
+                              const VarPtr& t) {
+  std::vector<size_t> ids;
+  for (size_t i = 0; i < x->data->size(); i++) {
+    ids.push_back(static_cast<size_t>((*x->data)[i]));
+  }
+  auto h = F::tanh(F::embedding(p[0], ids));
+  auto d = F::matmul(h, p[1]) + p[2] - t;
+  return F::sum(d * d) / static_cast<double>(x->shape().rows);
+}
+
+TEST_F(DataParallelTest, embeddingTest) {
+  // 全体のバッチで学習したものと、データ並列で学習したものを比べる
+  auto make_params = []() {
+    return std::vector<VarPtr>{
+        as_variable(as_array(dp_test_input(7, 3, 0.1))),
+        as_variable(as_array(dp_test_input(3, 2, -0.2))),
+        as_variable(as_array(dp_test_input(1, 2, 0.3)))};
+  };
+  nc::NdArray<double> x(10, 1);
+  for (size_t i = 0; i < x.size(); i++) x[i] = (i * 3) % 5;
+  const auto t = dp_test_input(10, 2, -0.1);
+  const double lr = 0.1;
+  auto update = [lr](std::vector<VarPtr>& params) {
+    for (auto& p : params) {
+      nc::NdArray<double> g = p->grad ? *p->grad->data
+                                      : nc::zeros<double>(p->shape());
+      if (p->sparse_grad) g = g + p->sparse_grad->to_dense();
+      *p->data = *p->data - g * lr;
+      p->cleargrad();
+    }
+  };
+
+  auto expected = make_params();
+  for (int step = 0; step < 3; step++) {
+    dp_test_embedding_loss(expected, as_variable(as_array(x)),
+                           as_variable(as_array(t)))
+        ->backward();
+    update(expected);
+  }
+  for (size_t bucket_size : {size_t(1), size_t(1) << 20}) {
+    auto params = make_params();
+    data_parallel::DataParallel dp(params, 3, bucket_size);
+    for (int step = 0; step < 3; step++) {
+      dp.step(dp_test_embedding_loss, x, t);
+      for (auto& p : params) ASSERT_TRUE(p->grad);
+      update(params);
+    }
+    for (size_t k = 0; k < params.size(); k++) {
+      EXPECT_TRUE(nc::allclose(*params[k]->data, *expected[k]->data)) << k;
+    }
+  }
+}
+
+TEST_F(DataParallelTest, threadLocalConfigTest) {
+  // 別のスレッドのno_gradは影響しない
+  auto guard = no_grad();
+  bool other = false;
+  std::thread([&other]() { other = Config::enable_backprop; }).join();
+  EXPECT_FALSE(Config::enable_backprop);
+  EXPECT_TRUE(other);
+}
@@ -0,0 +1,128 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <string>
+
+#include "NumCpp.hpp"
+#include "dezero.h"
+
+class DatasetsTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    // ctest -jでは各テストが別プロセスで同時に走るので、テストごとに分ける
+    const auto* info = ::testing::UnitTest::GetInstance()->current_test_info();
+    dir = std::filesystem::temp_directory_path() /
+          (std::string("dezero_datasets_test_") + info->name());
+    std::filesystem::create_directories(dir);
+    // 10行3列、1シャード4レコード
+    std::ofstream csv(dir / "data.csv");
+    csv << "a,b,c\n";
+    for (int i = 0; i < 10; i++) {
+      csv << i << "," << i * 0.5 << "," << -i << "\n";
+    }
+    csv.close();
+    datasets::convert_csv((dir / "data.csv").string(), (dir / "data").string(),
+                          4, ',', true);
+  };
+  virtual void TearDown() { std::filesystem::remove_all(dir); };
+  std::filesystem::path dir;
+};
+
+TEST_F(DatasetsTest, roundTripTest) {
+  datasets::ShardedDataset ds((dir / "data.index").string());
+  EXPECT_EQ(ds.size(), 10u);
+  EXPECT_EQ(ds.record_size(), 3u);
+  EXPECT_EQ(ds.num_shards(), 3u);
+
+  // シャード内はmmap領域を直接参照する
+  auto x = ds.slice(4, 3);
+  EXPECT_EQ(x->shape(), nc::Shape(3, 3));
+  EXPECT_EQ(x->data(), ds.shard(1).record(0));
+  EXPECT_DOUBLE_EQ((*x)(2, 1), 3.0);
+
+  // シャードを跨ぐ場合はコピー
+  auto y = ds.slice(2, 4);
+  EXPECT_DOUBLE_EQ((*y)(3, 2), -5.0);
+}
+
+TEST_F(DatasetsTest, shuffleLoaderTest) {
+  datasets::ShardedDataset ds((dir / "data.index").string());
+  // ウィンドウが1シャードになる予算
+  datasets::DataLoader loader(ds, 3, true, ds.shard(0).bytes(), 1);
+  std::multiset<double> seen;
+  datasets::ConstNdArrPtr batch;
+  while (loader.next(batch)) {
+    for (nc::uint32 r = 0; r < batch->shape().rows; r++) {
+      seen.insert((*batch)(r, 0));
+    }
+  }
+  EXPECT_EQ(seen.size(), 10u);
+  EXPECT_EQ(std::set<double>(seen.begin(), seen.end()).size(), 10u);
+}
+
+TEST_F(DatasetsTest, heldViewTest) {
+  datasets::ShardedDataset ds((dir / "data.index").string());
+  datasets::DataLoader loader(ds, 2, false);
+  // シャード0（レコード0〜3）のビューを持ったまま読み進める
+  datasets::ConstNdArrPtr first, batch;
+  ASSERT_TRUE(loader.next(first));
+  EXPECT_EQ(first->data(), ds.shard(0).record(0));
+  while (loader.next(batch)) {
+  }
+  // ビューが残っているシャードは解放されない
+  EXPECT_FALSE(ds.release(0));
+  EXPECT_DOUBLE_EQ((*first)(1, 1), 0.5);
+  first.reset();
+  batch.reset();
+  EXPECT_TRUE(ds.release(0));
+}
+
+TEST_F(DatasetsTest, graphInputTest) {
+  // ローダーのバッチをコピーせずにモデルへ入れて逆伝播する
+  datasets::ShardedDataset ds((dir / "data.index").string());
+  datasets::DataLoader loader(ds, 4, false);
+  auto W = as_variable(as_array({{0.1, -0.2}, {0.3, 0.4}, {-0.5, 0.6}}));
+  auto model = [&](const VarPtr& x) {
+    return F::sum(F::tanh(F::matmul(x, W)));
+  };
+  datasets::ConstNdArrPtr batch;
+  ASSERT_TRUE(loader.next(batch));
+  auto x = datasets::as_input(batch);
+  EXPECT_EQ(x->data->data(), ds.shard(0).record(0));
+  model(x)->backward();
+  const auto gW = *W->grad->data;
+  EXPECT_TRUE(nc::allclose(*x->data, *batch));
+
+  W->cleargrad();
+  model(as_variable(as_array(*batch)))->backward();
+  EXPECT_TRUE(nc::allclose(*W->grad->data, gW, 0.0));
+
+  // 変数が残っている間はシャードを解放しない
+  while (loader.next(batch)) {
+  }
+  batch.reset();
+  EXPECT_FALSE(ds.release(0));
+  x.reset();
+  EXPECT_TRUE(ds.release(0));
+}
+
+TEST_F(DatasetsTest, writeErrorTest) {
+  // 書き込みに失敗するデバイス（書き込みはバッファされ、fcloseで失敗がわかる）
+  if (!std::filesystem::exists("/dev/full")) {
+    GTEST_SKIP() << "/dev/full is not available";
+  }
+  std::filesystem::create_symlink("/dev/full", dir / "full-00000.shard");
+  datasets::ShardWriter writer((dir / "full").string(), 3, 4);
+  const double record[3] = {1.0, 2.0, 3.0};
+  EXPECT_THROW(
+      {
+        for (int i = 0; i < 4; i++) writer.write(record);
+      },
+      std::runtime_error);
+  // 失敗したシャードはインデックスに載らない
+  writer.close();
+  datasets::ShardedDataset ds((dir / "full.index").string());
+  EXPECT_EQ(ds.num_shards(), 0u);
+}
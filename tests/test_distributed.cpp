@@ -0,0 +1,170 @@
+#include <gtest/gtest.h>
+
+#include "NumCpp.hpp"
+#include "dezero.h"
+
+// 子プロセスではgtestのアサーションは使えないので、終了コードで結果を返す
+class DistributedTest : public ::testing::TestWithParam<distributed::Backend> {
+ protected:
+  virtual void SetUp(){};
+  virtual void TearDown(){};
+};
+
+TEST_P(DistributedTest, allreduceTest) {
+  const int world = 3;
+  // チャンクが割り切れない大きさと、共有メモリのリングバッファより大きいもの
+  for (size_t n : {size_t(1000), size_t(200003)}) {
+    const int code = distributed::launch(
+        world, GetParam(), [n](distributed::Transport& t) {
+          std::vector<double> data(n);
+          for (size_t i = 0; i < n; i++) {
+            data[i] = (t.rank() + 1) * 0.5 + i;
+          }
+          distributed::allreduce(t, data.data(), n);
+          for (size_t i = 0; i < n; i++) {
+            // (1 + 2 + 3) * 0.5 + 3 i
+            if (data[i] != 3.0 + 3.0 * i) {
+              return 1;
+            }
+          }
+          return 0;
+        });
+    EXPECT_EQ(code, 0) << "n = " << n;
+  }
+}
+
+VarPtr ddp_test_loss(const std::vector<VarPtr>& p, const VarPtr& x,
+                     const VarPtr& t) {
+  auto h = F::tanh(F::matmul(x, p[0]) + p[1]);
+  auto d = F::matmul(h, p[2]) + p[3] - t;
+  return F::sum(d * d) / static_cast<double>(x->shape().rows);
+}
+
+nc::NdArray<double> ddp_test_input(size_t rows, size_t cols, double scale,
+                                   size_t offset = 0) {
+  nc::NdArray<double> a(rows, cols);
+  for (size_t i = 0; i < a.size(); i++) {
+    a[i] = scale * (static_cast<double>((i + offset) % 7) - 3.0);
+  }
+  return a;
+}
+
+TEST_P(DistributedTest, dataParallelTest) {
+  const int world = 2;
+  const int code =
+      distributed::launch(world, GetParam(), [](distributed::Transport& t) {
+        std::vector<VarPtr> params = {
+            as_variable(as_array(ddp_test_input(3, 5, 0.1))),
+            as_variable(as_array(ddp_test_input(1, 5, 0.05))),
+            as_variable(as_array(ddp_test_input(5, 2, -0.2))),
+            as_variable(as_array(ddp_test_input(1, 2, 0.3)))};
+        const size_t rows = 4;
+        // バッチ全体（全ランク分）の勾配
+        auto x = as_variable(as_array(ddp_test_input(rows * 2, 3, 0.3)));
+        auto y = as_variable(as_array(ddp_test_input(rows * 2, 2, -0.1)));
+        ddp_test_loss(params, x, y)->backward();
+        std::vector<nc::NdArray<double>> expected;
+        for (auto& p : params) {
+          expected.push_back(*p->grad->data);
+          p->cleargrad();
+        }
+
+        // パラメータごとのバケットで、自分のシャードだけを計算する
+        distributed::DistributedDataParallel ddp(t, params, 1);
+        auto xs = as_variable(
+            as_array(ddp_test_input(rows, 3, 0.3, rows * 3 * t.rank())));
+        auto ys = as_variable(
+            as_array(ddp_test_input(rows, 2, -0.1, rows * 2 * t.rank())));
+        ddp.backward(ddp_test_loss(params, xs, ys));
+        for (size_t k = 0; k < params.size(); k++) {
+          if (!nc::allclose(*params[k]->grad->data, expected[k])) {
+            return 1;
+          }
+        }
+        return ddp.num_buckets() == params.size() ? 0 : 2;
+      });
+  EXPECT_EQ(code, 0);
+}
+
+VarPtr ddp_test_embedding_loss(const std::vector<VarPtr>& p,
+                               const std::vector<size_t>& ids,
+                               const VarPtr& t) {
+  auto h = F::tanh(F::embedding(p[0], ids));
+  auto d = F::matmul(h, p[1]) - t;
+  return F::sum(d * d) / static_cast<double>(ids.size());
+}
+
+TEST_P(DistributedTest, embeddingTest) {
+  // 埋め込みの行疎な勾配も平均され、全体のバッチで学習したものと一致する
+  for (int world : {1, 2}) {
+    const int code =
+        distributed::launch(world, GetParam(), [](distributed::Transport& t) {
+          auto make_params = []() {
+            return std::vector<VarPtr>{
+                as_variable(as_array(ddp_test_input(7, 3, 0.1))),
+                as_variable(as_array(ddp_test_input(3, 2, -0.2)))};
+          };
+          const size_t rows = 4;
+          const size_t n = rows * t.world_size();
+          std::vector<size_t> ids(n);
+          for (size_t i = 0; i < n; i++) ids[i] = (i * 3) % 5;
+          auto y = ddp_test_input(n, 2, -0.1);
+          auto update = [](std::vector<VarPtr>& params) {
+            for (auto& p : params) {
+              nc::NdArray<double> g = p->grad ? *p->grad->data
+                                              : nc::zeros<double>(p->shape());
+              if (p->sparse_grad) g = g + p->sparse_grad->to_dense();
+              *p->data = *p->data - g * 0.1;
+              p->cleargrad();
+            }
+          };
+
+          auto expected = make_params();
+          auto params = make_params();
+          // 1つのバケットに埋め込みと密なパラメータを入れる
+          distributed::DistributedDataParallel ddp(t, params, 1 << 20);
+          const std::vector<size_t> shard(ids.begin() + rows * t.rank(),
+                                          ids.begin() + rows * (t.rank() + 1));
+          nc::NdArray<double> ys(rows, 2);
+          for (size_t i = 0; i < ys.size(); i++) {
+            ys[i] = y[rows * 2 * t.rank() + i];
+          }
+          for (int step = 0; step < 3; step++) {
+            ddp_test_embedding_loss(expected, ids, as_variable(as_array(y)))
+                ->backward();
+            update(expected);
+            ddp.backward(ddp_test_embedding_loss(params, shard,
+                                                 as_variable(as_array(ys))));
+            if (params[0]->sparse_grad) {
+              return 2;
+            }
+            update(params);
+          }
+          for (size_t k = 0; k < params.size(); k++) {
+            if (!nc::allclose(*params[k]->data, *expected[k]->data)) {
+              return 1;
+            }
+          }
+          return 0;
+        });
+    EXPECT_EQ(code, 0) << "world = " << world;
+  }
+}
+
+TEST_P(DistributedTest, failureTest) {
+  // 1つのランクが失敗したら、通信で待っている他のランクも止めて終了コードを返す
+  const int code =
+      distributed::launch(3, GetParam(), [](distributed::Transport& t) {
+        if (t.rank() == 1) {
+          return 3;
+        }
+        std::vector<double> data(10, 1.0);
+        distributed::allreduce(t, data.data(), data.size());
+        return 0;
+      });
+  EXPECT_EQ(code, 3);
+}
+
+INSTANTIATE_TEST_SUITE_P(Backends, DistributedTest,
+                         ::testing::Values(distributed::Backend::SharedMemory,
+                                           distributed::Backend::UnixSocket));
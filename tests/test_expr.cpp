@@ -0,0 +1,49 @@
+#include <gtest/gtest.h>
+
+#include "NumCpp.hpp"
+#include "dezero.h"
+
+class ExprTest : public ::testing::Test {
+ protected:
+  virtual void SetUp(){};
+  virtual void TearDown(){};
+};
+
+TEST_F(ExprTest, fusedTest) {
+  nc::NdArray<double> a(3, 4), b(1, 4), c(3, 1);
+  for (nc::uint32 i = 0; i < a.size(); i++) a[i] = 0.1 * i;
+  for (nc::uint32 i = 0; i < b.size(); i++) b[i] = -1.0 + i;
+  for (nc::uint32 i = 0; i < c.size(); i++) c[i] = 2.0 * i;
+  auto x = as_variable(as_array(a));
+  auto w = as_variable(as_array(b));
+  auto v = as_variable(as_array(c));
+
+  using expr::lazy;
+  auto no_grad_guard = no_grad();
+  VarPtr y = expr::tanh(lazy(x) * lazy(w) + lazy(v)) / 2.0 - 1.0;
+  // 逆伝播のグラフは作られない
+  EXPECT_FALSE(y->creator_ptr);
+  EXPECT_EQ(y->shape(), nc::Shape(3, 4));
+  for (nc::uint32 r = 0; r < 3; r++) {
+    for (nc::uint32 k = 0; k < 4; k++) {
+      EXPECT_DOUBLE_EQ((*y->data)(r, k),
+                       std::tanh(a(r, k) * b[k] + c[r]) / 2.0 - 1.0);
+    }
+  }
+
+  // 既存の配列に書き込む
+  nc::NdArray<double> out(3, 4);
+  expr::assign(out, 1.0 - lazy(x) * x);
+  EXPECT_TRUE(nc::allclose(out, 1.0 - a * a));
+}
+
+TEST_F(ExprTest, backpropTest) {
+  // enable_backpropのときは通常の計算グラフになり微分できる
+  auto x = as_variable(as_array({0.5, -1.0}));
+  VarPtr y = expr::lazy(x) * expr::exp(expr::lazy(x)) + 3.0;
+  EXPECT_TRUE(y->creator_ptr);
+  y->backward();
+  auto e = nc::exp(*x->data);
+  EXPECT_TRUE(nc::allclose(*y->data, *x->data * e + 3.0));
+  EXPECT_TRUE(nc::allclose(*x->grad->data, e + *x->data * e));
+}
@@ -0,0 +1,178 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <vector>
+
+#include "NumCpp.hpp"
+#include "dezero.h"
+
+class FlatTest : public ::testing::Test {
+ protected:
+  virtual void SetUp(){};
+  virtual void TearDown(){};
+};
+
+VarPtr flat_test_input(size_t rows, size_t cols, double phase) {
+  nc::NdArray<double> x(rows, cols);
+  for (size_t i = 0; i < x.size(); i++) {
+    x[i] = std::sin(0.37 * i + phase);
+  }
+  return as_variable(as_array(x));
+}
+
+struct FlatTestModel {
+  VarPtr W1 = flat_test_input(3, 4, 0.0);
+  VarPtr b1 = flat_test_input(1, 4, 1.0);
+  VarPtr W2 = flat_test_input(4, 2, 2.0);
+  VarPtr x = flat_test_input(5, 3, 3.0);
+  std::vector<VarPtr> params() const { return {W1, b1, W2}; }
+  VarPtr loss() const {
+    auto h = F::tanh(F::matmul(x, W1) + b1);
+    // W1を2回使い、勾配が足し合わされるようにする
+    return F::sum(F::matmul(h, W2)) + F::sum(W1 * W1);
+  }
+};
+
+TEST_F(FlatTest, viewTest) {
+  FlatTestModel m;
+  auto params = m.params();
+  std::vector<nc::NdArray<double>> values;
+  for (auto& p : params) values.push_back(*p->data);
+  flat::FlatParameters flat(params);
+  EXPECT_EQ(flat.size(), 12u + 4u + 8u);
+  for (size_t k = 0; k < params.size(); k++) {
+    // 値はそのままで、バッファ上に順に並ぶ
+    EXPECT_EQ(params[k]->data->data(), flat.data() + flat.offset(k));
+    EXPECT_EQ(params[k]->grad_view->data(), flat.grad() + flat.offset(k));
+    EXPECT_TRUE(nc::allclose(*params[k]->data, values[k], 0.0));
+  }
+  flat.data()[flat.offset(1)] = 5.0;
+  EXPECT_EQ((*m.b1->data)[0], 5.0);
+
+  EXPECT_THROW(flat::FlatParameters({m.x, m.x}), std::invalid_argument);
+  EXPECT_THROW(flat::FlatParameters({m.x * 2.0}), std::invalid_argument);
+}
+
+TEST_F(FlatTest, backwardTest) {
+  FlatTestModel m;
+  auto expected = grad({m.loss()}, m.params());
+  flat::FlatParameters flat(m.params());
+  flat.cleargrads();
+  m.loss()->backward();
+  auto params = m.params();
+  for (size_t k = 0; k < params.size(); k++) {
+    // 勾配はバッファに直接足される
+    EXPECT_EQ(params[k]->grad->data->data(), flat.grad() + flat.offset(k));
+    EXPECT_TRUE(nc::allclose(*params[k]->grad->data, *expected[k]->data));
+  }
+  // もう1回逆伝播すると足し合わされる
+  m.loss()->backward();
+  EXPECT_TRUE(nc::allclose(*m.W1->grad->data, *expected[0]->data * 2.0));
+
+  flat.cleargrads();
+  for (size_t i = 0; i < flat.size(); i++) EXPECT_EQ(flat.grad()[i], 0.0);
+  EXPECT_EQ(m.W2->grad->data->data(), flat.grad() + flat.offset(2));
+
+  // Variable::cleargradしたパラメータはsyncで0になる
+  m.loss()->backward();
+  m.b1->cleargrad();
+  flat.sync();
+  for (size_t i = 0; i < 4; i++) {
+    EXPECT_EQ(flat.grad()[flat.offset(1) + i], 0.0);
+  }
+  EXPECT_TRUE(nc::allclose(*m.W2->grad->data, *expected[2]->data));
+}
+
+TEST_F(FlatTest, clipTest) {
+  FlatTestModel m;
+  flat::FlatParameters flat(m.params());
+  m.loss()->backward();
+  double sq = 0.0;
+  for (auto& p : m.params()) {
+    for (size_t i = 0; i < p->grad->data->size(); i++) {
+      sq += (*p->grad->data)[i] * (*p->grad->data)[i];
+    }
+  }
+  const double norm = std::sqrt(sq);
+  EXPECT_NEAR(flat.grad_norm(), norm, 1e-12);
+  // ノルムが上限以下なら変えない
+  EXPECT_NEAR(flat.clip_grad_norm(norm * 2.0), norm, 1e-12);
+  EXPECT_NEAR(flat.grad_norm(), norm, 1e-12);
+  EXPECT_NEAR(flat.clip_grad_norm(0.5), norm, 1e-12);
+  EXPECT_NEAR(flat.grad_norm(), 0.5, 1e-6);
+}
+
+TEST_F(FlatTest, optimizerTest) {
+  FlatTestModel m;
+  auto params = m.params();
+  flat::FlatParameters flat(params);
+  m.loss()->backward();
+  std::vector<nc::NdArray<double>> xs, gs;
+  for (auto& p : params) {
+    xs.push_back(*p->data);
+    gs.push_back(*p->grad->data);
+  }
+  flat.sgd(0.1);
+  for (size_t k = 0; k < params.size(); k++) {
+    EXPECT_TRUE(nc::allclose(*params[k]->data, xs[k] - gs[k] * 0.1));
+  }
+
+  // dataを代入で差し替えてもsyncでバッファに戻る
+  *m.W2->data = *m.W2->data * 2.0;
+  flat.sgd(0.0);
+  EXPECT_EQ(m.W2->data->data(), flat.data() + flat.offset(2));
+  EXPECT_TRUE(nc::allclose(*m.W2->data, (xs[2] - gs[2] * 0.1) * 2.0));
+
+  // Adam: 要素ごとに計算したものと比べる
+  for (auto& p : params) xs.push_back(*p->data);
+  const double lr = 0.01, b1 = 0.9, b2 = 0.999, eps = 1e-8;
+  flat.adam(lr, b1, b2, eps);
+  flat.adam(lr, b1, b2, eps);
+  for (size_t k = 0; k < params.size(); k++) {
+    for (size_t i = 0; i < gs[k].size(); i++) {
+      const double g = gs[k][i];
+      double x = xs[params.size() + k][i], mt = 0.0, vt = 0.0;
+      for (int t = 1; t <= 2; t++) {
+        mt = b1 * mt + (1 - b1) * g;
+        vt = b2 * vt + (1 - b2) * g * g;
+        const double a = lr * std::sqrt(1 - std::pow(b2, t)) /
+                         (1 - std::pow(b1, t));
+        x -= a * mt / (std::sqrt(vt) + eps);
+      }
+      EXPECT_NEAR((*params[k]->data)[i], x, 1e-12);
+    }
+  }
+}
+
+TEST_F(FlatTest, sparseGradTest) {
+  // 埋め込みの行疎な勾配はsyncで触れた行だけバッファに足される
+  auto W = flat_test_input(6, 3, 0.0);
+  flat::FlatParameters flat({W});
+  auto y = F::embedding(W, {1, 4, 1});
+  F::sum(y * y)->backward();
+  ASSERT_TRUE(W->sparse_grad);
+  flat.sync();
+  EXPECT_FALSE(W->sparse_grad);
+  for (size_t r = 0; r < 6; r++) {
+    const double times = r == 1 ? 2.0 : r == 4 ? 1.0 : 0.0;
+    for (size_t c = 0; c < 3; c++) {
+      EXPECT_NEAR(flat.grad()[r * 3 + c], 2.0 * times * (*W->data)(r, c),
+                  1e-12);
+    }
+  }
+}
+
+TEST_F(FlatTest, allreduceTest) {
+  const int code = distributed::launch(
+      2, distributed::Backend::SharedMemory, [](distributed::Transport& t) {
+        FlatTestModel m;
+        flat::FlatParameters flat(m.params());
+        // ランクごとに勾配の大きさを変える
+        (m.loss() * static_cast<double>(t.rank() + 1))->backward();
+        // 平均は1.5倍の損失の勾配
+        auto expected = *m.W1->grad->data * (1.5 / (t.rank() + 1));
+        flat.allreduce(t);
+        return nc::allclose(*m.W1->grad->data, expected) ? 0 : 1;
+      });
+  EXPECT_EQ(code, 0);
+}
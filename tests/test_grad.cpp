@@ -0,0 +1,60 @@
+#include <gtest/gtest.h>
+
+#include "NumCpp.hpp"
+#include "dezero.h"
+
+class GradTest : public ::testing::Test {
+ protected:
+  virtual void SetUp(){};
+  virtual void TearDown(){};
+};
+
+TEST_F(GradTest, gradTest) {
+  auto x0 = as_variable(as_array({1.0, 2.0}));
+  auto x1 = as_variable(as_array({3.0, 4.0}));
+  auto y = F::sum(x0 * x1 + F::sin(x0));
+  auto gx0 = grad(y, x0);
+  EXPECT_TRUE(nc::allclose(*gx0->data, *x1->data + nc::cos(*x0->data)));
+  // Variable::gradは書き換えない
+  EXPECT_FALSE(x0->grad);
+  EXPECT_FALSE(x1->grad);
+}
+
+TEST_F(GradTest, hvpTest) {
+  // f(x) = sum(x^4) のとき H v = 12 x^2 v
+  auto x = as_variable(as_array({1.0, -2.0, 0.5}));
+  auto v = as_variable(as_array({1.0, 2.0, 3.0}));
+  auto hv = hvp([](const VarPtr& x) { return F::sum(pow(x, 4)); }, x, v);
+  EXPECT_TRUE(nc::allclose(
+      *hv->data, 12.0 * (*x->data) * (*x->data) * (*v->data)));
+}
+
+TEST_F(GradTest, rosenbrockTest) {
+  // y = 100 (x1 - x0^2)^2 + (1 - x0)^2
+  auto x0 = as_variable(as_array({0.0}));
+  auto x1 = as_variable(as_array({2.0}));
+  auto y = 100.0 * pow(x1 - pow(x0, 2), 2) + pow(1.0 - x0, 2);
+  auto gxs = grad({y}, {x0, x1});
+  EXPECT_DOUBLE_EQ((*gxs[0]->data)[0], -2.0);
+  EXPECT_DOUBLE_EQ((*gxs[1]->data)[0], 400.0);
+}
+
+TEST_F(GradTest, scalarOpTest) {
+  // 数値との演算は定数用のFunctionになる
+  auto x = as_variable(as_array({2.0, -0.5}));
+  auto y = 3.0 - 2.0 / x + x * 4 - x / 2.0 + (1.0 + x);
+  EXPECT_TRUE(std::dynamic_pointer_cast<AddScalar>(
+      std::dynamic_pointer_cast<Add>(y->creator_ptr)->inputs_[1]->creator_ptr));
+  y->backward();
+  const auto& xd = *x->data;
+  EXPECT_TRUE(nc::allclose(*y->data, 3.0 - 2.0 / xd + xd * 4.0 - xd / 2.0 +
+                                         (1.0 + xd)));
+  EXPECT_TRUE(
+      nc::allclose(*x->grad->data, 2.0 / (xd * xd) + 4.0 - 0.5 + 1.0));
+
+  // 二階微分: d^2/dx^2 (2 / x) = 4 / x^3
+  auto z = as_variable(as_array({2.0}));
+  auto gz = grad(2.0 / z, z, true);
+  auto ggz = grad(gz, z);
+  EXPECT_DOUBLE_EQ((*ggz->data)[0], 0.5);
+}
@@ -0,0 +1,178 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "NumCpp.hpp"
+#include "dezero.h"
+
+class JvpTest : public ::testing::Test {
+ protected:
+  virtual void SetUp(){};
+  virtual void TearDown(){};
+};
+
+// 要素ごとの関数では J v = f'(x) v
+TEST_F(JvpTest, elementwiseTest) {
+  auto x = as_variable(as_array({0.5, -1.0, 2.0}));
+  auto v = as_array({1.0, 2.0, -1.0});
+  auto f = [](const VarPtr& x) { return F::sin(x) * x + F::tanh(x) / 2.0; };
+  auto [y, ty] = jvp(f, x, v);
+
+  const auto& xd = *x->data;
+  auto t = nc::tanh(xd);
+  auto expected = (nc::cos(xd) * xd + nc::sin(xd) + (1.0 - t * t) / 2.0) * *v;
+  EXPECT_TRUE(nc::allclose(*ty, expected));
+  // 計算グラフは残らない
+  EXPECT_FALSE(y->creator_ptr);
+  EXPECT_FALSE(x->tangent);
+}
+
+// スカラー出力なら逆伝播の勾配との内積に一致する
+TEST_F(JvpTest, matchesBackwardTest) {
+  auto x = as_variable(as_array({1.0, 2.0}));
+  auto W = as_variable(as_array({{0.5, -1.0}, {2.0, 0.1}}));
+  auto v = as_array({0.1, -0.3});
+  auto f = [&W](const VarPtr& x) {
+    return F::sum(pow(F::matmul(x, W), 2) - F::cos(x));
+  };
+  auto [y, ty] = jvp(f, x, v);
+  auto gx = grad(f(x), x);
+  EXPECT_NEAR((*ty)[0], nc::sum(*gx->data * *v)[0], 1e-10);
+}
+
+// [0.5, 1.5]の値（logやc / xにも使える）
+nc::NdArray<double> jvp_test_input(const nc::Shape& shape, int phase) {
+  nc::NdArray<double> x(shape.rows, shape.cols);
+  for (size_t i = 0; i < x.size(); i++) {
+    x[i] = 0.5 + 0.1 * static_cast<double>((i * 7 + phase) % 11);
+  }
+  return x;
+}
+
+nc::NdArray<double> jvp_test_direction(const nc::Shape& shape, int phase) {
+  nc::NdArray<double> v(shape.rows, shape.cols);
+  for (size_t i = 0; i < v.size(); i++) v[i] = std::sin(1.3 * i + phase);
+  return v;
+}
+
+VarPtr jvp_test_const(nc::uint32 rows, nc::uint32 cols, int phase) {
+  return as_variable(as_array(jvp_test_input(nc::Shape(rows, cols), phase)));
+}
+
+struct JvpCase {
+  std::string name;
+  nc::Shape shape;
+  std::function<VarPtr(const VarPtr&)> f;
+};
+
+// 各関数のjvpを、中心差分の方向微分と、逆伝播の勾配との内積
+// <u, J v> = <J^T u, v>の両方と比べる
+// 2入力の関数はどちらの入力に接ベクトルがある場合も確かめる
+TEST_F(JvpTest, functionTableTest) {
+  const auto c32 = jvp_test_const(3, 2, 1);
+  const auto c12 = jvp_test_const(1, 2, 2);
+  const auto c31 = jvp_test_const(3, 1, 3);
+  const auto A = jvp_test_const(4, 3, 4);
+  const auto B = jvp_test_const(2, 3, 5);
+  nc::NdArray<double> dense(3, 4);
+  for (size_t i = 0; i < dense.size(); i++) dense[i] = i % 3 ? 0.0 : 0.1 * i;
+  const auto csr = sparse::as_csr(sparse::CSR::from_dense(dense));
+  const nc::Shape s32(3, 2), s12(1, 2), s31(3, 1), s34(3, 4);
+
+  const std::vector<JvpCase> cases = {
+      {"add", s32, [&](const VarPtr& x) { return x + c32; }},
+      {"add broadcast x", s12, [&](const VarPtr& x) { return c32 + x; }},
+      {"add broadcast c", s32, [&](const VarPtr& x) { return x + c12; }},
+      {"mul", s32, [&](const VarPtr& x) { return x * c32; }},
+      {"mul broadcast x", s31, [&](const VarPtr& x) { return c32 * x; }},
+      {"mul broadcast c", s32, [&](const VarPtr& x) { return x * c31; }},
+      {"mul self", s32, [&](const VarPtr& x) { return x * x; }},
+      {"neg", s32, [&](const VarPtr& x) { return -x; }},
+      {"sub", s32, [&](const VarPtr& x) { return c32 - x; }},
+      {"sub broadcast", s12, [&](const VarPtr& x) { return x - c32; }},
+      {"div x0", s32, [&](const VarPtr& x) { return x / c12; }},
+      {"div x1", s12, [&](const VarPtr& x) { return c32 / x; }},
+      {"pow", s32, [&](const VarPtr& x) { return pow(x, 3); }},
+      {"add scalar", s32, [&](const VarPtr& x) { return x + 2.0; }},
+      {"sub scalar", s32, [&](const VarPtr& x) { return x - 2.0; }},
+      {"rsub scalar", s32, [&](const VarPtr& x) { return 2.0 - x; }},
+      {"mul scalar", s32, [&](const VarPtr& x) { return x * 3.0; }},
+      {"div scalar", s32, [&](const VarPtr& x) { return x / 3.0; }},
+      {"rdiv scalar", s32, [&](const VarPtr& x) { return 3.0 / x; }},
+      {"sin", s32, [&](const VarPtr& x) { return F::sin(x); }},
+      {"cos", s32, [&](const VarPtr& x) { return F::cos(x); }},
+      {"tanh", s32, [&](const VarPtr& x) { return F::tanh(x); }},
+      {"exp", s32, [&](const VarPtr& x) { return F::exp(x); }},
+      {"log", s32, [&](const VarPtr& x) { return F::log(x); }},
+      {"sigmoid", s32, [&](const VarPtr& x) { return F::sigmoid(x); }},
+      {"reshape", s32,
+       [&](const VarPtr& x) { return F::reshape(x, nc::Shape(2, 3)); }},
+      {"transpose", s32, [&](const VarPtr& x) { return F::transpose(x); }},
+      {"broadcast_to", s12,
+       [&](const VarPtr& x) { return F::broadcast_to(x, s32); }},
+      {"sum_to rows", s32, [&](const VarPtr& x) { return F::sum_to(x, s12); }},
+      {"sum_to cols", s32, [&](const VarPtr& x) { return F::sum_to(x, s31); }},
+      {"sum", s32, [&](const VarPtr& x) { return F::sum(x); }},
+      {"sum row", s32,
+       [&](const VarPtr& x) { return F::sum(x, nc::Axis::ROW); }},
+      {"sum col", s32,
+       [&](const VarPtr& x) { return F::sum(x, nc::Axis::COL); }},
+      {"matmul x0", s34, [&](const VarPtr& x) { return F::matmul(x, A); }},
+      {"matmul x1", s34, [&](const VarPtr& x) { return F::matmul(B, x); }},
+      {"sparse_matmul", nc::Shape(4, 2),
+       [&](const VarPtr& x) { return F::sparse_matmul(csr, x); }},
+      {"get_item", s34,
+       [&](const VarPtr& x) { return F::get_item(x, {2, 0, 2}); }},
+      {"get_item range", s34,
+       [&](const VarPtr& x) { return F::get_item(x, 1, 3); }},
+      {"get_item grad", s34,
+       [&](const VarPtr& x) {
+         auto f = std::make_shared<F::GetItemGrad>(
+             std::vector<size_t>{2, 0, 2}, nc::Shape(4, 4));
+         return (*f)(x)[0];
+       }},
+      {"softmax", s34, [&](const VarPtr& x) { return F::softmax(x); }},
+      {"softmax_cross_entropy", s34,
+       [&](const VarPtr& x) {
+         return F::softmax_cross_entropy(x, {3, 0, 1});
+       }},
+      {"dropout", s34,
+       [&](const VarPtr& x) {
+         // 差分と同じマスクになるよう毎回同じ乱数を使う
+         rng::manual_seed(0);
+         return F::dropout(x, 0.5);
+       }},
+  };
+
+  const double h = 1e-5;
+  for (const auto& c : cases) {
+    SCOPED_TRACE(c.name);
+    const auto x0 = jvp_test_input(c.shape, 0);
+    const auto v = jvp_test_direction(c.shape, 0);
+    auto x = as_variable(as_array(x0));
+    auto [y, ty] = jvp(c.f, x, as_array(v));
+    ASSERT_EQ(ty->shape(), y->shape());
+
+    nc::NdArray<double> fd;
+    {
+      auto mode = no_grad();
+      const auto yp = *c.f(as_variable(as_array(x0 + v * h)))->data;
+      const auto ym = *c.f(as_variable(as_array(x0 - v * h)))->data;
+      fd = (yp - ym) / (2.0 * h);
+    }
+    for (size_t i = 0; i < ty->size(); i++) {
+      EXPECT_NEAR((*ty)[i], fd[i], 1e-7 * (1.0 + std::fabs(fd[i])));
+    }
+
+    const auto u = as_variable(as_array(jvp_test_direction(y->shape(), 1)));
+    auto gx = grad(F::sum(c.f(x) * u), x);
+    double uJv = 0.0, JTuv = 0.0;
+    for (size_t i = 0; i < ty->size(); i++) uJv += (*u->data)[i] * (*ty)[i];
+    for (size_t i = 0; i < v.size(); i++) JTuv += (*gx->data)[i] * v[i];
+    EXPECT_NEAR(uJv, JTuv, 1e-10 * (1.0 + std::fabs(JTuv)));
+  }
+}
@@ -0,0 +1,118 @@
+#include <gtest/gtest.h>
+
+#include "NumCpp.hpp"
+#include "dezero.h"
+
+class LazyTest : public ::testing::Test {
+ protected:
+  virtual void SetUp(){};
+  virtual void TearDown(){};
+};
+
+nc::NdArray<double> lazy_test_input(size_t rows, size_t cols) {
+  nc::NdArray<double> a(rows, cols);
+  for (size_t i = 0; i < a.size(); i++) {
+    a[i] = 0.1 * static_cast<double>(i % 17) - 0.7;
+  }
+  return a;
+}
+
+TEST_F(LazyTest, fusedTest) {
+  // チャンクの境界をまたぐ大きさ
+  auto x = as_variable(as_array(lazy_test_input(7, 300)));
+  auto expected = *(F::sin(x) * F::cos(x) + x)->data;
+
+  VarPtr s, c, y;
+  {
+    auto mode = no_grad();
+    lazy::Tracing tracing;
+    s = F::sin(x);
+    c = F::cos(x);
+    y = s * c + x;
+  }
+  EXPECT_FALSE(y->data.ready());
+  EXPECT_EQ(y->shape(), x->shape());
+  const size_t runs = lazy::num_kernel_runs();
+  EXPECT_TRUE(nc::allclose(*y->data, expected));
+  EXPECT_EQ(lazy::num_kernel_runs(), runs + 1);
+  // 逆伝播しないなら、途中の値は1つのループの中でしか作られない
+  EXPECT_FALSE(s->data.ready());
+  EXPECT_FALSE(c->data.node()->result);
+}
+
+TEST_F(LazyTest, broadcastTest) {
+  auto x = as_variable(as_array(lazy_test_input(5, 6)));
+  auto b = as_variable(as_array(lazy_test_input(1, 6)));
+  auto expected = *(F::exp(b * 2.0) * x - 1.0 / (x + 3.0))->data;
+
+  VarPtr y;
+  {
+    lazy::Tracing tracing;
+    y = F::exp(b * 2.0) * x - 1.0 / (x + 3.0);
+    // 形が合わなければ記録するときに投げる
+    EXPECT_THROW(x + as_variable(as_array(lazy_test_input(2, 6))),
+                 std::invalid_argument);
+  }
+  EXPECT_TRUE(nc::allclose(*y->data, expected));
+}
+
+TEST_F(LazyTest, backwardTest) {
+  auto x = as_variable(as_array(lazy_test_input(3, 4)));
+  auto b = as_variable(as_array(lazy_test_input(1, 4)));
+  auto f = [&]() {
+    return F::sum(F::tanh(x) * b + pow(x, 2) / 2.0 - F::sigmoid(-x));
+  };
+  auto y = f();
+  y->backward();
+  const auto gx = *x->grad->data;
+  const auto gb = *b->grad->data;
+  x->cleargrad();
+  b->cleargrad();
+
+  VarPtr yl;
+  {
+    lazy::Tracing tracing;
+    yl = f();
+  }
+  yl->backward();
+  EXPECT_DOUBLE_EQ((*yl->data)[0], (*y->data)[0]);
+  EXPECT_TRUE(nc::allclose(*x->grad->data, gx));
+  EXPECT_TRUE(nc::allclose(*b->grad->data, gb));
+}
+
+TEST_F(LazyTest, chainBackwardTest) {
+  // 長い鎖の逆伝播で、途中の値を読むたびに鎖を評価し直さない
+  auto x = as_variable(as_array(lazy_test_input(3, 200)));
+  const int length = 200;
+  auto f = [&]() {
+    auto y = x;
+    for (int i = 0; i < length; i++) y = F::tanh(y * 0.9 + x);
+    return F::sum(y);
+  };
+  f()->backward();
+  const auto gx = *x->grad->data;
+  x->cleargrad();
+
+  const size_t runs = lazy::num_kernel_runs();
+  VarPtr y;
+  {
+    lazy::Tracing tracing;
+    y = f();
+  }
+  y->backward();
+  // sumの入力を評価する1回だけで、途中の値は全てそのカーネルが書き出す
+  EXPECT_EQ(lazy::num_kernel_runs(), runs + 1);
+  EXPECT_TRUE(nc::allclose(*x->grad->data, gx, 1e-12));
+}
+
+TEST_F(LazyTest, residualTeardownTest) {
+  // 各ノードを2回使う鎖（y + f(y)）も再帰せずに解放する
+  auto mode = no_grad();
+  lazy::Tracing tracing;
+  auto y = as_variable(as_array(lazy_test_input(1, 4)));
+  const size_t runs = lazy::num_kernel_runs();
+  for (int i = 0; i < 300000; i++) y = y + F::sin(y) * 0.001;
+  y.reset();
+  // 評価はされない
+  EXPECT_EQ(lazy::num_kernel_runs(), runs);
+}
@@ -0,0 +1,69 @@
+#include <gtest/gtest.h>
+
+#include "NumCpp.hpp"
+#include "dezero.h"
+
+class ParallelTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    parallel::set_num_threads(4);
+    // 小さいテンソルでも分割されるようにする
+    parallel::set_grain_size(7);
+  };
+  virtual void TearDown() {
+    parallel::set_num_threads(0);
+    parallel::set_grain_size(1 << 15);
+  };
+};
+
+TEST_F(ParallelTest, parallelForTest) {
+  std::vector<int> hits(1000, 0);
+  parallel::parallel_for(0, hits.size(), [&hits](size_t b, size_t e) {
+    for (size_t i = b; i < e; i++) hits[i]++;
+  });
+  for (const auto h : hits) EXPECT_EQ(h, 1);
+}
+
+TEST_F(ParallelTest, broadcastKernelTest) {
+  nc::NdArray<double> a(40, 30);
+  for (nc::uint32 i = 0; i < a.size(); i++) a[i] = 0.01 * i;
+  nc::NdArray<double> row(1, 30), col(40, 1);
+  for (nc::uint32 i = 0; i < 30; i++) row[i] = i;
+  for (nc::uint32 i = 0; i < 40; i++) col[i] = -2.0 * i;
+
+  auto x = as_variable(as_array(a));
+  auto y = F::sin(x) * as_variable(as_array(row)) - as_variable(as_array(col));
+  for (nc::uint32 r = 0; r < 40; r++) {
+    for (nc::uint32 c = 0; c < 30; c++) {
+      EXPECT_DOUBLE_EQ((*y->data)(r, c), std::sin(a(r, c)) * c + 2.0 * r);
+    }
+  }
+}
+
+TEST_F(ParallelTest, reduceKernelTest) {
+  // 細長い・横長の両方で部分和の分割が起きる大きさ
+  for (const auto shape : {nc::Shape(97, 3), nc::Shape(5, 301)}) {
+    nc::NdArray<double> a(shape);
+    for (nc::uint32 i = 0; i < a.size(); i++) a[i] = 0.5 * i - 7.0;
+    auto rows = kernels::sum(a, nc::Axis::ROW);
+    auto cols = kernels::sum(a, nc::Axis::COL);
+    auto all = kernels::sum(a, nc::Axis::NONE);
+    EXPECT_EQ(rows.shape(), nc::Shape(1, shape.cols));
+    EXPECT_EQ(cols.shape(), nc::Shape(shape.rows, 1));
+    EXPECT_EQ(all.shape(), nc::Shape(1, 1));
+    EXPECT_TRUE(nc::allclose(rows, nc::sum(a, nc::Axis::ROW)));
+    EXPECT_TRUE(nc::allclose(cols, nc::sum(a, nc::Axis::COL).transpose()));
+    EXPECT_NEAR(all[0], nc::sum(a)[0], 1e-9);
+    EXPECT_TRUE(nc::allclose(kernels::broadcast_to(rows, shape),
+                             nc::ones<double>(shape.rows, 1).dot(rows)));
+  }
+}
+
+TEST_F(ParallelTest, sumKeepdimsTest) {
+  auto x = as_variable(as_array(nc::NdArray<double>(3, 4).fill(1.0)));
+  auto y = F::sum(x, nc::Axis::COL);
+  EXPECT_EQ(y->shape(), nc::Shape(3, 1));
+  EXPECT_DOUBLE_EQ((*y->data)[2], 4.0);
+  y->backward();
+  EXPECT_TRUE(nc::allclose(*x->grad->data, *x->data));
+}
@@ -0,0 +1,164 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "NumCpp.hpp"
+#include "dezero.h"
+
+class QuantizeTest : public ::testing::Test {
+ protected:
+  virtual void SetUp(){};
+  virtual void TearDown() {
+    parallel::set_num_threads(0);
+    parallel::set_grain_size(1 << 15);
+  };
+};
+
+nc::NdArray<double> quantize_test_input(size_t rows, size_t cols,
+                                        double phase) {
+  nc::NdArray<double> x(rows, cols);
+  for (size_t i = 0; i < x.size(); i++) {
+    x[i] = std::sin(0.37 * i + phase);
+  }
+  return x;
+}
+
+// 命令セットによらず整数の積和と完全に一致する
+TEST_F(QuantizeTest, gemmTest) {
+  // Kはブロックの境界をまたがず、nは4の倍数でもブロックの倍数でもない
+  const size_t m = 5, n = 71, k = 100;
+  const size_t ldk = quant::aligned(k);
+  ASSERT_EQ(ldk, 128);
+  std::vector<int8_t> a(m * ldk, 0), b(n * ldk, 0);
+  std::vector<int32_t> sums(n, 0);
+  for (size_t i = 0; i < m; i++) {
+    for (size_t p = 0; p < k; p++) {
+      a[i * ldk + p] = (i * 31 + p * 7) % 255 - 127;
+    }
+  }
+  for (size_t j = 0; j < n; j++) {
+    for (size_t p = 0; p < k; p++) {
+      b[j * ldk + p] = (j * 13 + p * 5) % 255 - 127;
+      sums[j] += b[j * ldk + p];
+    }
+  }
+  parallel::set_num_threads(3);
+  parallel::set_grain_size(1);
+  std::vector<int32_t> c(m * n);
+  quant::gemm_s8(a.data(), b.data(), sums.data(), c.data(), m, n, ldk);
+  for (size_t i = 0; i < m; i++) {
+    for (size_t j = 0; j < n; j++) {
+      int32_t expected = 0;
+      for (size_t p = 0; p < k; p++) {
+        expected += a[i * ldk + p] * b[j * ldk + p];
+      }
+      ASSERT_EQ(c[i * n + j], expected) << i << ", " << j;
+    }
+  }
+}
+
+// 端の値（±127だけの行、負の値）と、ブロックや4行の組に満たない端数
+// SIMD版（dezero_unittest_avx2 / _native）ではスカラーの積和と比べることになる
+TEST_F(QuantizeTest, gemmEdgeTest) {
+  const size_t m = 4, k = 200;
+  const size_t ldk = quant::aligned(k);
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<int> dist(-127, 127);
+  std::vector<int8_t> a(m * ldk, 0);
+  for (size_t i = 0; i < m; i++) {
+    for (size_t p = 0; p < k; p++) {
+      // 0行目は127、1行目は-127、残りは乱数
+      a[i * ldk + p] = i == 0 ? 127 : i == 1 ? -127 : dist(rng);
+    }
+  }
+  parallel::set_num_threads(3);
+  parallel::set_grain_size(1);
+  for (size_t n : {1, 3, 4, 5, 63, 64, 65, 131}) {
+    std::vector<int8_t> b(n * ldk, 0);
+    std::vector<int32_t> sums(n, 0);
+    for (size_t j = 0; j < n; j++) {
+      for (size_t p = 0; p < k; p++) {
+        // 0行目は-127、1行目は127、残りは乱数
+        const int v = j == 0 ? -127 : j == 1 ? 127 : dist(rng);
+        b[j * ldk + p] = v;
+        sums[j] += v;
+      }
+    }
+    std::vector<int32_t> c(m * n);
+    quant::gemm_s8(a.data(), b.data(), sums.data(), c.data(), m, n, ldk);
+    for (size_t i = 0; i < m; i++) {
+      for (size_t j = 0; j < n; j++) {
+        int32_t expected = 0;
+        for (size_t p = 0; p < ldk; p++) {
+          expected += a[i * ldk + p] * b[j * ldk + p];
+        }
+        ASSERT_EQ(c[i * n + j], expected)
+            << quant::isa() << ": n = " << n << ", " << i << ", " << j;
+      }
+    }
+  }
+  EXPECT_THROW(quant::gemm_s8(a.data(), a.data(), nullptr, nullptr, 1, 1, k),
+               std::invalid_argument);
+}
+
+TEST_F(QuantizeTest, weightTest) {
+  // 列ごとに大きさが1000倍違っても、小さい列が0に潰れない
+  auto W = quantize_test_input(30, 4, 0.0);
+  for (nc::uint32 i = 0; i < 30; i++) W(i, 3) *= 1e-3;
+  quant::QuantizedWeight qW(W);
+  EXPECT_EQ(qW.ldk(), 64);
+  auto restored = qW.dequantize();
+  for (nc::uint32 j = 0; j < 4; j++) {
+    double max_abs = 0.0;
+    for (nc::uint32 i = 0; i < 30; i++) {
+      max_abs = std::max(max_abs, std::abs(W(i, j)));
+      // 誤差は列のscaleの半分以下
+      EXPECT_LE(std::abs(restored(i, j) - W(i, j)),
+                0.5 * qW.scales()[j] + 1e-15);
+    }
+    EXPECT_DOUBLE_EQ(qW.scales()[j], max_abs / 127.0);
+  }
+}
+
+// 倍精度の行列積とほぼ一致する
+TEST_F(QuantizeTest, quantizedLinearTest) {
+  auto W = quantize_test_input(200, 30, 1.0) * 0.1;
+  auto b = quantize_test_input(1, 30, 2.0);
+  auto qW = std::make_shared<const quant::QuantizedWeight>(W);
+  auto x = quantize_test_input(8, 200, 3.0);
+
+  quant::Calibrator calib;
+  calib.observe(quantize_test_input(16, 200, 0.5));
+  EXPECT_NEAR(calib.scale(), 1.0 / 127.0, 1e-4);
+
+  auto mode = no_grad();
+  auto expected = x.dot(W) + b;
+  auto y = F::quantized_linear(as_variable(as_array(x)), qW,
+                               as_variable(as_array(b)), calib.scale());
+  ASSERT_EQ(y->shape(), expected.shape());
+  double err = 0.0;
+  double norm = 0.0;
+  for (size_t i = 0; i < expected.size(); i++) {
+    err += std::pow((*y->data)[i] - expected[i], 2);
+    norm += std::pow(expected[i], 2);
+  }
+  EXPECT_LT(std::sqrt(err / norm), 0.01);
+
+  // 動的量子化（scaleを渡さない）でもほぼ一致する
+  auto yd = F::quantized_matmul(as_variable(as_array(x)), qW);
+  EXPECT_TRUE(nc::allclose(*yd->data, x.dot(W), 0.05));
+
+  EXPECT_THROW(F::quantized_matmul(as_variable(as_array(W)), qW),
+               std::invalid_argument);
+}
+
+TEST_F(QuantizeTest, inferenceOnlyTest) {
+  auto qW = std::make_shared<const quant::QuantizedWeight>(
+      quantize_test_input(3, 2, 0.0));
+  auto x = as_variable(as_array(quantize_test_input(2, 3, 1.0)));
+  auto y = F::quantized_matmul(x, qW);
+  EXPECT_THROW(y->backward(), std::logic_error);
+}
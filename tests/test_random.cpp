@@ -0,0 +1,115 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <vector>
+
+#include "NumCpp.hpp"
+#include "dezero.h"
+
+class RandomTest : public ::testing::Test {
+ protected:
+  virtual void SetUp(){};
+  virtual void TearDown() {
+    parallel::set_num_threads(0);
+    parallel::set_grain_size(1 << 15);
+    rng::manual_seed(0);
+  };
+};
+
+// Random123の既知の値
+TEST_F(RandomTest, philoxTest) {
+  EXPECT_EQ(rng::philox4x32(rng::Counter{0, 0, 0, 0}, rng::Key{0, 0}),
+            (rng::Counter{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}));
+  EXPECT_EQ(
+      rng::philox4x32(
+          rng::Counter{0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff},
+          rng::Key{0xffffffff, 0xffffffff}),
+      (rng::Counter{0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd}));
+  EXPECT_EQ(
+      rng::philox4x32(
+          rng::Counter{0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344},
+          rng::Key{0xa4093822, 0x299f31d0}),
+      (rng::Counter{0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}));
+}
+
+// スレッド数・チャンクの分け方によらず同じ値になる
+TEST_F(RandomTest, reproducibleTest) {
+  const size_t n = 100003;
+  std::vector<double> serial(n), parallel(n);
+  parallel::set_num_threads(1);
+  rng::normal(serial.data(), n, 42, 5);
+  parallel::set_num_threads(4);
+  parallel::set_grain_size(7);
+  rng::normal(parallel.data(), n, 42, 5);
+  EXPECT_EQ(serial, parallel);
+
+  // offsetをずらすと、同じブロックから作った要素が一致する
+  std::vector<double> shifted(n - 4);
+  rng::normal(shifted.data(), shifted.size(), 42, 7);
+  EXPECT_TRUE(std::equal(shifted.begin(), shifted.end(), serial.begin() + 4));
+
+  // 平均と分散
+  double mean = 0.0;
+  double var = 0.0;
+  for (double v : serial) mean += v / n;
+  for (double v : serial) var += (v - mean) * (v - mean) / n;
+  EXPECT_NEAR(mean, 0.0, 0.02);
+  EXPECT_NEAR(var, 1.0, 0.02);
+
+  std::vector<double> u(n);
+  rng::uniform(u.data(), n, 42, 0, -1.0, 3.0);
+  mean = 0.0;
+  for (double v : u) {
+    ASSERT_GE(v, -1.0);
+    ASSERT_LT(v, 3.0);
+    mean += v / n;
+  }
+  EXPECT_NEAR(mean, 1.0, 0.02);
+}
+
+TEST_F(RandomTest, generatorTest) {
+  rng::Generator generator(7);
+  auto a = generator.uniform(nc::Shape(3, 5));
+  EXPECT_EQ(generator.offset(), rng::blocks_uniform(15));
+  // 続けて呼ぶと別の値になる
+  auto b = generator.uniform(nc::Shape(3, 5));
+  EXPECT_FALSE(nc::allclose(a, b));
+  // seedを設定し直すと先頭から同じ値になる
+  generator.manual_seed(7);
+  EXPECT_TRUE(nc::allclose(generator.uniform(nc::Shape(3, 5)), a, 0.0));
+  generator.manual_seed(8);
+  EXPECT_FALSE(nc::allclose(generator.uniform(nc::Shape(3, 5)), a));
+}
+
+TEST_F(RandomTest, dropoutTest) {
+  rng::manual_seed(123);
+  const double ratio = 0.3;
+  auto x = as_variable(as_array(nc::NdArray<double>(200, 500).fill(2.0)));
+  auto y = F::dropout(x, ratio);
+  size_t dropped = 0;
+  for (size_t i = 0; i < y->data->size(); i++) {
+    const double v = (*y->data)[i];
+    if (v == 0.0) {
+      dropped++;
+    } else {
+      ASSERT_DOUBLE_EQ(v, 2.0 / (1.0 - ratio));
+    }
+  }
+  EXPECT_NEAR(static_cast<double>(dropped) / y->data->size(), ratio, 0.01);
+
+  // 逆伝播はマスクを保存せずに作り直すが、同じ要素が0になる
+  y->backward();
+  EXPECT_TRUE(nc::allclose(*x->grad->data, *y->data / 2.0, 0.0));
+
+  // 次の呼び出しは別のマスク
+  auto y2 = F::dropout(x, ratio);
+  EXPECT_FALSE(nc::allclose(*y2->data, *y->data));
+
+  // 推論時は何もしない
+  {
+    auto mode = test_mode();
+    auto z = F::dropout(x, ratio);
+    EXPECT_TRUE(nc::allclose(*z->data, *x->data, 0.0));
+  }
+  EXPECT_THROW(F::dropout(x, 1.0), std::invalid_argument);
+}
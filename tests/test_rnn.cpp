@@ -0,0 +1,171 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <functional>
+#include <vector>
+
+#include "NumCpp.hpp"
+#include "dezero.h"
+
+class RnnTest : public ::testing::Test {
+ protected:
+  virtual void SetUp(){};
+  virtual void TearDown(){};
+};
+
+VarPtr rnn_test_input(size_t rows, size_t cols, double phase,
+                      double scale = 1.0) {
+  nc::NdArray<double> x(rows, cols);
+  for (size_t i = 0; i < x.size(); i++) {
+    x[i] = scale * std::sin(0.37 * i + phase);
+  }
+  return as_variable(as_array(x));
+}
+
+// 列[begin, end)（基本関数だけで組む）
+VarPtr rnn_test_cols(const VarPtr& a, size_t begin, size_t end) {
+  return F::transpose(F::get_item(F::transpose(a), begin, end));
+}
+
+// 基本関数で組んだLSTM
+std::pair<VarPtr, VarPtr> lstm_reference(const VarPtr& x, const VarPtr& h,
+                                         const VarPtr& c, const VarPtr& W,
+                                         const VarPtr& b) {
+  const size_t nx = x->shape().cols;
+  const size_t nh = h->shape().cols;
+  auto a = F::matmul(x, F::get_item(W, 0, nx)) +
+           F::matmul(h, F::get_item(W, nx, nx + nh)) + b;
+  auto i = F::sigmoid(rnn_test_cols(a, 0, nh));
+  auto f = F::sigmoid(rnn_test_cols(a, nh, 2 * nh));
+  auto g = F::tanh(rnn_test_cols(a, 2 * nh, 3 * nh));
+  auto o = F::sigmoid(rnn_test_cols(a, 3 * nh, 4 * nh));
+  auto c2 = f * c + i * g;
+  return {o * F::tanh(c2), c2};
+}
+
+// 基本関数で組んだGRU
+VarPtr gru_reference(const VarPtr& x, const VarPtr& h, const VarPtr& Wx,
+                     const VarPtr& Wh, const VarPtr& bx, const VarPtr& bh) {
+  const size_t nh = h->shape().cols;
+  auto ax = F::matmul(x, Wx) + bx;
+  auto ah = F::matmul(h, Wh) + bh;
+  auto r = F::sigmoid(rnn_test_cols(ax, 0, nh) + rnn_test_cols(ah, 0, nh));
+  auto z = F::sigmoid(rnn_test_cols(ax, nh, 2 * nh) +
+                      rnn_test_cols(ah, nh, 2 * nh));
+  auto n = F::tanh(rnn_test_cols(ax, 2 * nh, 3 * nh) +
+                   r * rnn_test_cols(ah, 2 * nh, 3 * nh));
+  return (1.0 - z) * n + z * h;
+}
+
+void expect_close(const VarPtr& a, const VarPtr& b, double tol = 1e-12) {
+  ASSERT_EQ(a->shape(), b->shape());
+  for (size_t i = 0; i < a->data->size(); i++) {
+    EXPECT_NEAR((*a->data)[i], (*b->data)[i], tol) << i;
+  }
+}
+
+struct LstmTestCase {
+  const size_t n = 3, nx = 5, nh = 4;
+  VarPtr x = rnn_test_input(n, nx, 0.0);
+  VarPtr h = rnn_test_input(n, nh, 1.0);
+  VarPtr c = rnn_test_input(n, nh, 2.0);
+  VarPtr W = rnn_test_input(nx + nh, 4 * nh, 3.0, 0.5);
+  VarPtr b = rnn_test_input(1, 4 * nh, 4.0, 0.5);
+  // 出力の重み（損失 = sum(h' * u) + F::sum(c' * v)）
+  VarPtr u = rnn_test_input(n, nh, 5.0);
+  VarPtr v = rnn_test_input(n, nh, 6.0);
+  std::vector<VarPtr> inputs() const { return {x, h, c, W, b}; }
+};
+
+TEST_F(RnnTest, lstmCellTest) {
+  LstmTestCase t;
+  auto [h2, c2] = F::lstm_cell(t.x, t.h, t.c, t.W, t.b);
+  auto [rh, rc] = lstm_reference(t.x, t.h, t.c, t.W, t.b);
+  expect_close(h2, rh);
+  expect_close(c2, rc);
+
+  auto gs = grad({F::sum(h2 * t.u) + F::sum(c2 * t.v)}, t.inputs());
+  auto rs = grad({F::sum(rh * t.u) + F::sum(rc * t.v)}, t.inputs());
+  for (size_t k = 0; k < gs.size(); k++) expect_close(gs[k], rs[k]);
+
+  EXPECT_THROW(F::lstm_cell(t.x, t.h, t.c, t.b, t.b), std::invalid_argument);
+}
+
+TEST_F(RnnTest, unusedOutputTest) {
+  // c'を捨ててもh'から逆伝播できる（c'の勾配はnullptrとして渡る）
+  LstmTestCase t;
+  auto h2 = F::lstm_cell(t.x, t.h, t.c, t.W, t.b).first;
+  F::sum(h2)->backward();
+  auto rh = lstm_reference(t.x, t.h, t.c, t.W, t.b).first;
+  auto rs = grad({F::sum(rh)}, t.inputs());
+  auto inputs = t.inputs();
+  for (size_t k = 0; k < inputs.size(); k++) {
+    expect_close(inputs[k]->grad, rs[k]);
+  }
+}
+
+TEST_F(RnnTest, gruCellTest) {
+  const size_t n = 3, nx = 5, nh = 4;
+  auto x = rnn_test_input(n, nx, 0.0);
+  auto h = rnn_test_input(n, nh, 1.0);
+  auto Wx = rnn_test_input(nx, 3 * nh, 2.0, 0.5);
+  auto Wh = rnn_test_input(nh, 3 * nh, 3.0, 0.5);
+  auto bx = rnn_test_input(1, 3 * nh, 4.0, 0.5);
+  auto bh = rnn_test_input(1, 3 * nh, 5.0, 0.5);
+  auto u = rnn_test_input(n, nh, 6.0);
+  std::vector<VarPtr> inputs = {x, h, Wx, Wh, bx, bh};
+
+  auto y = F::gru_cell(x, h, Wx, Wh, bx, bh);
+  auto ry = gru_reference(x, h, Wx, Wh, bx, bh);
+  expect_close(y, ry);
+  auto gs = grad({F::sum(y * u)}, inputs);
+  auto rs = grad({F::sum(ry * u)}, inputs);
+  for (size_t k = 0; k < gs.size(); k++) expect_close(gs[k], rs[k]);
+
+  // 二階微分（create_graphでは基本関数で組み直す）
+  auto gx = grad(F::sum(y * u), x, true);
+  auto rgx = grad(F::sum(ry * u), x, true);
+  expect_close(gx, rgx);
+  auto gg = grad({F::sum(gx * gx)}, {Wh, h});
+  auto rgg = grad({F::sum(rgx * rgx)}, {Wh, h});
+  for (size_t k = 0; k < gg.size(); k++) expect_close(gg[k], rgg[k], 1e-10);
+}
+
+TEST_F(RnnTest, lstmDoubleBackwardTest) {
+  LstmTestCase t;
+  auto [h2, c2] = F::lstm_cell(t.x, t.h, t.c, t.W, t.b);
+  auto [rh, rc] = lstm_reference(t.x, t.h, t.c, t.W, t.b);
+  auto gx = grad(F::sum(h2 * t.u) + F::sum(c2 * t.v), t.x, true);
+  auto rgx = grad(F::sum(rh * t.u) + F::sum(rc * t.v), t.x, true);
+  expect_close(gx, rgx);
+  auto gg = grad({F::sum(gx * gx)}, {t.W, t.c});
+  auto rgg = grad({F::sum(rgx * rgx)}, {t.W, t.c});
+  for (size_t k = 0; k < gg.size(); k++) expect_close(gg[k], rgg[k], 1e-10);
+}
+
+TEST_F(RnnTest, jvpTest) {
+  // 中心差分と比べる
+  LstmTestCase t;
+  auto Wx = rnn_test_input(t.nx, 3 * t.nh, 7.0, 0.5);
+  auto Wh = rnn_test_input(t.nh, 3 * t.nh, 8.0, 0.5);
+  auto bx = rnn_test_input(1, 3 * t.nh, 9.0, 0.5);
+  auto bh = rnn_test_input(1, 3 * t.nh, 10.0, 0.5);
+  std::vector<std::function<VarPtr(const VarPtr&)>> cells = {
+      [&](const VarPtr& x) {
+        auto [h2, c2] = F::lstm_cell(x, t.h, t.c, t.W, t.b);
+        return h2 + c2 * 2.0;
+      },
+      [&](const VarPtr& x) { return F::gru_cell(x, t.h, Wx, Wh, bx, bh); }};
+  auto v = rnn_test_input(t.n, t.nx, 11.0)->data.get();
+  const double eps = 1e-6;
+  for (const auto& f : cells) {
+    auto [y, ty] = jvp(f, t.x, v);
+    auto mode = no_grad();
+    auto yp = f(as_variable(as_array(*t.x->data + *v * eps)));
+    auto ym = f(as_variable(as_array(*t.x->data - *v * eps)));
+    for (size_t i = 0; i < ty->size(); i++) {
+      const double fd = ((*yp->data)[i] - (*ym->data)[i]) / (2 * eps);
+      EXPECT_NEAR((*ty)[i], fd, 1e-7) << i;
+    }
+  }
+}
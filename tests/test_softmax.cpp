@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+
+#include "NumCpp.hpp"
+#include "dezero.h"
+
+class SoftmaxTest : public ::testing::Test {
+ protected:
+  virtual void SetUp(){};
+  virtual void TearDown(){};
+};
+
+// 列数がlog-sum-expのブロック（256）をまたぐ入力
+nc::NdArray<double> softmax_test_input(size_t rows, size_t cols,
+                                       double scale) {
+  nc::NdArray<double> x(rows, cols);
+  for (size_t i = 0; i < x.size(); i++) {
+    x[i] = scale * std::sin(0.37 * i + 1.0);
+  }
+  return x;
+}
+
+// 基本の関数を組み合わせたsoftmax
+VarPtr naive_softmax(const VarPtr& x) {
+  auto e = F::exp(x);
+  return e / F::sum(e, nc::Axis::COL);
+}
+
+TEST_F(SoftmaxTest, softmaxTest) {
+  auto x = as_variable(as_array(softmax_test_input(3, 600, 4.0)));
+  auto w = as_variable(as_array(softmax_test_input(3, 600, 1.0) * 0.5));
+  auto y = F::softmax(x);
+  auto expected = naive_softmax(x);
+  EXPECT_TRUE(nc::allclose(*y->data, *expected->data, 1e-12));
+
+  F::sum(y * w)->backward();
+  auto gx = *x->grad->data;
+  x->cleargrad();
+  F::sum(expected * w)->backward();
+  EXPECT_TRUE(nc::allclose(gx, *x->grad->data, 1e-12));
+
+  // 2階微分も基本の関数の組み合わせと一致する
+  auto g = grad(F::sum(F::softmax(x) * w), x, true);
+  auto hv = grad(F::sum(g * w), x);
+  auto g_naive = grad(F::sum(naive_softmax(x) * w), x, true);
+  auto hv_naive = grad(F::sum(g_naive * w), x);
+  EXPECT_TRUE(nc::allclose(*hv->data, *hv_naive->data, 1e-10));
+
+  // expがオーバーフローする大きさでも最大値を引くので計算できる
+  auto big = F::softmax(as_variable(as_array({{1000.0, 1000.0, 0.0}})));
+  EXPECT_NEAR((*big->data)[0], 0.5, 1e-15);
+  EXPECT_NEAR((*big->data)[2], 0.0, 1e-15);
+}
+
+TEST_F(SoftmaxTest, crossEntropyTest) {
+  const size_t rows = 4;
+  const size_t cols = 300;
+  auto x = as_variable(as_array(softmax_test_input(rows, cols, 3.0)));
+  std::vector<size_t> t = {0, 299, 17, 17};
+  nc::NdArray<double> onehot = nc::zeros<double>(rows, cols);
+  for (size_t r = 0; r < rows; r++) onehot(r, t[r]) = 1.0;
+
+  auto loss = F::softmax_cross_entropy(x, t);
+  ASSERT_EQ(loss->shape(), nc::Shape(1, 1));
+  auto p = naive_softmax(x);
+  double expected = 0.0;
+  for (size_t r = 0; r < rows; r++) {
+    expected -= std::log((*p->data)(r, t[r]));
+  }
+  EXPECT_NEAR((*loss->data)[0], expected / rows, 1e-12);
+
+  // 勾配は(softmax - onehot) / N
+  loss->backward();
+  auto expected_grad = (*p->data - onehot) / static_cast<double>(rows);
+  EXPECT_TRUE(nc::allclose(*x->grad->data, expected_grad, 1e-12));
+
+  // 2階微分
+  auto w = as_variable(as_array(softmax_test_input(rows, cols, 1.0)));
+  auto g = grad(F::softmax_cross_entropy(x, t), x, true);
+  auto hv = grad(F::sum(g * w), x);
+  // log-sum-expを基本の関数で書いたもの
+  auto naive_loss = (F::sum(F::log(F::sum(F::exp(x), nc::Axis::COL))) -
+                     F::sum(x * as_variable(as_array(onehot)))) /
+                    static_cast<double>(rows);
+  auto g_naive = grad(naive_loss, x, true);
+  auto hv_naive = grad(F::sum(g_naive * w), x);
+  EXPECT_TRUE(nc::allclose(*hv->data, *hv_naive->data, 1e-10));
+
+  // ラベルが列数を超える・行数と合わない
+  EXPECT_THROW(F::softmax_cross_entropy(x, {0, 1, 2, 300}), std::out_of_range);
+  EXPECT_THROW(F::softmax_cross_entropy(x, {0}), std::invalid_argument);
+}
+
+// 大きなロジットでもinf/NaNにならない
+TEST_F(SoftmaxTest, stableTest) {
+  auto x = as_variable(as_array({{1000.0, -1000.0}, {-800.0, 800.0}}));
+  auto loss = F::softmax_cross_entropy(x, {1, 1});
+  // 行0は-log(exp(-2000)) = 2000、行1は0
+  EXPECT_NEAR((*loss->data)[0], 1000.0, 1e-9);
+  loss->backward();
+  EXPECT_TRUE(nc::allclose(*x->grad->data,
+                           nc::NdArray<double>{{0.5, -0.5}, {0.0, 0.0}}));
+}
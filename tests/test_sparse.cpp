@@ -0,0 +1,154 @@
+#include <gtest/gtest.h>
+
+#include "NumCpp.hpp"
+#include "dezero.h"
+
+class SparseTest : public ::testing::Test {
+ protected:
+  virtual void SetUp(){};
+  virtual void TearDown(){};
+};
+
+// 4x5で、列1と列3にだけ非零要素がある
+sparse::CSRPtr sparse_test_matrix() {
+  sparse::COO coo(4, 5);
+  coo.add(2, 3, 1.5);
+  coo.add(0, 1, 2.0);
+  coo.add(3, 1, -1.0);
+  coo.add(0, 3, 0.5);
+  // 同じ位置は足される
+  coo.add(2, 3, 0.25);
+  return sparse::as_csr(sparse::CSR(coo));
+}
+
+TEST_F(SparseTest, csrTest) {
+  auto x = sparse_test_matrix();
+  EXPECT_EQ(x->nnz(), 4);
+  EXPECT_EQ(x->indptr(), (std::vector<size_t>{0, 2, 2, 3, 4}));
+  EXPECT_EQ(x->indices(), (std::vector<size_t>{1, 3, 3, 1}));
+  nc::NdArray<double> expected = {{0.0, 2.0, 0.0, 0.5, 0.0},
+                                  {0.0, 0.0, 0.0, 0.0, 0.0},
+                                  {0.0, 0.0, 0.0, 1.75, 0.0},
+                                  {0.0, -1.0, 0.0, 0.0, 0.0}};
+  EXPECT_TRUE(nc::allclose(x->to_dense(), expected));
+  EXPECT_TRUE(
+      nc::allclose(sparse::CSR::from_dense(expected).to_dense(), expected));
+  EXPECT_TRUE(nc::allclose(x->transpose().to_dense(), expected.transpose()));
+
+  // 行の中の列番号が昇順でない
+  EXPECT_THROW(sparse::CSR(1, 3, {0, 2}, {2, 0}, {1.0, 1.0}),
+               std::invalid_argument);
+  EXPECT_THROW(sparse::CSR(1, 3, {0, 1}, {3}, {1.0}), std::invalid_argument);
+}
+
+// 密な行列積と同じ値・勾配になる
+TEST_F(SparseTest, matmulTest) {
+  auto x = sparse_test_matrix();
+  auto W = as_variable(as_array({{0.1, -0.2, 0.3},
+                                 {0.4, 0.5, -0.6},
+                                 {0.7, 0.8, 0.9},
+                                 {-1.0, 1.1, 1.2},
+                                 {1.3, -1.4, 1.5}}));
+  auto y = F::sparse_matmul(x, W);
+  auto expected = F::matmul(as_variable(as_array(x->to_dense())), W);
+  EXPECT_TRUE(nc::allclose(*y->data, *expected->data));
+
+  auto gy = as_array({{1.0, 2.0, -1.0},
+                      {0.5, 0.5, 0.5},
+                      {-2.0, 1.0, 3.0},
+                      {0.0, 1.0, 2.0}});
+  y->grad = as_variable(gy);
+  y->backward();
+  auto gW = *W->grad->data;
+  W->cleargrad();
+  expected->grad = as_variable(gy);
+  expected->backward();
+  EXPECT_TRUE(nc::allclose(gW, *W->grad->data));
+
+  // 2階微分: sum((xW)^2)のWについてのヘッセ行列とvの積は2 x^T x v
+  W->cleargrad();
+  auto v = as_array(nc::ones<double>(5, 3));
+  auto g = grad(F::sum(pow(F::sparse_matmul(x, W), 2)), W, true);
+  auto hv = grad(F::sum(g * as_variable(v)), W);
+  auto xd = x->to_dense();
+  EXPECT_TRUE(nc::allclose(*hv->data, xd.transpose().dot(xd).dot(*v) * 2.0));
+}
+
+// 勾配は触れた行（xの非零要素のある列）だけになる
+TEST_F(SparseTest, sparseGradTest) {
+  auto x = sparse_test_matrix();
+  auto W = as_variable(as_array(nc::ones<double>(5, 2)));
+  auto dense = F::matmul(as_variable(as_array(x->to_dense())), W);
+  F::sum(dense)->backward();
+  auto expected = *W->grad->data * 2.0;
+  W->cleargrad();
+
+  for (int i = 0; i < 2; i++) {
+    F::sum(F::sparse_matmul(x, W, true))->backward();
+  }
+  EXPECT_FALSE(W->grad);
+  ASSERT_TRUE(W->sparse_grad);
+  EXPECT_EQ(W->sparse_grad->rows(), (std::vector<size_t>{1, 3}));
+  EXPECT_TRUE(nc::allclose(W->sparse_grad->to_dense(), expected));
+
+  // 触れた行だけ更新する
+  auto w = *W->data;
+  W->sparse_grad->add_to(w, -0.1);
+  EXPECT_TRUE(nc::allclose(w, *W->data - expected * 0.1));
+
+  W->cleargrad();
+  EXPECT_FALSE(W->sparse_grad);
+}
+
+TEST_F(SparseTest, getItemTest) {
+  auto x = as_variable(as_array({{1.0, 2.0}, {3.0, 4.0}, {5.0, 6.0}}));
+  // 連続した範囲はxのデータをそのまま参照する
+  auto y = F::get_item(x, 1, 3);
+  EXPECT_EQ(y->data->data(), x->data->data() + 2);
+  EXPECT_TRUE(
+      nc::allclose(*y->data, nc::NdArray<double>{{3.0, 4.0}, {5.0, 6.0}}));
+
+  // 重複した行の勾配は足される
+  auto z = F::get_item(x, {2, 0, 2});
+  EXPECT_TRUE(nc::allclose(
+      *z->data, nc::NdArray<double>{{5.0, 6.0}, {1.0, 2.0}, {5.0, 6.0}}));
+  F::sum(z * as_variable(as_array({{1.0, 2.0}, {3.0, 4.0}, {5.0, 6.0}})))
+      ->backward();
+  EXPECT_TRUE(nc::allclose(
+      *x->grad->data,
+      nc::NdArray<double>{{3.0, 4.0}, {0.0, 0.0}, {6.0, 8.0}}));
+  EXPECT_THROW(F::get_item(x, {3}), std::out_of_range);
+
+  // 2階微分: sum(get_item(x)^3)のヘッセ行列とvの積
+  x->cleargrad();
+  auto g = grad(F::sum(pow(F::get_item(x, {0, 0, 1}), 3)), x, true);
+  auto hv = grad(F::sum(g), x);
+  // 行0は2回引かれるので2 * 6x、行1は6x、行2は0
+  EXPECT_TRUE(nc::allclose(
+      *hv->data, nc::NdArray<double>{{12.0, 24.0}, {18.0, 24.0}, {0.0, 0.0}}));
+}
+
+// 埋め込み表の勾配は引いた行だけ
+TEST_F(SparseTest, embeddingTest) {
+  auto W = as_variable(as_array(nc::NdArray<double>(1000, 3).fill(0.5)));
+  std::vector<size_t> ids = {7, 999, 7, 3, 7};
+  // 行kの重みはk + 1
+  nc::NdArray<double> w(5, 3);
+  for (nc::uint32 k = 0; k < 5; k++) {
+    for (nc::uint32 j = 0; j < 3; j++) w(k, j) = k + 1.0;
+  }
+  F::sum(F::embedding(W, ids) * as_variable(as_array(w)))->backward();
+  EXPECT_FALSE(W->grad);
+  ASSERT_TRUE(W->sparse_grad);
+  EXPECT_EQ(W->sparse_grad->rows(), (std::vector<size_t>{3, 7, 999}));
+  EXPECT_TRUE(nc::allclose(W->sparse_grad->values(),
+                           nc::NdArray<double>{{4.0, 4.0, 4.0},
+                                               {9.0, 9.0, 9.0},
+                                               {2.0, 2.0, 2.0}}));
+
+  // 密な勾配と一致する
+  auto dense = W->sparse_grad->to_dense();
+  W->cleargrad();
+  F::sum(F::embedding(W, ids, false) * as_variable(as_array(w)))->backward();
+  EXPECT_TRUE(nc::allclose(*W->grad->data, dense));
+}
@@ -0,0 +1,96 @@
+#include <gtest/gtest.h>
+
+#include <future>
+
+#include "NumCpp.hpp"
+#include "dezero.h"
+
+class StreamTest : public ::testing::Test {
+ protected:
+  virtual void SetUp(){};
+  virtual void TearDown(){};
+};
+
+// openが値を持つまで順伝播を止める恒等関数
+class Gate : public Function {
+ public:
+  explicit Gate(std::shared_future<void> open) : open_(std::move(open)) {}
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override {
+    open_.wait();
+    return {xs[0]};
+  }
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override {
+    return gy;
+  }
+
+ private:
+  std::shared_future<void> open_;
+};
+
+class Fail : public Function {
+ public:
+  std::vector<NdArrPtr> forward(const std::vector<NdArrPtr>& xs) override {
+    throw std::runtime_error("fail");
+  }
+  std::vector<VarPtr> backward(const std::vector<VarPtr>& gy) override {
+    return gy;
+  }
+};
+
+VarPtr stream_test_f(const VarPtr& x0, const VarPtr& x1) {
+  auto a = F::sin(x0) * x1;
+  return F::sum(a / (x1 + 2.0) - pow(a, 2));
+}
+
+TEST_F(StreamTest, matchesSyncTest) {
+  auto x0 = as_variable(as_array({0.5, -1.0, 2.0}));
+  auto x1 = as_variable(as_array({1.5, 0.2, -0.7}));
+  auto y = stream_test_f(x0, x1);
+  y->backward();
+  const auto gx0 = *x0->grad->data;
+  x0->cleargrad();
+  x1->cleargrad();
+
+  VarPtr ya;
+  {
+    stream::Async async_mode;
+    ya = stream_test_f(x0, x1);
+  }
+  // 計算グラフは呼び出し時に繋がっているので、値を待たずにbackwardできる
+  ya->backward();
+  EXPECT_DOUBLE_EQ((*ya->data)[0], (*y->data)[0]);
+  EXPECT_TRUE(nc::allclose(*x0->grad->data, gx0));
+}
+
+TEST_F(StreamTest, overlapTest) {
+  std::promise<void> open;
+  auto x = as_variable(as_array({1.0, 2.0}));
+  VarPtr y, z;
+  {
+    stream::Async async_mode;
+    auto f = std::make_shared<Gate>(open.get_future().share());
+    y = (*f)(x)[0];
+    // 依存する関数も待たずに積める
+    z = y * 3.0;
+  }
+  EXPECT_FALSE(y->data.ready());
+  EXPECT_FALSE(z->data.ready());
+  open.set_value();
+  EXPECT_DOUBLE_EQ((*z->data)[1], 6.0);
+  stream::synchronize();
+  EXPECT_TRUE(y->data.ready());
+}
+
+TEST_F(StreamTest, errorTest) {
+  auto x = as_variable(as_array({1.0}));
+  VarPtr y, z;
+  {
+    stream::Async async_mode;
+    y = (*std::make_shared<Fail>())(x)[0];
+    z = y + 1.0;
+  }
+  // 失敗は値を参照したときと同期したときに投げ直される
+  EXPECT_THROW(*z->data, std::runtime_error);
+  EXPECT_THROW(stream::synchronize(), std::runtime_error);
+  EXPECT_NO_THROW(stream::synchronize());
+}
@@ -0,0 +1,67 @@
+#include <gtest/gtest.h>
+
+#include "NumCpp.hpp"
+#include "dezero.h"
+
+class TapeTest : public ::testing::Test {
+ protected:
+  virtual void SetUp(){};
+  virtual void TearDown(){};
+};
+
+VarPtr tape_test_f(const VarPtr& x0, const VarPtr& x1) {
+  // 同じ変数を複数回使う
+  auto a = F::sin(x0) * x1;
+  auto b = a + pow(a, 2);
+  return F::sum(b / (x1 + 2.0) - a);
+}
+
+TEST_F(TapeTest, matchesBackwardTest) {
+  auto x0 = as_variable(as_array({0.5, -1.0, 2.0}));
+  auto x1 = as_variable(as_array({1.5, 0.2, -0.7}));
+  tape_test_f(x0, x1)->backward();
+  const auto gx0 = *x0->grad->data;
+  const auto gx1 = *x1->grad->data;
+  x0->cleargrad();
+  x1->cleargrad();
+
+  tape::Tape tape;
+  VarPtr y;
+  {
+    tape::Recording rec(tape);
+    y = tape_test_f(x0, x1);
+  }
+  // creator_ptrでは繋がない
+  EXPECT_FALSE(y->creator_ptr);
+  EXPECT_EQ(tape.num_functions(), 8u);
+  tape.backward(y);
+  EXPECT_TRUE(nc::allclose(*x0->grad->data, gx0));
+  EXPECT_TRUE(nc::allclose(*x1->grad->data, gx1));
+
+  // 記録を捨てれば同じテープを使い回せる
+  tape.clear();
+  x0->cleargrad();
+  {
+    tape::Recording rec(tape);
+    y = F::sum(x0 * 3.0);
+  }
+  tape.backward(y);
+  EXPECT_TRUE(nc::allclose(*x0->grad->data, nc::NdArray<double>(1, 3).fill(3)));
+}
+
+TEST_F(TapeTest, createGraphTest) {
+  // 勾配の計算グラフは通常どおり作られるので二階微分できる
+  auto x = as_variable(as_array({2.0}));
+  tape::Tape tape;
+  VarPtr y;
+  {
+    tape::Recording rec(tape);
+    y = pow(x, 4) - 2.0 * pow(x, 2);
+  }
+  tape.backward(y, false, true);
+  auto gx = x->grad;
+  EXPECT_DOUBLE_EQ((*gx->data)[0], 24.0);
+  x->cleargrad();
+  gx->backward();
+  EXPECT_DOUBLE_EQ((*x->grad->data)[0], 44.0);
+}
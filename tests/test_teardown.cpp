@@ -0,0 +1,140 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <tuple>
+
+#include "NumCpp.hpp"
+#include "dezero.h"
+
+class TeardownTest : public ::testing::Test {
+ protected:
+  virtual void SetUp(){};
+  virtual void TearDown(){};
+};
+
+// 再帰的に解放するとスタックが溢れる長さ
+constexpr int kTeardownDepth = 300000;
+
+TEST_F(TeardownTest, deepChainTest) {
+  auto x = as_variable(as_array({1.0}));
+  auto y = x;
+  for (int i = 0; i < kTeardownDepth; i++) y = y + 1.0;
+  EXPECT_DOUBLE_EQ((*y->data)[0], 1.0 + kTeardownDepth);
+  y.reset();
+  // 葉は残る
+  EXPECT_EQ(x.use_count(), 1);
+}
+
+TEST_F(TeardownTest, multiOutputChainTest) {
+  // h、cが1つの関数を共有する鎖（生成元の参照数が2でも再帰しない）
+  auto x = as_variable(as_array({1.0}));
+  nc::NdArray<double> w(2, 4);
+  for (size_t i = 0; i < w.size(); i++) w[i] = 0.1 * (i + 1);
+  auto W = as_variable(as_array(w));
+  auto b = as_variable(as_array({0.0, 0.0, 0.0, 0.0}));
+  auto h = as_variable(as_array({0.0}));
+  auto c = as_variable(as_array({0.0}));
+  std::weak_ptr<Function> first;
+  for (int i = 0; i < kTeardownDepth; i++) {
+    std::tie(h, c) = F::lstm_cell(x, h, c, W, b);
+    if (i == 0) first = h->creator_ptr;
+  }
+  h.reset();
+  EXPECT_FALSE(first.expired());
+  c.reset();
+  EXPECT_TRUE(first.expired());
+  EXPECT_EQ(W.use_count(), 1);
+}
+
+TEST_F(TeardownTest, sharedSubgraphTest) {
+  // 途中の変数が外から参照されていればそこから先は解放しない
+  auto x = as_variable(as_array({1.0}));
+  auto y = x;
+  VarPtr mid;
+  for (int i = 0; i < kTeardownDepth; i++) {
+    y = F::sin(y);
+    if (i == kTeardownDepth / 2) mid = y;
+  }
+  y.reset();
+  ASSERT_TRUE(mid->creator_ptr);
+  mid->backward();
+  EXPECT_TRUE(x->grad);
+}
+
+TEST_F(TeardownTest, asyncReleaseTest) {
+  auto x = as_variable(as_array({1.0}));
+  auto y = x;
+  for (int i = 0; i < kTeardownDepth; i++) y = y * 1.0;
+  std::weak_ptr<Variable> w = y;
+  release_async(std::move(y));
+  EXPECT_FALSE(y);
+  wait_released();
+  EXPECT_TRUE(w.expired());
+}
+
+TEST_F(TeardownTest, unchainTest) {
+  auto x = as_variable(as_array({2.0}));
+  auto y = F::sin(x);
+  std::weak_ptr<Function> f = y->creator_ptr;
+  auto z = y * 3.0;
+  y->unchain();
+  EXPECT_FALSE(y->creator_ptr);
+  EXPECT_TRUE(f.expired());
+  // 逆伝播はyで止まる
+  z->backward();
+  EXPECT_DOUBLE_EQ((*y->grad->data)[0], 3.0);
+  EXPECT_FALSE(x->grad);
+}
+
+TEST_F(TeardownTest, unchainBackwardTest) {
+  // 長い鎖を切っても再帰しない
+  auto x = as_variable(as_array({1.0}));
+  auto y = x;
+  std::weak_ptr<Function> first;
+  for (int i = 0; i < kTeardownDepth; i++) {
+    y = F::sin(y);
+    if (i == 0) first = y->creator_ptr;
+  }
+  auto prev = y->creator_ptr->inputs_[0];
+  std::weak_ptr<Function> last = y->creator_ptr;
+  y->unchain_backward();
+  EXPECT_TRUE(first.expired());
+  EXPECT_FALSE(prev->creator_ptr);
+  EXPECT_FALSE(last.expired());
+  EXPECT_EQ(x.use_count(), 1);
+  // 直前の関数までは逆伝播できる
+  y->backward();
+  EXPECT_DOUBLE_EQ((*prev->grad->data)[0], std::cos((*prev->data)[0]));
+  EXPECT_FALSE(x->grad);
+}
+
+TEST_F(TeardownTest, truncatedBpttTest) {
+  // 窓ごとにlossから切ると、次の窓の勾配は窓の先頭の状態を葉にした場合と一致する
+  auto w = as_variable(as_array({0.9}));
+  auto h = as_variable(as_array({0.5}));
+  auto loss = as_variable(as_array({0.0}));
+  std::weak_ptr<Function> first;
+  for (int t = 0; t < 6; t++) {
+    h = F::tanh(h * w + 0.1);
+    if (t == 0) first = h->creator_ptr;
+    loss = loss + h;
+  }
+  loss->backward();
+  loss->unchain_backward();
+  EXPECT_TRUE(first.expired());
+  EXPECT_FALSE(h->creator_ptr);
+
+  auto h0 = as_variable(as_array(*h->data));
+  auto y = h;
+  auto y0 = h0;
+  for (int t = 0; t < 4; t++) {
+    y = F::tanh(y * w + 0.1);
+    y0 = F::tanh(y0 * w + 0.1);
+  }
+  w->cleargrad();
+  y->backward();
+  const double g = (*w->grad->data)[0];
+  w->cleargrad();
+  y0->backward();
+  EXPECT_DOUBLE_EQ(g, (*w->grad->data)[0]);
+}
@@ -0,0 +1,96 @@
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+
+#include "NumCpp.hpp"
+#include "dezero.h"
+
+class VmapTest : public ::testing::Test {
+ protected:
+  virtual void SetUp(){};
+  virtual void TearDown(){};
+};
+
+// サンプルごとに逆伝播した勾配と一致する
+TEST_F(VmapTest, perSampleGradTest) {
+  nc::NdArray<double> xs = {{1.0, 2.0}, {-0.5, 0.3}, {2.0, -1.0}};
+  nc::NdArray<double> ts = {{0.5, 1.0}, {0.0, -1.0}, {1.5, 2.0}};
+  auto W = as_variable(as_array({{0.1, -0.2}, {0.3, 0.4}}));
+  auto b = as_variable(as_array({0.01, -0.02}));
+  auto s = as_variable(as_array({2.0}));
+
+  auto loss = [&](const VarPtr& x, const VarPtr& t) {
+    auto y = F::tanh(F::matmul(x, W) + b) * s;
+    return F::sum(pow(y - t, 2));
+  };
+
+  auto t = as_variable(as_array(ts));
+  auto gs = vmap::per_sample_grad(
+      [&](const VarPtr& x) { return loss(x, t); }, as_variable(as_array(xs)),
+      {W, b, s});
+
+  for (nc::uint32 n = 0; n < 3; n++) {
+    auto x_n = as_variable(as_array({xs(n, 0), xs(n, 1)}));
+    auto t_n = as_variable(as_array({ts(n, 0), ts(n, 1)}));
+    auto expected = grad({loss(x_n, t_n)}, {W, b, s});
+    for (int k = 0; k < 3; k++) {
+      for (nc::uint32 j = 0; j < expected[k]->size(); j++) {
+        EXPECT_NEAR(gs[k](n, j), (*expected[k]->data)[j], 1e-12);
+      }
+    }
+  }
+  EXPECT_FALSE(W->grad);
+}
+
+TEST_F(VmapTest, restoreOnErrorTest) {
+  // 途中で投げても呼ぶ前の勾配が残る
+  nc::NdArray<double> xs = {{1.0, 2.0}, {-0.5, 0.3}};
+  auto x = as_variable(as_array(xs));
+  auto W = as_variable(as_array({{0.1, -0.2}, {0.3, 0.4}}));
+  auto W2 = as_variable(as_array({0.5, -0.5}));
+  W->grad = as_variable(as_array({{1.0, 2.0}, {3.0, 4.0}}));
+  W2->grad = as_variable(as_array({5.0, 5.0}));
+  x->grad = as_variable(as_array({{6.0, 6.0}, {6.0, 6.0}}));
+  const auto W_grad = W->grad;
+  const auto W2_grad = W2->grad;
+  const auto x_grad = x->grad;
+
+  // exp(W2)にはバッチ化の規則がない（逆伝播の後で投げる）
+  EXPECT_THROW(vmap::per_sample_grad(
+                   [&](const VarPtr& x) {
+                     return F::sum(F::matmul(x, W) * F::exp(W2));
+                   },
+                   x, {W, W2}),
+               std::invalid_argument);
+  // サンプルごとのスカラーを返さない（逆伝播の前に投げる）
+  EXPECT_THROW(vmap::per_sample_grad(
+                   [&](const VarPtr& x) { return F::matmul(x, W); }, x, {W}),
+               std::invalid_argument);
+  EXPECT_EQ(W->grad, W_grad);
+  EXPECT_EQ(W2->grad, W2_grad);
+  EXPECT_EQ(x->grad, x_grad);
+  EXPECT_TRUE(nc::allclose(*W2->grad->data, *as_array({5.0, 5.0})));
+}
+
+TEST_F(VmapTest, flatParametersTest) {
+  // 勾配バッファのビューに逆伝播の結果を書かない
+  nc::NdArray<double> xs = {{1.0, 2.0}, {-0.5, 0.3}};
+  auto W = as_variable(as_array({{0.1, -0.2}, {0.3, 0.4}}));
+  flat::FlatParameters flat({W});
+  for (size_t i = 0; i < flat.size(); i++) flat.grad()[i] = 7.0;
+  auto f = [&](const VarPtr& x) { return F::sum(F::matmul(x, W)); };
+  auto gs = vmap::per_sample_grad(f, as_variable(as_array(xs)), {W});
+  for (size_t i = 0; i < flat.size(); i++) EXPECT_EQ(flat.grad()[i], 7.0);
+  EXPECT_EQ(W->grad->data->data(), flat.grad());
+  EXPECT_EQ(W->grad_view->data(), flat.grad());
+  // 行nはx_nの各要素を列方向に並べたもの
+  for (nc::uint32 n = 0; n < 2; n++) {
+    for (nc::uint32 j = 0; j < 4; j++) {
+      EXPECT_DOUBLE_EQ(gs[0](n, j), xs(n, j / 2));
+    }
+  }
+  // 逆伝播は引き続きバッファに足す
+  f(as_variable(as_array(xs)))->backward();
+  EXPECT_EQ(W->grad->data->data(), flat.grad());
+  EXPECT_DOUBLE_EQ(flat.grad()[0], 7.0 + 0.5);
+}
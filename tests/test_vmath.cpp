@@ -0,0 +1,204 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "NumCpp.hpp"
+#include "dezero.h"
+
+class VmathTest : public ::testing::Test {
+ protected:
+  virtual void SetUp(){};
+  virtual void TearDown(){};
+};
+
+TEST_F(VmathTest, libmTest) {
+  // 端数の処理も通るよう幅で割り切れない長さにする
+  const size_t n = 1003;
+  std::mt19937_64 rng(0);
+  std::uniform_real_distribution<double> dist(-50.0, 50.0);
+  std::vector<double> x(n), y(n);
+  for (auto& v : x) v = dist(rng);
+
+  vmath::exp(x.data(), y.data(), n);
+  for (size_t i = 0; i < n; i++) EXPECT_NEAR(y[i] / std::exp(x[i]), 1.0, 1e-15);
+  vmath::sin(x.data(), y.data(), n);
+  for (size_t i = 0; i < n; i++) EXPECT_NEAR(y[i], std::sin(x[i]), 1e-15);
+  vmath::cos(x.data(), y.data(), n);
+  for (size_t i = 0; i < n; i++) EXPECT_NEAR(y[i], std::cos(x[i]), 1e-15);
+  vmath::tanh(x.data(), y.data(), n);
+  for (size_t i = 0; i < n; i++) EXPECT_NEAR(y[i], std::tanh(x[i]), 1e-15);
+  vmath::sigmoid(x.data(), y.data(), n);
+  for (size_t i = 0; i < n; i++) {
+    EXPECT_NEAR(y[i] * (1.0 + std::exp(-x[i])), 1.0, 1e-15);
+  }
+  for (auto& v : x) v = std::fabs(v);
+  vmath::log(x.data(), y.data(), n);
+  for (size_t i = 0; i < n; i++) EXPECT_NEAR(y[i], std::log(x[i]), 1e-14);
+}
+
+TEST_F(VmathTest, inPlaceTest) {
+  // その場で計算しても別の配列に書いたときと同じ値になる
+  // （sin/cosのlibmで計算し直す大きな入力も含める）
+  std::vector<double> x;
+  for (int i = 0; i < 37; i++) x.push_back(0.37 * i - 5.0);
+  for (double v : {1e300, -1e300, 1.6e6, -2e7, 1e22, 3.0, 1.5e6,
+                   std::numeric_limits<double>::infinity(),
+                   std::numeric_limits<double>::quiet_NaN()}) {
+    x.insert(x.begin() + (x.size() * 7) % (x.size() + 1), v);
+  }
+  const size_t n = x.size();
+  using Fn = void (*)(const double*, double*, size_t);
+  for (Fn f : {static_cast<Fn>(vmath::sin), static_cast<Fn>(vmath::cos),
+               static_cast<Fn>(vmath::exp), static_cast<Fn>(vmath::tanh),
+               static_cast<Fn>(vmath::sigmoid)}) {
+    std::vector<double> expected(n), y = x;
+    f(x.data(), expected.data(), n);
+    f(y.data(), y.data(), n);
+    for (size_t i = 0; i < n; i++) {
+      if (std::isnan(expected[i])) {
+        EXPECT_TRUE(std::isnan(y[i])) << "x = " << x[i];
+      } else {
+        EXPECT_EQ(y[i], expected[i]) << "x = " << x[i];
+      }
+    }
+  }
+  std::vector<double> y = x;
+  vmath::sin(y.data(), y.data(), n);
+  for (size_t i = 0; i < n; i++) {
+    if (!std::isnan(x[i]) && !std::isinf(x[i])) {
+      EXPECT_NEAR(y[i], std::sin(x[i]), 1e-15) << "x = " << x[i];
+    }
+  }
+}
+
+// long doubleのlibmを真値としたULP単位の誤差
+double vmath_test_ulp(double y, long double ref) {
+  if (std::isnan(y) && std::isnan(ref)) return 0.0;
+  if (y == ref) return 0.0;
+  const double r = static_cast<double>(ref);
+  const double ulp = std::nextafter(std::fabs(r), INFINITY) - std::fabs(r);
+  return static_cast<double>(std::fabs(y - ref) / ulp);
+}
+
+double vmath_test_max_ulp(const std::vector<double>& x,
+                          void (*fn)(const double*, double*, size_t),
+                          long double (*ref)(long double)) {
+  std::vector<double> y(x.size());
+  fn(x.data(), y.data(), x.size());
+  double max_ulp = 0.0;
+  for (size_t i = 0; i < x.size(); i++) {
+    max_ulp = std::max(max_ulp, vmath_test_ulp(y[i], ref(x[i])));
+  }
+  return max_ulp;
+}
+
+// 一様乱数と区間の両端
+std::vector<double> vmath_test_uniform(double lo, double hi) {
+  std::mt19937_64 rng(0);
+  std::uniform_real_distribution<double> dist(lo, hi);
+  std::vector<double> x(1 << 16);
+  for (auto& v : x) v = dist(rng);
+  x.push_back(lo);
+  x.push_back(hi);
+  return x;
+}
+
+// 指数部が一様になる正の数（2^lo〜2^hi）
+std::vector<double> vmath_test_log_uniform(int lo, int hi) {
+  std::mt19937_64 rng(0);
+  std::uniform_real_distribution<double> mant(1.0, 2.0);
+  std::uniform_int_distribution<int> exp(lo, hi);
+  std::vector<double> x(1 << 16);
+  for (auto& v : x) v = std::ldexp(mant(rng), exp(rng));
+  return x;
+}
+
+long double vmath_test_sigmoidl(long double x) {
+  return 1.0L / (1.0L + std::exp(-x));
+}
+
+// vmath.hに書いた誤差の上限（SIMD版のみ。スカラー版はlibmそのもの）
+TEST_F(VmathTest, ulpTest) {
+  if (std::string(vmath::isa()) == "scalar") {
+    GTEST_SKIP() << "scalar build uses libm";
+  }
+  auto ld = [](long double (*f)(long double)) { return f; };
+  auto neg = [](std::vector<double> x) {
+    const size_t n = x.size();
+    for (size_t i = 0; i < n; i++) x.push_back(-x[i]);
+    return x;
+  };
+  EXPECT_LE(vmath_test_max_ulp(vmath_test_uniform(-745.0, 709.78), vmath::exp,
+                               ld(std::exp)),
+            1.0);
+  EXPECT_LE(vmath_test_max_ulp(vmath_test_log_uniform(-1074, 1023),
+                               vmath::log, ld(std::log)),
+            1.0);
+  EXPECT_LE(vmath_test_max_ulp(vmath_test_uniform(0.5, 2.0), vmath::log,
+                               ld(std::log)),
+            1.0);
+  for (bool is_cos : {false, true}) {
+    using Fn = void (*)(const double*, double*, size_t);
+    Fn fn = is_cos ? static_cast<Fn>(vmath::cos) : static_cast<Fn>(vmath::sin);
+    auto ref = is_cos ? ld(std::cos) : ld(std::sin);
+    EXPECT_LE(vmath_test_max_ulp(vmath_test_uniform(-10.0, 10.0), fn, ref),
+              1.5);
+    EXPECT_LE(vmath_test_max_ulp(vmath_test_uniform(-1.6e6, 1.6e6), fn, ref),
+              2.5);
+  }
+  EXPECT_LE(vmath_test_max_ulp(vmath_test_uniform(-20.0, 20.0), vmath::tanh,
+                               ld(std::tanh)),
+            1.5);
+  EXPECT_LE(vmath_test_max_ulp(neg(vmath_test_log_uniform(-1074, 9)),
+                               vmath::tanh, ld(std::tanh)),
+            1.5);
+  EXPECT_LE(vmath_test_max_ulp(vmath_test_uniform(-40.0, 40.0),
+                               vmath::sigmoid, vmath_test_sigmoidl),
+            2.5);
+  EXPECT_LE(vmath_test_max_ulp(neg(vmath_test_log_uniform(-1074, 9)),
+                               vmath::sigmoid, vmath_test_sigmoidl),
+            2.5);
+}
+
+TEST_F(VmathTest, specialValueTest) {
+  const double inf = std::numeric_limits<double>::infinity();
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  std::vector<double> x = {0.0, -1.0, inf, -inf, nan, 1e300, 5e-324};
+  std::vector<double> y(x.size());
+  vmath::exp(x.data(), y.data(), x.size());
+  EXPECT_EQ(y[0], 1.0);
+  EXPECT_EQ(y[2], inf);
+  EXPECT_EQ(y[3], 0.0);
+  EXPECT_TRUE(std::isnan(y[4]));
+  EXPECT_EQ(y[5], inf);
+  vmath::log(x.data(), y.data(), x.size());
+  EXPECT_EQ(y[0], -inf);
+  EXPECT_TRUE(std::isnan(y[1]));
+  EXPECT_EQ(y[2], inf);
+  EXPECT_TRUE(std::isnan(y[4]));
+  EXPECT_DOUBLE_EQ(y[6], std::log(5e-324));
+  // 大きな入力はlibmで計算する
+  vmath::sin(x.data(), y.data(), x.size());
+  EXPECT_EQ(y[5], std::sin(1e300));
+  EXPECT_TRUE(std::isnan(y[2]));
+}
+
+TEST_F(VmathTest, functionTest) {
+  auto x = as_variable(as_array({-2.0, 0.5, 3.0}));
+  auto y = F::sigmoid(x);
+  y->backward();
+  auto s = 1.0 / (1.0 + nc::exp(-*x->data));
+  EXPECT_TRUE(nc::allclose(*y->data, s));
+  EXPECT_TRUE(nc::allclose(*x->grad->data, s * (1.0 - s)));
+
+  x->cleargrad();
+  auto z = F::log(F::exp(x));
+  z->backward();
+  EXPECT_TRUE(nc::allclose(*z->data, *x->data));
+  EXPECT_TRUE(nc::allclose(*x->grad->data, nc::ones<double>(1, 3)));
+}